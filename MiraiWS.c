@@ -1,1734 +1,3913 @@
-#include <Windows.h>
-#include <strsafe.h>
-#include "MiraiWS.h"
-#include "yyjson.h"
-
-#pragma comment(lib, "winhttp.lib")
-#pragma comment(lib, "Normaliz.lib")
-
-#define MAX_ASYNC_PENDING 1024
-SRWLOCK AsyncCallListLock = SRWLOCK_INIT;
-
-typedef enum _ASYNC_CALL_TYPE
-{
-    ASYNC_FRIENDMSG = 1,
-    ASYNC_GROUPMSG
-}ASYNC_CALL_TYPE;
-
-typedef struct
-{
-    BOOL bUsed;
-    INT64 ID;
-    ASYNC_CALL_TYPE Type;
-    LPVOID Callback;
-    LPVOID Context;
-} ASYNC_CALL;
-// It's really stupid to use an array to store and search for pending async calls. it takes O(n) to search, insert, and remove
-// I hope there should not have too much pending calls at a same time.
-// TODO: consider use some other K-V containers like a balanced binary tree, or 01-trie.
-ASYNC_CALL AsyncCalls[MAX_ASYNC_PENDING] = { 0 };
-INT64 AsyncCallIDAlloc = 0;
-
-typedef BOOL(*EVENTHANDLER)(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField);
-
-#define RESERVED_SYNC_ID -1 // set in setting.yml of mirai.
-
-/// <summary>
-/// Allocate space and copy a zero-terminated ANSI string.
-/// Free the allocated string using HeapFree with GetProcessHeap
-/// </summary>
-/// <param name="Source">The string to copy</param>
-/// <returns>return the allocated string or NULL when failure.</returns>
-static LPSTR StrAllocCopyA(_In_ LPCSTR Source)
-{
-    SIZE_T len = strlen(Source);
-    LPSTR lpCopyStr = HeapAlloc(GetProcessHeap(), 0, (len + 1) * sizeof(CHAR));
-    if (!lpCopyStr) return NULL;
-
-    if (StringCchCopyA(lpCopyStr, len + 1, Source) != S_OK)
-    {
-        HeapFree(GetProcessHeap(), 0, lpCopyStr);
-        return NULL;
-    }
-    lpCopyStr[len] = '\0';
-    return lpCopyStr;
-}
-
-/// <summary>
-/// Allocate space and copy a zero-terminated Wide Char string.
-/// </summary>
-/// <param name="Source">The string to copy</param>
-/// <returns>return the allocated string or NULL when failure.</returns>
-static LPWSTR StrAllocCopyW(_In_ LPCWSTR Source)
-{
-    SIZE_T len = wcslen(Source);
-    LPWSTR lpCopyStr = HeapAlloc(GetProcessHeap(), 0, (len + 1) * sizeof(WCHAR));
-    if (!lpCopyStr) return NULL;
-
-    if (StringCchCopyW(lpCopyStr, len + 1, Source) != S_OK)
-    {
-        HeapFree(GetProcessHeap(), 0, lpCopyStr);
-        return NULL;
-    }
-    lpCopyStr[len] = L'\0';
-    return lpCopyStr;
-}
-
-/// <summary>
-/// Allocate space and convert a wide-char string to utf8 string.
-/// </summary>
-/// <param name="Source">wide-char string</param>
-/// <param name="cchLen">length in char, or -1 to get zero-terminated length automatically</param>
-/// <param name="cbConvLen">optional, pass out converted length in byte</param>
-/// <returns>converted string, free it with HeapFree</returns>
-static LPSTR StrWideToUtf8(_In_ LPCWSTR Source, _In_ int cchLen, _Out_opt_ int* cbConvLen)
-{
-    if (cbConvLen) *cbConvLen = 0;
-    SIZE_T cbLen = WideCharToMultiByte(CP_UTF8, 0, Source, cchLen, NULL, 0, 0, 0);
-    LPSTR lpBuffer = (LPSTR)HeapAlloc(GetProcessHeap(), 0, cbLen + 1);
-    if (!lpBuffer)
-        return NULL;
-
-    WideCharToMultiByte(CP_UTF8, 0, Source, cchLen, lpBuffer, cbLen, 0, 0);
-    lpBuffer[cbLen] = '\0';
-    if (cbConvLen) *cbConvLen = cbLen;
-    return lpBuffer;
-}
-
-/// <summary>
-/// Allocate space and convert utf8 string to a wide-char string.
-/// </summary>
-/// <param name="Source">utf8 string</param>
-/// <param name="cbLen">length in byte, or -1 to get zero-terminated length automatically</param>
-/// <param name="cchConvLen">optional, pass out converted length in char</param>
-/// <returns>converted string, free it with HeapFree</returns>
-static LPWSTR StrUtf8ToWide(_In_ LPCSTR Source, _In_ int cbLen, _Out_opt_ int* cchConvLen)
-{
-    if (cchConvLen) *cchConvLen = 0;
-
-    SIZE_T cchLen = MultiByteToWideChar(CP_UTF8, 0, Source, cbLen, NULL, 0);
-    LPWSTR lpBuffer = (LPWSTR)HeapAlloc(GetProcessHeap(), 0, (cchLen + 1) * sizeof(WCHAR));
-    if (!lpBuffer)
-        return NULL;
-
-    MultiByteToWideChar(CP_UTF8, 0, Source, cbLen, lpBuffer, cchLen);
-    lpBuffer[cchLen] = L'\0';
-    if (cchConvLen) *cchConvLen = cchLen;
-    return lpBuffer;
-}
-
-/// <summary>
-/// Stores a information about an async call, and allocate ID for it.
-/// </summary>
-/// <param name="Type">the type of async call</param>
-/// <param name="Callback">callback address provided by user</param>
-/// <param name="Context">context provided by user</param>
-/// <returns>the allocated ID when success, 0 when failed.</returns>
-static INT64 GetAsyncCallID(_In_ ASYNC_CALL_TYPE Type, _In_opt_ LPVOID Callback, _In_opt_ LPVOID Context)
-{
-    INT64 AllocID = 0;
-    AcquireSRWLockExclusive(&AsyncCallListLock);
-    __try
-    {
-        for (int i = 0; i < _countof(AsyncCalls); i++)
-        {
-            if (!AsyncCalls[i].bUsed)
-            {
-                AllocID = AsyncCalls[i].ID = ++AsyncCallIDAlloc;
-                AsyncCalls[i].Type = Type;
-                AsyncCalls[i].Callback = Callback;
-                AsyncCalls[i].Context = Context;
-                AsyncCalls[i].bUsed = TRUE;
-                break;
-            }
-        }
-    }
-    __finally
-    {
-        ReleaseSRWLockExclusive(&AsyncCallListLock);
-    }
-    return AllocID;
-}
-
-/// <summary>
-/// Find and remove informations about a async call
-/// </summary>
-/// <param name="ID">async call ID</param>
-/// <param name="pType">returns the type of that async call</param>
-/// <param name="pCallback">returns the callback address</param>
-/// <param name="pContext">returns the context</param>
-/// <returns>return TRUE when success</returns>
-static BOOL RemoveAsyncCallID(_In_ INT64 ID, _Out_opt_ ASYNC_CALL_TYPE* pType, _Out_opt_ LPVOID* pCallback, _Out_opt_ LPVOID* pContext)
-{
-    BOOL bSuccess = FALSE;
-    AcquireSRWLockExclusive(&AsyncCallListLock);
-    __try
-    {
-        for (int i = 0; i < _countof(AsyncCalls); i++)
-        {
-            if (AsyncCalls[i].ID == ID)
-            {
-                if (pType) *pType = AsyncCalls[i].Type;
-                if (pCallback) *pCallback = AsyncCalls[i].Callback;
-                if (pContext) *pContext = AsyncCalls[i].Context;
-
-                AsyncCalls[i].bUsed = FALSE;
-                bSuccess = TRUE;
-                __leave;
-            }
-        }
-
-        if (pType) *pType = 0;
-        if (pCallback) *pCallback = NULL;
-        if (pContext) *pContext = NULL;
-    }
-    __finally
-    {
-        ReleaseSRWLockExclusive(&AsyncCallListLock);
-    }
-
-    return bSuccess;
-}
-
-static BOOL DestructMessageBlock(_In_ MESSAGE_BLOCK* pBlock)
-{
-    switch (pBlock->Type)
-    {
-    case MB_AT:
-    {
-        if (pBlock->At.Display)
-        {
-            HeapFree(GetProcessHeap(), 0, pBlock->At.Display);
-        }
-        break;
-    }
-    case MB_ATALL:
-    {
-        break;
-    }
-    case MB_FACE:
-    {
-        break;
-    }
-    case MB_PLAIN:
-    {
-        if (pBlock->Plain.Text)
-        {
-            HeapFree(GetProcessHeap(), 0, pBlock->Plain.Text);
-        }
-        break;
-    }
-    case MB_IMAGE:
-    {
-        if (pBlock->Image.ImageIDStr)
-        {
-            HeapFree(GetProcessHeap(), 0, pBlock->Image.ImageIDStr);
-        }
-        if (pBlock->Image.URL)
-        {
-            HeapFree(GetProcessHeap(), 0, pBlock->Image.URL);
-        }
-        if (pBlock->Image.ImageType)
-        {
-            HeapFree(GetProcessHeap(), 0, pBlock->Image.ImageType);
-        }
-        break;
-    }
-    case MB_VOICE:
-    {
-        if (pBlock->Voice.VoiceIDStr)
-        {
-            HeapFree(GetProcessHeap(), 0, pBlock->Voice.VoiceIDStr);
-        }
-        if (pBlock->Voice.URL)
-        {
-            HeapFree(GetProcessHeap(), 0, pBlock->Voice.URL);
-        }
-        break;
-    }
-    case MB_XML:
-    {
-        break;
-    }
-    case MB_JSON:
-    {
-        break;
-    }
-    case MB_APP:
-    {
-        break;
-    }
-    case MB_POKE:
-    {
-        break;
-    }
-    case MB_DICE:
-    {
-        break;
-    }
-    case MB_MARKETFACE:
-    {
-        break;
-    }
-    case MB_MUSICSHARE:
-    {
-        break;
-    }
-    case MB_FORWARD:
-    {
-        break;
-    }
-    case MB_FILE:
-    {
-        break;
-    }
-    default:
-        return FALSE;
-    }
-    return TRUE;
-}
-
-static BOOL ReleaseMessageChain(_In_ MESSAGE_CHAIN* pMessageChain)
-{
-    BOOL bSuccess = TRUE;
-    if (pMessageChain->MessageBlocks)
-    {
-        for (int i = 0; i < pMessageChain->BlockCnt; i++)
-        {
-            bSuccess &= DestructMessageBlock(pMessageChain->MessageBlocks + i);
-        }
-        bSuccess &= HeapFree(GetProcessHeap(), 0, pMessageChain->MessageBlocks);
-        pMessageChain->MessageBlocks = NULL;
-    }
-    return bSuccess;
-}
-
-static BOOL ConstructMessageBlock(_Out_ MESSAGE_BLOCK *pBlock, _In_ LPCSTR lpType, _In_ yyjson_val *Node)
-{
-    if (strcmp(lpType, "At") == 0)
-    {
-        pBlock->Type = MB_AT;
-        yyjson_val* TargetField = yyjson_obj_get(Node, "target");
-        yyjson_val* DisplayField = yyjson_obj_get(Node, "display");
-        if (!TargetField || !yyjson_is_int(TargetField) || !DisplayField || !yyjson_is_str(DisplayField))
-            return FALSE;
-
-
-        LPWSTR CopiedDisplay = StrUtf8ToWide(yyjson_get_str(DisplayField), -1, NULL);
-        if (!CopiedDisplay)
-            return FALSE;
-
-        pBlock->At.Target = yyjson_get_sint(TargetField);
-        pBlock->At.Display = CopiedDisplay;
-    }
-    else if (strcmp(lpType, "AtAll") == 0)
-    {
-        pBlock->Type = MB_ATALL;
-    }
-    else if (strcmp(lpType, "Face") == 0)
-    {
-        pBlock->Type = MB_FACE;
-        yyjson_val* FaceIDField = yyjson_obj_get(Node, "faceId");
-        if (!FaceIDField || !yyjson_is_int(FaceIDField))
-            return FALSE;
-
-        pBlock->Face.FaceID = yyjson_get_sint(FaceIDField);
-    }
-    else if (strcmp(lpType, "Plain") == 0)
-    {
-        pBlock->Type = MB_PLAIN;
-        yyjson_val* TextField = yyjson_obj_get(Node, "text");
-        if (!TextField || !yyjson_is_str(TextField))
-            return FALSE;
-
-        LPWSTR CopiedText = StrUtf8ToWide(yyjson_get_str(TextField), -1, NULL);
-        if (!CopiedText)
-            return FALSE;
-
-        pBlock->Plain.Text = CopiedText;
-    }
-    else if (strcmp(lpType, "Image") == 0)
-    {
-        pBlock->Type = MB_IMAGE;
-        yyjson_val* ImageIDField = yyjson_obj_get(Node, "imageId");
-        yyjson_val* UrlField = yyjson_obj_get(Node, "url");
-        yyjson_val* ImageTypeField = yyjson_obj_get(Node, "imageType");
-        yyjson_val* IsEmojiField = yyjson_obj_get(Node, "isEmoji");
-
-        if (!ImageIDField || !yyjson_is_str(ImageIDField) ||
-            !UrlField || !yyjson_is_str(UrlField) ||
-            !ImageTypeField || !yyjson_is_str(ImageTypeField) ||
-            !IsEmojiField || !yyjson_is_bool(IsEmojiField))
-            return FALSE;
-
-        LPWSTR CopiedImageID = StrUtf8ToWide(yyjson_get_str(ImageIDField), -1, NULL);
-        LPWSTR CopiedUrl = StrUtf8ToWide(yyjson_get_str(UrlField), -1, NULL);
-        LPWSTR CopiedImageType = StrUtf8ToWide(yyjson_get_str(ImageTypeField), -1, NULL);
-        if (!CopiedImageID || !CopiedUrl || !CopiedImageType)
-            return FALSE;
-
-        pBlock->Image.IsFlash = FALSE;
-        pBlock->Image.ImageIDStr = CopiedImageID;
-        pBlock->Image.URL = CopiedUrl;
-        pBlock->Image.ImageType = CopiedImageType;
-        pBlock->Image.IsEmoji = (BOOL)yyjson_get_bool(IsEmojiField);
-    }
-    else if (strcmp(lpType, "FlashImage") == 0)
-    {
-        pBlock->Type = MB_IMAGE;
-        yyjson_val* ImageIDField = yyjson_obj_get(Node, "imageId");
-        yyjson_val* UrlField = yyjson_obj_get(Node, "url");
-        yyjson_val* ImageTypeField = yyjson_obj_get(Node, "imageType");
-        yyjson_val* IsEmojiField = yyjson_obj_get(Node, "isEmoji");
-
-        if (!ImageIDField || !yyjson_is_str(ImageIDField) ||
-            !UrlField || !yyjson_is_str(UrlField) ||
-            !ImageTypeField || !yyjson_is_str(ImageTypeField) ||
-            !IsEmojiField || !yyjson_is_bool(IsEmojiField))
-            return FALSE;
-
-        LPWSTR CopiedImageID = StrUtf8ToWide(yyjson_get_str(ImageIDField), -1, NULL);
-        LPWSTR CopiedUrl = StrUtf8ToWide(yyjson_get_str(UrlField), -1, NULL);
-        LPWSTR CopiedImageType = StrUtf8ToWide(yyjson_get_str(ImageTypeField), -1, NULL);
-        if (!CopiedImageID || !CopiedUrl || !CopiedImageType)
-            return FALSE;
-
-        pBlock->Image.IsFlash = TRUE;
-        pBlock->Image.ImageIDStr = CopiedImageID;
-        pBlock->Image.URL = CopiedUrl;
-        pBlock->Image.ImageType = CopiedImageType;
-        pBlock->Image.IsEmoji = (BOOL)yyjson_get_bool(IsEmojiField);
-    }
-    else if (strcmp(lpType, "Voice") == 0)
-    {
-        pBlock->Type = MB_VOICE;
-        yyjson_val* VoiceIDField = yyjson_obj_get(Node, "voiceId");
-        yyjson_val* UrlField = yyjson_obj_get(Node, "url");
-        yyjson_val* LengthField = yyjson_obj_get(Node, "length");
-
-        if (!VoiceIDField || !yyjson_is_str(VoiceIDField) ||
-            !UrlField || !yyjson_is_str(UrlField) ||
-            !LengthField || !yyjson_is_int(LengthField))
-            return FALSE;
-
-        LPWSTR CopiedVoiceID = StrUtf8ToWide(yyjson_get_str(VoiceIDField), -1, NULL);
-        LPWSTR CopiedUrl = StrUtf8ToWide(yyjson_get_str(UrlField), -1, NULL);
-
-        if (!CopiedVoiceID || !CopiedUrl)
-            return FALSE;
-        
-        pBlock->Voice.VoiceIDStr = CopiedVoiceID;
-        pBlock->Voice.URL = CopiedUrl;
-        pBlock->Voice.Length = yyjson_get_sint(LengthField);
-    }
-    else if (strcmp(lpType, "Xml") == 0)
-    {
-        pBlock->Type = MB_XML;
-        // TODO: WIP
-    }
-    else if (strcmp(lpType, "Json") == 0)
-    {
-        pBlock->Type = MB_JSON;
-        // TODO: WIP
-    }
-    else if (strcmp(lpType, "App") == 0)
-    {
-        pBlock->Type = MB_APP;
-        // TODO: WIP
-    }
-    else if (strcmp(lpType, "Poke") == 0)
-    {
-        pBlock->Type = MB_POKE;
-        // TODO: WIP
-    }
-    else if (strcmp(lpType, "Dice") == 0)
-    {
-        pBlock->Type = MB_DICE;
-        // TODO: WIP
-    }
-    else if (strcmp(lpType, "MarketFace") == 0)
-    {
-        pBlock->Type = MB_MARKETFACE;
-        // TODO: WIP
-    }
-    else if (strcmp(lpType, "MusicShare") == 0)
-    {
-        pBlock->Type = MB_MUSICSHARE;
-        // TODO: WIP
-    }
-    else if (strcmp(lpType, "Forward") == 0)
-    {
-        pBlock->Type = MB_FORWARD;
-        // TODO: WIP
-    }
-    else if (strcmp(lpType, "File") == 0)
-    {
-        pBlock->Type = MB_FILE;
-        // TODO: WIP
-    }
-    else
-    {
-        pBlock->Type = 0;
-        return FALSE;
-    }
-    return TRUE;
-}
-
-static BOOL UnpackMessageChain(_Out_ MESSAGE_CHAIN* pMessageChain, _In_ yyjson_val *MessageChainNode)
-{
-    BOOL bSuccess = FALSE;
-    pMessageChain->BlockCnt = 0;
-    __try
-    {
-        size_t EnumIndex, MaxNode = yyjson_arr_size(MessageChainNode);
-        yyjson_val* EnumNode;
-
-        // atleast one "Source" node.
-        if (MaxNode < 1)
-            __leave;
-        pMessageChain->MessageBlocks = (PMESSAGE_BLOCK)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(MESSAGE_BLOCK) * MaxNode);
-
-        if (!pMessageChain->MessageBlocks)
-            __leave;
-
-        BOOL bHaveSource = FALSE; // we have to check if source node exists.
-        yyjson_arr_foreach(MessageChainNode, EnumIndex, MaxNode, EnumNode) {
-            yyjson_val* TypeField = yyjson_obj_get(EnumNode, "type");
-            if (!TypeField || !yyjson_is_str(TypeField))
-            {
-                __leave;
-            }
-            LPCSTR lpType = yyjson_get_str(TypeField);
-
-            // Handle different type of message block
-            // well... I don't think "Source" and "Quote" should be treated as a message block.
-            if (strcmp(lpType, "Source") == 0)
-            {
-                yyjson_val* IDField = yyjson_obj_get(EnumNode, "id");
-                yyjson_val* TimeField = yyjson_obj_get(EnumNode, "time");
-                if (!IDField || !yyjson_is_int(IDField) || !TimeField || !yyjson_is_int(TimeField))
-                {
-                    __leave;
-                }
-                pMessageChain->ID = yyjson_get_sint(IDField);
-                pMessageChain->Timestamp = yyjson_get_sint(TimeField);
-
-                bHaveSource = TRUE;
-            }
-            else if (strcmp(lpType, "Quote") == 0)
-            {
-                // TODO: WIP
-            }
-            else
-            {
-                if (!ConstructMessageBlock(pMessageChain->MessageBlocks + pMessageChain->BlockCnt, lpType, EnumNode))
-                {
-                    __leave;
-                }
-                pMessageChain->BlockCnt++;
-            }
-        }
-        if (!bHaveSource)
-            __leave;
-        bSuccess = TRUE;
-    }
-    __finally
-    {
-        if (!bSuccess)
-        {
-            ReleaseMessageChain(pMessageChain);
-        }
-    }
-    return bSuccess;
-}
-
-static BOOL FriendMessageUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    MWS_FRIENDMSGINFO Info = { 0 };
-    BOOL bSuccess = FALSE;
-    __try
-    {
-        yyjson_val* MessageChainField = yyjson_obj_get(DataField, "messageChain");
-        yyjson_val* SenderField = yyjson_obj_get(DataField, "sender");
-        if (!MessageChainField || !yyjson_is_arr(MessageChainField) || !SenderField || !yyjson_is_obj(SenderField))
-            __leave;
-
-        yyjson_val* SenderIDField = yyjson_obj_get(SenderField, "id");
-        yyjson_val* SenderNickField = yyjson_obj_get(SenderField, "nickname");
-        yyjson_val* SenderRemarkField = yyjson_obj_get(SenderField, "remark");
-
-        if (!SenderIDField || !yyjson_is_int(SenderIDField) ||
-            !SenderNickField || !yyjson_is_str(SenderNickField) ||
-            !SenderRemarkField || !yyjson_is_str(SenderRemarkField))
-            __leave;
-
-
-        if (!UnpackMessageChain(&Info.MessageChain, MessageChainField))
-            __leave;
-
-        Info.Sender.ID = yyjson_get_sint(SenderIDField);
-        Info.Sender.Nick = StrUtf8ToWide(yyjson_get_str(SenderNickField), -1, NULL);
-        Info.Sender.Remark = StrUtf8ToWide(yyjson_get_str(SenderRemarkField), -1, NULL);
-
-        if (!Info.Sender.Nick || !Info.Sender.Remark)
-            __leave;
-
-        pMiraiWS->Callback(pMiraiWS, MWS_FRIENDMSG, &Info);
-        bSuccess = TRUE;
-    }
-    __finally
-    {
-        if (Info.Sender.Nick) HeapFree(GetProcessHeap(), 0, Info.Sender.Nick);
-        if (Info.Sender.Remark) HeapFree(GetProcessHeap(), 0, Info.Sender.Remark);
-        ReleaseMessageChain(&Info.MessageChain);
-    }
-
-    return bSuccess;
-}
-
-static BOOL GroupMessageUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    MWS_GROUPMSGINFO Info = { 0 };
-    BOOL bSuccess = FALSE;
-    __try
-    {
-        yyjson_val* MessageChainField = yyjson_obj_get(DataField, "messageChain");
-        yyjson_val* SenderField = yyjson_obj_get(DataField, "sender");
-        if (!MessageChainField || !yyjson_is_arr(MessageChainField) || !SenderField || !yyjson_is_obj(SenderField))
-            __leave;
-
-        yyjson_val* SenderIDField = yyjson_obj_get(SenderField, "id");
-        yyjson_val* SenderMemberNameField = yyjson_obj_get(SenderField, "memberName");
-        yyjson_val* SenderSpecialTitleField = yyjson_obj_get(SenderField, "specialTitle");
-        yyjson_val* SenderPermissionField = yyjson_obj_get(SenderField, "permission");
-        yyjson_val* SenderJoinTimeField = yyjson_obj_get(SenderField, "joinTimestamp");
-        yyjson_val* SenderLastSpeakTimeField = yyjson_obj_get(SenderField, "lastSpeakTimestamp");
-        yyjson_val* SenderMuteTimeRemainField = yyjson_obj_get(SenderField, "muteTimeRemaining");
-        yyjson_val* SenderGroupField = yyjson_obj_get(SenderField, "group");
-
-        if (!SenderIDField || !yyjson_is_int(SenderIDField) ||
-            !SenderMemberNameField || !yyjson_is_str(SenderMemberNameField) ||
-            !SenderSpecialTitleField || !yyjson_is_str(SenderSpecialTitleField) ||
-            !SenderPermissionField || !yyjson_is_str(SenderPermissionField) ||
-            !SenderJoinTimeField || !yyjson_is_int(SenderJoinTimeField) ||
-            !SenderLastSpeakTimeField || !yyjson_is_int(SenderLastSpeakTimeField) ||
-            !SenderMuteTimeRemainField || !yyjson_is_int(SenderMuteTimeRemainField) ||
-            !SenderGroupField || !yyjson_is_obj(SenderGroupField))
-            __leave;
-
-        yyjson_val* GroupIDField = yyjson_obj_get(SenderGroupField, "id");
-        yyjson_val* GroupNameField = yyjson_obj_get(SenderGroupField, "name");
-        yyjson_val* GroupPermissionField = yyjson_obj_get(SenderGroupField, "permission");
-
-        if (!GroupIDField || !yyjson_is_int(GroupIDField) ||
-            !GroupNameField || !yyjson_is_str(GroupNameField) ||
-            !GroupPermissionField || !yyjson_is_str(GroupPermissionField))
-            __leave;
-
-
-        if (!UnpackMessageChain(&Info.MessageChain, MessageChainField))
-            __leave;
-
-        Info.Sender.ID = yyjson_get_sint(SenderIDField);
-        Info.Sender.MemberName = StrUtf8ToWide(yyjson_get_str(SenderMemberNameField), -1, NULL);
-        Info.Sender.SpecialTitle = StrUtf8ToWide(yyjson_get_str(SenderSpecialTitleField), -1, NULL);
-        Info.Sender.Permission = StrUtf8ToWide(yyjson_get_str(SenderPermissionField), -1, NULL);
-        Info.Sender.JoinTimestamp = yyjson_get_sint(SenderJoinTimeField);
-        Info.Sender.LastSpeakTimestamp = yyjson_get_sint(SenderLastSpeakTimeField);
-        Info.Sender.MuteTimeRemaining = yyjson_get_sint(SenderMuteTimeRemainField);
-        Info.Sender.Group.ID = yyjson_get_sint(GroupIDField);
-        Info.Sender.Group.Name = StrUtf8ToWide(yyjson_get_str(GroupNameField), -1, NULL);
-        Info.Sender.Group.Permission = StrUtf8ToWide(yyjson_get_str(GroupPermissionField), -1, NULL);
-
-        if (!Info.Sender.MemberName ||
-            !Info.Sender.SpecialTitle ||
-            !Info.Sender.Permission ||
-            !Info.Sender.Group.Name ||
-            !Info.Sender.Group.Permission)
-            __leave;
-
-        pMiraiWS->Callback(pMiraiWS, MWS_GROUPMSG, &Info);
-        bSuccess = TRUE;
-    }
-    __finally
-    {
-        if (Info.Sender.MemberName)       HeapFree(GetProcessHeap(), 0, Info.Sender.MemberName);
-        if (Info.Sender.SpecialTitle)     HeapFree(GetProcessHeap(), 0, Info.Sender.SpecialTitle);
-        if (Info.Sender.Permission)       HeapFree(GetProcessHeap(), 0, Info.Sender.Permission);
-        if (Info.Sender.Group.Name)       HeapFree(GetProcessHeap(), 0, Info.Sender.Group.Name);
-        if (Info.Sender.Group.Permission) HeapFree(GetProcessHeap(), 0, Info.Sender.Group.Permission);
-        ReleaseMessageChain(&Info.MessageChain);
-    }
-    return bSuccess;
-}
-
-static BOOL TempMessageUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL StrangerMessageUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL OtherClientMessageUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL FriendSyncMessageUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL GroupSyncMessageUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL TempSyncMessageUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL StrangerSyncMessageUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL BotOnlineEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL BotOfflineEventActiveUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL BotOfflineEventForceUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL BotOfflineEventDroppedUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL BotReloginEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL FriendInputStatusChangedEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL FriendNickChangedEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL BotGroupPermissionChangeEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL BotMuteEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL BotUnmuteEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL BotJoinGroupEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL BotLeaveEventActiveUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL BotLeaveEventKickUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL BotLeaveEventDisbandUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL GroupRecallEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL FriendRecallEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL NudgeEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL GroupNameChangeEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL GroupEntranceAnnouncementChangeEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL GroupMuteAllEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL GroupAllowAnonymousChatEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL GroupAllowConfessTalkEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL GroupAllowMemberInviteEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL MemberJoinEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL MemberLeaveEventKickUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL MemberLeaveEventQuitUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL MemberCardChangeEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL MemberSpecialTitleChangeEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL MemberPermissionChangeEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL MemberMuteEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL MemberUnmuteEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL MemberHonorChangeEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL NewFriendRequestEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL MemberJoinRequestEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL BotInvitedJoinGroupRequestEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL OtherClientOnlineEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL OtherClientOfflineEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-static BOOL CommandExecutedEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    return TRUE;
-}
-
-
-static void CallBadMsgCallback(_In_ PMIRAI_WS pMiraiWS)
-{
-    int cchLen;
-    LPWSTR wMessage = StrUtf8ToWide(pMiraiWS->Buffer, pMiraiWS->RecvLength, &cchLen);
-    if (!wMessage)
-        return;
-
-    MWS_BADMSGINFO Info = { wMessage, cchLen };
-    pMiraiWS->Callback(pMiraiWS, MWS_BADMSG, &Info);
-    HeapFree(GetProcessHeap(), 0, wMessage);
-}
-
-static void CallAuthCallback(_In_ PMIRAI_WS pMiraiWS, _In_ INT64 ResponseCode, _In_opt_z_ LPCSTR lpSession, _In_opt_z_ LPCSTR lpMessage)
-{
-    LPWSTR wSession = lpSession ? StrUtf8ToWide(lpSession, -1, NULL) : NULL;
-    LPWSTR wMessage = lpMessage ? StrUtf8ToWide(lpMessage, -1, NULL) : NULL;
-    MWS_AUTHINFO Info = { ResponseCode, wSession, wMessage };
-    
-    pMiraiWS->Callback(pMiraiWS, MWS_AUTH, &Info);
-
-    if (wSession) HeapFree(GetProcessHeap(), 0, wSession);
-    if (wMessage) HeapFree(GetProcessHeap(), 0, wMessage);
-}
-
-static BOOL EventsUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
-{
-    yyjson_val* TypeField = yyjson_obj_get(DataField, "type");
-    if (!TypeField || !yyjson_is_str(TypeField))
-    {
-        CallBadMsgCallback(pMiraiWS);
-        return FALSE;
-    }
-
-    // TODO: Use something to optimize this, perhaps trie tree?
-    LPCSTR TypeList[] = {
-        "FriendMessage",
-        "GroupMessage",
-        "TempMessage",
-        "StrangerMessage",
-        "OtherClientMessage",
-        "FriendSyncMessage",
-        "GroupSyncMessage",
-        "TempSyncMessage",
-        "StrangerSyncMessage",
-
-        "BotOnlineEvent",
-        "BotOfflineEventActive",
-        "BotOfflineEventForce",
-        "BotOfflineEventDropped",
-        "BotReloginEvent",
-        "FriendInputStatusChangedEvent",
-        "FriendNickChangedEvent",
-        "BotGroupPermissionChangeEvent",
-        "BotMuteEvent",
-        "BotUnmuteEvent",
-        "BotJoinGroupEvent",
-        "BotLeaveEventActive",
-        "BotLeaveEventKick",
-        "BotLeaveEventDisband",
-        "GroupRecallEvent",
-        "FriendRecallEvent",
-        "NudgeEvent",
-        "GroupNameChangeEvent",
-        "GroupEntranceAnnouncementChangeEvent",
-        "GroupMuteAllEvent",
-        "GroupAllowAnonymousChatEvent",
-        "GroupAllowConfessTalkEvent",
-        "GroupAllowMemberInviteEvent",
-        "MemberJoinEvent",
-        "MemberLeaveEventKick",
-        "MemberLeaveEventQuit",
-        "MemberCardChangeEvent",
-        "MemberSpecialTitleChangeEvent",
-        "MemberPermissionChangeEvent",
-        "MemberMuteEvent",
-        "MemberUnmuteEvent",
-        "MemberHonorChangeEvent",
-        "NewFriendRequestEvent",
-        "MemberJoinRequestEvent",
-        "BotInvitedJoinGroupRequestEvent",
-        "OtherClientOnlineEvent",
-        "OtherClientOfflineEvent",
-        "CommandExecutedEvent"
-    };
-    EVENTHANDLER EventPackerList[] =  {
-        FriendMessageUnpacker,
-        GroupMessageUnpacker,
-        TempMessageUnpacker,
-        StrangerMessageUnpacker,
-        OtherClientMessageUnpacker,
-        FriendSyncMessageUnpacker,
-        GroupSyncMessageUnpacker,
-        TempSyncMessageUnpacker,
-        StrangerSyncMessageUnpacker,
-
-        BotOnlineEventUnpacker,
-        BotOfflineEventActiveUnpacker,
-        BotOfflineEventForceUnpacker,
-        BotOfflineEventDroppedUnpacker,
-        BotReloginEventUnpacker,
-        FriendInputStatusChangedEventUnpacker,
-        FriendNickChangedEventUnpacker,
-        BotGroupPermissionChangeEventUnpacker,
-        BotMuteEventUnpacker,
-        BotUnmuteEventUnpacker,
-        BotJoinGroupEventUnpacker,
-        BotLeaveEventActiveUnpacker,
-        BotLeaveEventKickUnpacker,
-        BotLeaveEventDisbandUnpacker,
-        GroupRecallEventUnpacker,
-        FriendRecallEventUnpacker,
-        NudgeEventUnpacker,
-        GroupNameChangeEventUnpacker,
-        GroupEntranceAnnouncementChangeEventUnpacker,
-        GroupMuteAllEventUnpacker,
-        GroupAllowAnonymousChatEventUnpacker,
-        GroupAllowConfessTalkEventUnpacker,
-        GroupAllowMemberInviteEventUnpacker,
-        MemberJoinEventUnpacker,
-        MemberLeaveEventKickUnpacker,
-        MemberLeaveEventQuitUnpacker,
-        MemberCardChangeEventUnpacker,
-        MemberSpecialTitleChangeEventUnpacker,
-        MemberPermissionChangeEventUnpacker,
-        MemberMuteEventUnpacker,
-        MemberUnmuteEventUnpacker,
-        MemberHonorChangeEventUnpacker,
-        NewFriendRequestEventUnpacker,
-        MemberJoinRequestEventUnpacker,
-        BotInvitedJoinGroupRequestEventUnpacker,
-        OtherClientOnlineEventUnpacker,
-        OtherClientOfflineEventUnpacker,
-        CommandExecutedEventUnpacker
-    };
-
-    const LPCSTR szType = unsafe_yyjson_get_str(TypeField);
-    for (SIZE_T i = 0; i < _countof(TypeList); i++)
-    {
-        if (strcmp(szType, TypeList[i]) == 0)
-        {
-            if (!EventPackerList[i](pMiraiWS, DataField))
-            {
-                CallBadMsgCallback(pMiraiWS);
-                return FALSE;
-            }
-
-            return TRUE;
-        }
-    }
-    return TRUE;
-}
-
-static BOOL CallbacksUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ INT64 ID, _In_ yyjson_val* DataField)
-{
-    ASYNC_CALL_TYPE Type = 0;
-    LPVOID Callback;
-    LPVOID Context;
-
-    if (!RemoveAsyncCallID(ID, &Type, &Callback, &Context))
-    {
-        CallBadMsgCallback(pMiraiWS);
-        return FALSE;
-    }
-
-    switch (Type)
-    {
-    case ASYNC_FRIENDMSG:
-    case ASYNC_GROUPMSG:
-    {
-        yyjson_val* CodeField = yyjson_obj_get(DataField, "code");
-        yyjson_val* MsgField = yyjson_obj_get(DataField, "msg");
-        yyjson_val* MsgIDField = yyjson_obj_get(DataField, "messageId");
-
-        if (!CodeField || !yyjson_is_int(CodeField) ||
-            !MsgField || !yyjson_is_str(MsgField))
-            return FALSE;
-
-        if(MsgIDField && !yyjson_is_int(MsgIDField))
-            return FALSE;
-
-        INT64 Code = yyjson_get_sint(CodeField);
-        LPWSTR lpMsg = StrUtf8ToWide(yyjson_get_str(MsgField), -1, NULL);
-        INT64 MsgID = MsgIDField ? yyjson_get_sint(MsgIDField) : 0;
-
-        if (Callback) ((SEND_MSG_CALLBACK)Callback)(pMiraiWS, Code, lpMsg, MsgID, Context);
-
-        HeapFree(GetProcessHeap(), 0, lpMsg);
-        return TRUE;
-    }
-    default:
-    {
-        DebugBreak();
-        return FALSE;
-    }
-    }
-}
-
-static void HandleJsonMessage(_In_ PMIRAI_WS pMiraiWS)
-{
-    yyjson_doc* JsonDoc = yyjson_read(pMiraiWS->Buffer, pMiraiWS->RecvLength, 0);
-    if (!JsonDoc)
-    {
-        CallBadMsgCallback(pMiraiWS);
-        return;
-    }
-    __try
-    {
-        yyjson_val* JsonRoot = yyjson_doc_get_root(JsonDoc);
-        yyjson_val* SyncIDField = yyjson_obj_get(JsonRoot, "syncId");
-        yyjson_val* DataField = yyjson_obj_get(JsonRoot, "data");
-
-        if (!SyncIDField || !DataField)
-        {
-            CallBadMsgCallback(pMiraiWS);
-            __leave;
-        }
-        const char* szSyncID = yyjson_get_str(SyncIDField);
-
-        if (!szSyncID)
-        {
-            CallBadMsgCallback(pMiraiWS);
-            __leave;
-        }
-
-        int FieldLen = strlen(szSyncID);
-        if (FieldLen == 0)
-        {
-            // Seems to be the first message passing session key. check the code.
-            yyjson_val* CodeField = yyjson_obj_get(DataField, "code");
-            yyjson_val* SessionField = yyjson_obj_get(DataField, "session");
-            yyjson_val* MessageField = yyjson_obj_get(DataField, "msg");
-            if (!CodeField || !yyjson_is_int(CodeField))
-            {
-                CallBadMsgCallback(pMiraiWS);
-                __leave;
-            }
-            INT64 ResponseCode = unsafe_yyjson_get_sint(CodeField);
-
-            CallAuthCallback(pMiraiWS, ResponseCode, SessionField ? yyjson_get_str(SessionField) : NULL, MessageField ? yyjson_get_str(MessageField) : NULL);
-        }
-        else
-        {
-            INT64 ID = atoll(szSyncID);
-            if (ID == RESERVED_SYNC_ID)
-            {
-                // events sent by server
-                if (!EventsUnpacker(pMiraiWS, DataField))
-                {
-                    CallBadMsgCallback(pMiraiWS);
-                    __leave;
-                }
-            }
-            else
-            {
-                // responding requests sent by client
-
-                if (!CallbacksUnpacker(pMiraiWS, ID, DataField))
-                {
-                    CallBadMsgCallback(pMiraiWS);
-                    __leave;
-                }
-            }
-        }
-    }
-    __finally
-    {
-        yyjson_doc_free(JsonDoc);
-    }
-}
-
-static void CleanUpMiraiWSAsync(_In_ PMIRAI_WS pMiraiWS)
-{
-    if (pMiraiWS->hRequestHandle != NULL)
-    {
-        WinHttpCloseHandle(pMiraiWS->hRequestHandle); // will be set to NULL when WINHTTP_CALLBACK_STATUS_HANDLE_CLOSING callback is called
-    }
-
-    if (pMiraiWS->hWebSocketHandle != NULL)
-    {
-        WinHttpCloseHandle(pMiraiWS->hWebSocketHandle); // will be set to NULL when WINHTTP_CALLBACK_STATUS_HANDLE_CLOSING callback is called
-    }
-
-    if (pMiraiWS->hConnectionHandle != NULL)
-    {
-        WinHttpCloseHandle(pMiraiWS->hConnectionHandle);
-        pMiraiWS->hConnectionHandle = NULL;
-    }
-
-    if (pMiraiWS->hSessionHandle != NULL)
-    {
-        WinHttpCloseHandle(pMiraiWS->hSessionHandle);
-        pMiraiWS->hSessionHandle = NULL;
-    }
-}
-
-static void CALLBACK WinHttpStatusCallback(
-    _In_ HINTERNET hInternet,
-    _In_ DWORD_PTR dwContext,
-    _In_ DWORD dwInternetStatus,
-    _In_ LPVOID lpvStatusInformation,
-    _In_ DWORD dwStatusInformationLength
-)
-{
-    PMIRAI_WS pMiraiWS = (PMIRAI_WS)dwContext;
-    switch (dwInternetStatus)
-    {
-    case WINHTTP_CALLBACK_STATUS_SENDREQUEST_COMPLETE:
-        // WinHttpSendRequest successed.
-        if (!WinHttpReceiveResponse(pMiraiWS->hRequestHandle, NULL))
-        {
-            MWS_CONNECTINFO Info = { FALSE, GetLastError() };
-            pMiraiWS->Callback(pMiraiWS, MWS_CONNECT, &Info);
-        }
-        break;
-
-    case WINHTTP_CALLBACK_STATUS_HEADERS_AVAILABLE:
-        // WinHttpReceiveResponse successed.
-        pMiraiWS->hWebSocketHandle = WinHttpWebSocketCompleteUpgrade(pMiraiWS->hRequestHandle, (DWORD_PTR)pMiraiWS);
-        if (!pMiraiWS->hWebSocketHandle)
-        {
-            MWS_CONNECTINFO Info = { FALSE, GetLastError() };
-            pMiraiWS->Callback(pMiraiWS, MWS_CONNECT, &Info);
-        }
-        else
-        {
-            // connection established.
-            MWS_CONNECTINFO Info = { TRUE, NO_ERROR };
-            pMiraiWS->Callback(pMiraiWS, MWS_CONNECT, &Info);
-
-            // start receiving data.
-            DWORD RecvLen;
-            WINHTTP_WEB_SOCKET_BUFFER_TYPE eBufferType;
-            DWORD dwRet = WinHttpWebSocketReceive(
-                pMiraiWS->hWebSocketHandle,
-                pMiraiWS->Buffer,
-                sizeof(pMiraiWS->Buffer),
-                &RecvLen,
-                &eBufferType);
-            if (dwRet != NO_ERROR)
-            {
-                MWS_NWERRORINFO Info = { dwRet };
-                pMiraiWS->Callback(pMiraiWS, MWS_NWERROR, &Info);
-                CleanUpMiraiWSAsync(pMiraiWS);
-            }
-        }
-        break;
-    
-    case WINHTTP_CALLBACK_STATUS_READ_COMPLETE:
-    {
-        WINHTTP_WEB_SOCKET_STATUS* pWebSockData = (WINHTTP_WEB_SOCKET_STATUS*)lpvStatusInformation;
-        if (pWebSockData->eBufferType == WINHTTP_WEB_SOCKET_UTF8_MESSAGE_BUFFER_TYPE ||
-            pWebSockData->eBufferType == WINHTTP_WEB_SOCKET_UTF8_FRAGMENT_BUFFER_TYPE)
-        {
-            pMiraiWS->RecvLength += pWebSockData->dwBytesTransferred;
-
-            if (pWebSockData->eBufferType == WINHTTP_WEB_SOCKET_UTF8_MESSAGE_BUFFER_TYPE)
-            {
-                HandleJsonMessage(pMiraiWS);
-                pMiraiWS->RecvLength = 0;
-            }
-
-            // start a new recv
-            DWORD RecvLen;
-            WINHTTP_WEB_SOCKET_BUFFER_TYPE eBufferType;
-            if (pMiraiWS->RecvLength >= sizeof(pMiraiWS->Buffer))
-            {
-                // TODO: assert here
-                DebugBreak();
-            }
-            DWORD dwRet = WinHttpWebSocketReceive(
-                pMiraiWS->hWebSocketHandle,
-                pMiraiWS->Buffer + pMiraiWS->RecvLength,
-                sizeof(pMiraiWS->Buffer) - pMiraiWS->RecvLength,
-                &RecvLen,
-                &eBufferType);
-            if (dwRet != NO_ERROR)
-            {
-                MWS_NWERRORINFO Info = { dwRet };
-                pMiraiWS->Callback(pMiraiWS, MWS_NWERROR, &Info);
-                CleanUpMiraiWSAsync(pMiraiWS);
-            }
-        }
-        Sleep(0);
-        break;
-    }
-
-    case WINHTTP_CALLBACK_STATUS_REQUEST_ERROR:
-    {
-        WINHTTP_ASYNC_RESULT* pResult = lpvStatusInformation;
-        switch (pResult->dwResult)
-        {
-        case API_SEND_REQUEST:
-        case API_RECEIVE_RESPONSE:
-        {
-            MWS_CONNECTINFO Info = { FALSE, pResult->dwError };
-            pMiraiWS->Callback(pMiraiWS, MWS_CONNECT, &Info);
-            break;
-        }
-        default:
-        {
-            MWS_NWERRORINFO Info = { pResult->dwError };
-            pMiraiWS->Callback(pMiraiWS, MWS_NWERROR, &Info);
-            break;
-        }
-        }
-        CleanUpMiraiWSAsync(pMiraiWS);
-        break;
-    }
-    case WINHTTP_CALLBACK_STATUS_HANDLE_CLOSING:
-    {
-        if (pMiraiWS && pMiraiWS->bClose)
-        {
-            if (pMiraiWS->hRequestHandle == hInternet)
-            {
-                pMiraiWS->hRequestHandle = 0;
-            }
-            if (pMiraiWS->hWebSocketHandle == hInternet)
-            {
-                pMiraiWS->hWebSocketHandle = 0;
-            }
-            if (pMiraiWS->hRequestHandle == 0 && pMiraiWS->hWebSocketHandle == 0)
-            {
-                // all clear, no one should have pMiraiWS in hand now.
-                if (pMiraiWS->lpServerName)
-                {
-                    HeapFree(GetProcessHeap(), 0, pMiraiWS->lpServerName);
-                }
-                HeapFree(GetProcessHeap(), 0, pMiraiWS);
-            }
-        }
-        break;
-    }
-    }
-}
-
-_Ret_maybenull_
-PMIRAI_WS CreateMiraiWS(_In_z_ LPCWSTR lpServerName, _In_ INTERNET_PORT Port, _In_ BOOL bSecure, _In_ MWSCALLBACK Callback)
-{
-    BOOL bSuccess = FALSE;
-    PMIRAI_WS pMiraiWS = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(MIRAI_WS));
-    if (!pMiraiWS)
-        return FALSE;
-
-    __try
-    {
-        int cchLen = (int)wcslen(lpServerName);
-        int cchConvertLen = IdnToAscii(0, lpServerName, cchLen, NULL, 0);
-
-        // WinHttpConnect needs to convert hostname into punny code, we convert it here.
-        pMiraiWS->lpServerName = (LPWSTR)HeapAlloc(GetProcessHeap(), 0, (cchConvertLen + 1) * sizeof(WCHAR));
-
-        if (!pMiraiWS->lpServerName)
-            __leave;
-        IdnToAscii(0, lpServerName, cchLen, pMiraiWS->lpServerName, cchConvertLen);
-        pMiraiWS->lpServerName[cchConvertLen] = L'\0';
-
-        pMiraiWS->Port     = Port;
-        pMiraiWS->bSecure  = bSecure;
-        pMiraiWS->Callback = Callback;
-        bSuccess = TRUE;
-    }
-    __finally
-    {
-        if (!bSuccess)
-        {
-            if (pMiraiWS->lpServerName)
-                HeapFree(GetProcessHeap(), 0, pMiraiWS->lpServerName);
-
-            HeapFree(GetProcessHeap(), 0, pMiraiWS);
-            pMiraiWS = NULL;
-        }
-    }
-
-    return pMiraiWS;
-}
-
-BOOL ConnectMiraiWS(_Inout_ PMIRAI_WS pMiraiWS, _In_z_ LPCWSTR szVerifyKey, _In_z_ LPCWSTR szQQ)
-{
-    BOOL bSuccess = FALSE;
-    LPWSTR szHeaderStr = NULL;
-    __try
-    {
-        DWORD dwHttpOpenFlag = pMiraiWS->bSecure ? WINHTTP_FLAG_SECURE_DEFAULTS : WINHTTP_FLAG_ASYNC; // WINHTTP_FLAG_SECURE_DEFAULTS also forces WINHTTP_FLAG_ASYNC
-
-        pMiraiWS->hSessionHandle = WinHttpOpen(
-            L"Mirai WS",
-            WINHTTP_ACCESS_TYPE_AUTOMATIC_PROXY,
-            WINHTTP_NO_PROXY_NAME,
-            WINHTTP_NO_PROXY_BYPASS,
-            dwHttpOpenFlag);
-        if (!pMiraiWS->hSessionHandle)
-            __leave;
-        
-        // We're going to use WinHttp Async mode, so we need to set a callback.
-        // request will inherit the callback from session.
-        WinHttpSetStatusCallback(pMiraiWS->hSessionHandle, WinHttpStatusCallback, WINHTTP_CALLBACK_FLAG_ALL_NOTIFICATIONS, 0);
-
-        pMiraiWS->hConnectionHandle = WinHttpConnect(
-            pMiraiWS->hSessionHandle,
-            pMiraiWS->lpServerName,
-            pMiraiWS->Port, 0);
-        if (!pMiraiWS->hConnectionHandle)
-            __leave;
-
-        pMiraiWS->hRequestHandle = WinHttpOpenRequest(
-            pMiraiWS->hConnectionHandle,
-            L"GET",
-            L"/all", // for pushing messages and events. see mirai-api-http websocket adapter docs for more detail.
-            NULL,
-            WINHTTP_NO_REFERER,
-            WINHTTP_DEFAULT_ACCEPT_TYPES,
-            pMiraiWS->bSecure ? WINHTTP_FLAG_SECURE : 0);
-        if (!pMiraiWS->hRequestHandle)
-            __leave;
-
-        if (!WinHttpSetOption(pMiraiWS->hRequestHandle,
-            WINHTTP_OPTION_UPGRADE_TO_WEB_SOCKET,
-            NULL,
-            0))
-            __leave;
-
-        // format the header string.
-
-        DWORD_PTR FormatArgs[2] = { (DWORD_PTR)szVerifyKey, (DWORD_PTR)szQQ };
-        DWORD cchHeaderStr = FormatMessageW(
-            FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_STRING | FORMAT_MESSAGE_ARGUMENT_ARRAY,
-            L"verifyKey: %1\r\nqq: %2\r\n",
-            0, 0, (LPWSTR)&szHeaderStr, 0, (va_list *)FormatArgs);
-        if (cchHeaderStr == 0)
-            __leave;
-
-        if (!WinHttpSendRequest(pMiraiWS->hRequestHandle, szHeaderStr, cchHeaderStr, WINHTTP_NO_REQUEST_DATA, 0, 0, (DWORD_PTR)pMiraiWS))
-            __leave;
-
-        bSuccess = TRUE;
-    }
-    __finally
-    {
-        if(szHeaderStr)
-            LocalFree(szHeaderStr);
-
-        if (!bSuccess)
-        {
-            CleanUpMiraiWSAsync(pMiraiWS);
-        }
-    }
-
-    return bSuccess;
-}
-
-BOOL DestroyMiraiWSAsync(_In_ _Frees_ptr_ PMIRAI_WS pMiraiWS)
-{
-    pMiraiWS->bClose = TRUE;
-
-    CleanUpMiraiWSAsync(pMiraiWS);
-
-    return TRUE;
-}
-
-_Success_(return)
-static BOOL CreateWebsockAdapterJson(_In_ INT64 SyncID, _In_z_ LPCSTR Command, _In_opt_z_ LPCSTR SubCommand, _Outptr_result_nullonfailure_ yyjson_mut_doc **pDoc, _Outptr_result_nullonfailure_ yyjson_mut_val **pContent)
-{
-    BOOL bSuccess = FALSE;
-    yyjson_mut_doc* Doc = NULL;
-    yyjson_mut_val* Root = NULL;
-    yyjson_mut_val* Content = NULL;
-
-    __try
-    {
-        Doc = yyjson_mut_doc_new(NULL);
-        if (!Doc) __leave;
-        Root = yyjson_mut_obj(Doc);
-        if (!Root) __leave;
-        yyjson_mut_doc_set_root(Doc, Root);
-        yyjson_mut_obj_add_int(Doc, Root, "syncId", SyncID);
-        yyjson_mut_obj_add_str(Doc, Root, "command", Command);
-
-        if (SubCommand)
-            yyjson_mut_obj_add_str(Doc, Root, "subCommand", Command);
-        else
-            yyjson_mut_obj_add_null(Doc, Root, "subCommand");
-
-        Content = yyjson_mut_obj(Doc);
-        if (!Content)
-            __leave;
-        yyjson_mut_obj_add_val(Doc, Root, "content", Content);
-        bSuccess = TRUE;
-    }
-    __finally
-    {
-        if (!bSuccess)
-        {
-            yyjson_mut_doc_free(Doc);
-            Doc = NULL;
-            Content = NULL;
-        }
-    }
-
-    *pDoc = Doc;
-    *pContent = Content;
-
-    return bSuccess;
-}
-
-static yyjson_mut_val* GetMessageChainJson(_In_ yyjson_mut_doc *Doc, _In_ MESSAGE_CHAIN* pMessageChain)
-{
-    yyjson_mut_val* MsgChain = yyjson_mut_arr(Doc);
-    if (!MsgChain)
-        return NULL;
-    for (int i = 0; i < pMessageChain->BlockCnt; i++)
-    {
-        yyjson_mut_val* MsgBlockNode = yyjson_mut_obj(Doc);
-
-        if (!MsgBlockNode)
-            return NULL;
-
-        switch (pMessageChain->MessageBlocks[i].Type)
-        {
-        case MB_AT:
-        {
-            yyjson_mut_obj_add_str(Doc, MsgBlockNode, "type", "At");
-            yyjson_mut_obj_add_int(Doc, MsgBlockNode, "target", pMessageChain->MessageBlocks[i].At.Target);
-            yyjson_mut_arr_append(MsgChain, MsgBlockNode);
-            break;
-        }
-        case MB_ATALL:
-        {
-            yyjson_mut_obj_add_str(Doc, MsgBlockNode, "type", "AtAll");
-
-            yyjson_mut_arr_append(MsgChain, MsgBlockNode);
-            break;
-        }
-        case MB_FACE:
-        {
-            yyjson_mut_obj_add_str(Doc, MsgBlockNode, "type", "Face");
-            yyjson_mut_obj_add_int(Doc, MsgBlockNode, "faceId", pMessageChain->MessageBlocks[i].Face.FaceID);
-
-            yyjson_mut_arr_append(MsgChain, MsgBlockNode);
-            break;
-        }
-        case MB_PLAIN:
-        {
-            LPSTR lpText = StrWideToUtf8(pMessageChain->MessageBlocks[i].Plain.Text, -1, NULL);
-            yyjson_mut_obj_add_str(Doc, MsgBlockNode, "type", "Plain");
-            yyjson_mut_obj_add_strcpy(Doc, MsgBlockNode, "text", lpText);
-            HeapFree(GetProcessHeap(), 0, lpText);
-
-            yyjson_mut_arr_append(MsgChain, MsgBlockNode);
-            break;
-        }
-        case MB_IMAGE:
-        {
-            yyjson_mut_obj_add_str(Doc, MsgBlockNode, "type", pMessageChain->MessageBlocks[i].Image.IsFlash ? "FlashImage" : "Image");
-            if (pMessageChain->MessageBlocks[i].Image.ImageIDStr)
-            {
-                LPSTR lpImageID = StrWideToUtf8(pMessageChain->MessageBlocks[i].Image.ImageIDStr, -1, NULL);
-                yyjson_mut_obj_add_strcpy(Doc, MsgBlockNode, "imageId", lpImageID);
-                HeapFree(GetProcessHeap(), 0, lpImageID);
-            }
-            if (pMessageChain->MessageBlocks[i].Image.URL)
-            {
-                LPSTR lpURL = StrWideToUtf8(pMessageChain->MessageBlocks[i].Image.URL, -1, NULL);
-                yyjson_mut_obj_add_strcpy(Doc, MsgBlockNode, "url", lpURL);
-                HeapFree(GetProcessHeap(), 0, lpURL);
-            }
-            if (pMessageChain->MessageBlocks[i].Image.ImageType)
-            {
-                LPSTR lpImageType = StrWideToUtf8(pMessageChain->MessageBlocks[i].Image.ImageType, -1, NULL);
-                yyjson_mut_obj_add_strcpy(Doc, MsgBlockNode, "imageType", lpImageType);
-                HeapFree(GetProcessHeap(), 0, lpImageType);
-            }
-
-            yyjson_mut_obj_add_bool(Doc, MsgBlockNode, "isEmoji", (bool)pMessageChain->MessageBlocks[i].Image.IsEmoji);
-            yyjson_mut_arr_append(MsgChain, MsgBlockNode);
-            break;
-        }    
-        case MB_VOICE:
-        {
-            yyjson_mut_obj_add_str(Doc, MsgBlockNode, "type", "Voice");
-            if (pMessageChain->MessageBlocks[i].Voice.VoiceIDStr)
-            {
-                LPSTR lpVoiceID = StrWideToUtf8(pMessageChain->MessageBlocks[i].Voice.VoiceIDStr, -1, NULL);
-                yyjson_mut_obj_add_strcpy(Doc, MsgBlockNode, "voiceId", lpVoiceID);
-                HeapFree(GetProcessHeap(), 0, lpVoiceID);
-            }
-            if (pMessageChain->MessageBlocks[i].Voice.URL)
-            {
-                LPSTR lpURL = StrWideToUtf8(pMessageChain->MessageBlocks[i].Voice.URL, -1, NULL);
-                yyjson_mut_obj_add_strcpy(Doc, MsgBlockNode, "url", lpURL);
-                HeapFree(GetProcessHeap(), 0, lpURL);
-            }
-            yyjson_mut_arr_append(MsgChain, MsgBlockNode);
-            break;
-        }
-        case MB_XML:
-        {
-            break;
-        }
-        case MB_JSON:
-        {
-            break;
-        }
-        case MB_APP:
-        {
-            break;
-        }
-        case MB_POKE:
-        {
-            break;
-        }
-        case MB_DICE:
-        {
-            break;
-        }
-        case MB_MARKETFACE:
-        {
-            break;
-        }
-        case MB_MUSICSHARE:
-        {
-            break;
-        }
-        case MB_FORWARD:
-        {
-            break;
-        }
-        case MB_FILE:
-        {
-            break;
-        }
-        default:
-        {
-            // Assert here
-            DebugBreak();
-            break;
-        }
-        }
-
-    }
-    return MsgChain;
-}
-
-BOOL SendFriendMsgAsync(
-    _In_ PMIRAI_WS pMiraiWS,
-    _In_ INT64 Target,
-    _In_ MESSAGE_CHAIN* pMessageChain,
-    _In_opt_ SEND_MSG_CALLBACK Callback,
-    _In_opt_ LPVOID Context)
-{
-    BOOL bSuccess = FALSE;
-    INT64 AsyncID = GetAsyncCallID(ASYNC_FRIENDMSG, Callback, Context);
-    if (!AsyncID)
-        return FALSE;
-
-    yyjson_mut_doc* Doc = NULL;
-    yyjson_mut_val* Content = NULL;
-    LPSTR lpJsonText = NULL;
-    __try
-    {
-        if (!CreateWebsockAdapterJson(AsyncID, "sendFriendMessage", NULL, &Doc, &Content))
-            __leave;
-
-        yyjson_mut_obj_add_int(Doc, Content, "target", Target);
-
-        yyjson_mut_val* MsgChain = GetMessageChainJson(Doc, pMessageChain);
-
-        yyjson_mut_obj_add_val(Doc, Content, "messageChain", MsgChain);
-
-        SIZE_T JsonLen;
-        lpJsonText = yyjson_mut_write(Doc, 0, &JsonLen);
-        if (!lpJsonText)
-            __leave;
-
-        if (WinHttpWebSocketSend(pMiraiWS->hWebSocketHandle, WINHTTP_WEB_SOCKET_UTF8_MESSAGE_BUFFER_TYPE, (PVOID)lpJsonText, (DWORD)JsonLen) != NO_ERROR)
-            __leave;
-
-        bSuccess = TRUE;
-    }
-    __finally
-    {
-        if (lpJsonText)
-        {
-            free(lpJsonText);
-        }
-        if (!bSuccess)
-        {
-            RemoveAsyncCallID(AsyncID, NULL, NULL, NULL);
-        }
-        if (Doc) yyjson_mut_doc_free(Doc);
-    }
-    return bSuccess;
-}
-
-BOOL SendGroupMsgAsync(
-    _In_ PMIRAI_WS pMiraiWS,
-    _In_ INT64 Target,
-    _In_ MESSAGE_CHAIN* pMessageChain,
-    _In_opt_ SEND_MSG_CALLBACK Callback,
-    _In_opt_ LPVOID Context
-)
-{
-    BOOL bSuccess = FALSE;
-    INT64 AsyncID = GetAsyncCallID(ASYNC_GROUPMSG, Callback, Context);
-    if (!AsyncID)
-        return FALSE;
-
-    yyjson_mut_doc* Doc = NULL;
-    yyjson_mut_val* Content = NULL;
-    LPSTR lpJsonText = NULL;
-    __try
-    {
-        if (!CreateWebsockAdapterJson(AsyncID, "sendGroupMessage", NULL, &Doc, &Content))
-            __leave;
-
-        yyjson_mut_obj_add_int(Doc, Content, "target", Target);
-
-        yyjson_mut_val* MsgChain = GetMessageChainJson(Doc, pMessageChain);
-
-        yyjson_mut_obj_add_val(Doc, Content, "messageChain", MsgChain);
-
-        SIZE_T JsonLen;
-        lpJsonText = yyjson_mut_write(Doc, 0, &JsonLen);
-        if (!lpJsonText)
-            __leave;
-
-        if (WinHttpWebSocketSend(pMiraiWS->hWebSocketHandle, WINHTTP_WEB_SOCKET_UTF8_MESSAGE_BUFFER_TYPE, (PVOID)lpJsonText, (DWORD)JsonLen) != NO_ERROR)
-            __leave;
-
-        bSuccess = TRUE;
-    }
-    __finally
-    {
-        if (lpJsonText)
-        {
-            free(lpJsonText);
-        }
-        if (!bSuccess)
-        {
-            RemoveAsyncCallID(AsyncID, NULL, NULL, NULL);
-        }
-        if (Doc) yyjson_mut_doc_free(Doc);
-    }
-    return bSuccess;
-}
+#include <Windows.h>
+#include <strsafe.h>
+#include "MiraiWS.h"
+#include "MiraiWSInternal.h"
+#include "yyjson.h"
+
+#pragma comment(lib, "winhttp.lib")
+#pragma comment(lib, "Normaliz.lib")
+
+#define MAX_ASYNC_PENDING 1024
+SRWLOCK AsyncCallListLock = SRWLOCK_INIT;
+
+typedef struct
+{
+    BOOL bUsed;
+    INT64 ID;
+    ASYNC_CALL_TYPE Type;
+    LPVOID Callback;
+    LPVOID Context;
+    ASYNC_CALL_TIMING Timing;
+} ASYNC_CALL;
+// It's really stupid to use an array to store and search for pending async calls. it takes O(n) to search, insert, and remove
+// I hope there should not have too much pending calls at a same time.
+// TODO: consider use some other K-V containers like a balanced binary tree, or 01-trie.
+ASYNC_CALL AsyncCalls[MAX_ASYNC_PENDING] = { 0 };
+INT64 AsyncCallIDAlloc = 0;
+volatile LONG AsyncCallsInUse = 0;
+
+typedef BOOL(*EVENTHANDLER)(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField);
+
+// Receiving is split into stages so that reading the socket and parsing json overlap with user callbacks:
+//   WinHttp read callback (reassemble fragments into a frame, cut large list responses into batches)
+//     -> ParseRing    -> parse stage    (yyjson_read)
+//     -> DispatchRing -> dispatch stage (unpack, user callback, recycle frame)
+// every ring has exactly one producer and one consumer, stages run as threadpool work items.
+
+typedef struct _MWS_FRAME MWS_FRAME, *PMWS_FRAME;
+typedef struct _MWS_FRAME
+{
+    SLIST_ENTRY Entry;  // links recycled frames, must be first
+    yyjson_doc* Doc;    // filled by parse stage, NULL when the frame is not valid json
+    LONGLONG RecvStart; // ReadPerfClock at first fragment, only set when journaling or tracing
+    BOOL bPartial;      // a batch of a streamed response, more batches follow. See StreamListResponse
+    BOOL bDiscarded;    // the end of a message too large to stream, not parsed and reported as MWS_BADMSG
+    INT64 SyncID;       // of a discarded response, its call is completed with MWS_CODE_DISCARDED. 0 if none
+    SIZE_T Length;
+    BYTE Data[MIRAI_WS_MAXBUF];
+} MWS_FRAME;
+
+typedef struct
+{
+    DECLSPEC_CACHEALIGN volatile LONG64 Head; // written by consumer only
+    DECLSPEC_CACHEALIGN volatile LONG64 Tail; // written by producer only
+    LONG Peak;                                // written by producer only
+    PMWS_FRAME Slots[MIRAI_WS_PIPELINE_DEPTH];
+} MWS_RING;
+
+typedef struct
+{
+    MWS_RING Ring;  // input of this stage
+    PTP_WORK Work;
+    volatile LONG bScheduled;
+} MWS_STAGE;
+
+typedef struct
+{
+    SLIST_HEADER FreeFrames;
+    USHORT MaxFrames; // frames kept for reuse, surplus is freed on recycle
+    const MWS_ALLOCATOR* pAllocator; // frames come from the owner of the pool
+} MWS_FRAME_POOL;
+
+// The longest message head, up to the list, a streamed response may have. Mirai's is about 50 bytes.
+#define MWS_LIST_HEAD_MAX 1024
+
+typedef enum
+{
+    HEAD_KEY_OTHER,
+    HEAD_KEY_SYNCID, // of the message
+    HEAD_KEY_DATA    // of the message, or of the object that is its "data"
+} MWS_HEAD_KEY;
+
+// Keys of the outer two objects of a message too large for a frame, one byte at a time.
+// Looks for the syncId and the list at "data" -> "data", whatever the order of keys around them.
+typedef struct
+{
+    int Depth;
+    BOOL bInString;
+    BOOL bEscape;
+    BOOL bObject[3];    // the container at depth 1 and 2 is an object
+    BOOL bKeyNext;      // the next string is a key of an object at depth 1 or 2
+    BOOL bInData;       // inside the object that is "data" of the message
+    MWS_HEAD_KEY Key;   // whose value comes next
+    BOOL bCapture;      // the string is kept in Text, a key or the value of syncId
+    BOOL bCaptureKey;
+    UINT cchText;
+    CHAR Text[24];      // longer strings are cut, they match nothing
+    BOOL bSyncID;       // syncId was read
+    INT64 SyncID;       // 0 if it is not a request of ours
+} MWS_HEAD_SCAN;
+
+// Where a streamed message is at, one byte at a time.
+typedef struct
+{
+    int Depth;      // nesting of objects and arrays, items of the list are at 4
+    BOOL bInString;
+    BOOL bEscape;
+    BOOL bInItem;
+    BOOL bTail;     // past the list, the rest of the message ends the last batch
+} MWS_LIST_SCAN;
+
+// A response too large for one frame, received with its list cut into frames of whole items, see StreamListResponse.
+// Only touched by the read side.
+typedef struct
+{
+    BOOL bActive;       // the message being received is streamed
+    BOOL bDiscard;      // it is no list response, or an item doesn't fit a frame. Reported as MWS_BADMSG
+    BOOL bLastFragment; // the message ends with what pRecvFrame holds
+    SIZE_T Scanned;     // bytes of pRecvFrame already looked at
+
+    MWS_HEAD_SCAN HeadScan; // up to the list, and on through a discarded message until its syncId is read
+    MWS_LIST_SCAN Scan;
+    PMWS_FRAME pBatch;  // being filled, not in a ring yet
+    PMWS_FRAME pFull;   // a batch that ran out of room, waiting for a frame to move its incomplete last item into
+    SIZE_T ItemStart;   // where the incomplete item begins in pBatch, with the comma before it
+    UINT BatchItems;    // complete items in pBatch
+
+    SIZE_T cbHead;
+    BYTE Head[MWS_LIST_HEAD_MAX]; // the message up to and including the '[' of the list, every batch starts with it
+} MWS_LIST_STREAM;
+
+// Strings of few distinct values, group names and image types, converted once per connection and kept until it is freed.
+#define INTERN_BUCKETS 256
+#define INTERN_MAX_STRINGS 4096 // new values past this many are only kept until the frame is dispatched
+
+typedef struct _INTERNED_STRING INTERNED_STRING;
+typedef struct _INTERNED_STRING
+{
+    INTERNED_STRING* pNext; // in its bucket
+    UINT Hash;
+    SIZE_T cbUtf8;
+    LPWSTR lpWide;          // points behind Utf8
+    CHAR Utf8[ANYSIZE_ARRAY];
+} INTERNED_STRING;
+
+typedef struct
+{
+    const MWS_ALLOCATOR* pAllocator; // of the connection
+    INTERNED_STRING* Buckets[INTERN_BUCKETS];
+    UINT Count;
+    INTERNED_STRING* pOverflow; // values that found the table full, freed by FlushInternOverflow
+} MWS_INTERN_TABLE;
+
+typedef struct _MWS_PIPELINE
+{
+    const MWS_ALLOCATOR* pAllocator; // of the connection
+    MWS_FRAME_POOL OwnFramePool; // used unless the connection is attached to a manager
+    MWS_FRAME_POOL* pFramePool;
+    MWS_STAGE ParseStage;
+    MWS_STAGE DispatchStage;
+
+    PMWS_FRAME pRecvFrame;     // owned by read side
+    PMWS_FRAME pDispatchFrame; // owned by dispatch stage, the raw message for MWS_BADMSG
+    MWS_LIST_STREAM Stream;    // owned by read side
+    MWS_INTERN_TABLE Interned; // owned by dispatch stage
+
+    volatile LONG FramesInFlight;
+    volatile LONG bReadStalled;
+    volatile LONG64 ReadStalls;
+    volatile LONG64 StreamedLists;
+
+    LONGLONG ReadStart; // ReadPerfClock when the pending receive was posted, 0 when not tracing
+
+    PTP_WORK FreeWork; // frees the connection, created up front so that can't fail when the connection closes
+    volatile LONG Holds; // one for the user until DestroyMiraiWSAsync, one per open request or websocket handle
+} MWS_PIPELINE, *PMWS_PIPELINE;
+
+// Many connections can share one WinHttp session, one frame pool and one threadpool for their stages.
+typedef struct _MIRAI_WS_MANAGER
+{
+    HINTERNET hSessionHandle;
+    MWS_FRAME_POOL FramePool;
+
+    PTP_POOL Pool;
+    TP_CALLBACK_ENVIRON CallbackEnviron;
+
+    volatile LONG Connections; // attached and not freed yet
+
+    MWS_ALLOCATOR Allocator; // copied to every attached connection
+} MIRAI_WS_MANAGER;
+
+#define RESERVED_SYNC_ID -1 // set in setting.yml of mirai.
+
+/// <summary>
+/// Allocate space and copy a zero-terminated ANSI string.
+/// Free the allocated string using MwsFree
+/// </summary>
+/// <param name="pAllocator">allocator to take the string from</param>
+/// <param name="Source">The string to copy</param>
+/// <returns>return the allocated string or NULL when failure.</returns>
+static LPSTR StrAllocCopyA(_In_ const MWS_ALLOCATOR* pAllocator, _In_ LPCSTR Source)
+{
+    SIZE_T len = strlen(Source);
+    LPSTR lpCopyStr = MwsAlloc(pAllocator, 0, (len + 1) * sizeof(CHAR));
+    if (!lpCopyStr) return NULL;
+
+    if (StringCchCopyA(lpCopyStr, len + 1, Source) != S_OK)
+    {
+        MwsFree(pAllocator, lpCopyStr);
+        return NULL;
+    }
+    lpCopyStr[len] = '\0';
+    return lpCopyStr;
+}
+
+/// <summary>
+/// Allocate space and copy a zero-terminated Wide Char string.
+/// </summary>
+/// <param name="pAllocator">allocator to take the string from</param>
+/// <param name="Source">The string to copy</param>
+/// <returns>return the allocated string or NULL when failure.</returns>
+static LPWSTR StrAllocCopyW(_In_ const MWS_ALLOCATOR* pAllocator, _In_ LPCWSTR Source)
+{
+    SIZE_T len = wcslen(Source);
+    LPWSTR lpCopyStr = MwsAlloc(pAllocator, 0, (len + 1) * sizeof(WCHAR));
+    if (!lpCopyStr) return NULL;
+
+    if (StringCchCopyW(lpCopyStr, len + 1, Source) != S_OK)
+    {
+        MwsFree(pAllocator, lpCopyStr);
+        return NULL;
+    }
+    lpCopyStr[len] = L'\0';
+    return lpCopyStr;
+}
+
+/// <summary>
+/// Allocate space and convert a wide-char string to utf8 string.
+/// </summary>
+/// <param name="pAllocator">allocator to take the string from</param>
+/// <param name="Source">wide-char string</param>
+/// <param name="cchLen">length in char, or -1 to get zero-terminated length automatically</param>
+/// <param name="cbConvLen">optional, pass out converted length in byte</param>
+/// <returns>converted string, free it with MwsFree</returns>
+static LPSTR StrWideToUtf8(_In_ const MWS_ALLOCATOR* pAllocator, _In_ LPCWSTR Source, _In_ int cchLen, _Out_opt_ int* cbConvLen)
+{
+    if (cbConvLen) *cbConvLen = 0;
+    SIZE_T cbLen = WideCharToMultiByte(CP_UTF8, 0, Source, cchLen, NULL, 0, 0, 0);
+    LPSTR lpBuffer = (LPSTR)MwsAlloc(pAllocator, 0, cbLen + 1);
+    if (!lpBuffer)
+        return NULL;
+
+    WideCharToMultiByte(CP_UTF8, 0, Source, cchLen, lpBuffer, cbLen, 0, 0);
+    lpBuffer[cbLen] = '\0';
+    if (cbConvLen) *cbConvLen = cbLen;
+    return lpBuffer;
+}
+
+/// <summary>
+/// Allocate space and convert utf8 string to a wide-char string.
+/// </summary>
+/// <param name="pAllocator">allocator to take the string from</param>
+/// <param name="Source">utf8 string</param>
+/// <param name="cbLen">length in byte, or -1 to get zero-terminated length automatically</param>
+/// <param name="cchConvLen">optional, pass out converted length in char</param>
+/// <returns>converted string, free it with MwsFree</returns>
+static LPWSTR StrUtf8ToWide(_In_ const MWS_ALLOCATOR* pAllocator, _In_ LPCSTR Source, _In_ int cbLen, _Out_opt_ int* cchConvLen)
+{
+    if (cchConvLen) *cchConvLen = 0;
+
+    SIZE_T cchLen = MultiByteToWideChar(CP_UTF8, 0, Source, cbLen, NULL, 0);
+    LPWSTR lpBuffer = (LPWSTR)MwsAlloc(pAllocator, 0, (cchLen + 1) * sizeof(WCHAR));
+    if (!lpBuffer)
+        return NULL;
+
+    MultiByteToWideChar(CP_UTF8, 0, Source, cbLen, lpBuffer, cchLen);
+    lpBuffer[cchLen] = L'\0';
+    if (cchConvLen) *cchConvLen = cchLen;
+    return lpBuffer;
+}
+
+/// <summary>
+/// Stores a information about an async call, and allocate ID for it.
+/// </summary>
+/// <param name="Type">the type of async call</param>
+/// <param name="pCommand">command sent to mirai, from FindMiraiWSCommand</param>
+/// <param name="Callback">callback address provided by user</param>
+/// <param name="Context">context provided by user</param>
+/// <param name="pSlot">returns where the call is stored, for MarkAsyncCallWritten</param>
+/// <returns>the allocated ID when success, 0 when failed.</returns>
+INT64 GetAsyncCallID(_In_ ASYNC_CALL_TYPE Type, _In_ const MWS_COMMAND* pCommand, _In_opt_ LPVOID Callback, _In_opt_ LPVOID Context, _Out_ int* pSlot)
+{
+    INT64 AllocID = 0;
+    AcquireSRWLockExclusive(&AsyncCallListLock);
+    __try
+    {
+        for (int i = 0; i < _countof(AsyncCalls); i++)
+        {
+            if (!AsyncCalls[i].bUsed)
+            {
+                AllocID = AsyncCalls[i].ID = ++AsyncCallIDAlloc;
+                AsyncCalls[i].Type = Type;
+                AsyncCalls[i].Callback = Callback;
+                AsyncCalls[i].Context = Context;
+                AsyncCalls[i].Timing.pCommand = pCommand;
+                AsyncCalls[i].Timing.lpCommandName = NULL;
+                AsyncCalls[i].Timing.lpSubCommandName = NULL;
+                AsyncCalls[i].Timing.AllocTime = ReadPerfClock();
+                AsyncCalls[i].Timing.WrittenTime = 0;
+                AsyncCalls[i].bUsed = TRUE;
+                AsyncCallsInUse++;
+                *pSlot = i;
+                break;
+            }
+        }
+    }
+    __finally
+    {
+        ReleaseSRWLockExclusive(&AsyncCallListLock);
+    }
+    return AllocID;
+}
+
+/// <summary>
+/// Remember when the request of an async call was handed to WinHttp.
+/// </summary>
+/// <param name="Slot">returned by GetAsyncCallID</param>
+/// <param name="ID">returned by GetAsyncCallID, the response may have freed the slot already</param>
+static void MarkAsyncCallWritten(_In_ int Slot, _In_ INT64 ID)
+{
+    LONGLONG Now = ReadPerfClock();
+    AcquireSRWLockExclusive(&AsyncCallListLock);
+    if (AsyncCalls[Slot].bUsed && AsyncCalls[Slot].ID == ID)
+        AsyncCalls[Slot].Timing.WrittenTime = Now;
+    ReleaseSRWLockExclusive(&AsyncCallListLock);
+}
+
+/// <summary>
+/// Keep the names a command not in the command table was sent with, so its result can tell them.
+/// </summary>
+/// <param name="pAllocator">allocator of the connection sending the command, the slot keeps a copy to free the names with</param>
+/// <param name="Slot">returned by GetAsyncCallID</param>
+/// <param name="ID">returned by GetAsyncCallID</param>
+/// <param name="lpCommand">the command as sent</param>
+/// <param name="lpSubCommand">the subcommand as sent, NULL if none</param>
+/// <returns>FALSE when out of memory</returns>
+static BOOL SetAsyncCallCommandName(_In_ const MWS_ALLOCATOR* pAllocator, _In_ int Slot, _In_ INT64 ID, _In_z_ LPCSTR lpCommand, _In_opt_z_ LPCSTR lpSubCommand)
+{
+    // one block, "command\0subcommand\0"
+    SIZE_T cbCommand = strlen(lpCommand) + 1;
+    SIZE_T cbSubCommand = lpSubCommand ? strlen(lpSubCommand) + 1 : 0;
+    LPSTR lpName = MwsAlloc(pAllocator, 0, cbCommand + cbSubCommand);
+    if (!lpName)
+        return FALSE;
+    memcpy(lpName, lpCommand, cbCommand);
+    if (lpSubCommand)
+        memcpy(lpName + cbCommand, lpSubCommand, cbSubCommand);
+
+    AcquireSRWLockExclusive(&AsyncCallListLock);
+    if (AsyncCalls[Slot].bUsed && AsyncCalls[Slot].ID == ID)
+    {
+        MwsFree(&AsyncCalls[Slot].Timing.NameAllocator, AsyncCalls[Slot].Timing.lpCommandName);
+        AsyncCalls[Slot].Timing.lpCommandName = lpName;
+        AsyncCalls[Slot].Timing.lpSubCommandName = lpSubCommand ? lpName + cbCommand : NULL;
+        AsyncCalls[Slot].Timing.NameAllocator = *pAllocator;
+        lpName = NULL;
+    }
+    ReleaseSRWLockExclusive(&AsyncCallListLock);
+    MwsFree(pAllocator, lpName);
+    return TRUE;
+}
+
+/// <summary>
+/// Find informations about a async call
+/// </summary>
+/// <param name="ID">async call ID</param>
+/// <param name="bRemove">free the slot, FALSE while more batches of a streamed response are coming</param>
+/// <param name="pType">returns the type of that async call</param>
+/// <param name="pCallback">returns the callback address</param>
+/// <param name="pContext">returns the context</param>
+/// <param name="pTiming">returns the command and when it was sent. When removing, the caller frees lpCommandName with NameAllocator</param>
+/// <returns>return TRUE when success</returns>
+static BOOL FindAsyncCallID(_In_ INT64 ID, _In_ BOOL bRemove, _Out_opt_ ASYNC_CALL_TYPE* pType, _Out_opt_ LPVOID* pCallback, _Out_opt_ LPVOID* pContext, _Out_opt_ ASYNC_CALL_TIMING* pTiming)
+{
+    BOOL bSuccess = FALSE;
+    AcquireSRWLockExclusive(&AsyncCallListLock);
+    __try
+    {
+        for (int i = 0; i < _countof(AsyncCalls); i++)
+        {
+            if (AsyncCalls[i].bUsed && AsyncCalls[i].ID == ID)
+            {
+                if (pType) *pType = AsyncCalls[i].Type;
+                if (pCallback) *pCallback = AsyncCalls[i].Callback;
+                if (pContext) *pContext = AsyncCalls[i].Context;
+                if (pTiming) *pTiming = AsyncCalls[i].Timing;
+
+                if (bRemove)
+                {
+                    if (!pTiming)
+                        MwsFree(&AsyncCalls[i].Timing.NameAllocator, AsyncCalls[i].Timing.lpCommandName);
+                    AsyncCalls[i].Timing.lpCommandName = NULL;
+                    AsyncCalls[i].Timing.lpSubCommandName = NULL;
+                    AsyncCalls[i].bUsed = FALSE;
+                    AsyncCallsInUse--;
+                }
+                bSuccess = TRUE;
+                __leave;
+            }
+        }
+
+        if (pType) *pType = 0;
+        if (pCallback) *pCallback = NULL;
+        if (pContext) *pContext = NULL;
+        if (pTiming) ZeroMemory(pTiming, sizeof(ASYNC_CALL_TIMING));
+    }
+    __finally
+    {
+        ReleaseSRWLockExclusive(&AsyncCallListLock);
+    }
+
+    return bSuccess;
+}
+
+/// <summary>
+/// Find and remove informations about a async call
+/// </summary>
+/// <returns>return TRUE when success</returns>
+BOOL RemoveAsyncCallID(_In_ INT64 ID, _Out_opt_ ASYNC_CALL_TYPE* pType, _Out_opt_ LPVOID* pCallback, _Out_opt_ LPVOID* pContext, _Out_opt_ ASYNC_CALL_TIMING* pTiming)
+{
+    return FindAsyncCallID(ID, TRUE, pType, pCallback, pContext, pTiming);
+}
+
+LONG GetAsyncCallsInUse()
+{
+    return ReadNoFence(&AsyncCallsInUse);
+}
+
+// Every message block type is described once, by the fields of its json object and where they live in MESSAGE_BLOCK.
+// Parsing, serializing, freeing and validating blocks all walk these descriptors.
+
+typedef enum
+{
+    BF_INT,  // INT64, json integer
+    BF_BOOL, // BOOL, json true or false
+    BF_STR,  // LPWSTR, json string
+    BF_JSON, // LPWSTR holding the json text of any value
+    BF_NAME  // LPCWSTR, json string of few distinct values. Interned for chains of the dispatched frame, see InternString,
+             // and copied for chains from UnpackMiraiWSChain
+} BLOCK_FIELD_TYPE;
+
+typedef struct
+{
+    LPCSTR lpKey;
+    BLOCK_FIELD_TYPE Type;
+    BOOL bOptional;    // may be missing in json and 0 or NULL in the block. optional ints and bools are only sent when set
+    BOOL bReceiveOnly; // filled when receiving, never read from a block being sent. implies bOptional
+    SIZE_T Offset;     // in MESSAGE_BLOCK
+} BLOCK_FIELD;
+
+#define BLOCK_FIELD(Block, Member, Key, Type, bOptional) { Key, Type, bOptional, FALSE, FIELD_OFFSET(MESSAGE_BLOCK, Block.Member) }
+#define BLOCK_FIELD_IN(Block, Member, Key, Type) { Key, Type, TRUE, TRUE, FIELD_OFFSET(MESSAGE_BLOCK, Block.Member) }
+
+static const BLOCK_FIELD AtFields[] = {
+    BLOCK_FIELD(At, Target, "target", BF_INT, FALSE),
+    BLOCK_FIELD(At, Display, "display", BF_STR, TRUE)
+};
+static const BLOCK_FIELD FaceFields[] = {
+    BLOCK_FIELD(Face, FaceID, "faceId", BF_INT, FALSE),
+    // mirai picks the face by faceId, callers filling only that leave name as garbage.
+    BLOCK_FIELD_IN(Face, Name, "name", BF_STR)
+};
+static const BLOCK_FIELD PlainFields[] = {
+    BLOCK_FIELD(Plain, Text, "text", BF_STR, FALSE)
+};
+// an image is sent by any one of these, mirai fills in all of them when receiving.
+static const BLOCK_FIELD ImageFields[] = {
+    BLOCK_FIELD(Image, ImageIDStr, "imageId", BF_STR, TRUE),
+    BLOCK_FIELD(Image, URL, "url", BF_STR, TRUE),
+    BLOCK_FIELD(Image, ImageType, "imageType", BF_NAME, TRUE),
+    BLOCK_FIELD(Image, IsEmoji, "isEmoji", BF_BOOL, TRUE)
+};
+static const BLOCK_FIELD VoiceFields[] = {
+    BLOCK_FIELD(Voice, VoiceIDStr, "voiceId", BF_STR, TRUE),
+    BLOCK_FIELD(Voice, URL, "url", BF_STR, TRUE),
+    BLOCK_FIELD(Voice, Length, "length", BF_INT, TRUE)
+};
+static const BLOCK_FIELD XmlFields[] = {
+    BLOCK_FIELD(Xml, Xml, "xml", BF_STR, FALSE)
+};
+static const BLOCK_FIELD JsonFields[] = {
+    BLOCK_FIELD(Json, Json, "json", BF_STR, FALSE)
+};
+static const BLOCK_FIELD AppFields[] = {
+    BLOCK_FIELD(App, Content, "content", BF_STR, FALSE)
+};
+static const BLOCK_FIELD PokeFields[] = {
+    BLOCK_FIELD(Poke, Name, "name", BF_STR, FALSE)
+};
+static const BLOCK_FIELD DiceFields[] = {
+    BLOCK_FIELD(Dice, Value, "value", BF_INT, FALSE)
+};
+static const BLOCK_FIELD MarketFaceFields[] = {
+    BLOCK_FIELD(MarketFace, ID, "id", BF_INT, FALSE),
+    BLOCK_FIELD(MarketFace, Name, "name", BF_STR, TRUE)
+};
+static const BLOCK_FIELD MusicShareFields[] = {
+    BLOCK_FIELD(MusicShare, Kind, "kind", BF_STR, FALSE),
+    BLOCK_FIELD(MusicShare, Title, "title", BF_STR, FALSE),
+    BLOCK_FIELD(MusicShare, Summary, "summary", BF_STR, FALSE),
+    BLOCK_FIELD(MusicShare, JumpURL, "jumpUrl", BF_STR, FALSE),
+    BLOCK_FIELD(MusicShare, PictureURL, "pictureUrl", BF_STR, FALSE),
+    BLOCK_FIELD(MusicShare, MusicURL, "musicUrl", BF_STR, FALSE),
+    BLOCK_FIELD(MusicShare, Brief, "brief", BF_STR, TRUE)
+};
+static const BLOCK_FIELD ForwardFields[] = {
+    BLOCK_FIELD(Forward, NodeList, "nodeList", BF_JSON, FALSE)
+};
+static const BLOCK_FIELD FileFields[] = {
+    BLOCK_FIELD(File, FileID, "id", BF_STR, FALSE),
+    BLOCK_FIELD(File, Name, "name", BF_STR, FALSE),
+    BLOCK_FIELD(File, Size, "size", BF_INT, TRUE)
+};
+
+typedef struct
+{
+    LPCSTR lpName; // "type" in json
+    const BLOCK_FIELD* Fields;
+    int FieldCnt;
+    LPCSTR lpFlagName; // another name of the same block, telling the BOOL at FlagOffset is set
+    SIZE_T FlagOffset;
+} BLOCK_CODEC;
+
+#define BLOCK_CODEC(Name, Fields) { Name, Fields, _countof(Fields), NULL, 0 }
+
+// indexed by MESSAGE_BLOCK_TYPE
+static const BLOCK_CODEC BlockCodecs[] = {
+    [MB_AT] = BLOCK_CODEC("At", AtFields),
+    [MB_ATALL] = { "AtAll", NULL, 0, NULL, 0 },
+    [MB_FACE] = BLOCK_CODEC("Face", FaceFields),
+    [MB_PLAIN] = BLOCK_CODEC("Plain", PlainFields),
+    [MB_IMAGE] = { "Image", ImageFields, _countof(ImageFields), "FlashImage", FIELD_OFFSET(MESSAGE_BLOCK, Image.IsFlash) },
+    [MB_VOICE] = BLOCK_CODEC("Voice", VoiceFields),
+    [MB_XML] = BLOCK_CODEC("Xml", XmlFields),
+    [MB_JSON] = BLOCK_CODEC("Json", JsonFields),
+    [MB_APP] = BLOCK_CODEC("App", AppFields),
+    [MB_POKE] = BLOCK_CODEC("Poke", PokeFields),
+    [MB_DICE] = BLOCK_CODEC("Dice", DiceFields),
+    [MB_MARKETFACE] = BLOCK_CODEC("MarketFace", MarketFaceFields),
+    [MB_MUSICSHARE] = BLOCK_CODEC("MusicShare", MusicShareFields),
+    [MB_FORWARD] = BLOCK_CODEC("Forward", ForwardFields),
+    [MB_FILE] = BLOCK_CODEC("File", FileFields)
+};
+C_ASSERT(_countof(BlockCodecs) == MB_FILE + 1);
+
+// open addressing table from type names to codecs, filled on first use.
+#define BLOCK_NAME_SLOTS 64 // power of 2, keep it at least twice the number of names
+
+typedef struct
+{
+    LPCSTR lpName;
+    MESSAGE_BLOCK_TYPE Type;
+    BOOL bFlag; // lpName is the lpFlagName of the codec
+} BLOCK_NAME_SLOT;
+
+static BLOCK_NAME_SLOT BlockNames[BLOCK_NAME_SLOTS];
+static INIT_ONCE BlockNamesInitOnce = INIT_ONCE_STATIC_INIT;
+
+static UINT HashName(_In_reads_(cchName) LPCSTR lpName, _In_ SIZE_T cchName)
+{
+    // FNV-1a
+    UINT Hash = 2166136261u;
+    for (SIZE_T i = 0; i < cchName; i++)
+        Hash = (Hash ^ (BYTE)lpName[i]) * 16777619u;
+    return Hash;
+}
+
+static void InsertBlockName(_In_z_ LPCSTR lpName, _In_ MESSAGE_BLOCK_TYPE Type, _In_ BOOL bFlag)
+{
+    UINT Slot = HashName(lpName, strlen(lpName)) & (BLOCK_NAME_SLOTS - 1);
+    while (BlockNames[Slot].lpName)
+        Slot = (Slot + 1) & (BLOCK_NAME_SLOTS - 1);
+
+    BlockNames[Slot].lpName = lpName;
+    BlockNames[Slot].Type = Type;
+    BlockNames[Slot].bFlag = bFlag;
+}
+
+static BOOL CALLBACK InitBlockNames(_Inout_ PINIT_ONCE InitOnce, _Inout_opt_ PVOID Parameter, _Outptr_opt_result_maybenull_ PVOID* Context)
+{
+    for (int Type = MB_AT; Type < _countof(BlockCodecs); Type++)
+    {
+        InsertBlockName(BlockCodecs[Type].lpName, (MESSAGE_BLOCK_TYPE)Type, FALSE);
+        if (BlockCodecs[Type].lpFlagName)
+            InsertBlockName(BlockCodecs[Type].lpFlagName, (MESSAGE_BLOCK_TYPE)Type, TRUE);
+    }
+    return TRUE;
+}
+
+static const BLOCK_NAME_SLOT* LookupBlockName(_In_reads_(cchName) LPCSTR lpName, _In_ SIZE_T cchName)
+{
+    InitOnceExecuteOnce(&BlockNamesInitOnce, InitBlockNames, NULL, NULL);
+
+    UINT Slot = HashName(lpName, cchName) & (BLOCK_NAME_SLOTS - 1);
+    while (BlockNames[Slot].lpName)
+    {
+        // the received name may hold a \u0000, so lengths first and no string compare.
+        if (strlen(BlockNames[Slot].lpName) == cchName && memcmp(BlockNames[Slot].lpName, lpName, cchName) == 0)
+            return &BlockNames[Slot];
+        Slot = (Slot + 1) & (BLOCK_NAME_SLOTS - 1);
+    }
+    return NULL;
+}
+
+/// <summary>
+/// Wide copy of a utf8 string that takes few distinct values, owned by the connection. Only used from the dispatch stage,
+/// for strings that live no longer than the frame being dispatched, never for chains handed out by UnpackMiraiWSChain.
+/// A value seen before costs a hash lookup instead of an allocation and a transcode.
+/// </summary>
+/// <returns>NULL when out of memory</returns>
+static LPCWSTR InternString(_Inout_ MWS_INTERN_TABLE* pTable, _In_reads_(cbUtf8) LPCSTR lpUtf8, _In_ SIZE_T cbUtf8)
+{
+    UINT Hash = HashName(lpUtf8, cbUtf8);
+    INTERNED_STRING** ppString = &pTable->Buckets[Hash & (INTERN_BUCKETS - 1)];
+    for (; *ppString; ppString = &(*ppString)->pNext)
+    {
+        INTERNED_STRING* pString = *ppString;
+        if (pString->Hash == Hash && pString->cbUtf8 == cbUtf8 && memcmp(pString->Utf8, lpUtf8, cbUtf8) == 0)
+            return pString->lpWide;
+    }
+    // a full table still converts the value, it just doesn't outlive the frame.
+    BOOL bOverflow = pTable->Count >= INTERN_MAX_STRINGS;
+    if (bOverflow)
+        ppString = &pTable->pOverflow;
+
+    int cchWide = cbUtf8 ? MultiByteToWideChar(CP_UTF8, 0, lpUtf8, (int)cbUtf8, NULL, 0) : 0;
+    SIZE_T cbWideStart = (FIELD_OFFSET(INTERNED_STRING, Utf8[cbUtf8]) + sizeof(WCHAR) - 1) & ~(sizeof(WCHAR) - 1);
+    INTERNED_STRING* pString = MwsAlloc(pTable->pAllocator, 0, cbWideStart + (cchWide + 1) * sizeof(WCHAR));
+    if (!pString)
+        return NULL;
+
+    pString->pNext = NULL;
+    pString->Hash = Hash;
+    pString->cbUtf8 = cbUtf8;
+    memcpy(pString->Utf8, lpUtf8, cbUtf8);
+    pString->lpWide = (LPWSTR)((PBYTE)pString + cbWideStart);
+    if (cchWide)
+        MultiByteToWideChar(CP_UTF8, 0, lpUtf8, (int)cbUtf8, pString->lpWide, cchWide);
+    pString->lpWide[cchWide] = L'\0';
+
+    if (bOverflow)
+        pString->pNext = pTable->pOverflow;
+    else
+        pTable->Count++;
+    *ppString = pString;
+    return pString->lpWide;
+}
+
+/// <summary>
+/// Free the values InternString found no room for, once nothing of the dispatched frame refers to them.
+/// </summary>
+static void FlushInternOverflow(_Inout_ MWS_INTERN_TABLE* pTable)
+{
+    INTERNED_STRING* pString = pTable->pOverflow;
+    while (pString)
+    {
+        INTERNED_STRING* pNext = pString->pNext;
+        MwsFree(pTable->pAllocator, pString);
+        pString = pNext;
+    }
+    pTable->pOverflow = NULL;
+}
+
+static void FreeInternTable(_Inout_ MWS_INTERN_TABLE* pTable)
+{
+    for (int i = 0; i < INTERN_BUCKETS; i++)
+    {
+        INTERNED_STRING* pString = pTable->Buckets[i];
+        while (pString)
+        {
+            INTERNED_STRING* pNext = pString->pNext;
+            MwsFree(pTable->pAllocator, pString);
+            pString = pNext;
+        }
+        pTable->Buckets[i] = NULL;
+    }
+    pTable->Count = 0;
+    FlushInternOverflow(pTable);
+}
+
+// indexed by MWS_PERMISSION
+static const LPCSTR PermissionNames[] = { NULL, "MEMBER", "ADMINISTRATOR", "OWNER" };
+static const LPCWSTR PermissionNamesW[] = { NULL, L"MEMBER", L"ADMINISTRATOR", L"OWNER" };
+C_ASSERT(_countof(PermissionNames) == MWS_PERMISSION_OWNER + 1);
+
+static MWS_PERMISSION ParsePermission(_In_reads_(cbUtf8) LPCSTR lpUtf8, _In_ SIZE_T cbUtf8)
+{
+    for (int i = MWS_PERMISSION_MEMBER; i < _countof(PermissionNames); i++)
+    {
+        if (strlen(PermissionNames[i]) == cbUtf8 && memcmp(PermissionNames[i], lpUtf8, cbUtf8) == 0)
+            return (MWS_PERMISSION)i;
+    }
+    return MWS_PERMISSION_UNKNOWN;
+}
+
+/// <summary>
+/// Permission as a string owned by the connection, a literal for the ones MiraiWS knows.
+/// </summary>
+static LPCWSTR InternPermission(_Inout_ MWS_INTERN_TABLE* pTable, _In_reads_(cbUtf8) LPCSTR lpUtf8, _In_ SIZE_T cbUtf8, _Out_ MWS_PERMISSION* pPermission)
+{
+    *pPermission = ParsePermission(lpUtf8, cbUtf8);
+    if (*pPermission != MWS_PERMISSION_UNKNOWN)
+        return PermissionNamesW[*pPermission];
+    return InternString(pTable, lpUtf8, cbUtf8);
+}
+
+#define BLOCK_MEMBER(pBlock, pField, Type) ((Type*)((PBYTE)(pBlock) + (pField)->Offset))
+
+static BOOL IsKnownBlockType(_In_ MESSAGE_BLOCK_TYPE Type)
+{
+    return Type >= MB_AT && Type < _countof(BlockCodecs);
+}
+
+/// <param name="bOwnNames">BF_NAME strings were copied, not interned</param>
+static BOOL DestructMessageBlock(_In_ const MWS_ALLOCATOR* pAllocator, _In_ BOOL bOwnNames, _In_ MESSAGE_BLOCK* pBlock)
+{
+    if (!IsKnownBlockType(pBlock->Type))
+        return FALSE;
+
+    const BLOCK_CODEC* pCodec = &BlockCodecs[pBlock->Type];
+    for (int i = 0; i < pCodec->FieldCnt; i++)
+    {
+        const BLOCK_FIELD* pField = pCodec->Fields + i;
+        if (pField->Type != BF_STR && pField->Type != BF_JSON && !(pField->Type == BF_NAME && bOwnNames))
+            continue; // interned BF_NAME strings belong to the connection
+
+        LPWSTR* ppStr = BLOCK_MEMBER(pBlock, pField, LPWSTR);
+        if (*ppStr)
+        {
+            MwsFree(pAllocator, *ppStr);
+            *ppStr = NULL;
+        }
+    }
+    return TRUE;
+}
+
+/// <summary>
+/// Check a block before sending it: the type is known and the strings it can't go without are set.
+/// </summary>
+static BOOL ValidateMessageBlock(_In_ const MESSAGE_BLOCK* pBlock)
+{
+    if (!IsKnownBlockType(pBlock->Type))
+        return FALSE;
+
+    const BLOCK_CODEC* pCodec = &BlockCodecs[pBlock->Type];
+    for (int i = 0; i < pCodec->FieldCnt; i++)
+    {
+        const BLOCK_FIELD* pField = pCodec->Fields + i;
+        if (!pField->bOptional && (pField->Type == BF_STR || pField->Type == BF_JSON || pField->Type == BF_NAME) &&
+            !*BLOCK_MEMBER(pBlock, pField, const LPWSTR))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/// <param name="bOwnNames">the chain was unpacked without an intern table</param>
+static BOOL ReleaseMessageChain(_In_ const MWS_ALLOCATOR* pAllocator, _In_ BOOL bOwnNames, _In_ MESSAGE_CHAIN* pMessageChain)
+{
+    BOOL bSuccess = TRUE;
+    if (pMessageChain->MessageBlocks)
+    {
+        for (int i = 0; i < pMessageChain->BlockCnt; i++)
+        {
+            bSuccess &= DestructMessageBlock(pAllocator, bOwnNames, pMessageChain->MessageBlocks + i);
+        }
+        MwsFree(pAllocator, pMessageChain->MessageBlocks);
+        pMessageChain->MessageBlocks = NULL;
+    }
+    return bSuccess;
+}
+
+static BOOL ParseBlockField(_In_ const MWS_ALLOCATOR* pAllocator, _Inout_opt_ MWS_INTERN_TABLE* pInterned, _Inout_ MESSAGE_BLOCK* pBlock, _In_ const BLOCK_FIELD* pField, _In_ yyjson_val* Node)
+{
+    yyjson_val* Value = yyjson_obj_get(Node, pField->lpKey);
+    if (!Value || yyjson_is_null(Value))
+        return pField->bOptional;
+
+    switch (pField->Type)
+    {
+    case BF_INT:
+    {
+        if (!yyjson_is_int(Value))
+            return FALSE;
+
+        *BLOCK_MEMBER(pBlock, pField, INT64) = yyjson_get_sint(Value);
+        return TRUE;
+    }
+    case BF_BOOL:
+    {
+        if (!yyjson_is_bool(Value))
+            return FALSE;
+
+        *BLOCK_MEMBER(pBlock, pField, BOOL) = (BOOL)yyjson_get_bool(Value);
+        return TRUE;
+    }
+    case BF_STR:
+    {
+        if (!yyjson_is_str(Value))
+            return FALSE;
+
+        LPWSTR CopiedStr = StrUtf8ToWide(pAllocator, yyjson_get_str(Value), -1, NULL);
+        *BLOCK_MEMBER(pBlock, pField, LPWSTR) = CopiedStr;
+        return CopiedStr != NULL;
+    }
+    case BF_JSON:
+    {
+        yyjson_alc Alc = MwsJsonAlc(pAllocator);
+        LPSTR lpJsonText = yyjson_val_write_opts(Value, 0, &Alc, NULL, NULL);
+        if (!lpJsonText)
+            return FALSE;
+
+        LPWSTR CopiedJson = StrUtf8ToWide(pAllocator, lpJsonText, -1, NULL);
+        Alc.free(Alc.ctx, lpJsonText);
+        *BLOCK_MEMBER(pBlock, pField, LPWSTR) = CopiedJson;
+        return CopiedJson != NULL;
+    }
+    case BF_NAME:
+    {
+        if (!yyjson_is_str(Value))
+            return FALSE;
+
+        LPCWSTR lpName = pInterned ?
+            InternString(pInterned, unsafe_yyjson_get_str(Value), unsafe_yyjson_get_len(Value)) :
+            StrUtf8ToWide(pAllocator, unsafe_yyjson_get_str(Value), (int)unsafe_yyjson_get_len(Value), NULL);
+        *BLOCK_MEMBER(pBlock, pField, LPCWSTR) = lpName;
+        return lpName != NULL;
+    }
+    }
+    return FALSE;
+}
+
+static BOOL ConstructMessageBlock(_In_ const MWS_ALLOCATOR* pAllocator, _Inout_opt_ MWS_INTERN_TABLE* pInterned, _Out_ MESSAGE_BLOCK *pBlock, _In_reads_(cchType) LPCSTR lpType, _In_ SIZE_T cchType, _In_ yyjson_val *Node)
+{
+    ZeroMemory(pBlock, sizeof(MESSAGE_BLOCK));
+
+    const BLOCK_NAME_SLOT* pName = LookupBlockName(lpType, cchType);
+    if (!pName)
+        return FALSE;
+
+    const BLOCK_CODEC* pCodec = &BlockCodecs[pName->Type];
+    pBlock->Type = pName->Type;
+    if (pCodec->lpFlagName)
+        *(BOOL*)((PBYTE)pBlock + pCodec->FlagOffset) = pName->bFlag;
+
+    for (int i = 0; i < pCodec->FieldCnt; i++)
+    {
+        if (!ParseBlockField(pAllocator, pInterned, pBlock, pCodec->Fields + i, Node))
+        {
+            DestructMessageBlock(pAllocator, !pInterned, pBlock);
+            pBlock->Type = 0;
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// Views borrow strings and chains from the received json instead of copying them.
+
+static const MWS_STRING EmptyString = { "", 0 };
+
+static MWS_STRING ViewStr(_In_opt_ yyjson_val* Obj, _In_z_ LPCSTR lpKey)
+{
+    yyjson_val* Field = yyjson_obj_get(Obj, lpKey);
+    if (!yyjson_is_str(Field))
+        return EmptyString;
+
+    MWS_STRING Str = { unsafe_yyjson_get_str(Field), unsafe_yyjson_get_len(Field) };
+    return Str;
+}
+
+static INT64 ViewInt(_In_opt_ yyjson_val* Obj, _In_z_ LPCSTR lpKey)
+{
+    return yyjson_get_sint(yyjson_obj_get(Obj, lpKey));
+}
+
+static BOOL ViewBool(_In_opt_ yyjson_val* Obj, _In_z_ LPCSTR lpKey)
+{
+    return yyjson_get_bool(yyjson_obj_get(Obj, lpKey));
+}
+
+static BOOL IsMissing(_In_opt_ yyjson_val* Node)
+{
+    return !Node || yyjson_is_null(Node);
+}
+
+static BOOL ViewChain(_In_opt_ yyjson_val* Node, _Out_ MWS_CHAINVIEW* pChain)
+{
+    // mirai puts Source first.
+    yyjson_val* First = yyjson_arr_get_first(Node);
+    BOOL bSource = yyjson_equals_str(yyjson_obj_get(First, "type"), "Source");
+    pChain->ID = bSource ? ViewInt(First, "id") : 0;
+    pChain->Timestamp = bSource ? ViewInt(First, "time") : 0;
+    pChain->BlockCnt = yyjson_arr_size(Node);
+    pChain->Node = Node;
+    return yyjson_is_arr(Node);
+}
+
+static BOOL ViewFriend(_In_opt_ yyjson_val* Node, _Out_ MWS_FRIENDVIEW* pFriend)
+{
+    yyjson_val* IDField = yyjson_obj_get(Node, "id");
+    pFriend->ID = yyjson_get_sint(IDField);
+    pFriend->Nick = ViewStr(Node, "nickname");
+    pFriend->Remark = ViewStr(Node, "remark");
+    return yyjson_is_int(IDField);
+}
+
+static BOOL ViewGroup(_In_opt_ yyjson_val* Node, _Out_ MWS_GROUPVIEW* pGroup)
+{
+    yyjson_val* IDField = yyjson_obj_get(Node, "id");
+    pGroup->ID = yyjson_get_sint(IDField);
+    pGroup->Name = ViewStr(Node, "name");
+    pGroup->Permission = ViewStr(Node, "permission");
+    pGroup->PermissionLevel = ParsePermission(pGroup->Permission.Ptr, pGroup->Permission.Len);
+    return yyjson_is_int(IDField);
+}
+
+static BOOL ViewMember(_In_opt_ yyjson_val* Node, _Out_ MWS_MEMBERVIEW* pMember)
+{
+    yyjson_val* IDField = yyjson_obj_get(Node, "id");
+    pMember->ID = yyjson_get_sint(IDField);
+    pMember->MemberName = ViewStr(Node, "memberName");
+    pMember->SpecialTitle = ViewStr(Node, "specialTitle");
+    pMember->Permission = ViewStr(Node, "permission");
+    pMember->PermissionLevel = ParsePermission(pMember->Permission.Ptr, pMember->Permission.Len);
+    pMember->JoinTimestamp = ViewInt(Node, "joinTimestamp");
+    pMember->LastSpeakTimestamp = ViewInt(Node, "lastSpeakTimestamp");
+    pMember->MuteTimeRemaining = ViewInt(Node, "muteTimeRemaining");
+    BOOL bGroup = ViewGroup(yyjson_obj_get(Node, "group"), &pMember->Group);
+    return yyjson_is_int(IDField) && bGroup;
+}
+
+// operators and invitors are null when it was the bot or nobody, the view is left empty then.
+static BOOL ViewOptionalMember(_In_opt_ yyjson_val* Node, _Out_ MWS_MEMBERVIEW* pMember)
+{
+    return ViewMember(Node, pMember) || IsMissing(Node);
+}
+
+static BOOL ViewClient(_In_opt_ yyjson_val* Node, _Out_ MWS_CLIENTVIEW* pClient)
+{
+    yyjson_val* IDField = yyjson_obj_get(Node, "id");
+    pClient->ID = yyjson_get_sint(IDField);
+    pClient->Platform = ViewStr(Node, "platform");
+    return yyjson_is_int(IDField);
+}
+
+static BOOL UnpackQuote(_Out_ MWS_QUOTE* pQuote, _In_ yyjson_val* Node)
+{
+    // origin stays json, most handlers only want to know what was replied to.
+    yyjson_val* IDField = yyjson_obj_get(Node, "id");
+    pQuote->ID = yyjson_get_sint(IDField);
+    pQuote->GroupID = ViewInt(Node, "groupId");
+    pQuote->SenderID = ViewInt(Node, "senderId");
+    pQuote->TargetID = ViewInt(Node, "targetId");
+    BOOL bOrigin = ViewChain(yyjson_obj_get(Node, "origin"), &pQuote->Origin);
+    return yyjson_is_int(IDField) && bOrigin;
+}
+
+/// <summary>
+/// Decode a message chain into blocks.
+/// </summary>
+/// <param name="pAllocator">allocator to take the blocks from</param>
+/// <param name="pInterned">intern table of the connection, for chains freed with the frame. NULL copies every string</param>
+/// <param name="pMessageChain">receives the blocks, free with ReleaseMessageChain</param>
+/// <param name="MessageChainNode">json array of the chain</param>
+/// <param name="bNeedSource">fail when the chain has no Source block, which received messages always have</param>
+/// <returns>TRUE on success</returns>
+static BOOL UnpackMessageChain(_In_ const MWS_ALLOCATOR* pAllocator, _Inout_opt_ MWS_INTERN_TABLE* pInterned, _Out_ MESSAGE_CHAIN* pMessageChain, _In_ yyjson_val *MessageChainNode, _In_ BOOL bNeedSource)
+{
+    BOOL bSuccess = FALSE;
+    pMessageChain->ID = 0;
+    pMessageChain->Timestamp = 0;
+    pMessageChain->MessageBlocks = NULL;
+    pMessageChain->BlockCnt = 0;
+    ZeroMemory(&pMessageChain->Quote, sizeof(MWS_QUOTE));
+    __try
+    {
+        size_t EnumIndex, MaxNode = yyjson_arr_size(MessageChainNode);
+        yyjson_val* EnumNode;
+
+        // atleast one "Source" node.
+        if (MaxNode < 1)
+        {
+            bSuccess = !bNeedSource;
+            __leave;
+        }
+        pMessageChain->MessageBlocks = (PMESSAGE_BLOCK)MwsAlloc(pAllocator, HEAP_ZERO_MEMORY, sizeof(MESSAGE_BLOCK) * MaxNode);
+
+        if (!pMessageChain->MessageBlocks)
+            __leave;
+
+        BOOL bHaveSource = FALSE; // we have to check if source node exists.
+        yyjson_arr_foreach(MessageChainNode, EnumIndex, MaxNode, EnumNode) {
+            yyjson_val* TypeField = yyjson_obj_get(EnumNode, "type");
+            if (!TypeField || !yyjson_is_str(TypeField))
+            {
+                __leave;
+            }
+            LPCSTR lpType = yyjson_get_str(TypeField);
+            SIZE_T cchType = yyjson_get_len(TypeField);
+
+            // Handle different type of message block
+            // well... I don't think "Source" and "Quote" should be treated as a message block.
+            if (strcmp(lpType, "Source") == 0)
+            {
+                yyjson_val* IDField = yyjson_obj_get(EnumNode, "id");
+                yyjson_val* TimeField = yyjson_obj_get(EnumNode, "time");
+                if (!IDField || !yyjson_is_int(IDField) || !TimeField || !yyjson_is_int(TimeField))
+                {
+                    __leave;
+                }
+                pMessageChain->ID = yyjson_get_sint(IDField);
+                pMessageChain->Timestamp = yyjson_get_sint(TimeField);
+
+                bHaveSource = TRUE;
+            }
+            else if (strcmp(lpType, "Quote") == 0)
+            {
+                if (!UnpackQuote(&pMessageChain->Quote, EnumNode))
+                {
+                    __leave;
+                }
+            }
+            else
+            {
+                if (!ConstructMessageBlock(pAllocator, pInterned, pMessageChain->MessageBlocks + pMessageChain->BlockCnt, lpType, cchType, EnumNode))
+                {
+                    __leave;
+                }
+                pMessageChain->BlockCnt++;
+            }
+        }
+        if (bNeedSource && !bHaveSource)
+            __leave;
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if (!bSuccess)
+        {
+            ReleaseMessageChain(pAllocator, !pInterned, pMessageChain);
+        }
+    }
+    return bSuccess;
+}
+
+/// <summary>
+/// Call the user callback from the dispatch stage, timed when metrics are enabled.
+/// </summary>
+static void DispatchToCallback(_In_ PMIRAI_WS pMiraiWS, _In_ UINT EventType, _In_ PVOID pInformation)
+{
+    if (!pMiraiWS->pMetrics && !MWS_TRACING())
+    {
+        pMiraiWS->Callback(pMiraiWS, EventType, pInformation);
+        return;
+    }
+
+    LONGLONG Start = ReadPerfClock();
+    pMiraiWS->Callback(pMiraiWS, EventType, pInformation);
+    if (pMiraiWS->pMetrics)
+        MetricsRecord(pMiraiWS->pMetrics, MWS_LAT_CALLBACK, ReadPerfClock() - Start);
+    if (MWS_TRACING())
+    {
+        // the MWS_ event types follow the same TypeList order as MWSBIN_EVENT_TYPE.
+        MWSBIN_EVENT_TYPE TraceEvent = EventType >= MWS_FRIENDMSG && EventType <= MWS_COMMANDEXECUTED ?
+            (MWSBIN_EVENT_TYPE)(EventType - MWS_FRIENDMSG + MWSBIN_EV_FRIEND_MESSAGE) : MWSBIN_EV_UNKNOWN;
+        TraceSpan(MWS_SPAN_CALLBACK, pMiraiWS, Start, 0, TraceEvent);
+    }
+}
+
+static BOOL FriendMessageUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    MWS_FRIENDMSGINFO Info = { 0 };
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        yyjson_val* MessageChainField = yyjson_obj_get(DataField, "messageChain");
+        yyjson_val* SenderField = yyjson_obj_get(DataField, "sender");
+        if (!MessageChainField || !yyjson_is_arr(MessageChainField) || !SenderField || !yyjson_is_obj(SenderField))
+            __leave;
+
+        yyjson_val* SenderIDField = yyjson_obj_get(SenderField, "id");
+        yyjson_val* SenderNickField = yyjson_obj_get(SenderField, "nickname");
+        yyjson_val* SenderRemarkField = yyjson_obj_get(SenderField, "remark");
+
+        if (!SenderIDField || !yyjson_is_int(SenderIDField) ||
+            !SenderNickField || !yyjson_is_str(SenderNickField) ||
+            !SenderRemarkField || !yyjson_is_str(SenderRemarkField))
+            __leave;
+
+        if (pMiraiWS->pHistory)
+            StoreHistoryMessage(pMiraiWS->pHistory, MWS_CONV_FRIEND, yyjson_get_sint(SenderIDField), 0, yyjson_get_sint(SenderIDField), MessageChainField);
+
+        LONGLONG DecodeStart = MWS_TRACING() ? ReadPerfClock() : 0;
+        if (!UnpackMessageChain(&pMiraiWS->Allocator, &pMiraiWS->pPipeline->Interned, &Info.MessageChain, MessageChainField, TRUE))
+            __leave;
+        if (DecodeStart)
+            TraceSpan(MWS_SPAN_CHAIN_DECODE, pMiraiWS, DecodeStart, 0, MWSBIN_EV_FRIEND_MESSAGE);
+        ViewChain(MessageChainField, &Info.View);
+
+        Info.Sender.ID = yyjson_get_sint(SenderIDField);
+        Info.Sender.Nick = StrUtf8ToWide(&pMiraiWS->Allocator, yyjson_get_str(SenderNickField), -1, NULL);
+        Info.Sender.Remark = StrUtf8ToWide(&pMiraiWS->Allocator, yyjson_get_str(SenderRemarkField), -1, NULL);
+
+        if (!Info.Sender.Nick || !Info.Sender.Remark)
+            __leave;
+
+        DispatchToCallback(pMiraiWS, MWS_FRIENDMSG, &Info);
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if (Info.Sender.Nick) MwsFree(&pMiraiWS->Allocator, Info.Sender.Nick);
+        if (Info.Sender.Remark) MwsFree(&pMiraiWS->Allocator, Info.Sender.Remark);
+        ReleaseMessageChain(&pMiraiWS->Allocator, FALSE, &Info.MessageChain);
+    }
+
+    return bSuccess;
+}
+
+static BOOL GroupMessageUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    MWS_GROUPMSGINFO Info = { 0 };
+    MWS_INTERN_TABLE* pInterned = &pMiraiWS->pPipeline->Interned;
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        yyjson_val* MessageChainField = yyjson_obj_get(DataField, "messageChain");
+        yyjson_val* SenderField = yyjson_obj_get(DataField, "sender");
+        if (!MessageChainField || !yyjson_is_arr(MessageChainField) || !SenderField || !yyjson_is_obj(SenderField))
+            __leave;
+
+        yyjson_val* SenderIDField = yyjson_obj_get(SenderField, "id");
+        yyjson_val* SenderMemberNameField = yyjson_obj_get(SenderField, "memberName");
+        yyjson_val* SenderSpecialTitleField = yyjson_obj_get(SenderField, "specialTitle");
+        yyjson_val* SenderPermissionField = yyjson_obj_get(SenderField, "permission");
+        yyjson_val* SenderJoinTimeField = yyjson_obj_get(SenderField, "joinTimestamp");
+        yyjson_val* SenderLastSpeakTimeField = yyjson_obj_get(SenderField, "lastSpeakTimestamp");
+        yyjson_val* SenderMuteTimeRemainField = yyjson_obj_get(SenderField, "muteTimeRemaining");
+        yyjson_val* SenderGroupField = yyjson_obj_get(SenderField, "group");
+
+        if (!SenderIDField || !yyjson_is_int(SenderIDField) ||
+            !SenderMemberNameField || !yyjson_is_str(SenderMemberNameField) ||
+            !SenderSpecialTitleField || !yyjson_is_str(SenderSpecialTitleField) ||
+            !SenderPermissionField || !yyjson_is_str(SenderPermissionField) ||
+            !SenderJoinTimeField || !yyjson_is_int(SenderJoinTimeField) ||
+            !SenderLastSpeakTimeField || !yyjson_is_int(SenderLastSpeakTimeField) ||
+            !SenderMuteTimeRemainField || !yyjson_is_int(SenderMuteTimeRemainField) ||
+            !SenderGroupField || !yyjson_is_obj(SenderGroupField))
+            __leave;
+
+        yyjson_val* GroupIDField = yyjson_obj_get(SenderGroupField, "id");
+        yyjson_val* GroupNameField = yyjson_obj_get(SenderGroupField, "name");
+        yyjson_val* GroupPermissionField = yyjson_obj_get(SenderGroupField, "permission");
+
+        if (!GroupIDField || !yyjson_is_int(GroupIDField) ||
+            !GroupNameField || !yyjson_is_str(GroupNameField) ||
+            !GroupPermissionField || !yyjson_is_str(GroupPermissionField))
+            __leave;
+
+        if (pMiraiWS->pDirectory)
+        {
+            MWS_MEMBERVIEW Sender;
+            ViewMember(SenderField, &Sender);
+            UpdateDirectoryMember(pMiraiWS->pDirectory, &Sender);
+        }
+        if (pMiraiWS->pHistory)
+        {
+            INT64 GroupID = yyjson_get_sint(GroupIDField);
+            StoreHistoryMessage(pMiraiWS->pHistory, MWS_CONV_GROUP, GroupID, GroupID, yyjson_get_sint(SenderIDField), MessageChainField);
+        }
+
+        LONGLONG DecodeStart = MWS_TRACING() ? ReadPerfClock() : 0;
+        if (!UnpackMessageChain(&pMiraiWS->Allocator, pInterned, &Info.MessageChain, MessageChainField, TRUE))
+            __leave;
+        if (DecodeStart)
+            TraceSpan(MWS_SPAN_CHAIN_DECODE, pMiraiWS, DecodeStart, 0, MWSBIN_EV_GROUP_MESSAGE);
+        ViewChain(MessageChainField, &Info.View);
+
+        Info.Sender.ID = yyjson_get_sint(SenderIDField);
+        Info.Sender.MemberName = StrUtf8ToWide(&pMiraiWS->Allocator, yyjson_get_str(SenderMemberNameField), -1, NULL);
+        Info.Sender.SpecialTitle = StrUtf8ToWide(&pMiraiWS->Allocator, yyjson_get_str(SenderSpecialTitleField), -1, NULL);
+        Info.Sender.Permission = InternPermission(pInterned, unsafe_yyjson_get_str(SenderPermissionField),
+            unsafe_yyjson_get_len(SenderPermissionField), &Info.Sender.PermissionLevel);
+        Info.Sender.JoinTimestamp = yyjson_get_sint(SenderJoinTimeField);
+        Info.Sender.LastSpeakTimestamp = yyjson_get_sint(SenderLastSpeakTimeField);
+        Info.Sender.MuteTimeRemaining = yyjson_get_sint(SenderMuteTimeRemainField);
+        Info.Sender.Group.ID = yyjson_get_sint(GroupIDField);
+        Info.Sender.Group.Name = InternString(pInterned, unsafe_yyjson_get_str(GroupNameField), unsafe_yyjson_get_len(GroupNameField));
+        Info.Sender.Group.Permission = InternPermission(pInterned, unsafe_yyjson_get_str(GroupPermissionField),
+            unsafe_yyjson_get_len(GroupPermissionField), &Info.Sender.Group.PermissionLevel);
+
+        if (!Info.Sender.MemberName ||
+            !Info.Sender.SpecialTitle ||
+            !Info.Sender.Permission ||
+            !Info.Sender.Group.Name ||
+            !Info.Sender.Group.Permission)
+            __leave;
+
+        DispatchToCallback(pMiraiWS, MWS_GROUPMSG, &Info);
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if (Info.Sender.MemberName)       MwsFree(&pMiraiWS->Allocator, Info.Sender.MemberName);
+        if (Info.Sender.SpecialTitle)     MwsFree(&pMiraiWS->Allocator, Info.Sender.SpecialTitle);
+        ReleaseMessageChain(&pMiraiWS->Allocator, FALSE, &Info.MessageChain);
+    }
+    return bSuccess;
+}
+
+// Decoders of the other events: nothing is copied, the infos borrow strings and chains from the document
+// of the frame being dispatched. Only what an event can't go without is checked, the rest is 0 or empty when missing.
+
+static BOOL TempMessageUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    MWS_TEMPMSGINFO Info;
+    if (!ViewMember(yyjson_obj_get(DataField, "sender"), &Info.Sender) ||
+        !ViewChain(yyjson_obj_get(DataField, "messageChain"), &Info.MessageChain))
+        return FALSE;
+    if (pMiraiWS->pDirectory)
+        UpdateDirectoryMember(pMiraiWS->pDirectory, &Info.Sender);
+    if (pMiraiWS->pHistory)
+        StoreHistoryMessage(pMiraiWS->pHistory, MWS_CONV_TEMP, Info.Sender.ID, Info.Sender.Group.ID, Info.Sender.ID, (yyjson_val*)Info.MessageChain.Node);
+
+    DispatchToCallback(pMiraiWS, MWS_TEMPMSG, &Info);
+    return TRUE;
+}
+
+static BOOL StrangerMessageUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    MWS_STRANGERMSGINFO Info;
+    if (!ViewFriend(yyjson_obj_get(DataField, "sender"), &Info.Sender) ||
+        !ViewChain(yyjson_obj_get(DataField, "messageChain"), &Info.MessageChain))
+        return FALSE;
+    if (pMiraiWS->pHistory)
+        StoreHistoryMessage(pMiraiWS->pHistory, MWS_CONV_FRIEND, Info.Sender.ID, 0, Info.Sender.ID, (yyjson_val*)Info.MessageChain.Node);
+
+    DispatchToCallback(pMiraiWS, MWS_STRANGERMSG, &Info);
+    return TRUE;
+}
+
+static BOOL OtherClientMessageUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    MWS_OTHERCLIENTMSGINFO Info;
+    if (!ViewClient(yyjson_obj_get(DataField, "sender"), &Info.Sender) ||
+        !ViewChain(yyjson_obj_get(DataField, "messageChain"), &Info.MessageChain))
+        return FALSE;
+
+    DispatchToCallback(pMiraiWS, MWS_OTHERCLIENTMSG, &Info);
+    return TRUE;
+}
+
+static BOOL UnpackFriendSyncMessage(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField, _In_ UINT EventType)
+{
+    MWS_FRIENDSYNCMSGINFO Info;
+    if (!ViewFriend(yyjson_obj_get(DataField, "subject"), &Info.Subject) ||
+        !ViewChain(yyjson_obj_get(DataField, "messageChain"), &Info.MessageChain))
+        return FALSE;
+    if (pMiraiWS->pHistory)
+        StoreHistoryMessage(pMiraiWS->pHistory, MWS_CONV_FRIEND, Info.Subject.ID, 0, 0, (yyjson_val*)Info.MessageChain.Node);
+
+    DispatchToCallback(pMiraiWS, EventType, &Info);
+    return TRUE;
+}
+
+static BOOL FriendSyncMessageUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackFriendSyncMessage(pMiraiWS, DataField, MWS_FRIENDSYNCMSG);
+}
+
+static BOOL GroupSyncMessageUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    MWS_GROUPSYNCMSGINFO Info;
+    if (!ViewGroup(yyjson_obj_get(DataField, "subject"), &Info.Subject) ||
+        !ViewChain(yyjson_obj_get(DataField, "messageChain"), &Info.MessageChain))
+        return FALSE;
+    if (pMiraiWS->pHistory)
+        StoreHistoryMessage(pMiraiWS->pHistory, MWS_CONV_GROUP, Info.Subject.ID, Info.Subject.ID, 0, (yyjson_val*)Info.MessageChain.Node);
+
+    DispatchToCallback(pMiraiWS, MWS_GROUPSYNCMSG, &Info);
+    return TRUE;
+}
+
+static BOOL TempSyncMessageUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    MWS_TEMPSYNCMSGINFO Info;
+    if (!ViewMember(yyjson_obj_get(DataField, "subject"), &Info.Subject) ||
+        !ViewChain(yyjson_obj_get(DataField, "messageChain"), &Info.MessageChain))
+        return FALSE;
+    if (pMiraiWS->pHistory)
+        StoreHistoryMessage(pMiraiWS->pHistory, MWS_CONV_TEMP, Info.Subject.ID, Info.Subject.Group.ID, 0, (yyjson_val*)Info.MessageChain.Node);
+
+    DispatchToCallback(pMiraiWS, MWS_TEMPSYNCMSG, &Info);
+    return TRUE;
+}
+
+static BOOL StrangerSyncMessageUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackFriendSyncMessage(pMiraiWS, DataField, MWS_STRANGERSYNCMSG);
+}
+
+static BOOL UnpackBotEvent(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField, _In_ UINT EventType)
+{
+    yyjson_val* QQField = yyjson_obj_get(DataField, "qq");
+    if (!yyjson_is_int(QQField))
+        return FALSE;
+
+    MWS_BOTINFO Info = { yyjson_get_sint(QQField) };
+    DispatchToCallback(pMiraiWS, EventType, &Info);
+    return TRUE;
+}
+
+static BOOL BotOnlineEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackBotEvent(pMiraiWS, DataField, MWS_BOTONLINE);
+}
+
+static BOOL BotOfflineEventActiveUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackBotEvent(pMiraiWS, DataField, MWS_BOTOFFLINEACTIVE);
+}
+
+static BOOL BotOfflineEventForceUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackBotEvent(pMiraiWS, DataField, MWS_BOTOFFLINEFORCE);
+}
+
+static BOOL BotOfflineEventDroppedUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackBotEvent(pMiraiWS, DataField, MWS_BOTOFFLINEDROPPED);
+}
+
+static BOOL BotReloginEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackBotEvent(pMiraiWS, DataField, MWS_BOTRELOGIN);
+}
+
+static BOOL FriendInputStatusChangedEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    MWS_FRIENDINPUTSTATUSINFO Info;
+    Info.bInputting = ViewBool(DataField, "inputting");
+    if (!ViewFriend(yyjson_obj_get(DataField, "friend"), &Info.Friend))
+        return FALSE;
+
+    DispatchToCallback(pMiraiWS, MWS_FRIENDINPUTSTATUSCHANGED, &Info);
+    return TRUE;
+}
+
+static BOOL FriendNickChangedEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    MWS_FRIENDNICKINFO Info;
+    Info.From = ViewStr(DataField, "from");
+    Info.To = ViewStr(DataField, "to");
+    if (!ViewFriend(yyjson_obj_get(DataField, "friend"), &Info.Friend))
+        return FALSE;
+
+    DispatchToCallback(pMiraiWS, MWS_FRIENDNICKCHANGED, &Info);
+    return TRUE;
+}
+
+static BOOL BotGroupPermissionChangeEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    MWS_BOTGROUPPERMISSIONINFO Info;
+    Info.Origin = ViewStr(DataField, "origin");
+    Info.Current = ViewStr(DataField, "current");
+    if (!ViewGroup(yyjson_obj_get(DataField, "group"), &Info.Group))
+        return FALSE;
+
+    DispatchToCallback(pMiraiWS, MWS_BOTGROUPPERMISSIONCHANGE, &Info);
+    return TRUE;
+}
+
+static BOOL UnpackBotMuteEvent(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField, _In_ UINT EventType)
+{
+    MWS_BOTMUTEINFO Info;
+    Info.DurationSeconds = ViewInt(DataField, "durationSeconds");
+    if (!ViewMember(yyjson_obj_get(DataField, "operator"), &Info.Operator))
+        return FALSE;
+
+    DispatchToCallback(pMiraiWS, EventType, &Info);
+    return TRUE;
+}
+
+static BOOL BotMuteEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackBotMuteEvent(pMiraiWS, DataField, MWS_BOTMUTE);
+}
+
+static BOOL BotUnmuteEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackBotMuteEvent(pMiraiWS, DataField, MWS_BOTUNMUTE);
+}
+
+static BOOL UnpackBotGroupEvent(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField, _In_ UINT EventType, _In_z_ LPCSTR lpOperatorKey)
+{
+    MWS_BOTGROUPINFO Info;
+    if (!ViewGroup(yyjson_obj_get(DataField, "group"), &Info.Group) ||
+        !ViewOptionalMember(yyjson_obj_get(DataField, lpOperatorKey), &Info.Operator))
+        return FALSE;
+    if (pMiraiWS->pDirectory && EventType != MWS_BOTJOINGROUP)
+        RemoveDirectoryGroup(pMiraiWS->pDirectory, Info.Group.ID);
+
+    DispatchToCallback(pMiraiWS, EventType, &Info);
+    return TRUE;
+}
+
+static BOOL BotJoinGroupEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackBotGroupEvent(pMiraiWS, DataField, MWS_BOTJOINGROUP, "invitor");
+}
+
+static BOOL BotLeaveEventActiveUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackBotGroupEvent(pMiraiWS, DataField, MWS_BOTLEAVEACTIVE, "operator");
+}
+
+static BOOL BotLeaveEventKickUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackBotGroupEvent(pMiraiWS, DataField, MWS_BOTLEAVEKICK, "operator");
+}
+
+static BOOL BotLeaveEventDisbandUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackBotGroupEvent(pMiraiWS, DataField, MWS_BOTLEAVEDISBAND, "operator");
+}
+
+static BOOL GroupRecallEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    MWS_GROUPRECALLINFO Info;
+    Info.AuthorID = ViewInt(DataField, "authorId");
+    Info.MessageID = ViewInt(DataField, "messageId");
+    Info.Time = ViewInt(DataField, "time");
+    if (!ViewGroup(yyjson_obj_get(DataField, "group"), &Info.Group) ||
+        !ViewOptionalMember(yyjson_obj_get(DataField, "operator"), &Info.Operator))
+        return FALSE;
+
+    DispatchToCallback(pMiraiWS, MWS_GROUPRECALL, &Info);
+    return TRUE;
+}
+
+static BOOL FriendRecallEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    yyjson_val* MessageIDField = yyjson_obj_get(DataField, "messageId");
+    if (!yyjson_is_int(MessageIDField))
+        return FALSE;
+
+    MWS_FRIENDRECALLINFO Info;
+    Info.AuthorID = ViewInt(DataField, "authorId");
+    Info.MessageID = yyjson_get_sint(MessageIDField);
+    Info.Time = ViewInt(DataField, "time");
+    Info.Operator = ViewInt(DataField, "operator");
+
+    DispatchToCallback(pMiraiWS, MWS_FRIENDRECALL, &Info);
+    return TRUE;
+}
+
+static BOOL NudgeEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    yyjson_val* SubjectField = yyjson_obj_get(DataField, "subject");
+    if (!yyjson_is_obj(SubjectField))
+        return FALSE;
+
+    MWS_NUDGEINFO Info;
+    Info.FromID = ViewInt(DataField, "fromId");
+    Info.Subject.ID = ViewInt(SubjectField, "id");
+    Info.Subject.Kind = ViewStr(SubjectField, "kind");
+    Info.Action = ViewStr(DataField, "action");
+    Info.Suffix = ViewStr(DataField, "suffix");
+    Info.Target = ViewInt(DataField, "target");
+
+    DispatchToCallback(pMiraiWS, MWS_NUDGE, &Info);
+    return TRUE;
+}
+
+static BOOL UnpackGroupChangeEvent(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField, _In_ UINT EventType)
+{
+    MWS_GROUPCHANGEINFO Info;
+    Info.Origin = ViewStr(DataField, "origin");
+    Info.Current = ViewStr(DataField, "current");
+    if (!ViewGroup(yyjson_obj_get(DataField, "group"), &Info.Group) ||
+        !ViewOptionalMember(yyjson_obj_get(DataField, "operator"), &Info.Operator))
+        return FALSE;
+    if (pMiraiWS->pDirectory && EventType == MWS_GROUPNAMECHANGE)
+    {
+        MWS_GROUPVIEW Group = Info.Group;
+        Group.Name = Info.Current;
+        UpdateDirectoryGroup(pMiraiWS->pDirectory, &Group);
+    }
+
+    DispatchToCallback(pMiraiWS, EventType, &Info);
+    return TRUE;
+}
+
+static BOOL GroupNameChangeEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackGroupChangeEvent(pMiraiWS, DataField, MWS_GROUPNAMECHANGE);
+}
+
+static BOOL GroupEntranceAnnouncementChangeEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackGroupChangeEvent(pMiraiWS, DataField, MWS_GROUPENTRANCEANNOUNCEMENTCHANGE);
+}
+
+static BOOL UnpackGroupSwitchEvent(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField, _In_ UINT EventType)
+{
+    MWS_GROUPSWITCHINFO Info;
+    Info.bOrigin = ViewBool(DataField, "origin");
+    Info.bCurrent = ViewBool(DataField, "current");
+    if (!ViewGroup(yyjson_obj_get(DataField, "group"), &Info.Group) ||
+        !ViewOptionalMember(yyjson_obj_get(DataField, "operator"), &Info.Operator))
+        return FALSE;
+
+    // AllowConfessTalk only tells whether the bot did it, the others leave the operator out then.
+    yyjson_val* ByBotField = yyjson_obj_get(DataField, "isByBot");
+    Info.bByBot = ByBotField ? yyjson_get_bool(ByBotField) : Info.Operator.ID == 0;
+
+    DispatchToCallback(pMiraiWS, EventType, &Info);
+    return TRUE;
+}
+
+static BOOL GroupMuteAllEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackGroupSwitchEvent(pMiraiWS, DataField, MWS_GROUPMUTEALL);
+}
+
+static BOOL GroupAllowAnonymousChatEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackGroupSwitchEvent(pMiraiWS, DataField, MWS_GROUPALLOWANONYMOUSCHAT);
+}
+
+static BOOL GroupAllowConfessTalkEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackGroupSwitchEvent(pMiraiWS, DataField, MWS_GROUPALLOWCONFESSTALK);
+}
+
+static BOOL GroupAllowMemberInviteEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackGroupSwitchEvent(pMiraiWS, DataField, MWS_GROUPALLOWMEMBERINVITE);
+}
+
+static BOOL UnpackMemberEvent(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField, _In_ UINT EventType, _In_z_ LPCSTR lpOperatorKey)
+{
+    MWS_MEMBERINFO Info;
+    Info.DurationSeconds = ViewInt(DataField, "durationSeconds");
+    if (!ViewMember(yyjson_obj_get(DataField, "member"), &Info.Member) ||
+        !ViewOptionalMember(yyjson_obj_get(DataField, lpOperatorKey), &Info.Operator))
+        return FALSE;
+    if (pMiraiWS->pDirectory)
+    {
+        if (EventType == MWS_MEMBERLEAVEKICK || EventType == MWS_MEMBERLEAVEQUIT)
+            RemoveDirectoryMember(pMiraiWS->pDirectory, Info.Member.Group.ID, Info.Member.ID);
+        else
+            UpdateDirectoryMember(pMiraiWS->pDirectory, &Info.Member);
+    }
+
+    DispatchToCallback(pMiraiWS, EventType, &Info);
+    return TRUE;
+}
+
+static BOOL MemberJoinEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackMemberEvent(pMiraiWS, DataField, MWS_MEMBERJOIN, "invitor");
+}
+
+static BOOL MemberLeaveEventKickUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackMemberEvent(pMiraiWS, DataField, MWS_MEMBERLEAVEKICK, "operator");
+}
+
+static BOOL MemberLeaveEventQuitUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackMemberEvent(pMiraiWS, DataField, MWS_MEMBERLEAVEQUIT, "operator");
+}
+
+static BOOL UnpackMemberChangeEvent(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField, _In_ UINT EventType)
+{
+    MWS_MEMBERCHANGEINFO Info;
+    Info.Origin = ViewStr(DataField, "origin");
+    Info.Current = ViewStr(DataField, "current");
+    if (!ViewMember(yyjson_obj_get(DataField, "member"), &Info.Member))
+        return FALSE;
+    if (pMiraiWS->pDirectory)
+    {
+        // the member object may still show what it was before the change.
+        MWS_MEMBERVIEW Member = Info.Member;
+        if (EventType == MWS_MEMBERCARDCHANGE)
+            Member.MemberName = Info.Current;
+        else if (EventType == MWS_MEMBERSPECIALTITLECHANGE)
+            Member.SpecialTitle = Info.Current;
+        else
+            Member.PermissionLevel = ParsePermission(Info.Current.Ptr, Info.Current.Len);
+        UpdateDirectoryMember(pMiraiWS->pDirectory, &Member);
+    }
+
+    DispatchToCallback(pMiraiWS, EventType, &Info);
+    return TRUE;
+}
+
+static BOOL MemberCardChangeEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackMemberChangeEvent(pMiraiWS, DataField, MWS_MEMBERCARDCHANGE);
+}
+
+static BOOL MemberSpecialTitleChangeEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackMemberChangeEvent(pMiraiWS, DataField, MWS_MEMBERSPECIALTITLECHANGE);
+}
+
+static BOOL MemberPermissionChangeEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackMemberChangeEvent(pMiraiWS, DataField, MWS_MEMBERPERMISSIONCHANGE);
+}
+
+static BOOL MemberMuteEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackMemberEvent(pMiraiWS, DataField, MWS_MEMBERMUTE, "operator");
+}
+
+static BOOL MemberUnmuteEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackMemberEvent(pMiraiWS, DataField, MWS_MEMBERUNMUTE, "operator");
+}
+
+static BOOL MemberHonorChangeEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    MWS_MEMBERHONORINFO Info;
+    Info.Action = ViewStr(DataField, "action");
+    Info.Honor = ViewStr(DataField, "honor");
+    if (!ViewMember(yyjson_obj_get(DataField, "member"), &Info.Member))
+        return FALSE;
+
+    DispatchToCallback(pMiraiWS, MWS_MEMBERHONORCHANGE, &Info);
+    return TRUE;
+}
+
+static BOOL UnpackRequestEvent(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField, _In_ UINT EventType)
+{
+    yyjson_val* EventIDField = yyjson_obj_get(DataField, "eventId");
+    if (!yyjson_is_int(EventIDField))
+        return FALSE;
+
+    MWS_REQUESTINFO Info;
+    Info.EventID = yyjson_get_sint(EventIDField);
+    Info.FromID = ViewInt(DataField, "fromId");
+    Info.GroupID = ViewInt(DataField, "groupId");
+    Info.GroupName = ViewStr(DataField, "groupName");
+    Info.Nick = ViewStr(DataField, "nick");
+    Info.Message = ViewStr(DataField, "message");
+    Info.InvitorID = ViewInt(DataField, "invitorId");
+
+    DispatchToCallback(pMiraiWS, EventType, &Info);
+    return TRUE;
+}
+
+static BOOL NewFriendRequestEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackRequestEvent(pMiraiWS, DataField, MWS_NEWFRIENDREQUEST);
+}
+
+static BOOL MemberJoinRequestEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackRequestEvent(pMiraiWS, DataField, MWS_MEMBERJOINREQUEST);
+}
+
+static BOOL BotInvitedJoinGroupRequestEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackRequestEvent(pMiraiWS, DataField, MWS_BOTINVITEDJOINGROUPREQUEST);
+}
+
+static BOOL UnpackOtherClientEvent(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField, _In_ UINT EventType)
+{
+    MWS_OTHERCLIENTINFO Info;
+    Info.Kind = ViewInt(DataField, "kind");
+    if (!ViewClient(yyjson_obj_get(DataField, "client"), &Info.Client))
+        return FALSE;
+
+    DispatchToCallback(pMiraiWS, EventType, &Info);
+    return TRUE;
+}
+
+static BOOL OtherClientOnlineEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackOtherClientEvent(pMiraiWS, DataField, MWS_OTHERCLIENTONLINE);
+}
+
+static BOOL OtherClientOfflineEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    return UnpackOtherClientEvent(pMiraiWS, DataField, MWS_OTHERCLIENTOFFLINE);
+}
+
+static BOOL CommandExecutedEventUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    yyjson_val* FriendField = yyjson_obj_get(DataField, "friend");
+    yyjson_val* ArgsField = yyjson_obj_get(DataField, "args");
+
+    MWS_COMMANDEXECUTEDINFO Info;
+    Info.Name = ViewStr(DataField, "name");
+    // friend and member are both null when the console ran it, args is a chain without Source.
+    if ((!ViewFriend(FriendField, &Info.Friend) && !IsMissing(FriendField)) ||
+        !ViewOptionalMember(yyjson_obj_get(DataField, "member"), &Info.Member) ||
+        (!ViewChain(ArgsField, &Info.Args) && !IsMissing(ArgsField)))
+        return FALSE;
+
+    DispatchToCallback(pMiraiWS, MWS_COMMANDEXECUTED, &Info);
+    return TRUE;
+}
+
+static void CallBadMsgCallback(_In_ PMIRAI_WS pMiraiWS)
+{
+    if (pMiraiWS->pMetrics)
+        MetricsAdd(pMiraiWS->pMetrics, MWS_CTR_BADMSG, 1);
+
+    PMWS_FRAME pFrame = pMiraiWS->pPipeline->pDispatchFrame;
+    if (!pFrame)
+        return;
+
+    int cchLen;
+    LPWSTR wMessage = StrUtf8ToWide(&pMiraiWS->Allocator, pFrame->Data, (int)pFrame->Length, &cchLen);
+    if (!wMessage)
+        return;
+
+    MWS_BADMSGINFO Info = { wMessage, cchLen };
+    DispatchToCallback(pMiraiWS, MWS_BADMSG, &Info);
+    MwsFree(&pMiraiWS->Allocator, wMessage);
+}
+
+static void CallAuthCallback(_In_ PMIRAI_WS pMiraiWS, _In_ INT64 ResponseCode, _In_opt_z_ LPCSTR lpSession, _In_opt_z_ LPCSTR lpMessage)
+{
+    LPWSTR wSession = lpSession ? StrUtf8ToWide(&pMiraiWS->Allocator, lpSession, -1, NULL) : NULL;
+    LPWSTR wMessage = lpMessage ? StrUtf8ToWide(&pMiraiWS->Allocator, lpMessage, -1, NULL) : NULL;
+    MWS_AUTHINFO Info = { ResponseCode, wSession, wMessage };
+    
+    DispatchToCallback(pMiraiWS, MWS_AUTH, &Info);
+
+    if (wSession) MwsFree(&pMiraiWS->Allocator, wSession);
+    if (wMessage) MwsFree(&pMiraiWS->Allocator, wMessage);
+}
+
+BOOL EventsUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField)
+{
+    yyjson_val* TypeField = yyjson_obj_get(DataField, "type");
+    if (!TypeField || !yyjson_is_str(TypeField))
+    {
+        CallBadMsgCallback(pMiraiWS);
+        return FALSE;
+    }
+
+    // TODO: Use something to optimize this, perhaps trie tree?
+    // same order as MWSBIN_EVENT_TYPE, TypeList[i] is event type i + 1.
+    LPCSTR TypeList[] = {
+        "FriendMessage",
+        "GroupMessage",
+        "TempMessage",
+        "StrangerMessage",
+        "OtherClientMessage",
+        "FriendSyncMessage",
+        "GroupSyncMessage",
+        "TempSyncMessage",
+        "StrangerSyncMessage",
+
+        "BotOnlineEvent",
+        "BotOfflineEventActive",
+        "BotOfflineEventForce",
+        "BotOfflineEventDropped",
+        "BotReloginEvent",
+        "FriendInputStatusChangedEvent",
+        "FriendNickChangedEvent",
+        "BotGroupPermissionChangeEvent",
+        "BotMuteEvent",
+        "BotUnmuteEvent",
+        "BotJoinGroupEvent",
+        "BotLeaveEventActive",
+        "BotLeaveEventKick",
+        "BotLeaveEventDisband",
+        "GroupRecallEvent",
+        "FriendRecallEvent",
+        "NudgeEvent",
+        "GroupNameChangeEvent",
+        "GroupEntranceAnnouncementChangeEvent",
+        "GroupMuteAllEvent",
+        "GroupAllowAnonymousChatEvent",
+        "GroupAllowConfessTalkEvent",
+        "GroupAllowMemberInviteEvent",
+        "MemberJoinEvent",
+        "MemberLeaveEventKick",
+        "MemberLeaveEventQuit",
+        "MemberCardChangeEvent",
+        "MemberSpecialTitleChangeEvent",
+        "MemberPermissionChangeEvent",
+        "MemberMuteEvent",
+        "MemberUnmuteEvent",
+        "MemberHonorChangeEvent",
+        "NewFriendRequestEvent",
+        "MemberJoinRequestEvent",
+        "BotInvitedJoinGroupRequestEvent",
+        "OtherClientOnlineEvent",
+        "OtherClientOfflineEvent",
+        "CommandExecutedEvent"
+    };
+    EVENTHANDLER EventPackerList[] =  {
+        FriendMessageUnpacker,
+        GroupMessageUnpacker,
+        TempMessageUnpacker,
+        StrangerMessageUnpacker,
+        OtherClientMessageUnpacker,
+        FriendSyncMessageUnpacker,
+        GroupSyncMessageUnpacker,
+        TempSyncMessageUnpacker,
+        StrangerSyncMessageUnpacker,
+
+        BotOnlineEventUnpacker,
+        BotOfflineEventActiveUnpacker,
+        BotOfflineEventForceUnpacker,
+        BotOfflineEventDroppedUnpacker,
+        BotReloginEventUnpacker,
+        FriendInputStatusChangedEventUnpacker,
+        FriendNickChangedEventUnpacker,
+        BotGroupPermissionChangeEventUnpacker,
+        BotMuteEventUnpacker,
+        BotUnmuteEventUnpacker,
+        BotJoinGroupEventUnpacker,
+        BotLeaveEventActiveUnpacker,
+        BotLeaveEventKickUnpacker,
+        BotLeaveEventDisbandUnpacker,
+        GroupRecallEventUnpacker,
+        FriendRecallEventUnpacker,
+        NudgeEventUnpacker,
+        GroupNameChangeEventUnpacker,
+        GroupEntranceAnnouncementChangeEventUnpacker,
+        GroupMuteAllEventUnpacker,
+        GroupAllowAnonymousChatEventUnpacker,
+        GroupAllowConfessTalkEventUnpacker,
+        GroupAllowMemberInviteEventUnpacker,
+        MemberJoinEventUnpacker,
+        MemberLeaveEventKickUnpacker,
+        MemberLeaveEventQuitUnpacker,
+        MemberCardChangeEventUnpacker,
+        MemberSpecialTitleChangeEventUnpacker,
+        MemberPermissionChangeEventUnpacker,
+        MemberMuteEventUnpacker,
+        MemberUnmuteEventUnpacker,
+        MemberHonorChangeEventUnpacker,
+        NewFriendRequestEventUnpacker,
+        MemberJoinRequestEventUnpacker,
+        BotInvitedJoinGroupRequestEventUnpacker,
+        OtherClientOnlineEventUnpacker,
+        OtherClientOfflineEventUnpacker,
+        CommandExecutedEventUnpacker
+    };
+
+    const LPCSTR szType = unsafe_yyjson_get_str(TypeField);
+    for (SIZE_T i = 0; i < _countof(TypeList); i++)
+    {
+        if (strcmp(szType, TypeList[i]) == 0)
+        {
+            if (pMiraiWS->pMetrics)
+                MetricsAdd(pMiraiWS->pMetrics, MWS_CTR_EVENTS + (MWS_COUNTER)(i + 1), 1);
+
+            LONGLONG TraceStart = MWS_TRACING() ? ReadPerfClock() : 0;
+            BOOL bUnpacked = EventPackerList[i](pMiraiWS, DataField);
+            if (TraceStart)
+                TraceSpan(MWS_SPAN_EVENT, pMiraiWS, TraceStart, 0, (MWSBIN_EVENT_TYPE)(i + 1));
+
+            if (!bUnpacked)
+            {
+                CallBadMsgCallback(pMiraiWS);
+                return FALSE;
+            }
+
+            return TRUE;
+        }
+    }
+    if (pMiraiWS->pMetrics)
+        MetricsAdd(pMiraiWS->pMetrics, MWS_CTR_EVENTS + MWSBIN_EV_UNKNOWN, 1);
+    return TRUE;
+}
+
+// Every command of mirai-api-http and what its response decodes to. Commands not listed are still sent, as "other".
+static const MWS_COMMAND CommandTable[] = {
+    { "about", NULL, MWS_RESULT_ABOUT },
+    { "botList", NULL, MWS_RESULT_DATA },
+    { "messageFromId", NULL, MWS_RESULT_DATA },
+    { "friendList", NULL, MWS_RESULT_FRIENDLIST },
+    { "groupList", NULL, MWS_RESULT_GROUPLIST },
+    { "memberList", NULL, MWS_RESULT_MEMBERLIST },
+    { "latestMemberList", NULL, MWS_RESULT_MEMBERLIST },
+    { "botProfile", NULL, MWS_RESULT_PROFILE },
+    { "friendProfile", NULL, MWS_RESULT_PROFILE },
+    { "memberProfile", NULL, MWS_RESULT_PROFILE },
+    { "userProfile", NULL, MWS_RESULT_PROFILE },
+    { "sendFriendMessage", NULL, MWS_RESULT_MESSAGEID },
+    { "sendGroupMessage", NULL, MWS_RESULT_MESSAGEID },
+    { "sendTempMessage", NULL, MWS_RESULT_MESSAGEID },
+    { "sendOtherClientMessage", NULL, MWS_RESULT_MESSAGEID },
+    { "sendImageMessage", NULL, MWS_RESULT_DATA },
+    { "sendNudge", NULL, MWS_RESULT_STATUS },
+    { "recall", NULL, MWS_RESULT_STATUS },
+    { "roamingMessages", NULL, MWS_RESULT_DATA },
+    { "file_list", NULL, MWS_RESULT_DATA },
+    { "file_info", NULL, MWS_RESULT_DATA },
+    { "file_mkdir", NULL, MWS_RESULT_DATA },
+    { "file_delete", NULL, MWS_RESULT_STATUS },
+    { "file_move", NULL, MWS_RESULT_STATUS },
+    { "file_rename", NULL, MWS_RESULT_STATUS },
+    { "deleteFriend", NULL, MWS_RESULT_STATUS },
+    { "mute", NULL, MWS_RESULT_STATUS },
+    { "unmute", NULL, MWS_RESULT_STATUS },
+    { "kick", NULL, MWS_RESULT_STATUS },
+    { "quit", NULL, MWS_RESULT_STATUS },
+    { "muteAll", NULL, MWS_RESULT_STATUS },
+    { "unmuteAll", NULL, MWS_RESULT_STATUS },
+    { "setEssence", NULL, MWS_RESULT_STATUS },
+    { "groupConfig", "get", MWS_RESULT_GROUPCONFIG },
+    { "groupConfig", "update", MWS_RESULT_STATUS },
+    { "memberInfo", "get", MWS_RESULT_MEMBER },
+    { "memberInfo", "update", MWS_RESULT_STATUS },
+    { "memberAdmin", NULL, MWS_RESULT_STATUS },
+    { "anno_list", NULL, MWS_RESULT_DATA },
+    { "anno_publish", NULL, MWS_RESULT_DATA },
+    { "anno_delete", NULL, MWS_RESULT_STATUS },
+    { "resp_newFriendRequestEvent", NULL, MWS_RESULT_STATUS },
+    { "resp_memberJoinRequestEvent", NULL, MWS_RESULT_STATUS },
+    { "resp_botInvitedJoinGroupRequestEvent", NULL, MWS_RESULT_STATUS },
+    { "cmd_execute", NULL, MWS_RESULT_STATUS },
+    { "cmd_register", NULL, MWS_RESULT_STATUS },
+    { "other", NULL, MWS_RESULT_DATA } // must be last
+};
+
+const MWS_COMMAND* FindMiraiWSCommand(_In_z_ LPCSTR lpCommand, _In_opt_z_ LPCSTR lpSubCommand)
+{
+    for (int i = 0; i < _countof(CommandTable) - 1; i++)
+    {
+        const MWS_COMMAND* pCommand = CommandTable + i;
+        if (strcmp(pCommand->Command, lpCommand) == 0 &&
+            (pCommand->SubCommand ? lpSubCommand && strcmp(pCommand->SubCommand, lpSubCommand) == 0 : !lpSubCommand))
+            return pCommand;
+    }
+    return CommandTable + _countof(CommandTable) - 1;
+}
+
+// Decoders of command responses, by MWS_RESULT_KIND. They only run for responses with code 0.
+typedef BOOL(*RESULT_DECODER)(_In_ yyjson_val* Response, _Inout_ MWS_COMMAND_RESULT* pResult);
+
+static BOOL DecodeStatusResult(_In_ yyjson_val* Response, _Inout_ MWS_COMMAND_RESULT* pResult)
+{
+    return yyjson_is_int(yyjson_obj_get(Response, "code"));
+}
+
+static BOOL DecodeMessageIDResult(_In_ yyjson_val* Response, _Inout_ MWS_COMMAND_RESULT* pResult)
+{
+    // a success without messageId has been seen, the message was still sent. MessageID stays 0.
+    pResult->MessageID = yyjson_get_sint(yyjson_obj_get(Response, "messageId"));
+    return TRUE;
+}
+
+static BOOL DecodeListResult(_In_ yyjson_val* Response, _Inout_ MWS_COMMAND_RESULT* pResult)
+{
+    yyjson_val* DataField = yyjson_obj_get(Response, "data");
+    pResult->List.Count = pResult->List.Left = yyjson_arr_size(DataField);
+    pResult->List.Next = yyjson_arr_get_first(DataField);
+    return yyjson_is_arr(DataField);
+}
+
+static BOOL DecodeProfileResult(_In_ yyjson_val* Response, _Inout_ MWS_COMMAND_RESULT* pResult)
+{
+    pResult->Profile.Nickname = ViewStr(Response, "nickname");
+    pResult->Profile.Email = ViewStr(Response, "email");
+    pResult->Profile.Age = ViewInt(Response, "age");
+    pResult->Profile.Level = ViewInt(Response, "level");
+    pResult->Profile.Sign = ViewStr(Response, "sign");
+    pResult->Profile.Sex = ViewStr(Response, "sex");
+    return yyjson_is_obj(Response);
+}
+
+static BOOL DecodeMemberResult(_In_ yyjson_val* Response, _Inout_ MWS_COMMAND_RESULT* pResult)
+{
+    // memberInfo get answers with the member itself, the group may be left out.
+    ViewMember(Response, &pResult->Member);
+    return yyjson_is_int(yyjson_obj_get(Response, "id"));
+}
+
+static BOOL DecodeGroupConfigResult(_In_ yyjson_val* Response, _Inout_ MWS_COMMAND_RESULT* pResult)
+{
+    pResult->GroupConfig.Name = ViewStr(Response, "name");
+    pResult->GroupConfig.Announcement = ViewStr(Response, "announcement");
+    pResult->GroupConfig.bConfessTalk = ViewBool(Response, "confessTalk");
+    pResult->GroupConfig.bAllowMemberInvite = ViewBool(Response, "allowMemberInvite");
+    pResult->GroupConfig.bAutoApprove = ViewBool(Response, "autoApprove");
+    pResult->GroupConfig.bAnonymousChat = ViewBool(Response, "anonymousChat");
+    return yyjson_is_obj(Response);
+}
+
+static BOOL DecodeAboutResult(_In_ yyjson_val* Response, _Inout_ MWS_COMMAND_RESULT* pResult)
+{
+    pResult->Version = ViewStr(yyjson_obj_get(Response, "data"), "version");
+    return TRUE;
+}
+
+static BOOL DecodeDataResult(_In_ yyjson_val* Response, _Inout_ MWS_COMMAND_RESULT* pResult)
+{
+    pResult->Data = yyjson_obj_get(Response, "data");
+    return TRUE;
+}
+
+static const RESULT_DECODER ResultDecoders[] = {
+    [MWS_RESULT_STATUS] = DecodeStatusResult,
+    [MWS_RESULT_MESSAGEID] = DecodeMessageIDResult,
+    [MWS_RESULT_FRIENDLIST] = DecodeListResult,
+    [MWS_RESULT_GROUPLIST] = DecodeListResult,
+    [MWS_RESULT_MEMBERLIST] = DecodeListResult,
+    [MWS_RESULT_PROFILE] = DecodeProfileResult,
+    [MWS_RESULT_MEMBER] = DecodeMemberResult,
+    [MWS_RESULT_GROUPCONFIG] = DecodeGroupConfigResult,
+    [MWS_RESULT_ABOUT] = DecodeAboutResult,
+    [MWS_RESULT_DATA] = DecodeDataResult
+};
+C_ASSERT(_countof(ResultDecoders) == MWS_RESULT_DATA + 1);
+
+static BOOL DecodeCommandResult(_In_ const ASYNC_CALL_TIMING* pTiming, _In_ INT64 SyncID, _In_opt_ yyjson_val* Response, _Out_ MWS_COMMAND_RESULT* pResult)
+{
+    const MWS_COMMAND* pCommand = pTiming->pCommand;
+    ZeroMemory(pResult, sizeof(MWS_COMMAND_RESULT));
+    pResult->Command = pTiming->lpCommandName ? pTiming->lpCommandName : pCommand->Command;
+    pResult->SubCommand = pTiming->lpCommandName ? pTiming->lpSubCommandName : pCommand->SubCommand;
+    pResult->SyncID = SyncID;
+    if (!Response)
+    {
+        pResult->Code = MWS_CODE_DISCARDED;
+        pResult->Msg = EmptyString;
+        pResult->Kind = pCommand->Kind;
+        return TRUE;
+    }
+    pResult->Code = ViewInt(Response, "code"); // responses that are the data itself have none
+    pResult->Msg = ViewStr(Response, "msg");
+    pResult->Kind = pCommand->Kind;
+    pResult->Node = Response;
+
+    if (pResult->Code != 0)
+        return TRUE;
+    return ResultDecoders[pCommand->Kind](Response, pResult);
+}
+
+static yyjson_val* TakeListItem(_Inout_ MWS_LISTVIEW* pList)
+{
+    if (!pList->Left)
+        return NULL;
+
+    yyjson_val* Item = (yyjson_val*)pList->Next;
+    pList->Left--;
+    pList->Next = pList->Left ? unsafe_yyjson_get_next(Item) : NULL;
+    return Item;
+}
+
+BOOL NextMiraiWSFriend(_Inout_ MWS_LISTVIEW* pList, _Out_ MWS_FRIENDVIEW* pFriend)
+{
+    return ViewFriend(TakeListItem(pList), pFriend);
+}
+
+BOOL NextMiraiWSGroup(_Inout_ MWS_LISTVIEW* pList, _Out_ MWS_GROUPVIEW* pGroup)
+{
+    return ViewGroup(TakeListItem(pList), pGroup);
+}
+
+BOOL NextMiraiWSMember(_Inout_ MWS_LISTVIEW* pList, _Out_ MWS_MEMBERVIEW* pMember)
+{
+    return ViewMember(TakeListItem(pList), pMember);
+}
+
+/// <summary>
+/// Complete an async call with its response, or pass it one batch of a response too large for a frame.
+/// </summary>
+/// <param name="DataField">the response, NULL if it was discarded and the call ends with MWS_CODE_DISCARDED</param>
+/// <param name="bPartial">DataField is a batch and more follow, see StreamListResponse</param>
+static BOOL CallbacksUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ INT64 ID, _In_opt_ yyjson_val* DataField, _In_ BOOL bPartial)
+{
+    ASYNC_CALL_TYPE Type = 0;
+    LPVOID Callback;
+    LPVOID Context;
+    ASYNC_CALL_TIMING Timing;
+
+    // unknown or expired, HandleJsonMessage reports it.
+    if (!FindAsyncCallID(ID, !bPartial, &Type, &Callback, &Context, &Timing))
+        return FALSE;
+
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        if (pMiraiWS->pMetrics && !bPartial)
+        {
+            LONGLONG Now = ReadPerfClock();
+            MetricsAdd(pMiraiWS->pMetrics, MWS_CTR_REQUESTS_COMPLETED, 1);
+            MetricsRecord(pMiraiWS->pMetrics, MWS_LAT_SEND_RTT, Now - Timing.AllocTime);
+            MetricsRecordCommand(pMiraiWS->pMetrics, Timing.pCommand->Command, Timing.AllocTime, Timing.WrittenTime, Now);
+        }
+
+        MWS_COMMAND_RESULT Result;
+        if (!DecodeCommandResult(&Timing, ID, DataField, &Result))
+            __leave;
+        Result.bMore = bPartial;
+        if (pMiraiWS->pDirectory && Result.Kind == MWS_RESULT_MEMBERLIST && Result.Code == 0)
+        {
+            MWS_LISTVIEW List = Result.List;
+            MWS_MEMBERVIEW Member;
+            while (List.Left)
+            {
+                if (NextMiraiWSMember(&List, &Member))
+                    UpdateDirectoryMember(pMiraiWS->pDirectory, &Member);
+            }
+        }
+        bSuccess = TRUE;
+        if (!Callback)
+            __leave;
+
+        LONGLONG CallbackStart = (pMiraiWS->pMetrics || MWS_TRACING()) ? ReadPerfClock() : 0;
+        if (Type == ASYNC_SENDMSG)
+        {
+            LPWSTR lpMsg = StrUtf8ToWide(&pMiraiWS->Allocator, Result.Msg.Ptr, -1, NULL);
+            ((SEND_MSG_CALLBACK)Callback)(pMiraiWS, Result.Code, lpMsg, Result.MessageID, Context);
+            MwsFree(&pMiraiWS->Allocator, lpMsg);
+        }
+        else
+        {
+            ((MWS_COMMAND_CALLBACK)Callback)(pMiraiWS, &Result, Context);
+        }
+        if (CallbackStart)
+        {
+            if (pMiraiWS->pMetrics)
+                MetricsRecord(pMiraiWS->pMetrics, MWS_LAT_CALLBACK, ReadPerfClock() - CallbackStart);
+            if (MWS_TRACING())
+                TraceSpan(MWS_SPAN_CALLBACK, pMiraiWS, CallbackStart, ID, MWSBIN_EV_UNKNOWN);
+        }
+    }
+    __finally
+    {
+        // the slot handed the name over when it was freed, batches before the last only borrow it.
+        if (!bPartial)
+            MwsFree(&Timing.NameAllocator, Timing.lpCommandName);
+    }
+    return bSuccess;
+}
+
+/// <summary>
+/// Dispatch a parsed frame to unpackers and user callback. JsonDoc is freed before returning.
+/// </summary>
+/// <param name="pMiraiWS">the connection the frame was received on</param>
+/// <param name="JsonDoc">parsed frame, or NULL if the frame failed to parse</param>
+void HandleJsonMessage(_In_ PMIRAI_WS pMiraiWS, _In_opt_ _Frees_ptr_opt_ yyjson_doc* JsonDoc)
+{
+    PMWS_FRAME pFrame = pMiraiWS->pPipeline->pDispatchFrame;
+    if (!JsonDoc)
+    {
+        CallBadMsgCallback(pMiraiWS);
+        // a response too large to receive, see StreamListResponse.
+        if (pFrame && pFrame->SyncID)
+            CallbacksUnpacker(pMiraiWS, pFrame->SyncID, NULL, FALSE);
+        return;
+    }
+    __try
+    {
+        yyjson_val* JsonRoot = yyjson_doc_get_root(JsonDoc);
+        yyjson_val* SyncIDField = yyjson_obj_get(JsonRoot, "syncId");
+        yyjson_val* DataField = yyjson_obj_get(JsonRoot, "data");
+
+        if (!SyncIDField || !DataField)
+        {
+            CallBadMsgCallback(pMiraiWS);
+            __leave;
+        }
+        const char* szSyncID = yyjson_get_str(SyncIDField);
+
+        if (!szSyncID)
+        {
+            CallBadMsgCallback(pMiraiWS);
+            __leave;
+        }
+
+        int FieldLen = strlen(szSyncID);
+        if (FieldLen == 0)
+        {
+            // Seems to be the first message passing session key. check the code.
+            yyjson_val* CodeField = yyjson_obj_get(DataField, "code");
+            yyjson_val* SessionField = yyjson_obj_get(DataField, "session");
+            yyjson_val* MessageField = yyjson_obj_get(DataField, "msg");
+            if (!CodeField || !yyjson_is_int(CodeField))
+            {
+                CallBadMsgCallback(pMiraiWS);
+                __leave;
+            }
+            INT64 ResponseCode = unsafe_yyjson_get_sint(CodeField);
+
+            CallAuthCallback(pMiraiWS, ResponseCode, SessionField ? yyjson_get_str(SessionField) : NULL, MessageField ? yyjson_get_str(MessageField) : NULL);
+        }
+        else
+        {
+            INT64 ID = atoll(szSyncID);
+            if (ID == RESERVED_SYNC_ID)
+            {
+                // events sent by server
+                if (pMiraiWS->pEventRing && !PublishEventToRing(pMiraiWS->pEventRing, DataField) && pMiraiWS->pMetrics)
+                    MetricsAdd(pMiraiWS->pMetrics, MWS_CTR_RING_DROPPED, 1);
+
+                if (!EventsUnpacker(pMiraiWS, DataField))
+                {
+                    CallBadMsgCallback(pMiraiWS);
+                    __leave;
+                }
+            }
+            else
+            {
+                // responding requests sent by client
+                LONGLONG TraceStart = MWS_TRACING() ? ReadPerfClock() : 0;
+                BOOL bUnpacked = CallbacksUnpacker(pMiraiWS, ID, DataField, pFrame && pFrame->bPartial);
+                if (TraceStart)
+                    TraceSpan(MWS_SPAN_EVENT, pMiraiWS, TraceStart, ID, MWSBIN_EV_UNKNOWN);
+
+                if (!bUnpacked)
+                {
+                    CallBadMsgCallback(pMiraiWS);
+                    __leave;
+                }
+            }
+        }
+    }
+    __finally
+    {
+        yyjson_doc_free(JsonDoc);
+        FlushInternOverflow(&pMiraiWS->pPipeline->Interned);
+    }
+}
+
+static void CleanUpMiraiWSAsync(_In_ PMIRAI_WS pMiraiWS)
+{
+    // taken out first, an error and DestroyMiraiWSAsync may both get here. Their holds go at WINHTTP_CALLBACK_STATUS_HANDLE_CLOSING.
+    HINTERNET hRequestHandle = InterlockedExchangePointer(&pMiraiWS->hRequestHandle, NULL);
+    if (hRequestHandle != NULL)
+    {
+        WinHttpCloseHandle(hRequestHandle);
+    }
+
+    HINTERNET hWebSocketHandle = InterlockedExchangePointer(&pMiraiWS->hWebSocketHandle, NULL);
+    if (hWebSocketHandle != NULL)
+    {
+        WinHttpCloseHandle(hWebSocketHandle);
+    }
+
+    HINTERNET hConnectionHandle = InterlockedExchangePointer(&pMiraiWS->hConnectionHandle, NULL);
+    if (hConnectionHandle != NULL)
+    {
+        WinHttpCloseHandle(hConnectionHandle);
+    }
+
+    HINTERNET hSessionHandle = InterlockedExchangePointer(&pMiraiWS->hSessionHandle, NULL);
+    if (hSessionHandle != NULL)
+    {
+        WinHttpCloseHandle(hSessionHandle);
+    }
+}
+
+static BOOL RingPush(_Inout_ MWS_RING* pRing, _In_ PMWS_FRAME pFrame)
+{
+    LONG64 Tail = pRing->Tail;
+    LONG64 Depth = Tail - ReadAcquire64(&pRing->Head);
+    if (Depth >= _countof(pRing->Slots))
+        return FALSE;
+
+    pRing->Slots[Tail & (_countof(pRing->Slots) - 1)] = pFrame;
+    WriteRelease64(&pRing->Tail, Tail + 1);
+
+    if (Depth + 1 > pRing->Peak)
+        pRing->Peak = (LONG)(Depth + 1);
+    return TRUE;
+}
+
+static PMWS_FRAME RingPop(_Inout_ MWS_RING* pRing)
+{
+    LONG64 Head = pRing->Head;
+    if (Head == ReadAcquire64(&pRing->Tail))
+        return NULL;
+
+    PMWS_FRAME pFrame = pRing->Slots[Head & (_countof(pRing->Slots) - 1)];
+    WriteRelease64(&pRing->Head, Head + 1);
+    return pFrame;
+}
+
+static LONG RingDepth(_In_ MWS_RING* pRing)
+{
+    LONG64 Head = ReadAcquire64(&pRing->Head);
+    return (LONG)(ReadAcquire64(&pRing->Tail) - Head);
+}
+
+/// <summary>
+/// Make sure a worker is running for the stage. Called by the producer after pushing.
+/// </summary>
+static void ScheduleStage(_Inout_ MWS_STAGE* pStage)
+{
+    if (!InterlockedExchange(&pStage->bScheduled, TRUE))
+        SubmitThreadpoolWork(pStage->Work);
+}
+
+/// <summary>
+/// Called by the worker of a stage once it drained its ring.
+/// </summary>
+/// <returns>TRUE when more frames arrived and the worker should keep going</returns>
+static BOOL ContinueStage(_Inout_ MWS_STAGE* pStage)
+{
+    InterlockedExchange(&pStage->bScheduled, FALSE);
+
+    // a producer may have pushed after we saw the ring empty but before bScheduled was cleared.
+    if (!RingDepth(&pStage->Ring))
+        return FALSE;
+    return !InterlockedExchange(&pStage->bScheduled, TRUE);
+}
+
+static void PostReceive(_In_ PMIRAI_WS pMiraiWS)
+{
+    PMWS_FRAME pFrame = pMiraiWS->pPipeline->pRecvFrame;
+    if (pFrame->Length >= sizeof(pFrame->Data))
+    {
+        // full frames go to StreamListResponse, there is no room left to receive into.
+        MWS_NWERRORINFO Info = { ERROR_INSUFFICIENT_BUFFER };
+        pMiraiWS->Callback(pMiraiWS, MWS_NWERROR, &Info);
+        CleanUpMiraiWSAsync(pMiraiWS);
+        return;
+    }
+
+    DWORD RecvLen;
+    WINHTTP_WEB_SOCKET_BUFFER_TYPE eBufferType;
+    pMiraiWS->pPipeline->ReadStart = MWS_TRACING() ? ReadPerfClock() : 0;
+    DWORD dwRet = WinHttpWebSocketReceive(
+        pMiraiWS->hWebSocketHandle,
+        pFrame->Data + pFrame->Length,
+        (DWORD)(sizeof(pFrame->Data) - pFrame->Length),
+        &RecvLen,
+        &eBufferType);
+    if (dwRet != NO_ERROR)
+    {
+        MWS_NWERRORINFO Info = { dwRet };
+        pMiraiWS->Callback(pMiraiWS, MWS_NWERROR, &Info);
+        CleanUpMiraiWSAsync(pMiraiWS);
+    }
+}
+
+/// <summary>
+/// Take a free frame, counted in flight until it is recycled.
+/// If every frame is in flight, the read side is parked and the dispatch stage resumes it with ReceiveNextFrame once a frame is recycled.
+/// </summary>
+/// <returns>NULL when parked, closing, or out of memory, which was reported</returns>
+static PMWS_FRAME TakeFrame(_In_ PMIRAI_WS pMiraiWS)
+{
+    PMWS_PIPELINE pPipeline = pMiraiWS->pPipeline;
+    for (;;)
+    {
+        if (pMiraiWS->bClose)
+            return NULL;
+
+        if (InterlockedIncrement(&pPipeline->FramesInFlight) <= MIRAI_WS_PIPELINE_DEPTH)
+            break;
+        InterlockedDecrement(&pPipeline->FramesInFlight);
+
+        InterlockedExchange(&pPipeline->bReadStalled, TRUE);
+        InterlockedIncrement64(&pPipeline->ReadStalls);
+
+        // the dispatch stage may have recycled a frame before it could see bReadStalled.
+        if (ReadAcquire(&pPipeline->FramesInFlight) >= MIRAI_WS_PIPELINE_DEPTH)
+            return NULL;
+        if (!InterlockedExchange(&pPipeline->bReadStalled, FALSE))
+            return NULL; // dispatch stage took over.
+    }
+
+    PMWS_FRAME pFrame = (PMWS_FRAME)InterlockedPopEntrySList(&pPipeline->pFramePool->FreeFrames);
+    if (!pFrame)
+    {
+        // frames are allocated lazily, a quiet connection only ever holds one.
+        pFrame = MwsAlloc(pPipeline->pFramePool->pAllocator, 0, sizeof(MWS_FRAME));
+        if (!pFrame)
+        {
+            InterlockedDecrement(&pPipeline->FramesInFlight);
+            MWS_NWERRORINFO Info = { ERROR_NOT_ENOUGH_MEMORY };
+            pMiraiWS->Callback(pMiraiWS, MWS_NWERROR, &Info);
+            CleanUpMiraiWSAsync(pMiraiWS);
+            return NULL;
+        }
+    }
+    pFrame->Doc = NULL;
+    pFrame->Length = 0;
+    pFrame->RecvStart = 0;
+    pFrame->bPartial = FALSE;
+    pFrame->bDiscarded = FALSE;
+    pFrame->SyncID = 0;
+    return pFrame;
+}
+
+static void FreeFrame(_In_ const MWS_ALLOCATOR* pAllocator, _In_ PMWS_FRAME pFrame)
+{
+    if (pFrame->Doc)
+        yyjson_doc_free(pFrame->Doc);
+    MwsFree(pAllocator, pFrame);
+}
+
+static void ReturnFrameToPool(_Inout_ MWS_FRAME_POOL* pPool, _In_ PMWS_FRAME pFrame)
+{
+    // depth is only approximate under contention, which is fine for a cap.
+    if (QueryDepthSList(&pPool->FreeFrames) >= pPool->MaxFrames)
+    {
+        FreeFrame(pPool->pAllocator, pFrame);
+        return;
+    }
+    if (pFrame->Doc)
+    {
+        yyjson_doc_free(pFrame->Doc);
+        pFrame->Doc = NULL;
+    }
+    InterlockedPushEntrySList(&pPool->FreeFrames, &pFrame->Entry);
+}
+
+/// <summary>
+/// Give back a frame the read side took but won't hand to the parse stage.
+/// </summary>
+static void DropFrame(_In_ PMIRAI_WS pMiraiWS, _In_ PMWS_FRAME pFrame)
+{
+    ReturnFrameToPool(pMiraiWS->pPipeline->pFramePool, pFrame);
+    InterlockedDecrement(&pMiraiWS->pPipeline->FramesInFlight);
+}
+
+static void PushToParseStage(_In_ PMIRAI_WS pMiraiWS, _In_ PMWS_FRAME pFrame)
+{
+    PMWS_PIPELINE pPipeline = pMiraiWS->pPipeline;
+    if (MWS_TRACING() && pFrame->RecvStart)
+        TraceSpan(MWS_SPAN_REASSEMBLY, pMiraiWS, pFrame->RecvStart, 0, MWSBIN_EV_UNKNOWN);
+    RingPush(&pPipeline->ParseStage.Ring, pFrame);
+    ScheduleStage(&pPipeline->ParseStage);
+}
+
+// Responses to memberList and friends of a large group or bot don't fit a frame.
+// Instead of holding the whole message, its list is cut into batches while it is received.
+// Every batch is a frame that looks like the response with only some of the items:
+//   {"syncId":"5","data":{"code":0,"msg":"","data":[item,item]}}
+// all but the last have bPartial set on their frame, which keeps the async call alive and sets bMore of the result.
+// Batches go through parse and dispatch like any frame, so memory stays within MIRAI_WS_PIPELINE_DEPTH frames.
+
+static const char BatchTail[] = "]}}";
+
+/// <summary>
+/// Read the syncId of a message from its digits, mirai echoes the one we sent.
+/// </summary>
+/// <returns>0 if it is not one we allocate, GetAsyncCallID starts at 1</returns>
+static INT64 ParseHeadSyncID(_In_reads_(cchText) const CHAR* pText, _In_ UINT cchText)
+{
+    if (cchText == 0 || cchText > 18 || pText[0] < '1' || pText[0] > '9')
+        return 0;
+
+    INT64 ID = 0;
+    for (UINT i = 0; i < cchText; i++)
+    {
+        if (pText[i] < '0' || pText[i] > '9')
+            return 0;
+        ID = ID * 10 + (pText[i] - '0');
+    }
+    return ID;
+}
+
+/// <summary>
+/// Take a byte of a message that is too large for a frame, see MWS_HEAD_SCAN.
+/// </summary>
+/// <returns>TRUE for the '[' that starts the list at "data" -> "data"</returns>
+static BOOL ScanListHead(_Inout_ MWS_HEAD_SCAN* pScan, _In_ BYTE c)
+{
+    if (pScan->bInString)
+    {
+        if (pScan->bEscape)
+            pScan->bEscape = FALSE;
+        else if (c == '\\')
+            pScan->bEscape = TRUE;
+        else if (c == '"')
+        {
+            pScan->bInString = FALSE;
+            if (!pScan->bCapture)
+                return FALSE;
+
+            // escapes are kept as they are, so an escaped key or syncId matches nothing.
+            pScan->bCapture = FALSE;
+            if (pScan->bCaptureKey)
+            {
+                if (pScan->Depth == 1 && pScan->cchText == 6 && memcmp(pScan->Text, "syncId", 6) == 0)
+                    pScan->Key = HEAD_KEY_SYNCID;
+                else if (pScan->cchText == 4 && memcmp(pScan->Text, "data", 4) == 0)
+                    pScan->Key = HEAD_KEY_DATA;
+            }
+            else
+            {
+                pScan->bSyncID = TRUE;
+                pScan->SyncID = ParseHeadSyncID(pScan->Text, pScan->cchText);
+            }
+            return FALSE;
+        }
+
+        if (pScan->bCapture && pScan->cchText < sizeof(pScan->Text))
+            pScan->Text[pScan->cchText++] = c;
+        return FALSE;
+    }
+
+    BOOL bList = FALSE;
+    switch (c)
+    {
+    case '"':
+        pScan->bInString = TRUE;
+        pScan->bCaptureKey = pScan->bKeyNext;
+        pScan->bCapture = pScan->bKeyNext || (pScan->Depth == 1 && pScan->Key == HEAD_KEY_SYNCID);
+        pScan->bKeyNext = FALSE;
+        pScan->cchText = 0;
+        break;
+    case ',':
+        pScan->bKeyNext = pScan->Depth <= 2 && pScan->bObject[pScan->Depth];
+        pScan->Key = HEAD_KEY_OTHER;
+        break;
+    case '{':
+    case '[':
+        bList = c == '[' && pScan->Depth == 2 && pScan->bInData && pScan->Key == HEAD_KEY_DATA;
+        if (c == '{' && pScan->Depth == 1 && pScan->Key == HEAD_KEY_DATA)
+            pScan->bInData = TRUE;
+        pScan->Depth++;
+        if (pScan->Depth <= 2)
+            pScan->bObject[pScan->Depth] = c == '{';
+        pScan->bKeyNext = c == '{' && pScan->Depth <= 2;
+        pScan->Key = HEAD_KEY_OTHER;
+        break;
+    case '}':
+    case ']':
+        if (pScan->Depth == 2)
+            pScan->bInData = FALSE;
+        pScan->Depth--;
+        pScan->Key = HEAD_KEY_OTHER;
+        break;
+    }
+    return bList;
+}
+
+/// <summary>
+/// Called when a fragment filled the receive frame. Find the list the message is to be cut at.
+/// </summary>
+static void StartListStream(_In_ PMIRAI_WS pMiraiWS)
+{
+    PMWS_PIPELINE pPipeline = pMiraiWS->pPipeline;
+    MWS_LIST_STREAM* pStream = &pPipeline->Stream;
+    PMWS_FRAME pRecv = pPipeline->pRecvFrame;
+    ZeroMemory(pStream, FIELD_OFFSET(MWS_LIST_STREAM, Head));
+    pStream->bActive = TRUE;
+    InterlockedIncrement64(&pPipeline->StreamedLists);
+
+    // only responses to our requests are streamed, and only when the syncId comes before the list.
+    // Mirai writes the syncId first and the list last, at "data" -> "data" after code and msg.
+    MWS_HEAD_SCAN* pScan = &pStream->HeadScan;
+    while (pStream->Scanned < pRecv->Length && !(pScan->bSyncID && !pScan->SyncID))
+    {
+        if (!ScanListHead(pScan, pRecv->Data[pStream->Scanned++]))
+            continue;
+
+        if (pScan->SyncID && pStream->Scanned <= sizeof(pStream->Head))
+        {
+            pStream->Scan.Depth = 3;
+            pStream->cbHead = pStream->Scanned;
+            memcpy(pStream->Head, pRecv->Data, pStream->cbHead);
+            return;
+        }
+        break;
+    }
+    pStream->bDiscard = TRUE;
+}
+
+/// <summary>
+/// Hand a batch to the parse stage.
+/// </summary>
+/// <param name="bPartial">more batches follow, close it with BatchTail</param>
+static void PushBatch(_In_ PMIRAI_WS pMiraiWS, _In_ PMWS_FRAME pBatch, _In_ BOOL bPartial)
+{
+    if (bPartial)
+    {
+        memcpy(pBatch->Data + pBatch->Length, BatchTail, sizeof(BatchTail) - 1);
+        pBatch->Length += sizeof(BatchTail) - 1;
+    }
+    pBatch->bPartial = bPartial;
+    pMiraiWS->pPipeline->Stream.BatchItems = 0;
+    PushToParseStage(pMiraiWS, pBatch);
+}
+
+/// <summary>
+/// Take a frame for the next batch and start it with the head of the message.
+/// A full batch waiting in pFull gives its incomplete last item to the new one and is pushed.
+/// </summary>
+/// <returns>FALSE when parked or closing</returns>
+static BOOL StartBatch(_In_ PMIRAI_WS pMiraiWS)
+{
+    MWS_LIST_STREAM* pStream = &pMiraiWS->pPipeline->Stream;
+    PMWS_FRAME pBatch = TakeFrame(pMiraiWS);
+    if (!pBatch)
+        return FALSE;
+
+    if (pMiraiWS->pJournal || MWS_TRACING())
+        pBatch->RecvStart = ReadPerfClock();
+    memcpy(pBatch->Data, pStream->Head, pStream->cbHead);
+    pBatch->Length = pStream->cbHead;
+
+    PMWS_FRAME pFull = pStream->pFull;
+    if (pFull)
+    {
+        BYTE* pItem = pFull->Data + pStream->ItemStart;
+        SIZE_T cbItem = pFull->Length - pStream->ItemStart;
+        if (*pItem == ',')
+        {
+            pItem++;
+            cbItem--;
+        }
+        memcpy(pBatch->Data + pBatch->Length, pItem, cbItem);
+        pFull->Length = pStream->ItemStart;
+        pStream->ItemStart = pBatch->Length;
+        pBatch->Length += cbItem;
+
+        pStream->pFull = NULL;
+        PushBatch(pMiraiWS, pFull, TRUE);
+    }
+    pStream->pBatch = pBatch;
+    return TRUE;
+}
+
+/// <summary>
+/// Append a byte of an item, or of what follows the list, to the batch.
+/// </summary>
+/// <returns>FALSE when the batch is full</returns>
+static BOOL AppendToBatch(_Inout_ MWS_LIST_STREAM* pStream, _In_ BYTE c)
+{
+    PMWS_FRAME pBatch = pStream->pBatch;
+    SIZE_T cbReserve = pStream->Scan.bTail ? 0 : sizeof(BatchTail) - 1;
+    if (pBatch->Length + cbReserve >= sizeof(pBatch->Data))
+        return FALSE;
+    pBatch->Data[pBatch->Length++] = c;
+    return TRUE;
+}
+
+/// <summary>
+/// Cut what pRecvFrame holds of a streamed message into batches, then receive more of it into the same frame.
+/// </summary>
+/// <returns>TRUE when the message is done and the caller should receive the next one with ReceiveNextFrame</returns>
+static BOOL StreamListResponse(_In_ PMIRAI_WS pMiraiWS)
+{
+    PMWS_PIPELINE pPipeline = pMiraiWS->pPipeline;
+    MWS_LIST_STREAM* pStream = &pPipeline->Stream;
+    PMWS_FRAME pRecv = pPipeline->pRecvFrame;
+    if (pMiraiWS->bClose)
+        return FALSE;
+
+    while (!pStream->bDiscard && pStream->Scanned < pRecv->Length)
+    {
+        if (!pStream->pBatch && !StartBatch(pMiraiWS))
+            return FALSE;
+
+        BYTE c = pRecv->Data[pStream->Scanned];
+        MWS_LIST_SCAN Before = pStream->Scan;
+        BOOL bKeep = pStream->Scan.bInItem || pStream->Scan.bTail;
+        BOOL bItemEnd = FALSE;
+        if (pStream->Scan.bInString)
+        {
+            if (pStream->Scan.bEscape)
+                pStream->Scan.bEscape = FALSE;
+            else if (c == '\\')
+                pStream->Scan.bEscape = TRUE;
+            else if (c == '"')
+                pStream->Scan.bInString = FALSE;
+        }
+        else if (c == '"')
+        {
+            pStream->Scan.bInString = TRUE;
+        }
+        else if (c == '{' || c == '[')
+        {
+            if (pStream->Scan.Depth == 3 && !pStream->Scan.bTail)
+            {
+                if (pStream->BatchItems == MIRAI_WS_LIST_BATCH)
+                {
+                    PushBatch(pMiraiWS, pStream->pBatch, TRUE);
+                    pStream->pBatch = NULL;
+                    continue;
+                }
+                pStream->ItemStart = pStream->pBatch->Length;
+                if (pStream->BatchItems && !AppendToBatch(pStream, ','))
+                {
+                    PushBatch(pMiraiWS, pStream->pBatch, TRUE);
+                    pStream->pBatch = NULL;
+                    continue;
+                }
+                pStream->Scan.bInItem = bKeep = TRUE;
+            }
+            pStream->Scan.Depth++;
+        }
+        else if (c == '}' || c == ']')
+        {
+            pStream->Scan.Depth--;
+            if (pStream->Scan.Depth == 3 && pStream->Scan.bInItem)
+                bItemEnd = TRUE;
+            else if (pStream->Scan.Depth == 2 && !pStream->Scan.bTail)
+                pStream->Scan.bTail = bKeep = TRUE;
+        }
+
+        if (bKeep && !AppendToBatch(pStream, c))
+        {
+            if (pStream->Scan.bTail || !pStream->BatchItems)
+            {
+                // an item as large as a frame, or something odd after the list.
+                pStream->bDiscard = TRUE;
+                break;
+            }
+            pStream->pFull = pStream->pBatch;
+            pStream->pBatch = NULL;
+            pStream->Scan = Before;
+            continue; // this byte again, in the next batch.
+        }
+        if (bItemEnd)
+        {
+            pStream->Scan.bInItem = FALSE;
+            pStream->BatchItems++;
+        }
+        pStream->Scanned++;
+    }
+
+    // a discarded response still completes its call, its syncId may be further on.
+    MWS_HEAD_SCAN* pScan = &pStream->HeadScan;
+    while (pStream->bDiscard && !pScan->bSyncID && pStream->Scanned < pRecv->Length)
+        ScanListHead(pScan, pRecv->Data[pStream->Scanned++]);
+
+    if (!pStream->bLastFragment)
+    {
+        pRecv->Length = 0;
+        pStream->Scanned = 0;
+        PostReceive(pMiraiWS);
+        return FALSE;
+    }
+
+    pStream->bActive = FALSE;
+    pPipeline->pRecvFrame = NULL;
+    if (pStream->bDiscard)
+    {
+        // the last piece of the message goes on unparsed, for the dispatch stage to report and complete the call.
+        if (pStream->pBatch)
+            DropFrame(pMiraiWS, pStream->pBatch);
+        if (pStream->pFull)
+            DropFrame(pMiraiWS, pStream->pFull);
+        pRecv->bDiscarded = TRUE;
+        pRecv->SyncID = pScan->SyncID;
+        PushToParseStage(pMiraiWS, pRecv);
+    }
+    else
+    {
+        if (pStream->pBatch)
+            PushBatch(pMiraiWS, pStream->pBatch, FALSE);
+        DropFrame(pMiraiWS, pRecv);
+    }
+    pStream->pBatch = pStream->pFull = NULL;
+    return TRUE;
+}
+
+/// <summary>
+/// Take a free frame and start receiving into it.
+/// Also resumes a streamed message whose read side was parked, see StreamListResponse.
+/// </summary>
+static void ReceiveNextFrame(_In_ PMIRAI_WS pMiraiWS)
+{
+    PMWS_PIPELINE pPipeline = pMiraiWS->pPipeline;
+    if (pPipeline->Stream.bActive && !StreamListResponse(pMiraiWS))
+        return;
+
+    PMWS_FRAME pFrame = TakeFrame(pMiraiWS);
+    if (!pFrame)
+        return;
+    pPipeline->pRecvFrame = pFrame;
+    PostReceive(pMiraiWS);
+}
+
+static void RecycleFrame(_In_ PMIRAI_WS pMiraiWS, _In_ PMWS_FRAME pFrame)
+{
+    PMWS_PIPELINE pPipeline = pMiraiWS->pPipeline;
+    ReturnFrameToPool(pPipeline->pFramePool, pFrame);
+    InterlockedDecrement(&pPipeline->FramesInFlight);
+
+    if (InterlockedExchange(&pPipeline->bReadStalled, FALSE))
+        ReceiveNextFrame(pMiraiWS);
+}
+
+static VOID CALLBACK ParseStageWork(_Inout_ PTP_CALLBACK_INSTANCE Instance, _Inout_opt_ PVOID Context, _Inout_ PTP_WORK Work)
+{
+    PMIRAI_WS pMiraiWS = Context;
+    PMWS_PIPELINE pPipeline = pMiraiWS->pPipeline;
+    yyjson_alc Alc = MwsJsonAlc(&pMiraiWS->Allocator);
+    do
+    {
+        PMWS_FRAME pFrame;
+        while ((pFrame = RingPop(&pPipeline->ParseStage.Ring)) != NULL)
+        {
+            if (pMiraiWS->pJournal)
+                AppendToJournal(pMiraiWS->pJournal, pFrame->Data, pFrame->Length, pFrame->RecvStart);
+
+            LONGLONG Start = (pMiraiWS->pMetrics || MWS_TRACING()) ? ReadPerfClock() : 0;
+            pFrame->Doc = pFrame->bDiscarded ? NULL : yyjson_read_opts((char*)pFrame->Data, pFrame->Length, 0, &Alc, NULL);
+            if (Start)
+            {
+                if (pMiraiWS->pMetrics)
+                {
+                    MetricsRecord(pMiraiWS->pMetrics, MWS_LAT_PARSE, ReadPerfClock() - Start);
+                    MetricsAdd(pMiraiWS->pMetrics, MWS_CTR_FRAMES, 1);
+                    MetricsAdd(pMiraiWS->pMetrics, MWS_CTR_BYTES, pFrame->Length);
+                }
+                if (MWS_TRACING())
+                    TraceSpan(MWS_SPAN_PARSE, pMiraiWS, Start, 0, MWSBIN_EV_UNKNOWN);
+            }
+
+            // never fails, rings are as deep as the number of frames in flight.
+            RingPush(&pPipeline->DispatchStage.Ring, pFrame);
+            ScheduleStage(&pPipeline->DispatchStage);
+        }
+    } while (ContinueStage(&pPipeline->ParseStage));
+}
+
+static VOID CALLBACK DispatchStageWork(_Inout_ PTP_CALLBACK_INSTANCE Instance, _Inout_opt_ PVOID Context, _Inout_ PTP_WORK Work)
+{
+    PMIRAI_WS pMiraiWS = Context;
+    PMWS_PIPELINE pPipeline = pMiraiWS->pPipeline;
+    do
+    {
+        PMWS_FRAME pFrame;
+        while ((pFrame = RingPop(&pPipeline->DispatchStage.Ring)) != NULL)
+        {
+            if (!pMiraiWS->bClose)
+            {
+                LONGLONG Start = (pMiraiWS->pMetrics || MWS_TRACING()) ? ReadPerfClock() : 0;
+                pPipeline->pDispatchFrame = pFrame;
+                HandleJsonMessage(pMiraiWS, pFrame->Doc);
+                pPipeline->pDispatchFrame = NULL;
+                if (Start)
+                {
+                    if (pMiraiWS->pMetrics)
+                        MetricsRecord(pMiraiWS->pMetrics, MWS_LAT_DISPATCH, ReadPerfClock() - Start);
+                    if (MWS_TRACING())
+                        TraceSpan(MWS_SPAN_DISPATCH, pMiraiWS, Start, 0, MWSBIN_EV_UNKNOWN);
+                }
+            }
+            else if (pFrame->Doc)
+            {
+                yyjson_doc_free(pFrame->Doc);
+            }
+            pFrame->Doc = NULL;
+            RecycleFrame(pMiraiWS, pFrame);
+        }
+    } while (ContinueStage(&pPipeline->DispatchStage));
+}
+
+BOOL DispatchReplayedFrame(_In_ PMIRAI_WS pMiraiWS, _In_reads_bytes_(cbData) const BYTE* pData, _In_ SIZE_T cbData)
+{
+    PMWS_PIPELINE pPipeline = pMiraiWS->pPipeline;
+    if (cbData > MIRAI_WS_MAXBUF)
+    {
+        // a frame this large never makes it out of the receive stage either.
+        CallBadMsgCallback(pMiraiWS);
+        SetLastError(ERROR_INSUFFICIENT_BUFFER);
+        return FALSE;
+    }
+
+    PMWS_FRAME pFrame = (PMWS_FRAME)InterlockedPopEntrySList(&pPipeline->pFramePool->FreeFrames);
+    if (!pFrame)
+    {
+        pFrame = MwsAlloc(pPipeline->pFramePool->pAllocator, 0, sizeof(MWS_FRAME));
+        if (!pFrame)
+        {
+            SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+            return FALSE;
+        }
+    }
+    memcpy(pFrame->Data, pData, cbData);
+    pFrame->Length = cbData;
+    pFrame->bPartial = FALSE;
+    pFrame->bDiscarded = FALSE;
+    pFrame->SyncID = 0;
+    yyjson_alc Alc = MwsJsonAlc(&pMiraiWS->Allocator);
+    pFrame->Doc = yyjson_read_opts((char*)pFrame->Data, pFrame->Length, 0, &Alc, NULL);
+
+    pPipeline->pDispatchFrame = pFrame;
+    HandleJsonMessage(pMiraiWS, pFrame->Doc);
+    pPipeline->pDispatchFrame = NULL;
+
+    pFrame->Doc = NULL;
+    ReturnFrameToPool(pPipeline->pFramePool, pFrame);
+    return TRUE;
+}
+
+/// <summary>
+/// Wait for stage workers to finish and give back every frame. No new frame may enter the pipeline.
+/// </summary>
+static void DestroyPipeline(_In_ PMWS_PIPELINE pPipeline)
+{
+    // parse stage feeds dispatch stage, so wait in that order.
+    WaitForThreadpoolWorkCallbacks(pPipeline->ParseStage.Work, FALSE);
+    WaitForThreadpoolWorkCallbacks(pPipeline->DispatchStage.Work, FALSE);
+    CloseThreadpoolWork(pPipeline->ParseStage.Work);
+    CloseThreadpoolWork(pPipeline->DispatchStage.Work);
+    // called from FreeWork itself, it is released once the callback returns.
+    CloseThreadpoolWork(pPipeline->FreeWork);
+
+    PMWS_FRAME pFrame;
+    while ((pFrame = RingPop(&pPipeline->ParseStage.Ring)) != NULL)
+        ReturnFrameToPool(pPipeline->pFramePool, pFrame);
+    while ((pFrame = RingPop(&pPipeline->DispatchStage.Ring)) != NULL)
+        ReturnFrameToPool(pPipeline->pFramePool, pFrame);
+    if (pPipeline->pRecvFrame)
+        ReturnFrameToPool(pPipeline->pFramePool, pPipeline->pRecvFrame);
+    if (pPipeline->Stream.pBatch)
+        ReturnFrameToPool(pPipeline->pFramePool, pPipeline->Stream.pBatch);
+    if (pPipeline->Stream.pFull)
+        ReturnFrameToPool(pPipeline->pFramePool, pPipeline->Stream.pFull);
+
+    while ((pFrame = (PMWS_FRAME)InterlockedPopEntrySList(&pPipeline->OwnFramePool.FreeFrames)) != NULL)
+        FreeFrame(pPipeline->OwnFramePool.pAllocator, pFrame);
+
+    FreeInternTable(&pPipeline->Interned);
+    MwsFree(pPipeline->pAllocator, pPipeline);
+}
+
+static VOID CALLBACK FreeMiraiWSWork(_Inout_ PTP_CALLBACK_INSTANCE Instance, _Inout_opt_ PVOID Context, _Inout_ PTP_WORK Work)
+{
+    PMIRAI_WS pMiraiWS = Context;
+    PMIRAI_WS_MANAGER pManager = pMiraiWS->pManager;
+    // every pointer is cleared once freed, MWS_CLOSED may still look at the connection and must find nothing.
+    if (pMiraiWS->pPipeline)
+    {
+        DestroyPipeline(pMiraiWS->pPipeline);
+        pMiraiWS->pPipeline = NULL;
+    }
+    if (pMiraiWS->pEventRing)
+    {
+        CloseEventRing(pMiraiWS->pEventRing);
+        pMiraiWS->pEventRing = NULL;
+    }
+    if (pMiraiWS->pJournal)
+    {
+        CloseJournal(pMiraiWS->pJournal);
+        pMiraiWS->pJournal = NULL;
+    }
+    if (pMiraiWS->pMetrics)
+    {
+        FreeMetrics(pMiraiWS->pMetrics);
+        pMiraiWS->pMetrics = NULL;
+    }
+    if (pMiraiWS->pDirectory)
+    {
+        FreeDirectory(pMiraiWS->pDirectory);
+        pMiraiWS->pDirectory = NULL;
+    }
+    if (pMiraiWS->pHistory)
+    {
+        FreeHistory(pMiraiWS->pHistory);
+        pMiraiWS->pHistory = NULL;
+    }
+    if (pMiraiWS->lpServerName)
+    {
+        MwsFree(&pMiraiWS->Allocator, pMiraiWS->lpServerName);
+        pMiraiWS->lpServerName = NULL;
+    }
+    pMiraiWS->Callback(pMiraiWS, MWS_CLOSED, NULL);
+    MWS_ALLOCATOR Allocator = pMiraiWS->Allocator;
+    MwsFree(&Allocator, pMiraiWS);
+
+    if (pManager)
+        InterlockedDecrement(&pManager->Connections);
+}
+
+static PMWS_PIPELINE CreatePipeline(_In_ PMIRAI_WS pMiraiWS)
+{
+    PMWS_PIPELINE pPipeline = MwsAlloc(&pMiraiWS->Allocator, HEAP_ZERO_MEMORY, sizeof(MWS_PIPELINE));
+    if (!pPipeline)
+        return NULL;
+
+    pPipeline->pAllocator = &pMiraiWS->Allocator;
+    pPipeline->Interned.pAllocator = &pMiraiWS->Allocator;
+    pPipeline->Holds = 1;
+    PTP_CALLBACK_ENVIRON pCallbackEnviron = NULL;
+    if (pMiraiWS->pManager)
+    {
+        pPipeline->pFramePool = &pMiraiWS->pManager->FramePool;
+        pCallbackEnviron = &pMiraiWS->pManager->CallbackEnviron;
+    }
+    else
+    {
+        InitializeSListHead(&pPipeline->OwnFramePool.FreeFrames);
+        pPipeline->OwnFramePool.MaxFrames = MIRAI_WS_PIPELINE_DEPTH;
+        pPipeline->OwnFramePool.pAllocator = &pMiraiWS->Allocator;
+        pPipeline->pFramePool = &pPipeline->OwnFramePool;
+    }
+
+    pPipeline->ParseStage.Work = CreateThreadpoolWork(ParseStageWork, pMiraiWS, pCallbackEnviron);
+    pPipeline->DispatchStage.Work = CreateThreadpoolWork(DispatchStageWork, pMiraiWS, pCallbackEnviron);
+    // always the default threadpool: a manager's pool may be too small to wait for its own work.
+    pPipeline->FreeWork = CreateThreadpoolWork(FreeMiraiWSWork, pMiraiWS, NULL);
+    if (!pPipeline->ParseStage.Work || !pPipeline->DispatchStage.Work || !pPipeline->FreeWork)
+    {
+        if (pPipeline->ParseStage.Work) CloseThreadpoolWork(pPipeline->ParseStage.Work);
+        if (pPipeline->DispatchStage.Work) CloseThreadpoolWork(pPipeline->DispatchStage.Work);
+        if (pPipeline->FreeWork) CloseThreadpoolWork(pPipeline->FreeWork);
+        MwsFree(&pMiraiWS->Allocator, pPipeline);
+        return NULL;
+    }
+    return pPipeline;
+}
+
+static void HoldMiraiWS(_In_ PMIRAI_WS pMiraiWS)
+{
+    InterlockedIncrement(&pMiraiWS->pPipeline->Holds);
+}
+
+/// <summary>
+/// Free a connection once it is destroyed and all of its handles are closed, whether it ever connected or not.
+/// Done on a threadpool thread, the last handle may be closed from inside a pipeline stage, which we have to wait for.
+/// </summary>
+static void ReleaseMiraiWS(_In_ PMIRAI_WS pMiraiWS)
+{
+    if (InterlockedDecrement(&pMiraiWS->pPipeline->Holds) == 0)
+        SubmitThreadpoolWork(pMiraiWS->pPipeline->FreeWork);
+}
+
+static void CALLBACK WinHttpStatusCallback(
+    _In_ HINTERNET hInternet,
+    _In_ DWORD_PTR dwContext,
+    _In_ DWORD dwInternetStatus,
+    _In_ LPVOID lpvStatusInformation,
+    _In_ DWORD dwStatusInformationLength
+)
+{
+    PMIRAI_WS pMiraiWS = (PMIRAI_WS)dwContext;
+    switch (dwInternetStatus)
+    {
+    case WINHTTP_CALLBACK_STATUS_SENDREQUEST_COMPLETE:
+        // WinHttpSendRequest successed.
+        if (!WinHttpReceiveResponse(hInternet, NULL))
+        {
+            MWS_CONNECTINFO Info = { FALSE, GetLastError() };
+            pMiraiWS->Callback(pMiraiWS, MWS_CONNECT, &Info);
+        }
+        break;
+
+    case WINHTTP_CALLBACK_STATUS_HEADERS_AVAILABLE:
+    {
+        // WinHttpReceiveResponse successed.
+        HINTERNET hWebSocketHandle = WinHttpWebSocketCompleteUpgrade(hInternet, (DWORD_PTR)pMiraiWS);
+        if (!hWebSocketHandle)
+        {
+            MWS_CONNECTINFO Info = { FALSE, GetLastError() };
+            pMiraiWS->Callback(pMiraiWS, MWS_CONNECT, &Info);
+        }
+        else
+        {
+            HoldMiraiWS(pMiraiWS); // released when it closes
+            InterlockedCompareExchangePointer(&pMiraiWS->hWebSocketHandle, hWebSocketHandle, NULL);
+            if (pMiraiWS->bClose)
+            {
+                // DestroyMiraiWSAsync ran while upgrading and may have looked before the handle was there.
+                // Whoever takes it out closes it.
+                hWebSocketHandle = InterlockedExchangePointer(&pMiraiWS->hWebSocketHandle, NULL);
+                if (hWebSocketHandle)
+                    WinHttpCloseHandle(hWebSocketHandle);
+                break;
+            }
+
+            // connection established.
+            MWS_CONNECTINFO Info = { TRUE, NO_ERROR };
+            pMiraiWS->Callback(pMiraiWS, MWS_CONNECT, &Info);
+
+            // start receiving data.
+            ReceiveNextFrame(pMiraiWS);
+        }
+        break;
+    }
+    
+    case WINHTTP_CALLBACK_STATUS_READ_COMPLETE:
+    {
+        WINHTTP_WEB_SOCKET_STATUS* pWebSockData = (WINHTTP_WEB_SOCKET_STATUS*)lpvStatusInformation;
+        if (pWebSockData->eBufferType == WINHTTP_WEB_SOCKET_UTF8_MESSAGE_BUFFER_TYPE ||
+            pWebSockData->eBufferType == WINHTTP_WEB_SOCKET_UTF8_FRAGMENT_BUFFER_TYPE)
+        {
+            PMWS_PIPELINE pPipeline = pMiraiWS->pPipeline;
+            PMWS_FRAME pFrame = pPipeline->pRecvFrame;
+            // tracing may have been turned off since the receive was posted.
+            if (pPipeline->ReadStart && MWS_TRACING())
+                TraceSpan(MWS_SPAN_SOCKET_READ, pMiraiWS, pPipeline->ReadStart, 0, MWSBIN_EV_UNKNOWN);
+            pPipeline->ReadStart = 0;
+            if ((pMiraiWS->pJournal || MWS_TRACING()) && pFrame->Length == 0)
+                pFrame->RecvStart = ReadPerfClock();
+            pFrame->Length += pWebSockData->dwBytesTransferred;
+            BOOL bLastFragment = pWebSockData->eBufferType == WINHTTP_WEB_SOCKET_UTF8_MESSAGE_BUFFER_TYPE;
+
+            if (pPipeline->Stream.bActive || (!bLastFragment && pFrame->Length == sizeof(pFrame->Data)))
+            {
+                // too large for a frame, cut into batches if it is a list response.
+                if (!pPipeline->Stream.bActive)
+                    StartListStream(pMiraiWS);
+                pPipeline->Stream.bLastFragment = bLastFragment;
+                if (StreamListResponse(pMiraiWS))
+                    ReceiveNextFrame(pMiraiWS);
+            }
+            else if (bLastFragment)
+            {
+                // frame complete, hand it to parse stage and go on reading into another one.
+                pPipeline->pRecvFrame = NULL;
+                PushToParseStage(pMiraiWS, pFrame);
+                ReceiveNextFrame(pMiraiWS);
+            }
+            else
+            {
+                PostReceive(pMiraiWS);
+            }
+        }
+        break;
+    }
+
+    case WINHTTP_CALLBACK_STATUS_REQUEST_ERROR:
+    {
+        WINHTTP_ASYNC_RESULT* pResult = lpvStatusInformation;
+        switch (pResult->dwResult)
+        {
+        case API_SEND_REQUEST:
+        case API_RECEIVE_RESPONSE:
+        {
+            MWS_CONNECTINFO Info = { FALSE, pResult->dwError };
+            pMiraiWS->Callback(pMiraiWS, MWS_CONNECT, &Info);
+            break;
+        }
+        default:
+        {
+            MWS_NWERRORINFO Info = { pResult->dwError };
+            pMiraiWS->Callback(pMiraiWS, MWS_NWERROR, &Info);
+            break;
+        }
+        }
+        CleanUpMiraiWSAsync(pMiraiWS);
+        break;
+    }
+    case WINHTTP_CALLBACK_STATUS_HANDLE_CLOSING:
+    {
+        // only the request and websocket handles carry pMiraiWS, each with a hold. Closed for an error or not,
+        // it is the last callback of that handle.
+        if (pMiraiWS)
+            ReleaseMiraiWS(pMiraiWS);
+        break;
+    }
+    }
+}
+
+_Ret_maybenull_
+static PMIRAI_WS AllocMiraiWS(_In_opt_ PMIRAI_WS_MANAGER pManager, _In_z_ LPCWSTR lpServerName, _In_ INTERNET_PORT Port, _In_ BOOL bSecure, _In_ MWSCALLBACK Callback, _In_opt_ const MWS_ALLOCATOR* pAllocator)
+{
+    BOOL bSuccess = FALSE;
+    MWS_ALLOCATOR Allocator = pManager ? pManager->Allocator : pAllocator ? *pAllocator : MwsHeapAllocator;
+    PMIRAI_WS pMiraiWS = MwsAlloc(&Allocator, HEAP_ZERO_MEMORY, sizeof(MIRAI_WS));
+    if (!pMiraiWS)
+        return NULL;
+    pMiraiWS->Allocator = Allocator;
+    pAllocator = &pMiraiWS->Allocator;
+
+    __try
+    {
+        int cchLen = (int)wcslen(lpServerName);
+        int cchConvertLen = IdnToAscii(0, lpServerName, cchLen, NULL, 0);
+
+        // WinHttpConnect needs to convert hostname into punny code, we convert it here.
+        pMiraiWS->lpServerName = (LPWSTR)MwsAlloc(pAllocator, 0, (cchConvertLen + 1) * sizeof(WCHAR));
+
+        if (!pMiraiWS->lpServerName)
+            __leave;
+        IdnToAscii(0, lpServerName, cchLen, pMiraiWS->lpServerName, cchConvertLen);
+        pMiraiWS->lpServerName[cchConvertLen] = L'\0';
+
+        pMiraiWS->Port     = Port;
+        pMiraiWS->bSecure  = bSecure;
+        pMiraiWS->Callback = Callback;
+        pMiraiWS->pManager = pManager;
+
+        pMiraiWS->pPipeline = CreatePipeline(pMiraiWS);
+        if (!pMiraiWS->pPipeline)
+            __leave;
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if (!bSuccess)
+        {
+            if (pMiraiWS->lpServerName)
+                MwsFree(pAllocator, pMiraiWS->lpServerName);
+
+            MwsFree(&Allocator, pMiraiWS);
+            pMiraiWS = NULL;
+        }
+    }
+
+    return pMiraiWS;
+}
+
+_Ret_maybenull_
+PMIRAI_WS CreateMiraiWS(_In_z_ LPCWSTR lpServerName, _In_ INTERNET_PORT Port, _In_ BOOL bSecure, _In_ MWSCALLBACK Callback)
+{
+    return AllocMiraiWS(NULL, lpServerName, Port, bSecure, Callback, NULL);
+}
+
+_Ret_maybenull_
+PMIRAI_WS CreateMiraiWSEx(_In_z_ LPCWSTR lpServerName, _In_ INTERNET_PORT Port, _In_ BOOL bSecure, _In_ MWSCALLBACK Callback, _In_opt_ const MWS_ALLOCATOR* pAllocator)
+{
+    return AllocMiraiWS(NULL, lpServerName, Port, bSecure, Callback, pAllocator);
+}
+
+BOOL ConnectMiraiWS(_Inout_ PMIRAI_WS pMiraiWS, _In_z_ LPCWSTR szVerifyKey, _In_z_ LPCWSTR szQQ)
+{
+    BOOL bSuccess = FALSE;
+    LPWSTR szHeaderStr = NULL;
+    __try
+    {
+        HINTERNET hSessionHandle;
+        if (pMiraiWS->pManager)
+        {
+            // session belongs to the manager, it already has our status callback set.
+            hSessionHandle = pMiraiWS->pManager->hSessionHandle;
+        }
+        else
+        {
+            DWORD dwHttpOpenFlag = pMiraiWS->bSecure ? WINHTTP_FLAG_SECURE_DEFAULTS : WINHTTP_FLAG_ASYNC; // WINHTTP_FLAG_SECURE_DEFAULTS also forces WINHTTP_FLAG_ASYNC
+
+            pMiraiWS->hSessionHandle = WinHttpOpen(
+                L"Mirai WS",
+                WINHTTP_ACCESS_TYPE_AUTOMATIC_PROXY,
+                WINHTTP_NO_PROXY_NAME,
+                WINHTTP_NO_PROXY_BYPASS,
+                dwHttpOpenFlag);
+            if (!pMiraiWS->hSessionHandle)
+                __leave;
+
+            // We're going to use WinHttp Async mode, so we need to set a callback.
+            // request will inherit the callback from session.
+            WinHttpSetStatusCallback(pMiraiWS->hSessionHandle, WinHttpStatusCallback, WINHTTP_CALLBACK_FLAG_ALL_NOTIFICATIONS, 0);
+            hSessionHandle = pMiraiWS->hSessionHandle;
+        }
+
+        pMiraiWS->hConnectionHandle = WinHttpConnect(
+            hSessionHandle,
+            pMiraiWS->lpServerName,
+            pMiraiWS->Port, 0);
+        if (!pMiraiWS->hConnectionHandle)
+            __leave;
+
+        pMiraiWS->hRequestHandle = WinHttpOpenRequest(
+            pMiraiWS->hConnectionHandle,
+            L"GET",
+            L"/all", // for pushing messages and events. see mirai-api-http websocket adapter docs for more detail.
+            NULL,
+            WINHTTP_NO_REFERER,
+            WINHTTP_DEFAULT_ACCEPT_TYPES,
+            pMiraiWS->bSecure ? WINHTTP_FLAG_SECURE : 0);
+        if (!pMiraiWS->hRequestHandle)
+            __leave;
+
+        // so that closing it finds us even before WinHttpSendRequest.
+        DWORD_PTR RequestContext = (DWORD_PTR)pMiraiWS;
+        if (!WinHttpSetOption(pMiraiWS->hRequestHandle, WINHTTP_OPTION_CONTEXT_VALUE, &RequestContext, sizeof(RequestContext)))
+        {
+            WinHttpCloseHandle(pMiraiWS->hRequestHandle);
+            pMiraiWS->hRequestHandle = NULL;
+            __leave;
+        }
+        HoldMiraiWS(pMiraiWS); // released when it closes
+
+        if (!WinHttpSetOption(pMiraiWS->hRequestHandle,
+            WINHTTP_OPTION_UPGRADE_TO_WEB_SOCKET,
+            NULL,
+            0))
+            __leave;
+
+        // format the header string.
+
+        DWORD_PTR FormatArgs[2] = { (DWORD_PTR)szVerifyKey, (DWORD_PTR)szQQ };
+        DWORD cchHeaderStr = FormatMessageW(
+            FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_STRING | FORMAT_MESSAGE_ARGUMENT_ARRAY,
+            L"verifyKey: %1\r\nqq: %2\r\n",
+            0, 0, (LPWSTR)&szHeaderStr, 0, (va_list *)FormatArgs);
+        if (cchHeaderStr == 0)
+            __leave;
+
+        if (!WinHttpSendRequest(pMiraiWS->hRequestHandle, szHeaderStr, cchHeaderStr, WINHTTP_NO_REQUEST_DATA, 0, 0, (DWORD_PTR)pMiraiWS))
+            __leave;
+
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if(szHeaderStr)
+            LocalFree(szHeaderStr);
+
+        if (!bSuccess)
+        {
+            CleanUpMiraiWSAsync(pMiraiWS);
+        }
+    }
+
+    return bSuccess;
+}
+
+BOOL DestroyMiraiWSAsync(_In_ _Frees_ptr_ PMIRAI_WS pMiraiWS)
+{
+    pMiraiWS->bClose = TRUE;
+
+    CleanUpMiraiWSAsync(pMiraiWS);
+
+    // freed here if no handle was ever open, otherwise when the last one closes.
+    ReleaseMiraiWS(pMiraiWS);
+    return TRUE;
+}
+
+BOOL GetMiraiWSPipelineStats(_In_ PMIRAI_WS pMiraiWS, _Out_ MWS_PIPELINE_STATS* pStats)
+{
+    PMWS_PIPELINE pPipeline = pMiraiWS->pPipeline;
+
+    pStats->FramesPendingParse = RingDepth(&pPipeline->ParseStage.Ring);
+    pStats->FramesPendingDispatch = RingDepth(&pPipeline->DispatchStage.Ring);
+    pStats->FramesInFlight = ReadAcquire(&pPipeline->FramesInFlight);
+    pStats->PeakPendingParse = ReadNoFence(&pPipeline->ParseStage.Ring.Peak);
+    pStats->PeakPendingDispatch = ReadNoFence(&pPipeline->DispatchStage.Ring.Peak);
+    pStats->ReadStalls = ReadNoFence64(&pPipeline->ReadStalls);
+    pStats->StreamedLists = ReadNoFence64(&pPipeline->StreamedLists);
+    return TRUE;
+}
+
+BOOL UnpackMiraiWSChain(_In_ PMIRAI_WS pMiraiWS, _In_ const MWS_CHAINVIEW* pView, _Out_ MESSAGE_CHAIN* pMessageChain)
+{
+    // the chain may be kept and this may run on any thread, so no intern table.
+    if (!UnpackMessageChain(&pMiraiWS->Allocator, NULL, pMessageChain, (yyjson_val*)pView->Node, FALSE))
+        return FALSE;
+
+    // chains without Source, like quoted ones, get what the view knows.
+    if (!pMessageChain->ID)
+    {
+        pMessageChain->ID = pView->ID;
+        pMessageChain->Timestamp = pView->Timestamp;
+    }
+    return TRUE;
+}
+
+BOOL FindMiraiWSViewBlock(
+    _In_ const MWS_CHAINVIEW* pView,
+    _In_z_ LPCSTR lpType,
+    _Inout_ SIZE_T* pIndex,
+    _In_opt_z_ LPCSTR lpKey,
+    _Out_opt_ MWS_STRING* pValue)
+{
+    if (pValue)
+        *pValue = EmptyString;
+
+    size_t i, MaxNode;
+    yyjson_val* Block;
+    yyjson_arr_foreach((yyjson_val*)pView->Node, i, MaxNode, Block) {
+        if (i < *pIndex || !yyjson_equals_str(yyjson_obj_get(Block, "type"), lpType))
+            continue;
+
+        *pIndex = i;
+        if (pValue && lpKey)
+            *pValue = ViewStr(Block, lpKey);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+static const MWS_FLATTEN_RULE DefaultFlattenRules[] = {
+    { "At", "@{target}" },
+    { "AtAll", "@all" },
+    { "Face", "[{name}]" },
+    { "MarketFace", "[{name}]" },
+    { "Image", "[image]" },
+    { "FlashImage", "[image]" }
+};
+
+typedef struct
+{
+    PVOID pBuffer;     // LPSTR, or LPWSTR when bWide
+    SIZE_T cchBuffer;
+    SIZE_T cchNeeded;  // terminator not included
+    BOOL bWide;
+    BOOL bOverflow;    // set once a piece did not fit, nothing is written after that
+} FLATTEN_OUT;
+
+static void FlattenAppend(_Inout_ FLATTEN_OUT* pOut, _In_reads_(cbText) LPCSTR lpText, _In_ SIZE_T cbText)
+{
+    if (!cbText)
+        return;
+
+    // one place is kept for the terminator.
+    SIZE_T cchRoom = (!pOut->bOverflow && pOut->pBuffer && pOut->cchBuffer > pOut->cchNeeded) ? pOut->cchBuffer - pOut->cchNeeded - 1 : 0;
+    SIZE_T cchText = cbText;
+    if (pOut->bWide)
+    {
+        int cchWide = cchRoom ? MultiByteToWideChar(CP_UTF8, 0, lpText, (int)cbText, (LPWSTR)pOut->pBuffer + pOut->cchNeeded, (int)min(cchRoom, INT_MAX)) : 0;
+        cchText = cchWide ? cchWide : MultiByteToWideChar(CP_UTF8, 0, lpText, (int)cbText, NULL, 0);
+    }
+    else if (cchText <= cchRoom)
+        memcpy((LPSTR)pOut->pBuffer + pOut->cchNeeded, lpText, cbText);
+
+    if (cchText > cchRoom)
+        pOut->bOverflow = TRUE;
+    pOut->cchNeeded += cchText;
+}
+
+static void FlattenBlock(_Inout_ FLATTEN_OUT* pOut, _In_ yyjson_val* Block, _In_z_ LPCSTR lpFormat)
+{
+    for (;;)
+    {
+        LPCSTR lpOpen = strchr(lpFormat, '{');
+        LPCSTR lpClose = lpOpen ? strchr(lpOpen, '}') : NULL;
+        if (!lpClose)
+        {
+            FlattenAppend(pOut, lpFormat, strlen(lpFormat));
+            return;
+        }
+        FlattenAppend(pOut, lpFormat, lpOpen - lpFormat);
+
+        yyjson_val* Field = yyjson_obj_getn(Block, lpOpen + 1, lpClose - lpOpen - 1);
+        if (yyjson_is_str(Field))
+            FlattenAppend(pOut, unsafe_yyjson_get_str(Field), unsafe_yyjson_get_len(Field));
+        else if (yyjson_is_int(Field))
+        {
+            CHAR Digits[24];
+            StringCchPrintfA(Digits, _countof(Digits), "%lld", yyjson_get_sint(Field));
+            FlattenAppend(pOut, Digits, strlen(Digits));
+        }
+        lpFormat = lpClose + 1;
+    }
+}
+
+static BOOL FlattenChain(_In_ const MWS_CHAINVIEW* pView, _In_reads_opt_(cRules) const MWS_FLATTEN_RULE* pRules, _In_ SIZE_T cRules,
+    _Inout_ FLATTEN_OUT* pOut, _Out_opt_ SIZE_T* pcchNeeded)
+{
+    if (!pRules)
+    {
+        pRules = DefaultFlattenRules;
+        cRules = _countof(DefaultFlattenRules);
+    }
+
+    size_t i, MaxNode;
+    yyjson_val* Block;
+    yyjson_arr_foreach((yyjson_val*)pView->Node, i, MaxNode, Block) {
+        yyjson_val* TypeField = yyjson_obj_get(Block, "type");
+        if (yyjson_equals_str(TypeField, "Plain"))
+        {
+            yyjson_val* TextField = yyjson_obj_get(Block, "text");
+            if (yyjson_is_str(TextField))
+                FlattenAppend(pOut, unsafe_yyjson_get_str(TextField), unsafe_yyjson_get_len(TextField));
+            continue;
+        }
+        if (!yyjson_is_str(TypeField) || yyjson_equals_str(TypeField, "Source"))
+            continue;
+
+        for (SIZE_T r = 0; r < cRules; r++)
+        {
+            if (!pRules[r].lpType || yyjson_equals_str(TypeField, pRules[r].lpType))
+            {
+                FlattenBlock(pOut, Block, pRules[r].lpFormat);
+                break;
+            }
+        }
+    }
+
+    if (pcchNeeded)
+        *pcchNeeded = pOut->cchNeeded + 1;
+    if (pOut->bOverflow || !pOut->pBuffer || pOut->cchNeeded >= pOut->cchBuffer)
+    {
+        SetLastError(ERROR_INSUFFICIENT_BUFFER);
+        return FALSE;
+    }
+    if (pOut->bWide)
+        ((LPWSTR)pOut->pBuffer)[pOut->cchNeeded] = L'\0';
+    else
+        ((LPSTR)pOut->pBuffer)[pOut->cchNeeded] = '\0';
+    return TRUE;
+}
+
+BOOL FlattenMiraiWSChain(
+    _In_ const MWS_CHAINVIEW* pView,
+    _In_reads_opt_(cRules) const MWS_FLATTEN_RULE* pRules,
+    _In_ SIZE_T cRules,
+    _Out_writes_opt_(cbBuffer) LPSTR lpBuffer,
+    _In_ SIZE_T cbBuffer,
+    _Out_opt_ SIZE_T* pcbNeeded)
+{
+    FLATTEN_OUT Out = { lpBuffer, cbBuffer, 0, FALSE, FALSE };
+    return FlattenChain(pView, pRules, cRules, &Out, pcbNeeded);
+}
+
+BOOL FlattenMiraiWSChainW(
+    _In_ const MWS_CHAINVIEW* pView,
+    _In_reads_opt_(cRules) const MWS_FLATTEN_RULE* pRules,
+    _In_ SIZE_T cRules,
+    _Out_writes_opt_(cchBuffer) LPWSTR lpBuffer,
+    _In_ SIZE_T cchBuffer,
+    _Out_opt_ SIZE_T* pcchNeeded)
+{
+    FLATTEN_OUT Out = { lpBuffer, cchBuffer, 0, TRUE, FALSE };
+    return FlattenChain(pView, pRules, cRules, &Out, pcchNeeded);
+}
+
+void ReleaseMiraiWSChain(_In_ PMIRAI_WS pMiraiWS, _Inout_ MESSAGE_CHAIN* pMessageChain)
+{
+    ReleaseMessageChain(&pMiraiWS->Allocator, TRUE, pMessageChain);
+}
+
+_Ret_maybenull_
+PMIRAI_WS_MANAGER CreateMiraiWSManager(_In_ DWORD MaxThreads, _In_ USHORT MaxPooledFrames)
+{
+    return CreateMiraiWSManagerEx(MaxThreads, MaxPooledFrames, NULL);
+}
+
+_Ret_maybenull_
+PMIRAI_WS_MANAGER CreateMiraiWSManagerEx(_In_ DWORD MaxThreads, _In_ USHORT MaxPooledFrames, _In_opt_ const MWS_ALLOCATOR* pAllocator)
+{
+    BOOL bSuccess = FALSE;
+    MWS_ALLOCATOR Allocator = pAllocator ? *pAllocator : MwsHeapAllocator;
+    PMIRAI_WS_MANAGER pManager = MwsAlloc(&Allocator, HEAP_ZERO_MEMORY, sizeof(MIRAI_WS_MANAGER));
+    if (!pManager)
+        return NULL;
+
+    pManager->Allocator = Allocator;
+    InitializeSListHead(&pManager->FramePool.FreeFrames);
+    pManager->FramePool.MaxFrames = MaxPooledFrames;
+    pManager->FramePool.pAllocator = &pManager->Allocator;
+    InitializeThreadpoolEnvironment(&pManager->CallbackEnviron);
+
+    __try
+    {
+        // one session serves secure and plain connections, WINHTTP_FLAG_SECURE is chosen per request.
+        pManager->hSessionHandle = WinHttpOpen(
+            L"Mirai WS",
+            WINHTTP_ACCESS_TYPE_AUTOMATIC_PROXY,
+            WINHTTP_NO_PROXY_NAME,
+            WINHTTP_NO_PROXY_BYPASS,
+            WINHTTP_FLAG_ASYNC);
+        if (!pManager->hSessionHandle)
+            __leave;
+
+        // same as WINHTTP_FLAG_SECURE_DEFAULTS: TLS 1.2 or newer.
+        DWORD dwProtocols = WINHTTP_FLAG_SECURE_PROTOCOL_TLS1_2 | WINHTTP_FLAG_SECURE_PROTOCOL_TLS1_3;
+        if (!WinHttpSetOption(pManager->hSessionHandle, WINHTTP_OPTION_SECURE_PROTOCOLS, &dwProtocols, sizeof(dwProtocols)))
+        {
+            // older systems don't know TLS 1.3
+            dwProtocols = WINHTTP_FLAG_SECURE_PROTOCOL_TLS1_2;
+            if (!WinHttpSetOption(pManager->hSessionHandle, WINHTTP_OPTION_SECURE_PROTOCOLS, &dwProtocols, sizeof(dwProtocols)))
+                __leave;
+        }
+        WinHttpSetStatusCallback(pManager->hSessionHandle, WinHttpStatusCallback, WINHTTP_CALLBACK_FLAG_ALL_NOTIFICATIONS, 0);
+
+        pManager->Pool = CreateThreadpool(NULL);
+        if (!pManager->Pool)
+            __leave;
+        SetThreadpoolThreadMaximum(pManager->Pool, MaxThreads ? MaxThreads : 1);
+        if (!SetThreadpoolThreadMinimum(pManager->Pool, 1))
+            __leave;
+        SetThreadpoolCallbackPool(&pManager->CallbackEnviron, pManager->Pool);
+
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if (!bSuccess)
+        {
+            if (pManager->Pool) CloseThreadpool(pManager->Pool);
+            if (pManager->hSessionHandle) WinHttpCloseHandle(pManager->hSessionHandle);
+            DestroyThreadpoolEnvironment(&pManager->CallbackEnviron);
+            MwsFree(&Allocator, pManager);
+            pManager = NULL;
+        }
+    }
+    return pManager;
+}
+
+_Ret_maybenull_
+PMIRAI_WS AttachMiraiWS(_In_ PMIRAI_WS_MANAGER pManager, _In_z_ LPCWSTR lpServerName, _In_ INTERNET_PORT Port, _In_ BOOL bSecure, _In_ MWSCALLBACK Callback)
+{
+    InterlockedIncrement(&pManager->Connections);
+    PMIRAI_WS pMiraiWS = AllocMiraiWS(pManager, lpServerName, Port, bSecure, Callback, NULL);
+    if (!pMiraiWS)
+        InterlockedDecrement(&pManager->Connections);
+    return pMiraiWS;
+}
+
+BOOL DestroyMiraiWSManager(_In_ _Frees_ptr_ PMIRAI_WS_MANAGER pManager)
+{
+    if (ReadAcquire(&pManager->Connections) != 0)
+    {
+        SetLastError(ERROR_BUSY);
+        return FALSE;
+    }
+
+    WinHttpSetStatusCallback(pManager->hSessionHandle, NULL, WINHTTP_CALLBACK_FLAG_ALL_NOTIFICATIONS, 0);
+    WinHttpCloseHandle(pManager->hSessionHandle);
+
+    CloseThreadpool(pManager->Pool);
+    DestroyThreadpoolEnvironment(&pManager->CallbackEnviron);
+
+    PMWS_FRAME pFrame;
+    while ((pFrame = (PMWS_FRAME)InterlockedPopEntrySList(&pManager->FramePool.FreeFrames)) != NULL)
+        FreeFrame(pManager->FramePool.pAllocator, pFrame);
+
+    MWS_ALLOCATOR Allocator = pManager->Allocator;
+    MwsFree(&Allocator, pManager);
+    return TRUE;
+}
+
+_Success_(return)
+static BOOL CreateWebsockAdapterJson(_In_ const MWS_ALLOCATOR* pAllocator, _In_ INT64 SyncID, _In_z_ LPCSTR Command, _In_opt_z_ LPCSTR SubCommand, _Outptr_result_nullonfailure_ yyjson_mut_doc **pDoc, _Outptr_result_nullonfailure_ yyjson_mut_val **pContent)
+{
+    BOOL bSuccess = FALSE;
+    yyjson_mut_doc* Doc = NULL;
+    yyjson_mut_val* Root = NULL;
+    yyjson_mut_val* Content = NULL;
+    yyjson_alc Alc = MwsJsonAlc(pAllocator);
+
+    __try
+    {
+        Doc = yyjson_mut_doc_new(&Alc);
+        if (!Doc) __leave;
+        Root = yyjson_mut_obj(Doc);
+        if (!Root) __leave;
+        yyjson_mut_doc_set_root(Doc, Root);
+        yyjson_mut_obj_add_int(Doc, Root, "syncId", SyncID);
+        yyjson_mut_obj_add_str(Doc, Root, "command", Command);
+
+        if (SubCommand)
+            yyjson_mut_obj_add_str(Doc, Root, "subCommand", SubCommand);
+        else
+            yyjson_mut_obj_add_null(Doc, Root, "subCommand");
+
+        Content = yyjson_mut_obj(Doc);
+        if (!Content)
+            __leave;
+        yyjson_mut_obj_add_val(Doc, Root, "content", Content);
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if (!bSuccess)
+        {
+            yyjson_mut_doc_free(Doc);
+            Doc = NULL;
+            Content = NULL;
+        }
+    }
+
+    *pDoc = Doc;
+    *pContent = Content;
+
+    return bSuccess;
+}
+
+/// <summary>
+/// Parse json text into a value of Doc.
+/// </summary>
+/// <returns>the value, or NULL if the text is not json</returns>
+static yyjson_mut_val* CopyJsonText(_In_ const MWS_ALLOCATOR* pAllocator, _In_ yyjson_mut_doc* Doc, _In_z_ LPCSTR lpJson)
+{
+    yyjson_alc Alc = MwsJsonAlc(pAllocator);
+    yyjson_doc* ValueDoc = yyjson_read_opts((char*)lpJson, strlen(lpJson), 0, &Alc, NULL);
+    if (!ValueDoc)
+        return NULL;
+
+    yyjson_mut_val* Value = yyjson_val_mut_copy(Doc, yyjson_doc_get_root(ValueDoc));
+    yyjson_doc_free(ValueDoc);
+    return Value;
+}
+
+static BOOL WriteBlockField(_In_ const MWS_ALLOCATOR* pAllocator, _In_ yyjson_mut_doc* Doc, _In_ yyjson_mut_val* BlockNode, _In_ const BLOCK_FIELD* pField, _In_ const MESSAGE_BLOCK* pBlock)
+{
+    if (pField->bReceiveOnly)
+        return TRUE;
+
+    switch (pField->Type)
+    {
+    case BF_INT:
+    {
+        INT64 Value = *BLOCK_MEMBER(pBlock, pField, const INT64);
+        if (pField->bOptional && !Value)
+            return TRUE;
+        return yyjson_mut_obj_add_int(Doc, BlockNode, pField->lpKey, Value);
+    }
+    case BF_BOOL:
+    {
+        BOOL Value = *BLOCK_MEMBER(pBlock, pField, const BOOL);
+        if (pField->bOptional && !Value)
+            return TRUE;
+        return yyjson_mut_obj_add_bool(Doc, BlockNode, pField->lpKey, (bool)Value);
+    }
+    case BF_STR:
+    case BF_JSON:
+    case BF_NAME:
+    {
+        LPCWSTR lpValue = *BLOCK_MEMBER(pBlock, pField, const LPCWSTR);
+        if (!lpValue)
+            return pField->bOptional;
+
+        LPSTR lpUtf8 = StrWideToUtf8(pAllocator, lpValue, -1, NULL);
+        if (!lpUtf8)
+            return FALSE;
+
+        BOOL bSuccess = FALSE;
+        if (pField->Type != BF_JSON)
+        {
+            bSuccess = yyjson_mut_obj_add_strcpy(Doc, BlockNode, pField->lpKey, lpUtf8);
+        }
+        else
+        {
+            yyjson_mut_val* Value = CopyJsonText(pAllocator, Doc, lpUtf8);
+            bSuccess = Value && yyjson_mut_obj_add_val(Doc, BlockNode, pField->lpKey, Value);
+        }
+        MwsFree(pAllocator, lpUtf8);
+        return bSuccess;
+    }
+    }
+    return FALSE;
+}
+
+yyjson_mut_val* GetMessageChainJson(_In_ const MWS_ALLOCATOR* pAllocator, _In_ yyjson_mut_doc *Doc, _In_ MESSAGE_CHAIN* pMessageChain)
+{
+    yyjson_mut_val* MsgChain = yyjson_mut_arr(Doc);
+    if (!MsgChain)
+        return NULL;
+    for (int i = 0; i < pMessageChain->BlockCnt; i++)
+    {
+        const MESSAGE_BLOCK* pBlock = pMessageChain->MessageBlocks + i;
+        if (!ValidateMessageBlock(pBlock))
+            return NULL;
+
+        yyjson_mut_val* MsgBlockNode = yyjson_mut_obj(Doc);
+        if (!MsgBlockNode)
+            return NULL;
+
+        const BLOCK_CODEC* pCodec = &BlockCodecs[pBlock->Type];
+        BOOL bFlag = pCodec->lpFlagName && *(const BOOL*)((const BYTE*)pBlock + pCodec->FlagOffset);
+        yyjson_mut_obj_add_str(Doc, MsgBlockNode, "type", bFlag ? pCodec->lpFlagName : pCodec->lpName);
+
+        for (int j = 0; j < pCodec->FieldCnt; j++)
+        {
+            if (!WriteBlockField(pAllocator, Doc, MsgBlockNode, pCodec->Fields + j, pBlock))
+                return NULL;
+        }
+        yyjson_mut_arr_append(MsgChain, MsgBlockNode);
+    }
+    return MsgChain;
+}
+
+static BOOL AddCommandArg(_In_ const MWS_ALLOCATOR* pAllocator, _In_ yyjson_mut_doc* Doc, _In_ yyjson_mut_val* Content, _In_ const MWS_COMMAND_ARG* pArg)
+{
+    switch (pArg->Type)
+    {
+    case MWS_ARG_INT:
+        return yyjson_mut_obj_add_int(Doc, Content, pArg->Key, pArg->Int);
+    case MWS_ARG_BOOL:
+        return yyjson_mut_obj_add_bool(Doc, Content, pArg->Key, (bool)pArg->Bool);
+    case MWS_ARG_STR:
+    {
+        LPSTR lpUtf8 = StrWideToUtf8(pAllocator, pArg->Str, -1, NULL);
+        if (!lpUtf8)
+            return FALSE;
+
+        BOOL bSuccess = yyjson_mut_obj_add_strcpy(Doc, Content, pArg->Key, lpUtf8);
+        MwsFree(pAllocator, lpUtf8);
+        return bSuccess;
+    }
+    case MWS_ARG_CHAIN:
+    {
+        yyjson_mut_val* MsgChain = GetMessageChainJson(pAllocator, Doc, pArg->pChain);
+        return MsgChain && yyjson_mut_obj_add_val(Doc, Content, pArg->Key, MsgChain);
+    }
+    case MWS_ARG_JSON:
+    {
+        yyjson_mut_val* Value = CopyJsonText(pAllocator, Doc, pArg->Json);
+        return Value && yyjson_mut_obj_add_val(Doc, Content, pArg->Key, Value);
+    }
+    }
+    return FALSE;
+}
+
+BOOL SendCommandFrame(
+    _In_ PMIRAI_WS pMiraiWS,
+    _In_ INT64 AsyncID,
+    _In_ int AsyncSlot,
+    _In_reads_(cbText) LPCSTR lpText,
+    _In_ SIZE_T cbText,
+    _In_ LONGLONG TraceStart)
+{
+    if (TraceStart)
+    {
+        TraceSpan(MWS_SPAN_SERIALIZE, pMiraiWS, TraceStart, AsyncID, MWSBIN_EV_UNKNOWN);
+        TraceStart = ReadPerfClock();
+    }
+    if (WinHttpWebSocketSend(pMiraiWS->hWebSocketHandle, WINHTTP_WEB_SOCKET_UTF8_MESSAGE_BUFFER_TYPE, (PVOID)lpText, (DWORD)cbText) != NO_ERROR)
+        return FALSE;
+    if (TraceStart)
+        TraceSpan(MWS_SPAN_SEND, pMiraiWS, TraceStart, AsyncID, MWSBIN_EV_UNKNOWN);
+
+    if (pMiraiWS->pMetrics)
+    {
+        MarkAsyncCallWritten(AsyncSlot, AsyncID);
+        MetricsAdd(pMiraiWS->pMetrics, MWS_CTR_REQUESTS_SENT, 1);
+    }
+    return TRUE;
+}
+
+static BOOL SendCommand(
+    _In_ PMIRAI_WS pMiraiWS,
+    _In_ ASYNC_CALL_TYPE Type,
+    _In_z_ LPCSTR lpCommand,
+    _In_opt_z_ LPCSTR lpSubCommand,
+    _In_reads_opt_(ArgCnt) const MWS_COMMAND_ARG* pArgs,
+    _In_ UINT ArgCnt,
+    _In_opt_ LPVOID Callback,
+    _In_opt_ LPVOID Context)
+{
+    BOOL bSuccess = FALSE;
+    int AsyncSlot;
+    const MWS_COMMAND* pCommand = FindMiraiWSCommand(lpCommand, lpSubCommand);
+    INT64 AsyncID = GetAsyncCallID(Type, pCommand, Callback, Context, &AsyncSlot);
+    if (!AsyncID)
+        return FALSE;
+
+    yyjson_mut_doc* Doc = NULL;
+    yyjson_mut_val* Content = NULL;
+    LPSTR lpJsonText = NULL;
+    __try
+    {
+        LONGLONG TraceStart = MWS_TRACING() ? ReadPerfClock() : 0;
+        // "other" is shared by every command not in the table, the result tells the names the caller sent.
+        if (pCommand == CommandTable + _countof(CommandTable) - 1 &&
+            !SetAsyncCallCommandName(&pMiraiWS->Allocator, AsyncSlot, AsyncID, lpCommand, lpSubCommand))
+            __leave;
+        if (!CreateWebsockAdapterJson(&pMiraiWS->Allocator, AsyncID, lpCommand, lpSubCommand, &Doc, &Content))
+            __leave;
+
+        for (UINT i = 0; i < ArgCnt; i++)
+        {
+            if (!AddCommandArg(&pMiraiWS->Allocator, Doc, Content, pArgs + i))
+                __leave;
+        }
+
+        SIZE_T JsonLen;
+        yyjson_alc Alc = MwsJsonAlc(&pMiraiWS->Allocator);
+        lpJsonText = yyjson_mut_write_opts(Doc, 0, &Alc, &JsonLen, NULL);
+        if (!lpJsonText)
+            __leave;
+
+        bSuccess = SendCommandFrame(pMiraiWS, AsyncID, AsyncSlot, lpJsonText, JsonLen, TraceStart);
+    }
+    __finally
+    {
+        if (lpJsonText)
+        {
+            MwsFree(&pMiraiWS->Allocator, lpJsonText);
+        }
+        if (!bSuccess)
+        {
+            RemoveAsyncCallID(AsyncID, NULL, NULL, NULL, NULL);
+        }
+        if (Doc) yyjson_mut_doc_free(Doc);
+    }
+    return bSuccess;
+}
+
+BOOL SendFriendMsgAsync(
+    _In_ PMIRAI_WS pMiraiWS,
+    _In_ INT64 Target,
+    _In_ MESSAGE_CHAIN* pMessageChain,
+    _In_opt_ SEND_MSG_CALLBACK Callback,
+    _In_opt_ LPVOID Context)
+{
+    MWS_COMMAND_ARG Args[] = { MWS_INT_ARG("target", Target), MWS_CHAIN_ARG("messageChain", pMessageChain) };
+    return SendCommand(pMiraiWS, ASYNC_SENDMSG, "sendFriendMessage", NULL, Args, _countof(Args), Callback, Context);
+}
+
+BOOL SendGroupMsgAsync(
+    _In_ PMIRAI_WS pMiraiWS,
+    _In_ INT64 Target,
+    _In_ MESSAGE_CHAIN* pMessageChain,
+    _In_opt_ SEND_MSG_CALLBACK Callback,
+    _In_opt_ LPVOID Context
+)
+{
+    MWS_COMMAND_ARG Args[] = { MWS_INT_ARG("target", Target), MWS_CHAIN_ARG("messageChain", pMessageChain) };
+    return SendCommand(pMiraiWS, ASYNC_SENDMSG, "sendGroupMessage", NULL, Args, _countof(Args), Callback, Context);
+}
+
+BOOL SendMiraiWSCommandAsync(
+    _In_ PMIRAI_WS pMiraiWS,
+    _In_z_ LPCSTR lpCommand,
+    _In_opt_z_ LPCSTR lpSubCommand,
+    _In_reads_opt_(ArgCnt) const MWS_COMMAND_ARG* pArgs,
+    _In_ UINT ArgCnt,
+    _In_opt_ MWS_COMMAND_CALLBACK Callback,
+    _In_opt_ LPVOID Context)
+{
+    return SendCommand(pMiraiWS, ASYNC_COMMAND, lpCommand, lpSubCommand, pArgs, ArgCnt, Callback, Context);
+}
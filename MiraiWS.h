@@ -1,248 +1,969 @@
-#pragma once
-
-#include <Windows.h>
-#include <WinHttp.h>
-
-EXTERN_C_START
-
-#define MIRAI_WS_MAXBUF (1LL << 16)
-
-typedef enum _MESSAGE_BLOCK_TYPE
-{
-    MB_AT = 1,
-    MB_ATALL,
-    MB_FACE,
-    MB_PLAIN,
-    MB_IMAGE, // FlashImage is also here
-    MB_VOICE,
-    MB_XML,
-    MB_JSON,
-    MB_APP,
-    MB_POKE,
-    MB_DICE,
-    MB_MARKETFACE,
-    MB_MUSICSHARE,
-    MB_FORWARD,
-    MB_FILE
-} MESSAGE_BLOCK_TYPE;
-
-typedef struct _MESSAGE_BLOCK MESSAGE_BLOCK, *PMESSAGE_BLOCK;
-typedef struct _MESSAGE_BLOCK
-{
-    MESSAGE_BLOCK_TYPE Type;
-    union
-    {
-        struct
-        {
-            INT64 Target;
-            LPWSTR Display;
-        } At;
-        struct
-        {
-            INT64 FaceID;
-        } Face;
-        struct
-        {
-            LPWSTR Text;
-        } Plain;
-        struct
-        {
-            BOOL IsFlash;
-            LPWSTR ImageIDStr;
-            LPWSTR URL;
-            
-            LPWSTR ImageType; // not documented in mirai-api-http, but sent in json
-            BOOL IsEmoji;     // not documented in mirai-api-http, but sent in json
-        } Image;
-        struct
-        {
-            LPWSTR VoiceIDStr;
-            LPWSTR URL;
-            INT64 Length;
-        } Voice;
-    };
-} MESSAGE_BLOCK;
-
-typedef struct
-{
-    INT64 ID;
-    INT64 Timestamp;
-
-    PMESSAGE_BLOCK MessageBlocks;
-    int BlockCnt;
-} MESSAGE_CHAIN;
-
-// Event Types
-
-// sent after ConnectMiraiWS is called.
-// pInformation is pointer to MWS_CONNECTINFO
-// when failed, dwError contains reason.
-#define MWS_CONNECT 1
-
-// some network error happened and MiraiWS have shutdown the connection
-// pInformation is pointer to MWS_NWERRORINFO
-// dwError contains reason.
-#define MWS_NWERROR 2
-
-// received an message and failed to parse
-// pInformation is pointer to MWS_BADMSGINFO
-// Message and Length contains the raw json message received
-#define MWS_BADMSG  3
-
-// received an authentication message, usually first message after connection
-// ResponseCode is the code mirai sent
-// may contain Session or Message.
-#define MWS_AUTH    4
-
-// received a friend's message
-// MessageChain contains the message received
-// Sender contains sender information
-#define MWS_FRIENDMSG 5
-
-// received a group message
-// MessageChain contains the message received
-// Sender contains sender and group information
-#define MWS_GROUPMSG 6
-
-
-typedef struct
-{
-    BOOL bSuccess;
-    DWORD dwError;
-} MWS_CONNECTINFO;
-
-typedef struct
-{
-    DWORD dwError;
-} MWS_NWERRORINFO;
-
-typedef struct
-{
-    LPCWSTR Message;
-    SIZE_T Length;
-} MWS_BADMSGINFO;
-
-typedef struct
-{
-    INT64 ResponseCode;
-    LPCWSTR Session;
-    LPCWSTR Message;
-} MWS_AUTHINFO;
-
-typedef struct
-{
-    struct
-    {
-        INT64 ID;
-        LPWSTR Nick;
-        LPWSTR Remark;
-    } Sender;
-    MESSAGE_CHAIN MessageChain;
-} MWS_FRIENDMSGINFO;
-
-typedef struct
-{
-    struct
-    {
-        INT64 ID;
-        LPWSTR MemberName;
-        LPWSTR SpecialTitle;
-        LPWSTR Permission;
-        INT64 JoinTimestamp;
-        INT64 LastSpeakTimestamp;
-        INT64 MuteTimeRemaining;
-
-        struct
-        {
-            INT64 ID;
-            LPWSTR Name;
-            LPWSTR Permission;
-        } Group;
-    } Sender;
-    MESSAGE_CHAIN MessageChain;
-} MWS_GROUPMSGINFO;
-
-typedef struct _MIRAI_WS MIRAI_WS, * PMIRAI_WS;
-
-typedef VOID(*MWSCALLBACK)(_In_ PMIRAI_WS pMiraiWS, _In_ UINT EventType, _In_ PVOID pInformation);
-
-typedef VOID(*SEND_MSG_CALLBACK)(_In_ PMIRAI_WS pMiraiWS, _In_ INT64 RetCode, _In_z_ LPCWSTR lpMessage, _In_ INT64 MessageCode, _In_ LPVOID Context);
-
-typedef struct _MIRAI_WS
-{
-    HINTERNET hSessionHandle;
-    HINTERNET hConnectionHandle;
-    HINTERNET hRequestHandle;
-    HINTERNET hWebSocketHandle;
-
-    LPWSTR        lpServerName;
-    INTERNET_PORT Port;
-    BOOL          bSecure;
-
-    BYTE          Buffer[MIRAI_WS_MAXBUF];
-    SIZE_T        RecvLength;
-
-    MWSCALLBACK Callback;
-    BOOL bClose;
-}MIRAI_WS, * PMIRAI_WS;
-
-_Ret_maybenull_
-/// <summary>
-/// Create a instance of mirai websocket. Call ConnectMiraiWS to connect it.
-/// </summary>
-/// <param name="lpServerName">Server Name or IP Address</param>
-/// <param name="Port">Server Port</param>
-/// <param name="bSecure">Enable TLS 1.2 or newer.</param>
-/// <returns>return a handle of mirai websock on success</returns>
-PMIRAI_WS CreateMiraiWS(_In_z_ LPCWSTR lpServerName, _In_ INTERNET_PORT Port, _In_ BOOL bSecure, _In_ MWSCALLBACK Callback);
-
-/// <summary>
-/// Try connect to mirai
-/// </summary>
-/// <param name="pMiraiWS">handle created by CreateMiraiWS</param>
-/// <param name="szVerifyKey">Verify key filled in mirai-api-http config file</param>
-/// <param name="szQQ">QQ to connect to, in string</param>
-/// <returns>return TRUE on success</returns>
-BOOL ConnectMiraiWS(_Inout_ PMIRAI_WS pMiraiWS, _In_z_ LPCWSTR szVerifyKey, _In_z_ LPCWSTR szQQ);
-
-/// <summary>
-/// Destroy a instance of mirai websocket, asynchronously.
-/// </summary>
-/// <param name="pMiraiWS">handle created by CreateMiraiWS</param>
-/// <returns>return TRUE on success</returns>
-BOOL DestroyMiraiWSAsync(_In_ _Frees_ptr_ PMIRAI_WS pMiraiWS);
-
-/// <summary>
-/// Send a message to a friend
-/// </summary>
-/// <param name="pMiraiWS">handle created by CreateMiraiWS</param>
-/// <param name="Target">target QQ id the message will be sent to</param>
-/// <param name="pMessageChain">the message to send</param>
-/// <param name="Callback">An optional callback to notify the sending result</param>
-/// <param name="Context">user defined context to pass to Callback</param>
-/// <returns>TRUE on success, callback will be called, if given, when sending finished.</returns>
-BOOL SendFriendMsgAsync(
-    _In_ PMIRAI_WS pMiraiWS,
-    _In_ INT64 Target,
-    _In_ MESSAGE_CHAIN* pMessageChain,
-    _In_opt_ SEND_MSG_CALLBACK Callback,
-    _In_opt_ LPVOID Context);
-
-/// <summary>
-/// Send a message to a group
-/// </summary>
-/// <param name="pMiraiWS">handle created by CreateMiraiWS</param>
-/// <param name="Target">target Group id the message will be sent to</param>
-/// <param name="pMessageChain">the message to send</param>
-/// <param name="Callback">An optional callback to notify the sending result</param>
-/// <param name="Context">user defined context to pass to Callback</param>
-/// <returns>TRUE on success, callback will be called, if given, when sending finished.</returns>
-BOOL SendGroupMsgAsync(
-    _In_ PMIRAI_WS pMiraiWS,
-    _In_ INT64 Target,
-    _In_ MESSAGE_CHAIN* pMessageChain,
-    _In_opt_ SEND_MSG_CALLBACK Callback,
-    _In_opt_ LPVOID Context
-);
-
+#pragma once
+
+#include <Windows.h>
+#include <WinHttp.h>
+
+EXTERN_C_START
+
+#define MIRAI_WS_MAXBUF (1LL << 16)
+
+// how many frames can be in flight between network read, json parse and dispatch.
+// must be a power of 2.
+#define MIRAI_WS_PIPELINE_DEPTH 8
+
+// responses with a list too large for one frame (memberList of a large group and the like) are received in batches:
+// the callback is called once per batch of at most this many items, with bMore set on all but the last.
+// A response that can't be cut into batches completes its call with MWS_CODE_DISCARDED.
+#define MIRAI_WS_LIST_BATCH 128
+
+typedef enum _MESSAGE_BLOCK_TYPE
+{
+    MB_AT = 1,
+    MB_ATALL,
+    MB_FACE,
+    MB_PLAIN,
+    MB_IMAGE, // FlashImage is also here
+    MB_VOICE,
+    MB_XML,
+    MB_JSON,
+    MB_APP,
+    MB_POKE,
+    MB_DICE,
+    MB_MARKETFACE,
+    MB_MUSICSHARE,
+    MB_FORWARD,
+    MB_FILE
+} MESSAGE_BLOCK_TYPE;
+
+// permission of a member in a group, decoded from "OWNER", "ADMINISTRATOR" or "MEMBER".
+typedef enum _MWS_PERMISSION
+{
+    MWS_PERMISSION_UNKNOWN = 0, // anything else mirai may send
+    MWS_PERMISSION_MEMBER,
+    MWS_PERMISSION_ADMINISTRATOR,
+    MWS_PERMISSION_OWNER
+} MWS_PERMISSION;
+
+typedef struct _MESSAGE_BLOCK MESSAGE_BLOCK, *PMESSAGE_BLOCK;
+typedef struct _MESSAGE_BLOCK
+{
+    MESSAGE_BLOCK_TYPE Type;
+    union
+    {
+        struct
+        {
+            INT64 Target;
+            LPWSTR Display;
+        } At;
+        struct
+        {
+            INT64 FaceID;
+            LPWSTR Name; // filled when receiving, never sent
+        } Face;
+        struct
+        {
+            LPWSTR Text;
+        } Plain;
+        struct
+        {
+            BOOL IsFlash;
+            LPWSTR ImageIDStr;
+            LPWSTR URL;
+            
+            LPCWSTR ImageType; // not documented in mirai-api-http, but sent in json. In the chain of an event info it belongs
+                               // to the connection, only valid during the callback. UnpackMiraiWSChain makes a copy
+            BOOL IsEmoji;     // not documented in mirai-api-http, but sent in json
+        } Image;
+        struct
+        {
+            LPWSTR VoiceIDStr;
+            LPWSTR URL;
+            INT64 Length;
+        } Voice;
+        struct
+        {
+            LPWSTR Xml;
+        } Xml;
+        struct
+        {
+            LPWSTR Json;
+        } Json;
+        struct
+        {
+            LPWSTR Content;
+        } App;
+        struct
+        {
+            LPWSTR Name; // Poke, ShowLove, Like, Heartbroken, SixSixSix or FangDaZhao
+        } Poke;
+        struct
+        {
+            INT64 Value;
+        } Dice;
+        struct
+        {
+            INT64 ID;
+            LPWSTR Name;
+        } MarketFace;
+        struct
+        {
+            LPWSTR Kind; // NeteaseCloudMusic, QQMusic or MiguMusic
+            LPWSTR Title;
+            LPWSTR Summary;
+            LPWSTR JumpURL;
+            LPWSTR PictureURL;
+            LPWSTR MusicURL;
+            LPWSTR Brief;
+        } MusicShare;
+        struct
+        {
+            LPWSTR NodeList; // the json array of forwarded messages as text, it nests whole message chains
+        } Forward;
+        struct
+        {
+            LPWSTR FileID;
+            LPWSTR Name;
+            INT64 Size;
+        } File;
+    };
+} MESSAGE_BLOCK;
+
+// utf8 string inside the received json, zero-terminated. Never NULL, "" when missing.
+typedef struct
+{
+    LPCSTR Ptr;
+    SIZE_T Len;
+} MWS_STRING;
+
+// message chain inside the received json, decode it with UnpackMiraiWSChain when the blocks are needed.
+typedef struct
+{
+    INT64 ID;         // of the Source block, 0 if there is none
+    INT64 Timestamp;
+    SIZE_T BlockCnt;  // Source included
+    const VOID* Node; // the json array
+} MWS_CHAINVIEW;
+
+// the message a received chain replies to.
+typedef struct
+{
+    INT64 ID;       // of the quoted message, 0 when the chain replies to nothing
+    INT64 GroupID;  // 0 for friend messages
+    INT64 SenderID;
+    INT64 TargetID; // the group, or the friend the quoted message was sent to
+    MWS_CHAINVIEW Origin; // the quoted message without Source. Borrowed, only valid during the callback
+} MWS_QUOTE;
+
+typedef struct
+{
+    INT64 ID;
+    INT64 Timestamp;
+
+    PMESSAGE_BLOCK MessageBlocks;
+    int BlockCnt;
+
+    MWS_QUOTE Quote; // filled for received chains only, not sent
+} MESSAGE_CHAIN;
+
+// Event Types
+
+// sent after ConnectMiraiWS is called.
+// pInformation is pointer to MWS_CONNECTINFO
+// when failed, dwError contains reason.
+#define MWS_CONNECT 1
+
+// some network error happened and MiraiWS have shutdown the connection
+// pInformation is pointer to MWS_NWERRORINFO
+// dwError contains reason.
+#define MWS_NWERROR 2
+
+// received an message and failed to parse
+// pInformation is pointer to MWS_BADMSGINFO
+// Message and Length contains the raw json message received
+#define MWS_BADMSG  3
+
+// received an authentication message, usually first message after connection
+// ResponseCode is the code mirai sent
+// may contain Session or Message.
+#define MWS_AUTH    4
+
+// received a friend's message
+// MessageChain contains the message received
+// Sender contains sender information
+#define MWS_FRIENDMSG 5
+
+// received a group message
+// MessageChain contains the message received
+// Sender contains sender and group information
+#define MWS_GROUPMSG 6
+
+// Every other event of mirai, in the order of its documentation. pInformation points to the struct named beside it.
+// These structs borrow from the received json: MWS_STRING and MWS_CHAINVIEW are only valid during the callback,
+// copy what you need to keep. Fields an event lacks are 0 or empty.
+
+#define MWS_TEMPMSG                         7  // MWS_TEMPMSGINFO
+#define MWS_STRANGERMSG                     8  // MWS_STRANGERMSGINFO
+#define MWS_OTHERCLIENTMSG                  9  // MWS_OTHERCLIENTMSGINFO
+#define MWS_FRIENDSYNCMSG                   10 // MWS_FRIENDSYNCMSGINFO, a message sent by another client of the bot
+#define MWS_GROUPSYNCMSG                    11 // MWS_GROUPSYNCMSGINFO
+#define MWS_TEMPSYNCMSG                     12 // MWS_TEMPSYNCMSGINFO
+#define MWS_STRANGERSYNCMSG                 13 // MWS_FRIENDSYNCMSGINFO
+#define MWS_BOTONLINE                       14 // MWS_BOTINFO
+#define MWS_BOTOFFLINEACTIVE                15 // MWS_BOTINFO
+#define MWS_BOTOFFLINEFORCE                 16 // MWS_BOTINFO
+#define MWS_BOTOFFLINEDROPPED               17 // MWS_BOTINFO
+#define MWS_BOTRELOGIN                      18 // MWS_BOTINFO
+#define MWS_FRIENDINPUTSTATUSCHANGED        19 // MWS_FRIENDINPUTSTATUSINFO
+#define MWS_FRIENDNICKCHANGED               20 // MWS_FRIENDNICKINFO
+#define MWS_BOTGROUPPERMISSIONCHANGE        21 // MWS_BOTGROUPPERMISSIONINFO
+#define MWS_BOTMUTE                         22 // MWS_BOTMUTEINFO
+#define MWS_BOTUNMUTE                       23 // MWS_BOTMUTEINFO
+#define MWS_BOTJOINGROUP                    24 // MWS_BOTGROUPINFO, Operator is the invitor
+#define MWS_BOTLEAVEACTIVE                  25 // MWS_BOTGROUPINFO
+#define MWS_BOTLEAVEKICK                    26 // MWS_BOTGROUPINFO
+#define MWS_BOTLEAVEDISBAND                 27 // MWS_BOTGROUPINFO
+#define MWS_GROUPRECALL                     28 // MWS_GROUPRECALLINFO
+#define MWS_FRIENDRECALL                    29 // MWS_FRIENDRECALLINFO
+#define MWS_NUDGE                           30 // MWS_NUDGEINFO
+#define MWS_GROUPNAMECHANGE                 31 // MWS_GROUPCHANGEINFO
+#define MWS_GROUPENTRANCEANNOUNCEMENTCHANGE 32 // MWS_GROUPCHANGEINFO
+#define MWS_GROUPMUTEALL                    33 // MWS_GROUPSWITCHINFO
+#define MWS_GROUPALLOWANONYMOUSCHAT         34 // MWS_GROUPSWITCHINFO
+#define MWS_GROUPALLOWCONFESSTALK           35 // MWS_GROUPSWITCHINFO, carries no Operator
+#define MWS_GROUPALLOWMEMBERINVITE          36 // MWS_GROUPSWITCHINFO
+#define MWS_MEMBERJOIN                      37 // MWS_MEMBERINFO, Operator is the invitor
+#define MWS_MEMBERLEAVEKICK                 38 // MWS_MEMBERINFO
+#define MWS_MEMBERLEAVEQUIT                 39 // MWS_MEMBERINFO
+#define MWS_MEMBERCARDCHANGE                40 // MWS_MEMBERCHANGEINFO
+#define MWS_MEMBERSPECIALTITLECHANGE        41 // MWS_MEMBERCHANGEINFO
+#define MWS_MEMBERPERMISSIONCHANGE          42 // MWS_MEMBERCHANGEINFO
+#define MWS_MEMBERMUTE                      43 // MWS_MEMBERINFO
+#define MWS_MEMBERUNMUTE                    44 // MWS_MEMBERINFO
+#define MWS_MEMBERHONORCHANGE               45 // MWS_MEMBERHONORINFO
+#define MWS_NEWFRIENDREQUEST                46 // MWS_REQUESTINFO
+#define MWS_MEMBERJOINREQUEST               47 // MWS_REQUESTINFO
+#define MWS_BOTINVITEDJOINGROUPREQUEST      48 // MWS_REQUESTINFO
+#define MWS_OTHERCLIENTONLINE               49 // MWS_OTHERCLIENTINFO
+#define MWS_OTHERCLIENTOFFLINE              50 // MWS_OTHERCLIENTINFO
+#define MWS_COMMANDEXECUTED                 51 // MWS_COMMANDEXECUTEDINFO
+
+// the last event of a connection, after DestroyMiraiWSAsync closed it and no other callback can come. Also raised for
+// connections that never connected or failed to.
+// pInformation is NULL, free what Context of the connection points to. pMiraiWS is freed right after.
+#define MWS_CLOSED                          52
+
+
+typedef struct
+{
+    BOOL bSuccess;
+    DWORD dwError;
+} MWS_CONNECTINFO;
+
+typedef struct
+{
+    DWORD dwError;
+} MWS_NWERRORINFO;
+
+typedef struct
+{
+    LPCWSTR Message;
+    SIZE_T Length;
+} MWS_BADMSGINFO;
+
+typedef struct
+{
+    INT64 ResponseCode;
+    LPCWSTR Session;
+    LPCWSTR Message;
+} MWS_AUTHINFO;
+
+typedef struct
+{
+    struct
+    {
+        INT64 ID;
+        LPWSTR Nick;
+        LPWSTR Remark;
+    } Sender;
+    MESSAGE_CHAIN MessageChain;
+    MWS_CHAINVIEW View; // the same chain as received, for FindMiraiWSViewBlock and MatchMiraiWSChain. Only valid during the callback
+} MWS_FRIENDMSGINFO;
+
+typedef struct
+{
+    struct
+    {
+        INT64 ID;
+        LPWSTR MemberName;
+        LPWSTR SpecialTitle;
+        LPCWSTR Permission; // belongs to the connection like Group.Name and Group.Permission, never free them. Only valid during the callback
+        MWS_PERMISSION PermissionLevel;
+        INT64 JoinTimestamp;
+        INT64 LastSpeakTimestamp;
+        INT64 MuteTimeRemaining;
+
+        struct
+        {
+            INT64 ID;
+            LPCWSTR Name;
+            LPCWSTR Permission; // of the bot
+            MWS_PERMISSION PermissionLevel;
+        } Group;
+    } Sender;
+    MESSAGE_CHAIN MessageChain;
+    MWS_CHAINVIEW View; // the same chain as received, see MWS_FRIENDMSGINFO
+} MWS_GROUPMSGINFO;
+
+typedef struct
+{
+    INT64 ID;
+    MWS_STRING Nick;
+    MWS_STRING Remark;
+} MWS_FRIENDVIEW;
+
+typedef struct
+{
+    INT64 ID;
+    MWS_STRING Name;
+    MWS_STRING Permission; // of the bot
+    MWS_PERMISSION PermissionLevel;
+} MWS_GROUPVIEW;
+
+// ID is 0 where an event's operator is the bot itself, or there is no invitor.
+typedef struct
+{
+    INT64 ID;
+    MWS_STRING MemberName;
+    MWS_STRING SpecialTitle;
+    MWS_STRING Permission;
+    MWS_PERMISSION PermissionLevel;
+    INT64 JoinTimestamp;
+    INT64 LastSpeakTimestamp;
+    INT64 MuteTimeRemaining;
+    MWS_GROUPVIEW Group;
+} MWS_MEMBERVIEW;
+
+typedef struct
+{
+    INT64 ID;
+    MWS_STRING Platform;
+} MWS_CLIENTVIEW;
+
+typedef struct
+{
+    MWS_MEMBERVIEW Sender;
+    MWS_CHAINVIEW MessageChain;
+} MWS_TEMPMSGINFO;
+
+typedef struct
+{
+    MWS_FRIENDVIEW Sender;
+    MWS_CHAINVIEW MessageChain;
+} MWS_STRANGERMSGINFO;
+
+typedef struct
+{
+    MWS_CLIENTVIEW Sender;
+    MWS_CHAINVIEW MessageChain;
+} MWS_OTHERCLIENTMSGINFO;
+
+typedef struct
+{
+    MWS_FRIENDVIEW Subject; // who it was sent to
+    MWS_CHAINVIEW MessageChain;
+} MWS_FRIENDSYNCMSGINFO;
+
+typedef struct
+{
+    MWS_GROUPVIEW Subject;
+    MWS_CHAINVIEW MessageChain;
+} MWS_GROUPSYNCMSGINFO;
+
+typedef struct
+{
+    MWS_MEMBERVIEW Subject;
+    MWS_CHAINVIEW MessageChain;
+} MWS_TEMPSYNCMSGINFO;
+
+typedef struct
+{
+    INT64 QQ;
+} MWS_BOTINFO;
+
+typedef struct
+{
+    MWS_FRIENDVIEW Friend;
+    BOOL bInputting;
+} MWS_FRIENDINPUTSTATUSINFO;
+
+typedef struct
+{
+    MWS_FRIENDVIEW Friend;
+    MWS_STRING From;
+    MWS_STRING To;
+} MWS_FRIENDNICKINFO;
+
+typedef struct
+{
+    MWS_STRING Origin;
+    MWS_STRING Current;
+    MWS_GROUPVIEW Group;
+} MWS_BOTGROUPPERMISSIONINFO;
+
+typedef struct
+{
+    INT64 DurationSeconds; // 0 for MWS_BOTUNMUTE
+    MWS_MEMBERVIEW Operator;
+} MWS_BOTMUTEINFO;
+
+typedef struct
+{
+    MWS_GROUPVIEW Group;
+    MWS_MEMBERVIEW Operator;
+} MWS_BOTGROUPINFO;
+
+typedef struct
+{
+    INT64 AuthorID;
+    INT64 MessageID;
+    INT64 Time;
+    MWS_GROUPVIEW Group;
+    MWS_MEMBERVIEW Operator;
+} MWS_GROUPRECALLINFO;
+
+typedef struct
+{
+    INT64 AuthorID;
+    INT64 MessageID;
+    INT64 Time;
+    INT64 Operator;
+} MWS_FRIENDRECALLINFO;
+
+typedef struct
+{
+    INT64 FromID;
+    struct
+    {
+        INT64 ID;
+        MWS_STRING Kind; // "Friend", "Group" or "Stranger"
+    } Subject;
+    MWS_STRING Action;
+    MWS_STRING Suffix;
+    INT64 Target;
+} MWS_NUDGEINFO;
+
+typedef struct
+{
+    MWS_STRING Origin;
+    MWS_STRING Current;
+    MWS_GROUPVIEW Group;
+    MWS_MEMBERVIEW Operator;
+} MWS_GROUPCHANGEINFO;
+
+typedef struct
+{
+    BOOL bOrigin;
+    BOOL bCurrent;
+    MWS_GROUPVIEW Group;
+    MWS_MEMBERVIEW Operator;
+    BOOL bByBot;
+} MWS_GROUPSWITCHINFO;
+
+typedef struct
+{
+    MWS_MEMBERVIEW Member;
+    MWS_MEMBERVIEW Operator;
+    INT64 DurationSeconds; // MWS_MEMBERMUTE only
+} MWS_MEMBERINFO;
+
+typedef struct
+{
+    MWS_STRING Origin;
+    MWS_STRING Current;
+    MWS_MEMBERVIEW Member;
+} MWS_MEMBERCHANGEINFO;
+
+typedef struct
+{
+    MWS_MEMBERVIEW Member;
+    MWS_STRING Action; // "achieve" or "lose"
+    MWS_STRING Honor;
+} MWS_MEMBERHONORINFO;
+
+// answer these with the matching command, passing EventID back.
+typedef struct
+{
+    INT64 EventID;
+    INT64 FromID;
+    INT64 GroupID; // 0 when not through a group
+    MWS_STRING GroupName;
+    MWS_STRING Nick;
+    MWS_STRING Message;
+    INT64 InvitorID;
+} MWS_REQUESTINFO;
+
+typedef struct
+{
+    MWS_CLIENTVIEW Client;
+    INT64 Kind; // MWS_OTHERCLIENTONLINE only
+} MWS_OTHERCLIENTINFO;
+
+typedef struct
+{
+    MWS_STRING Name;
+    MWS_FRIENDVIEW Friend; // who ran it, ID is 0 when not a friend
+    MWS_MEMBERVIEW Member; // who ran it, ID is 0 when not a group member. Both 0 for the console
+    MWS_CHAINVIEW Args;
+} MWS_COMMANDEXECUTEDINFO;
+
+typedef struct
+{
+    LONG FramesPendingParse;    // received frames waiting for json parse
+    LONG FramesPendingDispatch; // parsed frames waiting for dispatch
+    LONG FramesInFlight;        // frames held by the pipeline, including the one being received into
+    LONG PeakPendingParse;
+    LONG PeakPendingDispatch;
+    INT64 ReadStalls;           // times receiving paused because every frame was in flight
+    INT64 StreamedLists;        // messages too large for a frame, received in batches, see MIRAI_WS_LIST_BATCH
+} MWS_PIPELINE_STATS;
+
+// Where a connection or manager takes its memory from (see CreateMiraiWSEx). Callbacks may be called from any thread.
+// Alloc and Realloc return memory aligned like malloc does, or NULL on failure. Free and Realloc are never passed NULL.
+typedef struct
+{
+    PVOID(*Alloc)(_In_opt_ PVOID Context, _In_ SIZE_T cbSize);
+    PVOID(*Realloc)(_In_opt_ PVOID Context, _In_ PVOID pMem, _In_ SIZE_T cbSize);
+    VOID(*Free)(_In_opt_ PVOID Context, _In_ PVOID pMem);
+    PVOID Context;
+} MWS_ALLOCATOR;
+
+typedef struct _MIRAI_WS MIRAI_WS, * PMIRAI_WS;
+typedef struct _MIRAI_WS_MANAGER MIRAI_WS_MANAGER, * PMIRAI_WS_MANAGER;
+
+// MWS_CONNECT and MWS_NWERROR are reported from WinHttp threads.
+// everything decoded from received frames is reported from the dispatch stage, one frame at a time, in receive order.
+typedef VOID(*MWSCALLBACK)(_In_ PMIRAI_WS pMiraiWS, _In_ UINT EventType, _In_ PVOID pInformation);
+
+typedef VOID(*SEND_MSG_CALLBACK)(_In_ PMIRAI_WS pMiraiWS, _In_ INT64 RetCode, _In_z_ LPCWSTR lpMessage, _In_ INT64 MessageCode, _In_ LPVOID Context);
+
+// Commands of mirai-api-http sent with SendMiraiWSCommandAsync.
+
+// the content of a command, one field per argument.
+typedef enum
+{
+    MWS_ARG_INT = 1,
+    MWS_ARG_BOOL,
+    MWS_ARG_STR,   // converted to utf8
+    MWS_ARG_CHAIN, // a message chain, serialized like SendGroupMsgAsync does
+    MWS_ARG_JSON   // utf8 json text put in as it is, for nested objects like the config of groupConfig
+} MWS_ARG_TYPE;
+
+typedef struct
+{
+    LPCSTR Key;
+    MWS_ARG_TYPE Type;
+    union
+    {
+        INT64 Int;
+        BOOL Bool;
+        LPCWSTR Str;
+        MESSAGE_CHAIN* pChain;
+        LPCSTR Json;
+    };
+} MWS_COMMAND_ARG;
+
+#ifdef __cplusplus
+// designated initializers are C only before C++20, so C++ gets the same args from functions.
+FORCEINLINE MWS_COMMAND_ARG MwsIntArg(LPCSTR Key, INT64 Value)            { MWS_COMMAND_ARG Arg = {}; Arg.Key = Key; Arg.Type = MWS_ARG_INT; Arg.Int = Value; return Arg; }
+FORCEINLINE MWS_COMMAND_ARG MwsBoolArg(LPCSTR Key, BOOL Value)            { MWS_COMMAND_ARG Arg = {}; Arg.Key = Key; Arg.Type = MWS_ARG_BOOL; Arg.Bool = Value; return Arg; }
+FORCEINLINE MWS_COMMAND_ARG MwsStrArg(LPCSTR Key, LPCWSTR Value)          { MWS_COMMAND_ARG Arg = {}; Arg.Key = Key; Arg.Type = MWS_ARG_STR; Arg.Str = Value; return Arg; }
+FORCEINLINE MWS_COMMAND_ARG MwsChainArg(LPCSTR Key, MESSAGE_CHAIN* Value) { MWS_COMMAND_ARG Arg = {}; Arg.Key = Key; Arg.Type = MWS_ARG_CHAIN; Arg.pChain = Value; return Arg; }
+FORCEINLINE MWS_COMMAND_ARG MwsJsonArg(LPCSTR Key, LPCSTR Value)          { MWS_COMMAND_ARG Arg = {}; Arg.Key = Key; Arg.Type = MWS_ARG_JSON; Arg.Json = Value; return Arg; }
+
+#define MWS_INT_ARG(Key, Value)   MwsIntArg(Key, Value)
+#define MWS_BOOL_ARG(Key, Value)  MwsBoolArg(Key, Value)
+#define MWS_STR_ARG(Key, Value)   MwsStrArg(Key, Value)
+#define MWS_CHAIN_ARG(Key, Value) MwsChainArg(Key, Value)
+#define MWS_JSON_ARG(Key, Value)  MwsJsonArg(Key, Value)
+#else
+#define MWS_INT_ARG(Key, Value)   { Key, MWS_ARG_INT, { .Int = (Value) } }
+#define MWS_BOOL_ARG(Key, Value)  { Key, MWS_ARG_BOOL, { .Bool = (Value) } }
+#define MWS_STR_ARG(Key, Value)   { Key, MWS_ARG_STR, { .Str = (Value) } }
+#define MWS_CHAIN_ARG(Key, Value) { Key, MWS_ARG_CHAIN, { .pChain = (Value) } }
+#define MWS_JSON_ARG(Key, Value)  { Key, MWS_ARG_JSON, { .Json = (Value) } }
+#endif
+
+// how the response of a command was decoded, which member of MWS_COMMAND_RESULT is filled.
+typedef enum
+{
+    MWS_RESULT_STATUS = 1, // only Code and Msg
+    MWS_RESULT_MESSAGEID,  // MessageID, of the send*Message commands
+    MWS_RESULT_FRIENDLIST, // List, of friends
+    MWS_RESULT_GROUPLIST,  // List, of groups
+    MWS_RESULT_MEMBERLIST, // List, of members
+    MWS_RESULT_PROFILE,    // Profile
+    MWS_RESULT_MEMBER,     // Member, of memberInfo get
+    MWS_RESULT_GROUPCONFIG,// GroupConfig, of groupConfig get
+    MWS_RESULT_ABOUT,      // Version
+    MWS_RESULT_DATA        // Data, the "data" field as it is
+} MWS_RESULT_KIND;
+
+// items of a list inside the received json, take them in order with NextMiraiWSFriend, NextMiraiWSGroup or NextMiraiWSMember.
+typedef struct
+{
+    SIZE_T Count;
+    SIZE_T Left;
+    const VOID* Next;
+} MWS_LISTVIEW;
+
+typedef struct
+{
+    MWS_STRING Nickname;
+    MWS_STRING Email;
+    INT64 Age;
+    INT64 Level;
+    MWS_STRING Sign;
+    MWS_STRING Sex; // UNKNOWN, MALE or FEMALE
+} MWS_PROFILEVIEW;
+
+typedef struct
+{
+    MWS_STRING Name;
+    MWS_STRING Announcement;
+    BOOL bConfessTalk;
+    BOOL bAllowMemberInvite;
+    BOOL bAutoApprove;
+    BOOL bAnonymousChat;
+} MWS_GROUPCONFIGVIEW;
+
+// Code of a result whose response was too large for a frame and could not be received in batches.
+// The response itself is reported as MWS_BADMSG, Msg and Node of the result are empty.
+#define MWS_CODE_DISCARDED (-1)
+
+// the response of a command. Like the event infos it borrows from the received json, only valid during the callback.
+typedef struct
+{
+    LPCSTR Command;    // as sent
+    LPCSTR SubCommand; // NULL if none
+    INT64 SyncID;
+    INT64 Code;        // 0 on success, the typed member is left empty otherwise
+    MWS_STRING Msg;
+    MWS_RESULT_KIND Kind;
+    BOOL bMore;        // List holds one batch of a large response, the callback will be called again with the next
+    union
+    {
+        INT64 MessageID;
+        MWS_LISTVIEW List;
+        MWS_PROFILEVIEW Profile;
+        MWS_MEMBERVIEW Member;
+        MWS_GROUPCONFIGVIEW GroupConfig;
+        MWS_STRING Version;
+        const VOID* Data; // NULL if the response has none
+    };
+    const VOID* Node; // the whole response object
+} MWS_COMMAND_RESULT;
+
+typedef VOID(*MWS_COMMAND_CALLBACK)(_In_ PMIRAI_WS pMiraiWS, _In_ const MWS_COMMAND_RESULT* pResult, _In_opt_ LPVOID Context);
+
+typedef struct _MIRAI_WS
+{
+    HINTERNET hSessionHandle;
+    HINTERNET hConnectionHandle;
+    HINTERNET hRequestHandle;
+    HINTERNET hWebSocketHandle;
+
+    LPWSTR        lpServerName;
+    INTERNET_PORT Port;
+    BOOL          bSecure;
+
+    struct _MWS_PIPELINE* pPipeline; // socket read -> json parse -> dispatch
+    PMIRAI_WS_MANAGER     pManager;  // NULL unless created by AttachMiraiWS
+    struct _MWS_EVENT_RING* pEventRing; // set by EnableMiraiWSEventRing
+    struct _MWS_JOURNAL*    pJournal;   // set by EnableMiraiWSJournal
+    struct _MWS_METRICS*    pMetrics;   // set by EnableMiraiWSMetrics
+    struct _MWS_DIRECTORY*  pDirectory; // set by EnableMiraiWSDirectory
+    struct _MWS_HISTORY*    pHistory;   // set by EnableMiraiWSHistory
+
+    MWSCALLBACK Callback;
+    LPVOID Context; // user defined, never touched by the library. Set it before ConnectMiraiWS
+    BOOL bClose;
+
+    MWS_ALLOCATOR Allocator; // every allocation of this connection, including its json documents
+}MIRAI_WS, * PMIRAI_WS;
+
+_Ret_maybenull_
+/// <summary>
+/// Create a instance of mirai websocket. Call ConnectMiraiWS to connect it.
+/// </summary>
+/// <param name="lpServerName">Server Name or IP Address</param>
+/// <param name="Port">Server Port</param>
+/// <param name="bSecure">Enable TLS 1.2 or newer.</param>
+/// <returns>return a handle of mirai websock on success</returns>
+PMIRAI_WS CreateMiraiWS(_In_z_ LPCWSTR lpServerName, _In_ INTERNET_PORT Port, _In_ BOOL bSecure, _In_ MWSCALLBACK Callback);
+
+_Ret_maybenull_
+/// <summary>
+/// Same as CreateMiraiWS, with the connection taking all of its memory from an allocator.
+/// Message chains and strings passed to Callback are allocated from it too.
+/// </summary>
+/// <param name="pAllocator">allocator to use, copied. NULL for the process heap, same as CreateMiraiWS</param>
+/// <returns>return a handle of mirai websock on success</returns>
+PMIRAI_WS CreateMiraiWSEx(_In_z_ LPCWSTR lpServerName, _In_ INTERNET_PORT Port, _In_ BOOL bSecure, _In_ MWSCALLBACK Callback, _In_opt_ const MWS_ALLOCATOR* pAllocator);
+
+/// <summary>
+/// Try connect to mirai
+/// </summary>
+/// <param name="pMiraiWS">handle created by CreateMiraiWS</param>
+/// <param name="szVerifyKey">Verify key filled in mirai-api-http config file</param>
+/// <param name="szQQ">QQ to connect to, in string</param>
+/// <returns>return TRUE on success</returns>
+BOOL ConnectMiraiWS(_Inout_ PMIRAI_WS pMiraiWS, _In_z_ LPCWSTR szVerifyKey, _In_z_ LPCWSTR szQQ);
+
+/// <summary>
+/// Destroy a instance of mirai websocket, asynchronously.
+/// </summary>
+/// <param name="pMiraiWS">handle created by CreateMiraiWS</param>
+/// <returns>return TRUE on success</returns>
+BOOL DestroyMiraiWSAsync(_In_ _Frees_ptr_ PMIRAI_WS pMiraiWS);
+
+_Ret_maybenull_
+/// <summary>
+/// Create a manager that lets many connections share one WinHttp session, one frame pool and one worker threadpool.
+/// Attach connections to it with AttachMiraiWS.
+/// </summary>
+/// <param name="MaxThreads">max threads running parse and dispatch stages of all attached connections</param>
+/// <param name="MaxPooledFrames">max receive frames (MIRAI_WS_MAXBUF each) kept for reuse between connections</param>
+/// <returns>return a handle of the manager on success</returns>
+PMIRAI_WS_MANAGER CreateMiraiWSManager(_In_ DWORD MaxThreads, _In_ USHORT MaxPooledFrames);
+
+_Ret_maybenull_
+/// <summary>
+/// Same as CreateMiraiWSManager, with the manager and every connection attached to it taking memory from an allocator.
+/// </summary>
+/// <param name="pAllocator">allocator to use, copied. NULL for the process heap, same as CreateMiraiWSManager</param>
+/// <returns>return a handle of the manager on success</returns>
+PMIRAI_WS_MANAGER CreateMiraiWSManagerEx(_In_ DWORD MaxThreads, _In_ USHORT MaxPooledFrames, _In_opt_ const MWS_ALLOCATOR* pAllocator);
+
+_Ret_maybenull_
+/// <summary>
+/// Create a instance of mirai websocket that shares resources of a manager. Call ConnectMiraiWS to connect it.
+/// Detach it by calling DestroyMiraiWSAsync. It uses the allocator of the manager.
+/// </summary>
+/// <param name="pManager">handle created by CreateMiraiWSManager</param>
+/// <param name="lpServerName">Server Name or IP Address</param>
+/// <param name="Port">Server Port</param>
+/// <param name="bSecure">Enable TLS 1.2 or newer.</param>
+/// <returns>return a handle of mirai websock on success</returns>
+PMIRAI_WS AttachMiraiWS(_In_ PMIRAI_WS_MANAGER pManager, _In_z_ LPCWSTR lpServerName, _In_ INTERNET_PORT Port, _In_ BOOL bSecure, _In_ MWSCALLBACK Callback);
+
+/// <summary>
+/// Destroy a manager. Every connection attached to it must have been destroyed and freed.
+/// </summary>
+/// <param name="pManager">handle created by CreateMiraiWSManager</param>
+/// <returns>return TRUE on success, FALSE with ERROR_BUSY if connections are still attached</returns>
+BOOL DestroyMiraiWSManager(_In_ _Frees_ptr_ PMIRAI_WS_MANAGER pManager);
+
+/// <summary>
+/// Publish every event this connection receives into a named shared memory ring, in packed binary form.
+/// Other processes read it with OpenMiraiWSEventRing (see MiraiWSRing.h). Events are still reported to Callback.
+/// Call before ConnectMiraiWS.
+/// </summary>
+/// <param name="pMiraiWS">handle created by CreateMiraiWS</param>
+/// <param name="lpName">name of the file mapping, e.g. L"Local\\MiraiEvents"</param>
+/// <param name="cbCapacity">bytes of the ring, a power of 2 and at least 4096</param>
+/// <returns>return TRUE on success</returns>
+BOOL EnableMiraiWSEventRing(_Inout_ PMIRAI_WS pMiraiWS, _In_z_ LPCWSTR lpName, _In_ DWORD cbCapacity);
+
+/// <summary>
+/// Record every frame this connection receives into an append-only journal, with arrival time and receive latency.
+/// A new segment file is started whenever the current one is full. Replay it with ReplayMiraiWSJournal (see MiraiWSJournal.h).
+/// Call before ConnectMiraiWS.
+/// </summary>
+/// <param name="pMiraiWS">handle created by CreateMiraiWS</param>
+/// <param name="lpDirectory">directory of the segment files, created if missing</param>
+/// <param name="cbSegment">bytes of one segment file, at least MWS_JOURNAL_MIN_SEGMENT (1MB)</param>
+/// <returns>return TRUE on success</returns>
+BOOL EnableMiraiWSJournal(_Inout_ PMIRAI_WS pMiraiWS, _In_z_ LPCWSTR lpDirectory, _In_ DWORD cbSegment);
+
+/// <summary>
+/// Start counting frames, events and requests of this connection and measuring how long parse, dispatch,
+/// user callbacks and request round trips take. Read them with GetMiraiWSMetrics (see MiraiWSMetrics.h).
+/// Call before ConnectMiraiWS.
+/// </summary>
+/// <param name="pMiraiWS">handle created by CreateMiraiWS</param>
+/// <returns>return TRUE on success</returns>
+BOOL EnableMiraiWSMetrics(_Inout_ PMIRAI_WS pMiraiWS);
+
+/// <summary>
+/// Keep a directory of the group members this connection sees in group messages, member events and memberList responses,
+/// so names, titles and permissions can be looked up without asking mirai. Look them up with LookupMiraiWSMember (see MiraiWSDirectory.h).
+/// Call before ConnectMiraiWS.
+/// </summary>
+/// <param name="pMiraiWS">handle created by CreateMiraiWS</param>
+/// <param name="cbMax">bytes the directory may hold, at least 64KB. Least recently used members are evicted beyond it</param>
+/// <returns>return TRUE on success</returns>
+BOOL EnableMiraiWSDirectory(_Inout_ PMIRAI_WS pMiraiWS, _In_ SIZE_T cbMax);
+
+/// <summary>
+/// Keep the most recent messages this connection receives, so the content of a recalled or quoted message can be
+/// looked up with LookupMiraiWSMessage (see MiraiWSHistory.h) instead of asking mirai with messageFromId.
+/// Call before ConnectMiraiWS.
+/// </summary>
+/// <param name="pMiraiWS">handle created by CreateMiraiWS</param>
+/// <param name="cbMax">bytes the history may hold, at least 64KB. Oldest messages are overwritten beyond it</param>
+/// <returns>return TRUE on success</returns>
+BOOL EnableMiraiWSHistory(_Inout_ PMIRAI_WS pMiraiWS, _In_ SIZE_T cbMax);
+
+/// <summary>
+/// Query how deep the receive pipeline queues are.
+/// </summary>
+/// <param name="pMiraiWS">handle created by CreateMiraiWS</param>
+/// <param name="pStats">receives the queue depths</param>
+/// <returns>return TRUE on success</returns>
+BOOL GetMiraiWSPipelineStats(_In_ PMIRAI_WS pMiraiWS, _Out_ MWS_PIPELINE_STATS* pStats);
+
+/// <summary>
+/// Decode a borrowed message chain into blocks, like the MessageChain of MWS_GROUPMSGINFO. Only during the callback,
+/// from any thread.
+/// </summary>
+/// <param name="pMiraiWS">the connection the event came from</param>
+/// <param name="pView">MessageChain of an event info, or the Origin of a MWS_QUOTE</param>
+/// <param name="pMessageChain">receives the blocks, free with ReleaseMiraiWSChain. Can be kept after the callback, except its Quote.Origin</param>
+/// <returns>TRUE on success</returns>
+BOOL UnpackMiraiWSChain(_In_ PMIRAI_WS pMiraiWS, _In_ const MWS_CHAINVIEW* pView, _Out_ MESSAGE_CHAIN* pMessageChain);
+
+/// <summary>
+/// Free the blocks of a chain from UnpackMiraiWSChain.
+/// </summary>
+void ReleaseMiraiWSChain(_In_ PMIRAI_WS pMiraiWS, _Inout_ MESSAGE_CHAIN* pMessageChain);
+
+/// <summary>
+/// Find a block in a borrowed message chain without decoding the others, for example the first Plain of a quoted message.
+/// Only during the callback.
+/// </summary>
+/// <param name="pView">the chain to look in</param>
+/// <param name="lpType">type of the block, like "Plain"</param>
+/// <param name="pIndex">index to start from. Receives the index of the found block, add 1 to find the next one</param>
+/// <param name="lpKey">optional, a string field of the block to return, like "text"</param>
+/// <param name="pValue">optional, receives the field named by lpKey, "" when the block lacks it</param>
+/// <returns>TRUE if a block was found</returns>
+BOOL FindMiraiWSViewBlock(
+    _In_ const MWS_CHAINVIEW* pView,
+    _In_z_ LPCSTR lpType,
+    _Inout_ SIZE_T* pIndex,
+    _In_opt_z_ LPCSTR lpKey,
+    _Out_opt_ MWS_STRING* pValue);
+
+// How FlattenMiraiWSChain renders a block other than Plain.
+typedef struct
+{
+    LPCSTR lpType;   // block type like "At", NULL for every type no rule before it names
+    LPCSTR lpFormat; // utf8, "{field}" is replaced by that string or integer field of the block. "" drops the block
+} MWS_FLATTEN_RULE;
+
+/// <summary>
+/// Render a borrowed chain as one text without allocating: Plain blocks as they are, other blocks by rules.
+/// Source is never rendered. Only during the callback.
+/// </summary>
+/// <param name="pView">the chain, like the View of MWS_GROUPMSGINFO</param>
+/// <param name="pRules">the first rule naming the type of a block renders it, blocks no rule names are dropped.
+/// NULL for At as "@{target}", AtAll as "@all", Face and MarketFace as "[{name}]", Image and FlashImage as "[image]"</param>
+/// <param name="cRules">how many rules</param>
+/// <param name="lpBuffer">receives the zero-terminated utf8 text</param>
+/// <param name="cbBuffer">size of lpBuffer</param>
+/// <param name="pcbNeeded">optional, receives the size the text needs, terminator included</param>
+/// <returns>TRUE if the text fit, FALSE with ERROR_INSUFFICIENT_BUFFER if not</returns>
+BOOL FlattenMiraiWSChain(
+    _In_ const MWS_CHAINVIEW* pView,
+    _In_reads_opt_(cRules) const MWS_FLATTEN_RULE* pRules,
+    _In_ SIZE_T cRules,
+    _Out_writes_opt_(cbBuffer) LPSTR lpBuffer,
+    _In_ SIZE_T cbBuffer,
+    _Out_opt_ SIZE_T* pcbNeeded);
+
+/// <summary>
+/// FlattenMiraiWSChain into a wide string, converted block by block straight into the buffer.
+/// </summary>
+/// <param name="cchBuffer">size of lpBuffer in WCHARs</param>
+/// <param name="pcchNeeded">optional, receives the WCHARs the text needs, terminator included</param>
+BOOL FlattenMiraiWSChainW(
+    _In_ const MWS_CHAINVIEW* pView,
+    _In_reads_opt_(cRules) const MWS_FLATTEN_RULE* pRules,
+    _In_ SIZE_T cRules,
+    _Out_writes_opt_(cchBuffer) LPWSTR lpBuffer,
+    _In_ SIZE_T cchBuffer,
+    _Out_opt_ SIZE_T* pcchNeeded);
+
+/// <summary>
+/// Send a message to a friend
+/// </summary>
+/// <param name="pMiraiWS">handle created by CreateMiraiWS</param>
+/// <param name="Target">target QQ id the message will be sent to</param>
+/// <param name="pMessageChain">the message to send</param>
+/// <param name="Callback">An optional callback to notify the sending result</param>
+/// <param name="Context">user defined context to pass to Callback</param>
+/// <returns>TRUE on success, callback will be called, if given, when sending finished.</returns>
+BOOL SendFriendMsgAsync(
+    _In_ PMIRAI_WS pMiraiWS,
+    _In_ INT64 Target,
+    _In_ MESSAGE_CHAIN* pMessageChain,
+    _In_opt_ SEND_MSG_CALLBACK Callback,
+    _In_opt_ LPVOID Context);
+
+/// <summary>
+/// Send a message to a group
+/// </summary>
+/// <param name="pMiraiWS">handle created by CreateMiraiWS</param>
+/// <param name="Target">target Group id the message will be sent to</param>
+/// <param name="pMessageChain">the message to send</param>
+/// <param name="Callback">An optional callback to notify the sending result</param>
+/// <param name="Context">user defined context to pass to Callback</param>
+/// <returns>TRUE on success, callback will be called, if given, when sending finished.</returns>
+BOOL SendGroupMsgAsync(
+    _In_ PMIRAI_WS pMiraiWS,
+    _In_ INT64 Target,
+    _In_ MESSAGE_CHAIN* pMessageChain,
+    _In_opt_ SEND_MSG_CALLBACK Callback,
+    _In_opt_ LPVOID Context
+);
+
+/// <summary>
+/// Send any command of mirai-api-http, like memberList, recall or mute. The response is matched by syncId
+/// and decoded by what the command returns, see MWS_RESULT_KIND.
+/// </summary>
+/// <param name="pMiraiWS">handle created by CreateMiraiWS</param>
+/// <param name="lpCommand">command name, e.g. "memberList"</param>
+/// <param name="lpSubCommand">optional, e.g. "get" for memberInfo</param>
+/// <param name="pArgs">content of the command, e.g. MWS_INT_ARG("target", GroupID)</param>
+/// <param name="ArgCnt">length of pArgs</param>
+/// <param name="Callback">An optional callback to receive the response</param>
+/// <param name="Context">user defined context to pass to Callback</param>
+/// <returns>TRUE on success, callback will be called, if given, when the response arrives.</returns>
+BOOL SendMiraiWSCommandAsync(
+    _In_ PMIRAI_WS pMiraiWS,
+    _In_z_ LPCSTR lpCommand,
+    _In_opt_z_ LPCSTR lpSubCommand,
+    _In_reads_opt_(ArgCnt) const MWS_COMMAND_ARG* pArgs,
+    _In_ UINT ArgCnt,
+    _In_opt_ MWS_COMMAND_CALLBACK Callback,
+    _In_opt_ LPVOID Context);
+
+/// <summary>
+/// Take the next item of a friend list. Only during the callback.
+/// </summary>
+/// <returns>FALSE when the list is exhausted or the item is malformed</returns>
+BOOL NextMiraiWSFriend(_Inout_ MWS_LISTVIEW* pList, _Out_ MWS_FRIENDVIEW* pFriend);
+
+/// <summary>
+/// Take the next item of a group list. Only during the callback.
+/// </summary>
+/// <returns>FALSE when the list is exhausted or the item is malformed</returns>
+BOOL NextMiraiWSGroup(_Inout_ MWS_LISTVIEW* pList, _Out_ MWS_GROUPVIEW* pGroup);
+
+/// <summary>
+/// Take the next item of a member list. Only during the callback.
+/// </summary>
+/// <returns>FALSE when the list is exhausted or the item is malformed</returns>
+BOOL NextMiraiWSMember(_Inout_ MWS_LISTVIEW* pList, _Out_ MWS_MEMBERVIEW* pMember);
+
 EXTERN_C_END
\ No newline at end of file
@@ -0,0 +1,452 @@
+#pragma once
+
+// C++17 layer over MiraiWS.h, header only:
+//   MiraiWS::Chain       owns a decoded message chain, move only. Takes the blocks of an event over without copying them
+//   MiraiWS::View        std::string_view and std::wstring_view of the borrowed strings of events
+//   MiraiWS::Connection  owns a connection, with a lambda per event type instead of one MWSCALLBACK
+//   MiraiWS::Send*       send with a lambda called on the response, no Context to box by hand
+//
+//   MiraiWS::Connection Bot(L"localhost", 8080, FALSE);
+//   Bot.On<MWS_GROUPMSG>([&](PMIRAI_WS pMiraiWS, MWS_GROUPMSGINFO& Info) {
+//       Kept.push_back(MiraiWS::Chain(pMiraiWS, Info.MessageChain)); // the library won't free it after the callback
+//   });
+//   Bot.Connect(L"VerifyKey", L"12345");
+//
+// Handlers and lambdas run on library threads like the C callbacks do, and must not throw.
+
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <Windows.h>
+#include "MiraiWS.h"
+
+namespace MiraiWS
+{
+    // Borrowed strings, only valid while what they come from is.
+
+    inline std::string_view View(const MWS_STRING& String) noexcept
+    {
+        return std::string_view(String.Ptr, String.Len);
+    }
+
+    inline std::wstring_view View(LPCWSTR lpString) noexcept
+    {
+        return lpString ? std::wstring_view(lpString) : std::wstring_view();
+    }
+
+    /// <summary>
+    /// A string field of the first block of a type in a borrowed chain, see FindMiraiWSViewBlock.
+    /// </summary>
+    /// <param name="pIndex">optional, index to start from. Receives the index of the found block</param>
+    /// <returns>the field, empty when there is no such block or field</returns>
+    inline std::string_view FindBlock(const MWS_CHAINVIEW& Chain, LPCSTR lpType, LPCSTR lpKey, SIZE_T* pIndex = nullptr) noexcept
+    {
+        SIZE_T Index = pIndex ? *pIndex : 0;
+        MWS_STRING Value;
+        if (!FindMiraiWSViewBlock(&Chain, lpType, &Index, lpKey, &Value))
+            return std::string_view();
+        if (pIndex)
+            *pIndex = Index;
+        return View(Value);
+    }
+
+    // The info struct of an event, EventInfo<MWS_GROUPMSG>::Type is MWS_GROUPMSGINFO.
+    template <UINT EventType>
+    struct EventInfo;
+
+#define MWS_EVENT_INFO(Event, Info) template <> struct EventInfo<Event> { using Type = Info; }
+    MWS_EVENT_INFO(MWS_CONNECT, MWS_CONNECTINFO);
+    MWS_EVENT_INFO(MWS_NWERROR, MWS_NWERRORINFO);
+    MWS_EVENT_INFO(MWS_BADMSG, MWS_BADMSGINFO);
+    MWS_EVENT_INFO(MWS_AUTH, MWS_AUTHINFO);
+    MWS_EVENT_INFO(MWS_FRIENDMSG, MWS_FRIENDMSGINFO);
+    MWS_EVENT_INFO(MWS_GROUPMSG, MWS_GROUPMSGINFO);
+    MWS_EVENT_INFO(MWS_TEMPMSG, MWS_TEMPMSGINFO);
+    MWS_EVENT_INFO(MWS_STRANGERMSG, MWS_STRANGERMSGINFO);
+    MWS_EVENT_INFO(MWS_OTHERCLIENTMSG, MWS_OTHERCLIENTMSGINFO);
+    MWS_EVENT_INFO(MWS_FRIENDSYNCMSG, MWS_FRIENDSYNCMSGINFO);
+    MWS_EVENT_INFO(MWS_GROUPSYNCMSG, MWS_GROUPSYNCMSGINFO);
+    MWS_EVENT_INFO(MWS_TEMPSYNCMSG, MWS_TEMPSYNCMSGINFO);
+    MWS_EVENT_INFO(MWS_STRANGERSYNCMSG, MWS_FRIENDSYNCMSGINFO);
+    MWS_EVENT_INFO(MWS_BOTONLINE, MWS_BOTINFO);
+    MWS_EVENT_INFO(MWS_BOTOFFLINEACTIVE, MWS_BOTINFO);
+    MWS_EVENT_INFO(MWS_BOTOFFLINEFORCE, MWS_BOTINFO);
+    MWS_EVENT_INFO(MWS_BOTOFFLINEDROPPED, MWS_BOTINFO);
+    MWS_EVENT_INFO(MWS_BOTRELOGIN, MWS_BOTINFO);
+    MWS_EVENT_INFO(MWS_FRIENDINPUTSTATUSCHANGED, MWS_FRIENDINPUTSTATUSINFO);
+    MWS_EVENT_INFO(MWS_FRIENDNICKCHANGED, MWS_FRIENDNICKINFO);
+    MWS_EVENT_INFO(MWS_BOTGROUPPERMISSIONCHANGE, MWS_BOTGROUPPERMISSIONINFO);
+    MWS_EVENT_INFO(MWS_BOTMUTE, MWS_BOTMUTEINFO);
+    MWS_EVENT_INFO(MWS_BOTUNMUTE, MWS_BOTMUTEINFO);
+    MWS_EVENT_INFO(MWS_BOTJOINGROUP, MWS_BOTGROUPINFO);
+    MWS_EVENT_INFO(MWS_BOTLEAVEACTIVE, MWS_BOTGROUPINFO);
+    MWS_EVENT_INFO(MWS_BOTLEAVEKICK, MWS_BOTGROUPINFO);
+    MWS_EVENT_INFO(MWS_BOTLEAVEDISBAND, MWS_BOTGROUPINFO);
+    MWS_EVENT_INFO(MWS_GROUPRECALL, MWS_GROUPRECALLINFO);
+    MWS_EVENT_INFO(MWS_FRIENDRECALL, MWS_FRIENDRECALLINFO);
+    MWS_EVENT_INFO(MWS_NUDGE, MWS_NUDGEINFO);
+    MWS_EVENT_INFO(MWS_GROUPNAMECHANGE, MWS_GROUPCHANGEINFO);
+    MWS_EVENT_INFO(MWS_GROUPENTRANCEANNOUNCEMENTCHANGE, MWS_GROUPCHANGEINFO);
+    MWS_EVENT_INFO(MWS_GROUPMUTEALL, MWS_GROUPSWITCHINFO);
+    MWS_EVENT_INFO(MWS_GROUPALLOWANONYMOUSCHAT, MWS_GROUPSWITCHINFO);
+    MWS_EVENT_INFO(MWS_GROUPALLOWCONFESSTALK, MWS_GROUPSWITCHINFO);
+    MWS_EVENT_INFO(MWS_GROUPALLOWMEMBERINVITE, MWS_GROUPSWITCHINFO);
+    MWS_EVENT_INFO(MWS_MEMBERJOIN, MWS_MEMBERINFO);
+    MWS_EVENT_INFO(MWS_MEMBERLEAVEKICK, MWS_MEMBERINFO);
+    MWS_EVENT_INFO(MWS_MEMBERLEAVEQUIT, MWS_MEMBERINFO);
+    MWS_EVENT_INFO(MWS_MEMBERCARDCHANGE, MWS_MEMBERCHANGEINFO);
+    MWS_EVENT_INFO(MWS_MEMBERSPECIALTITLECHANGE, MWS_MEMBERCHANGEINFO);
+    MWS_EVENT_INFO(MWS_MEMBERPERMISSIONCHANGE, MWS_MEMBERCHANGEINFO);
+    MWS_EVENT_INFO(MWS_MEMBERMUTE, MWS_MEMBERINFO);
+    MWS_EVENT_INFO(MWS_MEMBERUNMUTE, MWS_MEMBERINFO);
+    MWS_EVENT_INFO(MWS_MEMBERHONORCHANGE, MWS_MEMBERHONORINFO);
+    MWS_EVENT_INFO(MWS_NEWFRIENDREQUEST, MWS_REQUESTINFO);
+    MWS_EVENT_INFO(MWS_MEMBERJOINREQUEST, MWS_REQUESTINFO);
+    MWS_EVENT_INFO(MWS_BOTINVITEDJOINGROUPREQUEST, MWS_REQUESTINFO);
+    MWS_EVENT_INFO(MWS_OTHERCLIENTONLINE, MWS_OTHERCLIENTINFO);
+    MWS_EVENT_INFO(MWS_OTHERCLIENTOFFLINE, MWS_OTHERCLIENTINFO);
+    MWS_EVENT_INFO(MWS_COMMANDEXECUTED, MWS_COMMANDEXECUTEDINFO);
+#undef MWS_EVENT_INFO
+
+    // A decoded message chain, released with the connection it came from, which must outlive it.
+    // Quote.Origin is never kept, it borrows from the received json.
+    class Chain
+    {
+    public:
+        Chain() noexcept = default;
+
+        /// <summary>
+        /// Take the blocks of a chain over, like the MessageChain of MWS_GROUPMSGINFO during the callback,
+        /// or one from UnpackMiraiWSChain. Source is left without blocks, so the library won't free them.
+        /// </summary>
+        Chain(PMIRAI_WS pMiraiWS, MESSAGE_CHAIN& Source) noexcept : m_pMiraiWS(pMiraiWS), m_Chain(Source)
+        {
+            m_Chain.Quote.Origin = MWS_CHAINVIEW();
+            Source.MessageBlocks = nullptr;
+            Source.BlockCnt = 0;
+        }
+
+        /// <summary>
+        /// Decode a borrowed chain, see UnpackMiraiWSChain. Only during the callback.
+        /// </summary>
+        /// <returns>the chain, empty on failure</returns>
+        static Chain Unpack(PMIRAI_WS pMiraiWS, const MWS_CHAINVIEW& View) noexcept
+        {
+            MESSAGE_CHAIN Decoded = {};
+            if (!UnpackMiraiWSChain(pMiraiWS, &View, &Decoded))
+                return Chain();
+            return Chain(pMiraiWS, Decoded);
+        }
+
+        Chain(Chain&& Other) noexcept :
+            m_pMiraiWS(std::exchange(Other.m_pMiraiWS, nullptr)), m_Chain(std::exchange(Other.m_Chain, MESSAGE_CHAIN()))
+        {
+        }
+
+        Chain& operator=(Chain&& Other) noexcept
+        {
+            if (this != &Other)
+            {
+                Reset();
+                m_pMiraiWS = std::exchange(Other.m_pMiraiWS, nullptr);
+                m_Chain = std::exchange(Other.m_Chain, MESSAGE_CHAIN());
+            }
+            return *this;
+        }
+
+        Chain(const Chain&) = delete;
+        Chain& operator=(const Chain&) = delete;
+
+        ~Chain()
+        {
+            Reset();
+        }
+
+        void Reset() noexcept
+        {
+            if (m_pMiraiWS)
+                ReleaseMiraiWSChain(m_pMiraiWS, &m_Chain);
+            m_pMiraiWS = nullptr;
+            m_Chain = MESSAGE_CHAIN();
+        }
+
+        explicit operator bool() const noexcept { return m_pMiraiWS != nullptr; }
+
+        INT64 ID() const noexcept { return m_Chain.ID; }
+        INT64 Timestamp() const noexcept { return m_Chain.Timestamp; }
+        const MWS_QUOTE& Quote() const noexcept { return m_Chain.Quote; }
+
+        size_t size() const noexcept { return (size_t)m_Chain.BlockCnt; }
+        bool empty() const noexcept { return m_Chain.BlockCnt == 0; }
+        const MESSAGE_BLOCK* begin() const noexcept { return m_Chain.MessageBlocks; }
+        const MESSAGE_BLOCK* end() const noexcept { return m_Chain.MessageBlocks + m_Chain.BlockCnt; }
+        const MESSAGE_BLOCK& operator[](size_t Index) const noexcept { return m_Chain.MessageBlocks[Index]; }
+
+        // for SendGroupMsgAsync and the like, which don't take it over.
+        MESSAGE_CHAIN* Get() noexcept { return &m_Chain; }
+
+    private:
+        PMIRAI_WS m_pMiraiWS = nullptr; // NULL when empty
+        MESSAGE_CHAIN m_Chain = {};
+    };
+
+    namespace Detail
+    {
+        // A callable is passed in Context as it is when it fits and copies bytewise, like a lambda capturing one pointer,
+        // and is boxed on the heap otherwise.
+        template <class F>
+        constexpr bool FitsContext = std::is_trivially_copyable_v<F> && sizeof(F) <= sizeof(LPVOID) && alignof(F) <= alignof(LPVOID);
+
+        template <class F>
+        inline bool PackContext(F&& Fn, LPVOID* pContext) noexcept
+        {
+            using D = std::decay_t<F>;
+            *pContext = nullptr;
+            if constexpr (FitsContext<D>)
+            {
+                std::memcpy(pContext, std::addressof(Fn), sizeof(D));
+                return true;
+            }
+            else
+            {
+                *pContext = new (std::nothrow) D(std::forward<F>(Fn));
+                if (!*pContext)
+                    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+                return *pContext != nullptr;
+            }
+        }
+
+        template <class D, class... A>
+        inline void InvokeContext(LPVOID Context, A&&... Args)
+        {
+            if constexpr (FitsContext<D>)
+            {
+                alignas(D) unsigned char Storage[sizeof(D)];
+                std::memcpy(Storage, &Context, sizeof(D));
+                (*std::launder(reinterpret_cast<D*>(Storage)))(std::forward<A>(Args)...);
+            }
+            else
+                (*static_cast<D*>(Context))(std::forward<A>(Args)...);
+        }
+
+        template <class D>
+        inline void ReleaseContext(LPVOID Context) noexcept
+        {
+            if constexpr (!FitsContext<D>)
+                delete static_cast<D*>(Context);
+        }
+
+        template <class D>
+        VOID SentTrampoline(PMIRAI_WS pMiraiWS, INT64 RetCode, LPCWSTR lpMessage, INT64 MessageID, LPVOID Context) noexcept
+        {
+            InvokeContext<D>(Context, pMiraiWS, RetCode, View(lpMessage), MessageID);
+            ReleaseContext<D>(Context);
+        }
+
+        template <class D>
+        VOID CommandTrampoline(PMIRAI_WS pMiraiWS, const MWS_COMMAND_RESULT* pResult, LPVOID Context) noexcept
+        {
+            InvokeContext<D>(Context, pMiraiWS, *pResult);
+            // large lists come in batches, the callback is called again unless this is the last.
+            if (!pResult->bMore)
+                ReleaseContext<D>(Context);
+        }
+    }
+
+    // Lambdas for responses. One that is still waiting when its connection closes is never called nor freed.
+
+    /// <summary>
+    /// SendFriendMsgAsync, OnSent is called like OnSent(pMiraiWS, RetCode, std::wstring_view Message, MessageID)
+    /// </summary>
+    template <class F>
+    inline BOOL SendFriendMessage(PMIRAI_WS pMiraiWS, INT64 Target, MESSAGE_CHAIN* pMessageChain, F&& OnSent)
+    {
+        using D = std::decay_t<F>;
+        LPVOID Context;
+        if (!Detail::PackContext(std::forward<F>(OnSent), &Context))
+            return FALSE;
+        if (SendFriendMsgAsync(pMiraiWS, Target, pMessageChain, Detail::SentTrampoline<D>, Context))
+            return TRUE;
+        Detail::ReleaseContext<D>(Context);
+        return FALSE;
+    }
+
+    /// <summary>
+    /// SendGroupMsgAsync, OnSent is called like OnSent(pMiraiWS, RetCode, std::wstring_view Message, MessageID)
+    /// </summary>
+    template <class F>
+    inline BOOL SendGroupMessage(PMIRAI_WS pMiraiWS, INT64 Target, MESSAGE_CHAIN* pMessageChain, F&& OnSent)
+    {
+        using D = std::decay_t<F>;
+        LPVOID Context;
+        if (!Detail::PackContext(std::forward<F>(OnSent), &Context))
+            return FALSE;
+        if (SendGroupMsgAsync(pMiraiWS, Target, pMessageChain, Detail::SentTrampoline<D>, Context))
+            return TRUE;
+        Detail::ReleaseContext<D>(Context);
+        return FALSE;
+    }
+
+    /// <summary>
+    /// SendMiraiWSCommandAsync, OnResult is called like OnResult(pMiraiWS, const MWS_COMMAND_RESULT& Result),
+    /// more than once for lists sent in batches.
+    /// </summary>
+    template <class F>
+    inline BOOL SendCommand(PMIRAI_WS pMiraiWS, LPCSTR lpCommand, LPCSTR lpSubCommand, const MWS_COMMAND_ARG* pArgs, UINT ArgCnt, F&& OnResult)
+    {
+        using D = std::decay_t<F>;
+        LPVOID Context;
+        if (!Detail::PackContext(std::forward<F>(OnResult), &Context))
+            return FALSE;
+        if (SendMiraiWSCommandAsync(pMiraiWS, lpCommand, lpSubCommand, pArgs, ArgCnt, Detail::CommandTrampoline<D>, Context))
+            return TRUE;
+        Detail::ReleaseContext<D>(Context);
+        return FALSE;
+    }
+
+    // A connection with a handler per event type. Register handlers before Connect, they are read from library threads
+    // without a lock afterwards. The handlers live until MWS_CLOSED, so a callback already running when the
+    // Connection is destroyed still finds them.
+    class Connection
+    {
+    public:
+        Connection() noexcept = default;
+
+        /// <summary>
+        /// CreateMiraiWSEx. Check the result with operator bool, GetLastError tells why it failed.
+        /// </summary>
+        Connection(LPCWSTR lpServerName, INTERNET_PORT Port, BOOL bSecure, const MWS_ALLOCATOR* pAllocator = nullptr) noexcept
+        {
+            if (InitHandlers())
+                Adopt(CreateMiraiWSEx(lpServerName, Port, bSecure, Dispatch, pAllocator));
+        }
+
+        /// <summary>
+        /// AttachMiraiWS
+        /// </summary>
+        Connection(PMIRAI_WS_MANAGER pManager, LPCWSTR lpServerName, INTERNET_PORT Port, BOOL bSecure) noexcept
+        {
+            if (InitHandlers())
+                Adopt(AttachMiraiWS(pManager, lpServerName, Port, bSecure, Dispatch));
+        }
+
+        Connection(Connection&& Other) noexcept :
+            m_pMiraiWS(std::exchange(Other.m_pMiraiWS, nullptr)), m_pHandlers(std::exchange(Other.m_pHandlers, nullptr))
+        {
+        }
+
+        Connection& operator=(Connection&& Other) noexcept
+        {
+            if (this != &Other)
+            {
+                Close();
+                m_pMiraiWS = std::exchange(Other.m_pMiraiWS, nullptr);
+                m_pHandlers = std::exchange(Other.m_pHandlers, nullptr);
+            }
+            return *this;
+        }
+
+        Connection(const Connection&) = delete;
+        Connection& operator=(const Connection&) = delete;
+
+        ~Connection()
+        {
+            Close();
+        }
+
+        /// <summary>
+        /// DestroyMiraiWSAsync. The handlers are freed at MWS_CLOSED.
+        /// </summary>
+        void Close() noexcept
+        {
+            if (m_pMiraiWS)
+                DestroyMiraiWSAsync(m_pMiraiWS);
+            else
+                delete m_pHandlers;
+            m_pMiraiWS = nullptr;
+            m_pHandlers = nullptr;
+        }
+
+        explicit operator bool() const noexcept { return m_pMiraiWS != nullptr; }
+        PMIRAI_WS Get() const noexcept { return m_pMiraiWS; }
+
+        /// <summary>
+        /// Handle an event type, like On&lt;MWS_GROUPMSG&gt;([](PMIRAI_WS pMiraiWS, MWS_GROUPMSGINFO&amp; Info) { ... }).
+        /// The info is mutable so chains can be taken over with Chain.
+        /// </summary>
+        template <UINT EventType, class F>
+        Connection& On(F&& Handler)
+        {
+            using Info = typename EventInfo<EventType>::Type;
+            if (!m_pHandlers)
+                return *this;
+            m_pHandlers->Events[EventType] = [Fn = std::forward<F>(Handler)](PMIRAI_WS pMiraiWS, PVOID pInformation) mutable
+            {
+                Fn(pMiraiWS, *static_cast<Info*>(pInformation));
+            };
+            return *this;
+        }
+
+        /// <summary>
+        /// Handle the events no On handler is registered for, like OnOther([](PMIRAI_WS pMiraiWS, UINT EventType, PVOID pInformation) { ... }).
+        /// </summary>
+        template <class F>
+        Connection& OnOther(F&& Handler)
+        {
+            if (m_pHandlers)
+                m_pHandlers->Other = std::forward<F>(Handler);
+            return *this;
+        }
+
+        BOOL Connect(LPCWSTR szVerifyKey, LPCWSTR szQQ) noexcept
+        {
+            return ConnectMiraiWS(m_pMiraiWS, szVerifyKey, szQQ);
+        }
+
+    private:
+        struct Handlers
+        {
+            std::function<void(PMIRAI_WS, PVOID)> Events[MWS_CLOSED];
+            std::function<void(PMIRAI_WS, UINT, PVOID)> Other;
+        };
+
+        bool InitHandlers() noexcept
+        {
+            m_pHandlers = new (std::nothrow) Handlers();
+            if (!m_pHandlers)
+                SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+            return m_pHandlers != nullptr;
+        }
+
+        void Adopt(PMIRAI_WS pMiraiWS) noexcept
+        {
+            if (!pMiraiWS)
+            {
+                delete m_pHandlers;
+                m_pHandlers = nullptr;
+                return;
+            }
+            // no callback comes before ConnectMiraiWS.
+            pMiraiWS->Context = m_pHandlers;
+            m_pMiraiWS = pMiraiWS;
+        }
+
+        static VOID Dispatch(PMIRAI_WS pMiraiWS, UINT EventType, PVOID pInformation) noexcept
+        {
+            Handlers* pHandlers = static_cast<Handlers*>(pMiraiWS->Context);
+            if (EventType == MWS_CLOSED)
+                delete pHandlers;
+            else if (EventType < std::size(pHandlers->Events) && pHandlers->Events[EventType])
+                pHandlers->Events[EventType](pMiraiWS, pInformation);
+            else if (pHandlers->Other)
+                pHandlers->Other(pMiraiWS, EventType, pInformation);
+        }
+
+        PMIRAI_WS m_pMiraiWS = nullptr;
+        Handlers* m_pHandlers = nullptr; // owned by the connection once it is created
+    };
+}
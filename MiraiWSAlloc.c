@@ -0,0 +1,340 @@
+#include <Windows.h>
+#include "MiraiWS.h"
+#include "MiraiWSAlloc.h"
+#include "MiraiWSInternal.h"
+
+__declspec(thread) MWS_ALLOC_STATS MwsThreadAllocStats;
+
+static PVOID HeapAllocatorAlloc(_In_opt_ PVOID Context, _In_ SIZE_T cbSize)
+{
+    return HeapAlloc(GetProcessHeap(), 0, cbSize);
+}
+
+static PVOID HeapAllocatorRealloc(_In_opt_ PVOID Context, _In_ PVOID pMem, _In_ SIZE_T cbSize)
+{
+    return HeapReAlloc(GetProcessHeap(), 0, pMem, cbSize);
+}
+
+static VOID HeapAllocatorFree(_In_opt_ PVOID Context, _In_ PVOID pMem)
+{
+    HeapFree(GetProcessHeap(), 0, pMem);
+}
+
+const MWS_ALLOCATOR MwsHeapAllocator = { HeapAllocatorAlloc, HeapAllocatorRealloc, HeapAllocatorFree, NULL };
+
+// Slabs for what the library allocates and frees per event or request: message block arrays, strings passed to
+// callbacks and yyjson documents. Each thread carves slots of a size class out of chunks and keeps them on free lists
+// only it touches. A slot freed by another thread, say a document parsed by the parse stage and freed by the dispatch
+// stage, goes back to its owner through a lock-free return list the owner takes over when its free list runs dry.
+// Chunks are kept for the life of the process. When a thread or fiber exits its cache is left to the next one that
+// needs one. The cache is found through fiber local storage only: its callback may run while the thread goes on,
+// for a deleted fiber, or before the last frees of an exiting thread, and after it the cache is no longer ours.
+//
+// Every block, slab or not, starts with a header telling MwsFree where it goes back to.
+// Other allocators than MwsHeapAllocator get every block directly, so what they count is exact.
+
+#define SLAB_HEADER_SIZE 16 // keeps blocks 16 byte aligned
+#define SLAB_MIN_SHIFT 6    // 64 byte slots, header included
+#define SLAB_CLASSES 7      // up to 4096 byte slots
+#define SLAB_CHUNK_SIZE 0x10000
+#define SLAB_SLOT_SIZE(Class) ((SIZE_T)1 << ((Class) + SLAB_MIN_SHIFT))
+
+typedef struct _SLAB_CACHE SLAB_CACHE;
+
+typedef struct
+{
+    SLAB_CACHE* pOwner; // NULL when the block came from the allocator
+    SIZE_T Class;
+} SLAB_HEADER;
+
+C_ASSERT(sizeof(SLAB_HEADER) <= SLAB_HEADER_SIZE);
+
+typedef struct
+{
+    SLIST_HEADER Returned; // freed by other threads
+    PSLIST_ENTRY pFree;    // owner only, same links as Returned
+} SLAB_CLASS;
+
+struct _SLAB_CACHE
+{
+    SLIST_ENTRY Abandoned; // links caches of exited threads, must be first
+    SLAB_CLASS Classes[SLAB_CLASSES];
+};
+
+static SLIST_HEADER AbandonedCaches;
+static DWORD SlabFlsIndex = FLS_OUT_OF_INDEXES;
+static INIT_ONCE SlabInitOnce = INIT_ONCE_STATIC_INIT;
+
+static VOID WINAPI AbandonSlabCache(_In_opt_ PVOID pCache)
+{
+    // blocks of the cache still in use keep coming back to its return lists until another thread adopts it.
+    if (pCache)
+        InterlockedPushEntrySList(&AbandonedCaches, pCache);
+}
+
+static BOOL CALLBACK InitSlabs(_Inout_ PINIT_ONCE InitOnce, _Inout_opt_ PVOID Parameter, _Outptr_opt_result_maybenull_ PVOID* Context)
+{
+    InitializeSListHead(&AbandonedCaches);
+    // holds the cache of each fiber, the callback gives it up when the fiber or its thread exits.
+    SlabFlsIndex = FlsAlloc(AbandonSlabCache);
+    return TRUE;
+}
+
+/// <summary>
+/// The cache of the running fiber, NULL if it has none yet or already gave it up.
+/// </summary>
+_Ret_maybenull_
+static SLAB_CACHE* CurrentSlabCache()
+{
+    return SlabFlsIndex != FLS_OUT_OF_INDEXES ? FlsGetValue(SlabFlsIndex) : NULL;
+}
+
+_Ret_maybenull_
+static SLAB_CACHE* GetSlabCache()
+{
+    InitOnceExecuteOnce(&SlabInitOnce, InitSlabs, NULL, NULL);
+    // without a slot to keep it in, nobody would give the cache back.
+    if (SlabFlsIndex == FLS_OUT_OF_INDEXES)
+        return NULL;
+
+    SLAB_CACHE* pCache = FlsGetValue(SlabFlsIndex);
+    if (pCache)
+        return pCache;
+
+    pCache = (SLAB_CACHE*)InterlockedPopEntrySList(&AbandonedCaches);
+    if (!pCache)
+    {
+        MwsThreadAllocStats.HeapAllocs++;
+        pCache = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(SLAB_CACHE));
+        if (!pCache)
+            return NULL;
+        for (int i = 0; i < SLAB_CLASSES; i++)
+            InitializeSListHead(&pCache->Classes[i].Returned);
+    }
+    if (!FlsSetValue(SlabFlsIndex, pCache))
+    {
+        InterlockedPushEntrySList(&AbandonedCaches, &pCache->Abandoned);
+        return NULL;
+    }
+    return pCache;
+}
+
+static int SlabClassOf(_In_ SIZE_T cbSize)
+{
+    SIZE_T cbSlot = SLAB_HEADER_SIZE + cbSize;
+    if (cbSlot > SLAB_SLOT_SIZE(SLAB_CLASSES - 1))
+        return -1;
+    if (cbSlot <= SLAB_SLOT_SIZE(0))
+        return 0;
+
+    DWORD Msb;
+    BitScanReverse(&Msb, (DWORD)(cbSlot - 1));
+    return (int)Msb + 1 - SLAB_MIN_SHIFT;
+}
+
+_Ret_maybenull_
+static SLAB_HEADER* SlabPop(_Inout_ SLAB_CACHE* pCache, _In_ int Class)
+{
+    SLAB_CLASS* pClass = &pCache->Classes[Class];
+    if (!pClass->pFree)
+        pClass->pFree = InterlockedFlushSList(&pClass->Returned);
+
+    if (!pClass->pFree)
+    {
+        MwsThreadAllocStats.HeapAllocs++;
+        PBYTE pChunk = HeapAlloc(GetProcessHeap(), 0, SLAB_CHUNK_SIZE);
+        if (!pChunk)
+            return NULL;
+
+        // link in reverse so slots are handed out in address order.
+        for (SIZE_T Offset = SLAB_CHUNK_SIZE; Offset >= SLAB_SLOT_SIZE(Class); Offset -= SLAB_SLOT_SIZE(Class))
+        {
+            SLAB_HEADER* pHeader = (SLAB_HEADER*)(pChunk + Offset - SLAB_SLOT_SIZE(Class));
+            pHeader->pOwner = pCache;
+            pHeader->Class = Class;
+            PSLIST_ENTRY pEntry = (PSLIST_ENTRY)((PBYTE)pHeader + SLAB_HEADER_SIZE);
+            pEntry->Next = pClass->pFree;
+            pClass->pFree = pEntry;
+        }
+    }
+
+    PSLIST_ENTRY pEntry = pClass->pFree;
+    pClass->pFree = pEntry->Next;
+    return (SLAB_HEADER*)((PBYTE)pEntry - SLAB_HEADER_SIZE);
+}
+
+PVOID MwsAlloc(_In_ const MWS_ALLOCATOR* pAllocator, _In_ DWORD dwFlags, _In_ SIZE_T cbSize)
+{
+    MwsThreadAllocStats.Allocs++;
+    MwsThreadAllocStats.Bytes += cbSize;
+
+    int Class = SlabClassOf(cbSize);
+    SLAB_CACHE* pCache = (Class >= 0 && pAllocator->Alloc == MwsHeapAllocator.Alloc) ? GetSlabCache() : NULL;
+
+    SLAB_HEADER* pHeader;
+    if (pCache)
+    {
+        pHeader = SlabPop(pCache, Class);
+        if (!pHeader)
+            return NULL;
+    }
+    else
+    {
+        MwsThreadAllocStats.HeapAllocs++;
+        pHeader = pAllocator->Alloc(pAllocator->Context, SLAB_HEADER_SIZE + cbSize);
+        if (!pHeader)
+            return NULL;
+        pHeader->pOwner = NULL;
+    }
+
+    PVOID pMem = (PBYTE)pHeader + SLAB_HEADER_SIZE;
+    if (dwFlags & HEAP_ZERO_MEMORY)
+        ZeroMemory(pMem, cbSize);
+    return pMem;
+}
+
+PVOID MwsRealloc(_In_ const MWS_ALLOCATOR* pAllocator, _In_ PVOID pMem, _In_ SIZE_T cbSize)
+{
+    SLAB_HEADER* pHeader = (SLAB_HEADER*)((PBYTE)pMem - SLAB_HEADER_SIZE);
+    if (!pHeader->pOwner)
+    {
+        MwsThreadAllocStats.Allocs++;
+        MwsThreadAllocStats.HeapAllocs++;
+        MwsThreadAllocStats.Bytes += cbSize;
+        pHeader = pAllocator->Realloc(pAllocator->Context, pHeader, SLAB_HEADER_SIZE + cbSize);
+        return pHeader ? (PBYTE)pHeader + SLAB_HEADER_SIZE : NULL;
+    }
+
+    SIZE_T cbSlot = SLAB_SLOT_SIZE(pHeader->Class) - SLAB_HEADER_SIZE;
+    if (cbSize <= cbSlot)
+        return pMem;
+
+    PVOID pNew = MwsAlloc(pAllocator, 0, cbSize);
+    if (!pNew)
+        return NULL;
+    memcpy(pNew, pMem, cbSlot);
+    MwsFree(pAllocator, pMem);
+    return pNew;
+}
+
+void MwsFree(_In_ const MWS_ALLOCATOR* pAllocator, _In_opt_ _Frees_ptr_opt_ PVOID pMem)
+{
+    if (!pMem)
+        return;
+
+    SLAB_HEADER* pHeader = (SLAB_HEADER*)((PBYTE)pMem - SLAB_HEADER_SIZE);
+    SLAB_CACHE* pOwner = pHeader->pOwner;
+    if (!pOwner)
+    {
+        pAllocator->Free(pAllocator->Context, pHeader);
+        return;
+    }
+
+    SLAB_CLASS* pClass = &pOwner->Classes[pHeader->Class];
+    PSLIST_ENTRY pEntry = pMem;
+    if (pOwner == CurrentSlabCache())
+    {
+        pEntry->Next = pClass->pFree;
+        pClass->pFree = pEntry;
+    }
+    else
+    {
+        InterlockedPushEntrySList(&pClass->Returned, pEntry);
+    }
+}
+
+// yyjson documents of a connection take memory from its allocator, ctx is the MWS_ALLOCATOR.
+
+static void* JsonMalloc(void* ctx, size_t size)
+{
+    return MwsAlloc(ctx, 0, size);
+}
+
+static void* JsonRealloc(void* ctx, void* ptr, size_t size)
+{
+    return MwsRealloc(ctx, ptr, size);
+}
+
+static void JsonFree(void* ctx, void* ptr)
+{
+    MwsFree(ctx, ptr);
+}
+
+yyjson_alc MwsJsonAlc(_In_ const MWS_ALLOCATOR* pAllocator)
+{
+    yyjson_alc Alc = { JsonMalloc, JsonRealloc, JsonFree, (void*)pAllocator };
+    return Alc;
+}
+
+// counting allocator
+
+#define COUNTING_HEADER 16 // keeps blocks 16 byte aligned
+
+static void CountLive(_Inout_ MWS_COUNTING_ALLOCATOR* pCounting, _In_ LONG64 Blocks, _In_ LONG64 Bytes)
+{
+    InterlockedAdd64(&pCounting->LiveBlocks, Blocks);
+    LONG64 Live = InterlockedAdd64(&pCounting->LiveBytes, Bytes);
+
+    LONG64 Peak = ReadNoFence64(&pCounting->PeakBytes);
+    while (Live > Peak)
+    {
+        LONG64 Seen = InterlockedCompareExchange64(&pCounting->PeakBytes, Live, Peak);
+        if (Seen == Peak)
+            break;
+        Peak = Seen;
+    }
+}
+
+static PVOID CountingAlloc(_In_opt_ PVOID Context, _In_ SIZE_T cbSize)
+{
+    MWS_COUNTING_ALLOCATOR* pCounting = Context;
+    PBYTE pBlock = pCounting->Inner.Alloc(pCounting->Inner.Context, COUNTING_HEADER + cbSize);
+    if (!pBlock)
+    {
+        InterlockedIncrement64(&pCounting->Failures);
+        return NULL;
+    }
+    *(SIZE_T*)pBlock = cbSize;
+    InterlockedIncrement64(&pCounting->Allocs);
+    CountLive(pCounting, 1, (LONG64)cbSize);
+    return pBlock + COUNTING_HEADER;
+}
+
+static PVOID CountingRealloc(_In_opt_ PVOID Context, _In_ PVOID pMem, _In_ SIZE_T cbSize)
+{
+    MWS_COUNTING_ALLOCATOR* pCounting = Context;
+    PBYTE pBlock = (PBYTE)pMem - COUNTING_HEADER;
+    SIZE_T cbOld = *(SIZE_T*)pBlock;
+
+    pBlock = pCounting->Inner.Realloc(pCounting->Inner.Context, pBlock, COUNTING_HEADER + cbSize);
+    if (!pBlock)
+    {
+        InterlockedIncrement64(&pCounting->Failures);
+        return NULL;
+    }
+    *(SIZE_T*)pBlock = cbSize;
+    InterlockedIncrement64(&pCounting->Reallocs);
+    CountLive(pCounting, 0, (LONG64)cbSize - (LONG64)cbOld);
+    return pBlock + COUNTING_HEADER;
+}
+
+static VOID CountingFree(_In_opt_ PVOID Context, _In_ PVOID pMem)
+{
+    MWS_COUNTING_ALLOCATOR* pCounting = Context;
+    PBYTE pBlock = (PBYTE)pMem - COUNTING_HEADER;
+    SIZE_T cbSize = *(SIZE_T*)pBlock;
+
+    InterlockedIncrement64(&pCounting->Frees);
+    CountLive(pCounting, -1, -(LONG64)cbSize);
+    pCounting->Inner.Free(pCounting->Inner.Context, pBlock);
+}
+
+void InitMiraiWSCountingAllocator(_Out_ MWS_COUNTING_ALLOCATOR* pCounting, _In_opt_ const MWS_ALLOCATOR* pInner)
+{
+    ZeroMemory(pCounting, sizeof(MWS_COUNTING_ALLOCATOR));
+    pCounting->Allocator.Alloc = CountingAlloc;
+    pCounting->Allocator.Realloc = CountingRealloc;
+    pCounting->Allocator.Free = CountingFree;
+    pCounting->Allocator.Context = pCounting;
+    pCounting->Inner = pInner ? *pInner : MwsHeapAllocator;
+}
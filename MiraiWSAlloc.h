@@ -0,0 +1,33 @@
+#pragma once
+
+#include <Windows.h>
+#include "MiraiWS.h"
+
+EXTERN_C_START
+
+// An allocator that counts what goes through it, for tests and for finding leaks:
+// after every connection created with it is freed, LiveBlocks and LiveBytes are back to where they started.
+// Every block carries a 16 byte header holding its size.
+
+typedef struct
+{
+    MWS_ALLOCATOR Allocator; // pass &Allocator to CreateMiraiWSEx or CreateMiraiWSManagerEx
+    MWS_ALLOCATOR Inner;     // where the memory comes from
+
+    volatile LONG64 Allocs;  // successful Alloc calls
+    volatile LONG64 Reallocs;
+    volatile LONG64 Frees;
+    volatile LONG64 Failures; // Alloc and Realloc calls the inner allocator failed
+    volatile LONG64 LiveBlocks;
+    volatile LONG64 LiveBytes; // requested sizes, without headers
+    volatile LONG64 PeakBytes;
+} MWS_COUNTING_ALLOCATOR;
+
+/// <summary>
+/// Set up a counting allocator with all counters at 0. It must outlive everything allocated through it.
+/// </summary>
+/// <param name="pCounting">the allocator to set up</param>
+/// <param name="pInner">allocator to take memory from, or NULL for the process heap</param>
+void InitMiraiWSCountingAllocator(_Out_ MWS_COUNTING_ALLOCATOR* pCounting, _In_opt_ const MWS_ALLOCATOR* pInner);
+
+EXTERN_C_END
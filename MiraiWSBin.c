@@ -0,0 +1,803 @@
+#include <Windows.h>
+#include "MiraiWSBin.h"
+
+void MwsBinWriterInit(_Out_ MWSBIN_WRITER* pWriter, _Out_writes_bytes_(cbBuffer) PVOID pBuffer, _In_ SIZE_T cbBuffer)
+{
+    pWriter->pBuffer = (PBYTE)pBuffer;
+    pWriter->cbBuffer = cbBuffer;
+    pWriter->cbWritten = 0;
+    pWriter->bOverflow = FALSE;
+}
+
+void MwsBinMeasureInit(_Out_ MWSBIN_WRITER* pWriter)
+{
+    pWriter->pBuffer = NULL;
+    pWriter->cbBuffer = MAXSIZE_T;
+    pWriter->cbWritten = 0;
+    pWriter->bOverflow = FALSE;
+}
+
+void MwsBinWriteByte(_Inout_ MWSBIN_WRITER* pWriter, _In_ BYTE Value)
+{
+    if (pWriter->bOverflow || pWriter->cbWritten >= pWriter->cbBuffer)
+    {
+        pWriter->bOverflow = TRUE;
+        return;
+    }
+    if (pWriter->pBuffer)
+        pWriter->pBuffer[pWriter->cbWritten] = Value;
+    pWriter->cbWritten++;
+}
+
+void MwsBinWriteVarUInt(_Inout_ MWSBIN_WRITER* pWriter, _In_ UINT64 Value)
+{
+    if (pWriter->bOverflow)
+        return;
+
+    // fast path, there is room for the longest varint.
+    if (pWriter->pBuffer && pWriter->cbBuffer - pWriter->cbWritten >= MWSBIN_MAX_VARINT)
+    {
+        PBYTE p = pWriter->pBuffer + pWriter->cbWritten;
+        PBYTE pStart = p;
+        while (Value >= 0x80)
+        {
+            *p++ = (BYTE)(Value | 0x80);
+            Value >>= 7;
+        }
+        *p++ = (BYTE)Value;
+        pWriter->cbWritten += p - pStart;
+        return;
+    }
+
+    while (Value >= 0x80)
+    {
+        MwsBinWriteByte(pWriter, (BYTE)(Value | 0x80));
+        Value >>= 7;
+    }
+    MwsBinWriteByte(pWriter, (BYTE)Value);
+}
+
+void MwsBinWriteVarSInt(_Inout_ MWSBIN_WRITER* pWriter, _In_ INT64 Value)
+{
+    // zigzag: small negative numbers stay short.
+    MwsBinWriteVarUInt(pWriter, ((UINT64)Value << 1) ^ (UINT64)(Value >> 63));
+}
+
+void MwsBinWriteBytes(_Inout_ MWSBIN_WRITER* pWriter, _In_reads_bytes_(cbLen) const void* pData, _In_ SIZE_T cbLen)
+{
+    if (pWriter->bOverflow || pWriter->cbBuffer - pWriter->cbWritten < cbLen)
+    {
+        pWriter->bOverflow = TRUE;
+        return;
+    }
+    if (pWriter->pBuffer)
+        memcpy(pWriter->pBuffer + pWriter->cbWritten, pData, cbLen);
+    pWriter->cbWritten += cbLen;
+}
+
+void MwsBinWriteStr(_Inout_ MWSBIN_WRITER* pWriter, _In_reads_bytes_(cbLen) LPCSTR lpStr, _In_ SIZE_T cbLen)
+{
+    MwsBinWriteVarUInt(pWriter, cbLen);
+    MwsBinWriteBytes(pWriter, lpStr, cbLen);
+}
+
+BOOL MwsBinWriteValue(_Inout_ MWSBIN_WRITER* pWriter, _In_ yyjson_val* Value)
+{
+    switch (yyjson_get_type(Value))
+    {
+    case YYJSON_TYPE_NULL:
+    {
+        MwsBinWriteByte(pWriter, MWSBIN_NULL);
+        break;
+    }
+    case YYJSON_TYPE_BOOL:
+    {
+        MwsBinWriteByte(pWriter, yyjson_get_bool(Value) ? MWSBIN_TRUE : MWSBIN_FALSE);
+        break;
+    }
+    case YYJSON_TYPE_NUM:
+    {
+        if (yyjson_is_sint(Value) || (yyjson_is_uint(Value) && yyjson_get_uint(Value) <= (UINT64)MAXINT64))
+        {
+            MwsBinWriteByte(pWriter, MWSBIN_SINT);
+            MwsBinWriteVarSInt(pWriter, yyjson_is_sint(Value) ? yyjson_get_sint(Value) : (INT64)yyjson_get_uint(Value));
+        }
+        else if (yyjson_is_uint(Value))
+        {
+            MwsBinWriteByte(pWriter, MWSBIN_UINT);
+            MwsBinWriteVarUInt(pWriter, yyjson_get_uint(Value));
+        }
+        else
+        {
+            double Real = yyjson_get_real(Value);
+            MwsBinWriteByte(pWriter, MWSBIN_REAL);
+            MwsBinWriteBytes(pWriter, &Real, sizeof(Real));
+        }
+        break;
+    }
+    case YYJSON_TYPE_STR:
+    case YYJSON_TYPE_RAW:
+    {
+        MwsBinWriteByte(pWriter, MWSBIN_STR);
+        MwsBinWriteStr(pWriter, unsafe_yyjson_get_str(Value), unsafe_yyjson_get_len(Value));
+        break;
+    }
+    case YYJSON_TYPE_ARR:
+    {
+        size_t Index, Max;
+        yyjson_val* Element;
+        MwsBinWriteByte(pWriter, MWSBIN_ARR);
+        MwsBinWriteVarUInt(pWriter, yyjson_arr_size(Value));
+        yyjson_arr_foreach(Value, Index, Max, Element)
+        {
+            if (!MwsBinWriteValue(pWriter, Element))
+                return FALSE;
+        }
+        break;
+    }
+    case YYJSON_TYPE_OBJ:
+    {
+        size_t Index, Max;
+        yyjson_val* Key;
+        yyjson_val* Member;
+        MwsBinWriteByte(pWriter, MWSBIN_OBJ);
+        MwsBinWriteVarUInt(pWriter, yyjson_obj_size(Value));
+        yyjson_obj_foreach(Value, Index, Max, Key, Member)
+        {
+            MwsBinWriteStr(pWriter, unsafe_yyjson_get_str(Key), unsafe_yyjson_get_len(Key));
+            if (!MwsBinWriteValue(pWriter, Member))
+                return FALSE;
+        }
+        break;
+    }
+    default:
+    {
+        pWriter->bOverflow = TRUE;
+        break;
+    }
+    }
+    return !pWriter->bOverflow;
+}
+
+SIZE_T MwsBinVarUIntSize(_In_ UINT64 Value)
+{
+    SIZE_T Size = 1;
+    while (Value >= 0x80)
+    {
+        Value >>= 7;
+        Size++;
+    }
+    return Size;
+}
+
+SIZE_T MwsBinMeasureValue(_In_ yyjson_val* Value)
+{
+    MWSBIN_WRITER Writer;
+    MwsBinMeasureInit(&Writer);
+    MwsBinWriteValue(&Writer, Value);
+    return Writer.cbWritten;
+}
+
+void MwsBinReaderInit(_Out_ MWSBIN_READER* pReader, _In_reads_bytes_(cbData) const void* pData, _In_ SIZE_T cbData)
+{
+    pReader->pCur = (const BYTE*)pData;
+    pReader->pEnd = (const BYTE*)pData + cbData;
+    pReader->bError = FALSE;
+}
+
+MWSBIN_TAG MwsBinPeekTag(_In_ const MWSBIN_READER* pReader)
+{
+    if (pReader->bError || pReader->pCur >= pReader->pEnd)
+        return MWSBIN_INVALID;
+    return (MWSBIN_TAG)*pReader->pCur;
+}
+
+BYTE MwsBinReadByte(_Inout_ MWSBIN_READER* pReader)
+{
+    if (pReader->bError || pReader->pCur >= pReader->pEnd)
+    {
+        pReader->bError = TRUE;
+        return 0;
+    }
+    return *pReader->pCur++;
+}
+
+UINT64 MwsBinReadVarUInt(_Inout_ MWSBIN_READER* pReader)
+{
+    UINT64 Value = 0;
+    for (int Shift = 0; Shift < 64; Shift += 7)
+    {
+        BYTE Byte = MwsBinReadByte(pReader);
+        if (pReader->bError)
+            return 0;
+        Value |= (UINT64)(Byte & 0x7F) << Shift;
+        if (!(Byte & 0x80))
+            return Value;
+    }
+    // more than MWSBIN_MAX_VARINT bytes.
+    pReader->bError = TRUE;
+    return 0;
+}
+
+INT64 MwsBinReadVarSInt(_Inout_ MWSBIN_READER* pReader)
+{
+    UINT64 ZigZag = MwsBinReadVarUInt(pReader);
+    return (INT64)(ZigZag >> 1) ^ -(INT64)(ZigZag & 1);
+}
+
+BOOL MwsBinReadStr(_Inout_ MWSBIN_READER* pReader, _Out_ LPCSTR* plpStr, _Out_ SIZE_T* pcbLen)
+{
+    *plpStr = NULL;
+    *pcbLen = 0;
+
+    UINT64 Len = MwsBinReadVarUInt(pReader);
+    if (pReader->bError || Len > (UINT64)(pReader->pEnd - pReader->pCur))
+    {
+        pReader->bError = TRUE;
+        return FALSE;
+    }
+    *plpStr = (LPCSTR)pReader->pCur;
+    *pcbLen = (SIZE_T)Len;
+    pReader->pCur += Len;
+    return TRUE;
+}
+
+BOOL MwsBinReadInt(_Inout_ MWSBIN_READER* pReader, _Out_ INT64* pValue)
+{
+    *pValue = 0;
+    switch (MwsBinPeekTag(pReader))
+    {
+    case MWSBIN_SINT:
+        pReader->pCur++;
+        *pValue = MwsBinReadVarSInt(pReader);
+        return !pReader->bError;
+    case MWSBIN_UINT:
+        pReader->pCur++;
+        *pValue = (INT64)MwsBinReadVarUInt(pReader);
+        return !pReader->bError;
+    default:
+        return FALSE;
+    }
+}
+
+BOOL MwsBinReadBool(_Inout_ MWSBIN_READER* pReader, _Out_ BOOL* pValue)
+{
+    *pValue = FALSE;
+    switch (MwsBinPeekTag(pReader))
+    {
+    case MWSBIN_TRUE:
+        *pValue = TRUE;
+        // fallthrough
+    case MWSBIN_FALSE:
+        pReader->pCur++;
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+BOOL MwsBinReadString(_Inout_ MWSBIN_READER* pReader, _Out_ LPCSTR* plpStr, _Out_ SIZE_T* pcbLen)
+{
+    *plpStr = NULL;
+    *pcbLen = 0;
+    if (MwsBinPeekTag(pReader) != MWSBIN_STR)
+        return FALSE;
+    pReader->pCur++;
+    return MwsBinReadStr(pReader, plpStr, pcbLen);
+}
+
+BOOL MwsBinReadContainer(_Inout_ MWSBIN_READER* pReader, _In_ MWSBIN_TAG Tag, _Out_ SIZE_T* pCount)
+{
+    *pCount = 0;
+    if (MwsBinPeekTag(pReader) != Tag || (Tag != MWSBIN_ARR && Tag != MWSBIN_OBJ))
+        return FALSE;
+    pReader->pCur++;
+
+    UINT64 Count = MwsBinReadVarUInt(pReader);
+    // every element takes at least one byte, reject counts the data can't hold.
+    if (pReader->bError || Count > (UINT64)(pReader->pEnd - pReader->pCur))
+    {
+        pReader->bError = TRUE;
+        return FALSE;
+    }
+    *pCount = (SIZE_T)Count;
+    return TRUE;
+}
+
+static BOOL SkipValue(_Inout_ MWSBIN_READER* pReader, _In_ int Depth)
+{
+    if (Depth > MWSBIN_MAX_DEPTH)
+    {
+        pReader->bError = TRUE;
+        return FALSE;
+    }
+
+    LPCSTR lpStr;
+    SIZE_T cbLen, Count;
+    switch (MwsBinReadByte(pReader))
+    {
+    case MWSBIN_NULL:
+    case MWSBIN_FALSE:
+    case MWSBIN_TRUE:
+        break;
+    case MWSBIN_SINT:
+    case MWSBIN_UINT:
+        MwsBinReadVarUInt(pReader);
+        break;
+    case MWSBIN_REAL:
+        if (pReader->pEnd - pReader->pCur < (SSIZE_T)sizeof(double))
+            pReader->bError = TRUE;
+        else
+            pReader->pCur += sizeof(double);
+        break;
+    case MWSBIN_STR:
+        MwsBinReadStr(pReader, &lpStr, &cbLen);
+        break;
+    case MWSBIN_ARR:
+        pReader->pCur--;
+        if (!MwsBinReadContainer(pReader, MWSBIN_ARR, &Count))
+            return FALSE;
+        while (Count-- && SkipValue(pReader, Depth + 1));
+        break;
+    case MWSBIN_OBJ:
+        pReader->pCur--;
+        if (!MwsBinReadContainer(pReader, MWSBIN_OBJ, &Count))
+            return FALSE;
+        while (Count-- && MwsBinReadStr(pReader, &lpStr, &cbLen) && SkipValue(pReader, Depth + 1));
+        break;
+    default:
+        pReader->bError = TRUE;
+        break;
+    }
+    return !pReader->bError;
+}
+
+BOOL MwsBinSkipValue(_Inout_ MWSBIN_READER* pReader)
+{
+    return SkipValue(pReader, 0);
+}
+
+BOOL MwsBinFindMember(_Inout_ MWSBIN_READER* pReader, _In_z_ LPCSTR lpKey)
+{
+    MWSBIN_READER Reader = *pReader;
+    SIZE_T Count;
+    SIZE_T cbKey = strlen(lpKey);
+
+    if (!MwsBinReadContainer(&Reader, MWSBIN_OBJ, &Count))
+        return FALSE;
+
+    while (Count--)
+    {
+        LPCSTR lpName;
+        SIZE_T cbName;
+        if (!MwsBinReadStr(&Reader, &lpName, &cbName))
+            return FALSE;
+        if (cbName == cbKey && memcmp(lpName, lpKey, cbKey) == 0)
+        {
+            *pReader = Reader;
+            return TRUE;
+        }
+        if (!MwsBinSkipValue(&Reader))
+            return FALSE;
+    }
+    return FALSE;
+}
+
+static const LPCSTR EventTypeNames[MWSBIN_EV_COUNT] = {
+    NULL,
+    "FriendMessage",
+    "GroupMessage",
+    "TempMessage",
+    "StrangerMessage",
+    "OtherClientMessage",
+    "FriendSyncMessage",
+    "GroupSyncMessage",
+    "TempSyncMessage",
+    "StrangerSyncMessage",
+    "BotOnlineEvent",
+    "BotOfflineEventActive",
+    "BotOfflineEventForce",
+    "BotOfflineEventDropped",
+    "BotReloginEvent",
+    "FriendInputStatusChangedEvent",
+    "FriendNickChangedEvent",
+    "BotGroupPermissionChangeEvent",
+    "BotMuteEvent",
+    "BotUnmuteEvent",
+    "BotJoinGroupEvent",
+    "BotLeaveEventActive",
+    "BotLeaveEventKick",
+    "BotLeaveEventDisband",
+    "GroupRecallEvent",
+    "FriendRecallEvent",
+    "NudgeEvent",
+    "GroupNameChangeEvent",
+    "GroupEntranceAnnouncementChangeEvent",
+    "GroupMuteAllEvent",
+    "GroupAllowAnonymousChatEvent",
+    "GroupAllowConfessTalkEvent",
+    "GroupAllowMemberInviteEvent",
+    "MemberJoinEvent",
+    "MemberLeaveEventKick",
+    "MemberLeaveEventQuit",
+    "MemberCardChangeEvent",
+    "MemberSpecialTitleChangeEvent",
+    "MemberPermissionChangeEvent",
+    "MemberMuteEvent",
+    "MemberUnmuteEvent",
+    "MemberHonorChangeEvent",
+    "NewFriendRequestEvent",
+    "MemberJoinRequestEvent",
+    "BotInvitedJoinGroupRequestEvent",
+    "OtherClientOnlineEvent",
+    "OtherClientOfflineEvent",
+    "CommandExecutedEvent"
+};
+
+static const MWSBIN_STRING PermissionNames[] = {
+    { "", 0 },
+    { "MEMBER", 6 },
+    { "ADMINISTRATOR", 13 },
+    { "OWNER", 5 }
+};
+
+MWSBIN_EVENT_TYPE MwsBinEventTypeFromName(_In_reads_(cchName) LPCSTR lpName, _In_ SIZE_T cchName)
+{
+    for (int i = 1; i < MWSBIN_EV_COUNT; i++)
+    {
+        // the name comes from the wire and may hold a \u0000, compare lengths before bytes.
+        if (strlen(EventTypeNames[i]) == cchName && memcmp(EventTypeNames[i], lpName, cchName) == 0)
+            return (MWSBIN_EVENT_TYPE)i;
+    }
+    return MWSBIN_EV_UNKNOWN;
+}
+
+_Ret_maybenull_
+LPCSTR MwsBinEventTypeName(_In_ MWSBIN_EVENT_TYPE Type)
+{
+    if (Type <= MWSBIN_EV_UNKNOWN || Type >= MWSBIN_EV_COUNT)
+        return NULL;
+    return EventTypeNames[Type];
+}
+
+static yyjson_val* GetInt(_In_ yyjson_val* Obj, _In_z_ LPCSTR lpKey)
+{
+    yyjson_val* Field = yyjson_obj_get(Obj, lpKey);
+    return yyjson_is_int(Field) ? Field : NULL;
+}
+
+static yyjson_val* GetStr(_In_ yyjson_val* Obj, _In_z_ LPCSTR lpKey)
+{
+    yyjson_val* Field = yyjson_obj_get(Obj, lpKey);
+    return yyjson_is_str(Field) ? Field : NULL;
+}
+
+static void WriteStrField(_Inout_ MWSBIN_WRITER* pWriter, _In_ yyjson_val* Field)
+{
+    MwsBinWriteStr(pWriter, unsafe_yyjson_get_str(Field), unsafe_yyjson_get_len(Field));
+}
+
+static BYTE PermissionCode(_In_ yyjson_val* Field)
+{
+    for (BYTE i = 1; i < _countof(PermissionNames); i++)
+    {
+        if (yyjson_equals_strn(Field, PermissionNames[i].Ptr, PermissionNames[i].Len))
+            return i;
+    }
+    return 0;
+}
+
+/// <summary>
+/// Write one block of a chain, schema form if it has exactly the known fields, packed otherwise.
+/// </summary>
+static void WriteBlock(_Inout_ MWSBIN_WRITER* pWriter, _In_ yyjson_val* Block)
+{
+    yyjson_val* TypeField = GetStr(Block, "type");
+    size_t FieldCnt = yyjson_obj_size(Block);
+    if (TypeField)
+    {
+        if (yyjson_equals_str(TypeField, "Plain") && FieldCnt == 2)
+        {
+            yyjson_val* TextField = GetStr(Block, "text");
+            if (TextField)
+            {
+                MwsBinWriteByte(pWriter, MWSBIN_BLOCK_PLAIN);
+                WriteStrField(pWriter, TextField);
+                return;
+            }
+        }
+        else if (yyjson_equals_str(TypeField, "At") && FieldCnt == 3)
+        {
+            yyjson_val* TargetField = GetInt(Block, "target");
+            yyjson_val* DisplayField = GetStr(Block, "display");
+            if (TargetField && DisplayField)
+            {
+                MwsBinWriteByte(pWriter, MWSBIN_BLOCK_AT);
+                MwsBinWriteVarSInt(pWriter, yyjson_get_sint(TargetField));
+                WriteStrField(pWriter, DisplayField);
+                return;
+            }
+        }
+        else if (yyjson_equals_str(TypeField, "AtAll") && FieldCnt == 1)
+        {
+            MwsBinWriteByte(pWriter, MWSBIN_BLOCK_ATALL);
+            return;
+        }
+        else if (yyjson_equals_str(TypeField, "Face") && FieldCnt == 3)
+        {
+            yyjson_val* FaceIDField = GetInt(Block, "faceId");
+            yyjson_val* NameField = GetStr(Block, "name");
+            if (FaceIDField && NameField)
+            {
+                MwsBinWriteByte(pWriter, MWSBIN_BLOCK_FACE);
+                MwsBinWriteVarSInt(pWriter, yyjson_get_sint(FaceIDField));
+                WriteStrField(pWriter, NameField);
+                return;
+            }
+        }
+    }
+    MwsBinWriteByte(pWriter, MWSBIN_BLOCK_PACKED);
+    MwsBinWriteValue(pWriter, Block);
+}
+
+BOOL MwsBinWriteChain(_Inout_ MWSBIN_WRITER* pWriter, _In_ yyjson_val* Chain)
+{
+    yyjson_val* Source = yyjson_arr_get_first(Chain);
+    if (!yyjson_is_obj(Source) || yyjson_obj_size(Source) != 3)
+        return FALSE;
+
+    yyjson_val* TypeField = GetStr(Source, "type");
+    yyjson_val* IDField = GetInt(Source, "id");
+    yyjson_val* TimeField = GetInt(Source, "time");
+    if (!TypeField || !yyjson_equals_str(TypeField, "Source") || !IDField || !TimeField)
+        return FALSE;
+
+    MwsBinWriteVarSInt(pWriter, yyjson_get_sint(IDField));
+    MwsBinWriteVarSInt(pWriter, yyjson_get_sint(TimeField));
+    MwsBinWriteVarUInt(pWriter, yyjson_arr_size(Chain) - 1);
+
+    size_t Index, Max;
+    yyjson_val* Block;
+    yyjson_arr_foreach(Chain, Index, Max, Block)
+    {
+        if (Index == 0)
+            continue;
+        if (!yyjson_is_obj(Block))
+            return FALSE;
+        WriteBlock(pWriter, Block);
+    }
+    return TRUE;
+}
+
+static BOOL WriteFriendMessage(_Inout_ MWSBIN_WRITER* pWriter, _In_ yyjson_val* DataField)
+{
+    yyjson_val* SenderField = yyjson_obj_get(DataField, "sender");
+    yyjson_val* ChainField = yyjson_obj_get(DataField, "messageChain");
+    if (yyjson_obj_size(DataField) != 3 || !yyjson_is_obj(SenderField) || !yyjson_is_arr(ChainField) ||
+        yyjson_obj_size(SenderField) != 3)
+        return FALSE;
+
+    yyjson_val* IDField = GetInt(SenderField, "id");
+    yyjson_val* NickField = GetStr(SenderField, "nickname");
+    yyjson_val* RemarkField = GetStr(SenderField, "remark");
+    if (!IDField || !NickField || !RemarkField)
+        return FALSE;
+
+    MwsBinWriteByte(pWriter, MWSBIN_FORM_FRIEND_MESSAGE);
+    MwsBinWriteVarSInt(pWriter, yyjson_get_sint(IDField));
+    WriteStrField(pWriter, NickField);
+    WriteStrField(pWriter, RemarkField);
+    return MwsBinWriteChain(pWriter, ChainField);
+}
+
+static BOOL WriteGroupMessage(_Inout_ MWSBIN_WRITER* pWriter, _In_ yyjson_val* DataField)
+{
+    yyjson_val* SenderField = yyjson_obj_get(DataField, "sender");
+    yyjson_val* ChainField = yyjson_obj_get(DataField, "messageChain");
+    if (yyjson_obj_size(DataField) != 3 || !yyjson_is_obj(SenderField) || !yyjson_is_arr(ChainField) ||
+        yyjson_obj_size(SenderField) != 8)
+        return FALSE;
+
+    yyjson_val* IDField = GetInt(SenderField, "id");
+    yyjson_val* MemberNameField = GetStr(SenderField, "memberName");
+    yyjson_val* SpecialTitleField = GetStr(SenderField, "specialTitle");
+    yyjson_val* PermissionField = GetStr(SenderField, "permission");
+    yyjson_val* JoinTimeField = GetInt(SenderField, "joinTimestamp");
+    yyjson_val* LastSpeakTimeField = GetInt(SenderField, "lastSpeakTimestamp");
+    yyjson_val* MuteTimeRemainField = GetInt(SenderField, "muteTimeRemaining");
+    yyjson_val* GroupField = yyjson_obj_get(SenderField, "group");
+    if (!IDField || !MemberNameField || !SpecialTitleField || !PermissionField ||
+        !JoinTimeField || !LastSpeakTimeField || !MuteTimeRemainField ||
+        !yyjson_is_obj(GroupField) || yyjson_obj_size(GroupField) != 3)
+        return FALSE;
+
+    yyjson_val* GroupIDField = GetInt(GroupField, "id");
+    yyjson_val* GroupNameField = GetStr(GroupField, "name");
+    yyjson_val* GroupPermissionField = GetStr(GroupField, "permission");
+    if (!GroupIDField || !GroupNameField || !GroupPermissionField)
+        return FALSE;
+
+    BYTE Permission = PermissionCode(PermissionField);
+    BYTE GroupPermission = PermissionCode(GroupPermissionField);
+    if (!Permission || !GroupPermission)
+        return FALSE;
+
+    MwsBinWriteByte(pWriter, MWSBIN_FORM_GROUP_MESSAGE);
+    MwsBinWriteVarSInt(pWriter, yyjson_get_sint(IDField));
+    WriteStrField(pWriter, MemberNameField);
+    WriteStrField(pWriter, SpecialTitleField);
+    MwsBinWriteByte(pWriter, Permission);
+    MwsBinWriteVarSInt(pWriter, yyjson_get_sint(JoinTimeField));
+    MwsBinWriteVarSInt(pWriter, yyjson_get_sint(LastSpeakTimeField));
+    MwsBinWriteVarSInt(pWriter, yyjson_get_sint(MuteTimeRemainField));
+    MwsBinWriteVarSInt(pWriter, yyjson_get_sint(GroupIDField));
+    WriteStrField(pWriter, GroupNameField);
+    MwsBinWriteByte(pWriter, GroupPermission);
+    return MwsBinWriteChain(pWriter, ChainField);
+}
+
+BOOL MwsBinWriteEvent(_Inout_ MWSBIN_WRITER* pWriter, _In_ yyjson_val* DataField)
+{
+    yyjson_val* TypeField = GetStr(DataField, "type");
+    MWSBIN_EVENT_TYPE Type = TypeField ?
+        MwsBinEventTypeFromName(unsafe_yyjson_get_str(TypeField), unsafe_yyjson_get_len(TypeField)) :
+        MWSBIN_EV_UNKNOWN;
+
+    MwsBinWriteByte(pWriter, MWSBIN_EVENT_VERSION);
+    MwsBinWriteByte(pWriter, (BYTE)Type);
+
+    // try the schema form, fall back to packed when the event has anything the schema doesn't cover.
+    SIZE_T cbMark = pWriter->cbWritten;
+    BOOL bSchema = FALSE;
+    switch (Type)
+    {
+    case MWSBIN_EV_FRIEND_MESSAGE:
+        bSchema = WriteFriendMessage(pWriter, DataField);
+        break;
+    case MWSBIN_EV_GROUP_MESSAGE:
+        bSchema = WriteGroupMessage(pWriter, DataField);
+        break;
+    default:
+        break;
+    }
+
+    if (pWriter->bOverflow)
+        return FALSE;
+    if (bSchema)
+        return TRUE;
+
+    pWriter->cbWritten = cbMark;
+    MwsBinWriteByte(pWriter, MWSBIN_FORM_PACKED);
+    return MwsBinWriteValue(pWriter, DataField);
+}
+
+static BOOL ReadStrView(_Inout_ MWSBIN_READER* pReader, _Out_ MWSBIN_STRING* pStr)
+{
+    return MwsBinReadStr(pReader, &pStr->Ptr, &pStr->Len);
+}
+
+static BOOL ReadPermission(_Inout_ MWSBIN_READER* pReader, _Out_ MWSBIN_STRING* pStr)
+{
+    BYTE Code = MwsBinReadByte(pReader);
+    if (pReader->bError || Code == 0 || Code >= _countof(PermissionNames))
+    {
+        pReader->bError = TRUE;
+        return FALSE;
+    }
+    *pStr = PermissionNames[Code];
+    return TRUE;
+}
+
+BOOL MwsBinReadChain(_Inout_ MWSBIN_READER* pReader, _Out_ MWSBIN_CHAIN* pChain)
+{
+    pChain->ID = MwsBinReadVarSInt(pReader);
+    pChain->Timestamp = MwsBinReadVarSInt(pReader);
+    pChain->BlockCnt = (SIZE_T)MwsBinReadVarUInt(pReader);
+    pChain->BlocksRead = 0;
+    pChain->Blocks = *pReader;
+    if (pReader->bError)
+        return FALSE;
+
+    // move the outer reader past the chain.
+    MWSBIN_CHAIN Skip = *pChain;
+    MWSBIN_BLOCK Block;
+    while (MwsBinReadBlock(&Skip, &Block));
+    if (Skip.BlocksRead != Skip.BlockCnt)
+    {
+        pReader->bError = TRUE;
+        return FALSE;
+    }
+    *pReader = Skip.Blocks;
+    return TRUE;
+}
+
+BOOL MwsBinReadEvent(_Inout_ MWSBIN_READER* pReader, _Out_ MWSBIN_EVENT* pEvent)
+{
+    ZeroMemory(pEvent, sizeof(MWSBIN_EVENT));
+    if (MwsBinReadByte(pReader) != MWSBIN_EVENT_VERSION)
+        return FALSE;
+
+    BYTE Type = MwsBinReadByte(pReader);
+    BYTE Form = MwsBinReadByte(pReader);
+    if (pReader->bError || Type >= MWSBIN_EV_COUNT)
+        return FALSE;
+    pEvent->Type = (MWSBIN_EVENT_TYPE)Type;
+    pEvent->Form = (MWSBIN_EVENT_FORM)Form;
+
+    switch (Form)
+    {
+    case MWSBIN_FORM_PACKED:
+    {
+        pEvent->Packed.Object = *pReader;
+        return MwsBinSkipValue(pReader);
+    }
+    case MWSBIN_FORM_FRIEND_MESSAGE:
+    {
+        pEvent->FriendMessage.SenderID = MwsBinReadVarSInt(pReader);
+        return ReadStrView(pReader, &pEvent->FriendMessage.Nick) &&
+            ReadStrView(pReader, &pEvent->FriendMessage.Remark) &&
+            MwsBinReadChain(pReader, &pEvent->FriendMessage.Chain);
+    }
+    case MWSBIN_FORM_GROUP_MESSAGE:
+    {
+        pEvent->GroupMessage.SenderID = MwsBinReadVarSInt(pReader);
+        if (!ReadStrView(pReader, &pEvent->GroupMessage.MemberName) ||
+            !ReadStrView(pReader, &pEvent->GroupMessage.SpecialTitle) ||
+            !ReadPermission(pReader, &pEvent->GroupMessage.Permission))
+            return FALSE;
+        pEvent->GroupMessage.JoinTimestamp = MwsBinReadVarSInt(pReader);
+        pEvent->GroupMessage.LastSpeakTimestamp = MwsBinReadVarSInt(pReader);
+        pEvent->GroupMessage.MuteTimeRemaining = MwsBinReadVarSInt(pReader);
+        pEvent->GroupMessage.GroupID = MwsBinReadVarSInt(pReader);
+        return ReadStrView(pReader, &pEvent->GroupMessage.GroupName) &&
+            ReadPermission(pReader, &pEvent->GroupMessage.GroupPermission) &&
+            MwsBinReadChain(pReader, &pEvent->GroupMessage.Chain);
+    }
+    default:
+        pReader->bError = TRUE;
+        return FALSE;
+    }
+}
+
+BOOL MwsBinReadBlock(_Inout_ MWSBIN_CHAIN* pChain, _Out_ MWSBIN_BLOCK* pBlock)
+{
+    MWSBIN_READER* pReader = &pChain->Blocks;
+    ZeroMemory(pBlock, sizeof(MWSBIN_BLOCK));
+    if (pChain->BlocksRead >= pChain->BlockCnt)
+        return FALSE;
+
+    pBlock->Tag = (MWSBIN_BLOCK_TAG)MwsBinReadByte(pReader);
+    switch (pBlock->Tag)
+    {
+    case MWSBIN_BLOCK_AT:
+        pBlock->At.Target = MwsBinReadVarSInt(pReader);
+        ReadStrView(pReader, &pBlock->At.Display);
+        break;
+    case MWSBIN_BLOCK_ATALL:
+        break;
+    case MWSBIN_BLOCK_FACE:
+        pBlock->Face.FaceID = MwsBinReadVarSInt(pReader);
+        ReadStrView(pReader, &pBlock->Face.Name);
+        break;
+    case MWSBIN_BLOCK_PLAIN:
+        ReadStrView(pReader, &pBlock->Plain.Text);
+        break;
+    case MWSBIN_BLOCK_PACKED:
+    {
+        MWSBIN_READER TypeReader = *pReader;
+        pBlock->Packed.Object = *pReader;
+        if (MwsBinFindMember(&TypeReader, "type"))
+            MwsBinReadString(&TypeReader, &pBlock->Packed.Type.Ptr, &pBlock->Packed.Type.Len);
+        MwsBinSkipValue(pReader);
+        break;
+    }
+    default:
+        pReader->bError = TRUE;
+        break;
+    }
+
+    if (pReader->bError)
+        return FALSE;
+    pChain->BlocksRead++;
+    return TRUE;
+}
@@ -0,0 +1,344 @@
+#pragma once
+
+#include <Windows.h>
+#include "yyjson.h"
+
+EXTERN_C_START
+
+// Packed values: a compact binary form of json values, for handing events between processes.
+// Every value starts with a tag byte:
+//   MWSBIN_NULL, MWSBIN_FALSE, MWSBIN_TRUE: nothing follows
+//   MWSBIN_SINT: zigzag varint
+//   MWSBIN_UINT: varint, only for integers above INT64_MAX
+//   MWSBIN_REAL: 8 bytes IEEE 754 double, little endian
+//   MWSBIN_STR:  varint byte length, utf8 bytes, not zero-terminated
+//   MWSBIN_ARR:  varint element count, elements
+//   MWSBIN_OBJ:  varint member count, members as varint key length, key bytes, value
+// varints are LEB128: 7 bits per byte, low bits first, high bit set on every byte but the last.
+
+typedef enum _MWSBIN_TAG
+{
+    MWSBIN_NULL = 0,
+    MWSBIN_FALSE,
+    MWSBIN_TRUE,
+    MWSBIN_SINT,
+    MWSBIN_UINT,
+    MWSBIN_REAL,
+    MWSBIN_STR,
+    MWSBIN_ARR,
+    MWSBIN_OBJ,
+    MWSBIN_INVALID = 0xFF
+} MWSBIN_TAG;
+
+// longest varint, a UINT64 takes 10 bytes.
+#define MWSBIN_MAX_VARINT 10
+
+// nesting limit when reading, packed values may come from untrusted memory.
+#define MWSBIN_MAX_DEPTH 64
+
+typedef struct
+{
+    PBYTE pBuffer;    // NULL when only measuring
+    SIZE_T cbBuffer;
+    SIZE_T cbWritten; // bytes written, or that would have been written when measuring
+    BOOL bOverflow;   // set once a write did not fit, nothing is written after that
+} MWSBIN_WRITER;
+
+typedef struct
+{
+    const BYTE* pCur;
+    const BYTE* pEnd;
+    BOOL bError; // set once the data was truncated or malformed, every read fails after that
+} MWSBIN_READER;
+
+/// <summary>
+/// Start writing packed values into a caller supplied buffer.
+/// </summary>
+void MwsBinWriterInit(_Out_ MWSBIN_WRITER* pWriter, _Out_writes_bytes_(cbBuffer) PVOID pBuffer, _In_ SIZE_T cbBuffer);
+
+/// <summary>
+/// Start a writer that stores nothing and only counts bytes, to learn how large a buffer is needed.
+/// </summary>
+void MwsBinMeasureInit(_Out_ MWSBIN_WRITER* pWriter);
+
+void MwsBinWriteByte(_Inout_ MWSBIN_WRITER* pWriter, _In_ BYTE Value);
+void MwsBinWriteVarUInt(_Inout_ MWSBIN_WRITER* pWriter, _In_ UINT64 Value);
+void MwsBinWriteVarSInt(_Inout_ MWSBIN_WRITER* pWriter, _In_ INT64 Value);
+void MwsBinWriteBytes(_Inout_ MWSBIN_WRITER* pWriter, _In_reads_bytes_(cbLen) const void* pData, _In_ SIZE_T cbLen);
+
+/// <summary>
+/// Write varint length followed by the bytes, the body of a MWSBIN_STR.
+/// </summary>
+void MwsBinWriteStr(_Inout_ MWSBIN_WRITER* pWriter, _In_reads_bytes_(cbLen) LPCSTR lpStr, _In_ SIZE_T cbLen);
+
+/// <summary>
+/// Pack a json value and everything below it.
+/// </summary>
+/// <returns>TRUE if everything fit into the buffer</returns>
+BOOL MwsBinWriteValue(_Inout_ MWSBIN_WRITER* pWriter, _In_ yyjson_val* Value);
+
+/// <summary>
+/// How many bytes MwsBinWriteValue writes for a json value.
+/// </summary>
+SIZE_T MwsBinMeasureValue(_In_ yyjson_val* Value);
+
+SIZE_T MwsBinVarUIntSize(_In_ UINT64 Value);
+
+/// <summary>
+/// Start reading packed values. Nothing is copied, strings read point into pData.
+/// </summary>
+void MwsBinReaderInit(_Out_ MWSBIN_READER* pReader, _In_reads_bytes_(cbData) const void* pData, _In_ SIZE_T cbData);
+
+/// <summary>
+/// Tag of the next value without consuming it, MWSBIN_INVALID at end of data or on error.
+/// </summary>
+MWSBIN_TAG MwsBinPeekTag(_In_ const MWSBIN_READER* pReader);
+
+BYTE MwsBinReadByte(_Inout_ MWSBIN_READER* pReader);
+UINT64 MwsBinReadVarUInt(_Inout_ MWSBIN_READER* pReader);
+INT64 MwsBinReadVarSInt(_Inout_ MWSBIN_READER* pReader);
+
+/// <summary>
+/// Read the body of a MWSBIN_STR: varint length and the bytes.
+/// </summary>
+/// <param name="plpStr">receives pointer to the bytes, inside the packed data</param>
+/// <param name="pcbLen">receives the byte length</param>
+/// <returns>FALSE if the data is truncated</returns>
+BOOL MwsBinReadStr(_Inout_ MWSBIN_READER* pReader, _Out_ LPCSTR* plpStr, _Out_ SIZE_T* pcbLen);
+
+// Typed reads of a whole value, tag included. They fail if the next value has another type.
+BOOL MwsBinReadInt(_Inout_ MWSBIN_READER* pReader, _Out_ INT64* pValue);
+BOOL MwsBinReadBool(_Inout_ MWSBIN_READER* pReader, _Out_ BOOL* pValue);
+BOOL MwsBinReadString(_Inout_ MWSBIN_READER* pReader, _Out_ LPCSTR* plpStr, _Out_ SIZE_T* pcbLen);
+
+/// <summary>
+/// Read the header of an array or object.
+/// </summary>
+/// <param name="pCount">receives element or member count</param>
+BOOL MwsBinReadContainer(_Inout_ MWSBIN_READER* pReader, _In_ MWSBIN_TAG Tag, _Out_ SIZE_T* pCount);
+
+/// <summary>
+/// Skip the next value and everything below it.
+/// </summary>
+BOOL MwsBinSkipValue(_Inout_ MWSBIN_READER* pReader);
+
+/// <summary>
+/// With the reader at an object, move it to the value of a member.
+/// </summary>
+/// <param name="lpKey">member name, zero-terminated</param>
+/// <returns>TRUE if found, the reader is then at the member value. On FALSE the reader is left unchanged.</returns>
+BOOL MwsBinFindMember(_Inout_ MWSBIN_READER* pReader, _In_z_ LPCSTR lpKey);
+
+// Events: versioned, schema aware encoding of the "data" object of mirai events.
+//   byte   MWSBIN_EVENT_VERSION
+//   byte   MWSBIN_EVENT_TYPE
+//   byte   MWSBIN_EVENT_FORM, how the body is encoded
+//   body
+//
+// MWSBIN_FORM_PACKED body is the whole data object as a packed value, used for every event type
+// and whenever a message event carries fields the schema doesn't know, so nothing is lost.
+//
+// MWSBIN_FORM_FRIEND_MESSAGE body:
+//   sint sender id, str nickname, str remark, chain
+// MWSBIN_FORM_GROUP_MESSAGE body:
+//   sint sender id, str memberName, str specialTitle, byte permission,
+//   sint joinTimestamp, sint lastSpeakTimestamp, sint muteTimeRemaining,
+//   sint group id, str group name, byte group permission, chain
+// chain:
+//   sint message id, sint time, varint block count, blocks
+// block:
+//   byte MWSBIN_BLOCK_TAG, then
+//   MWSBIN_BLOCK_AT:    sint target, str display
+//   MWSBIN_BLOCK_ATALL: nothing
+//   MWSBIN_BLOCK_FACE:  sint faceId, str name
+//   MWSBIN_BLOCK_PLAIN: str text
+//   MWSBIN_BLOCK_PACKED: the block object as a packed value, for every other block
+
+#define MWSBIN_EVENT_VERSION 1
+
+typedef enum _MWSBIN_EVENT_TYPE
+{
+    MWSBIN_EV_UNKNOWN = 0,
+    MWSBIN_EV_FRIEND_MESSAGE,
+    MWSBIN_EV_GROUP_MESSAGE,
+    MWSBIN_EV_TEMP_MESSAGE,
+    MWSBIN_EV_STRANGER_MESSAGE,
+    MWSBIN_EV_OTHER_CLIENT_MESSAGE,
+    MWSBIN_EV_FRIEND_SYNC_MESSAGE,
+    MWSBIN_EV_GROUP_SYNC_MESSAGE,
+    MWSBIN_EV_TEMP_SYNC_MESSAGE,
+    MWSBIN_EV_STRANGER_SYNC_MESSAGE,
+    MWSBIN_EV_BOT_ONLINE,
+    MWSBIN_EV_BOT_OFFLINE_ACTIVE,
+    MWSBIN_EV_BOT_OFFLINE_FORCE,
+    MWSBIN_EV_BOT_OFFLINE_DROPPED,
+    MWSBIN_EV_BOT_RELOGIN,
+    MWSBIN_EV_FRIEND_INPUT_STATUS_CHANGED,
+    MWSBIN_EV_FRIEND_NICK_CHANGED,
+    MWSBIN_EV_BOT_GROUP_PERMISSION_CHANGE,
+    MWSBIN_EV_BOT_MUTE,
+    MWSBIN_EV_BOT_UNMUTE,
+    MWSBIN_EV_BOT_JOIN_GROUP,
+    MWSBIN_EV_BOT_LEAVE_ACTIVE,
+    MWSBIN_EV_BOT_LEAVE_KICK,
+    MWSBIN_EV_BOT_LEAVE_DISBAND,
+    MWSBIN_EV_GROUP_RECALL,
+    MWSBIN_EV_FRIEND_RECALL,
+    MWSBIN_EV_NUDGE,
+    MWSBIN_EV_GROUP_NAME_CHANGE,
+    MWSBIN_EV_GROUP_ENTRANCE_ANNOUNCEMENT_CHANGE,
+    MWSBIN_EV_GROUP_MUTE_ALL,
+    MWSBIN_EV_GROUP_ALLOW_ANONYMOUS_CHAT,
+    MWSBIN_EV_GROUP_ALLOW_CONFESS_TALK,
+    MWSBIN_EV_GROUP_ALLOW_MEMBER_INVITE,
+    MWSBIN_EV_MEMBER_JOIN,
+    MWSBIN_EV_MEMBER_LEAVE_KICK,
+    MWSBIN_EV_MEMBER_LEAVE_QUIT,
+    MWSBIN_EV_MEMBER_CARD_CHANGE,
+    MWSBIN_EV_MEMBER_SPECIAL_TITLE_CHANGE,
+    MWSBIN_EV_MEMBER_PERMISSION_CHANGE,
+    MWSBIN_EV_MEMBER_MUTE,
+    MWSBIN_EV_MEMBER_UNMUTE,
+    MWSBIN_EV_MEMBER_HONOR_CHANGE,
+    MWSBIN_EV_NEW_FRIEND_REQUEST,
+    MWSBIN_EV_MEMBER_JOIN_REQUEST,
+    MWSBIN_EV_BOT_INVITED_JOIN_GROUP_REQUEST,
+    MWSBIN_EV_OTHER_CLIENT_ONLINE,
+    MWSBIN_EV_OTHER_CLIENT_OFFLINE,
+    MWSBIN_EV_COMMAND_EXECUTED,
+    MWSBIN_EV_COUNT
+} MWSBIN_EVENT_TYPE;
+
+typedef enum _MWSBIN_EVENT_FORM
+{
+    MWSBIN_FORM_PACKED = 0,
+    MWSBIN_FORM_FRIEND_MESSAGE,
+    MWSBIN_FORM_GROUP_MESSAGE
+} MWSBIN_EVENT_FORM;
+
+typedef enum _MWSBIN_BLOCK_TAG
+{
+    MWSBIN_BLOCK_PACKED = 0,
+    MWSBIN_BLOCK_AT,
+    MWSBIN_BLOCK_ATALL,
+    MWSBIN_BLOCK_FACE,
+    MWSBIN_BLOCK_PLAIN
+} MWSBIN_BLOCK_TAG;
+
+// a string inside packed data, not zero-terminated.
+typedef struct
+{
+    LPCSTR Ptr;
+    SIZE_T Len;
+} MWSBIN_STRING;
+
+typedef struct
+{
+    INT64 ID;
+    INT64 Timestamp;
+    SIZE_T BlockCnt;
+    SIZE_T BlocksRead;
+    MWSBIN_READER Blocks; // positioned at the next block, read them with MwsBinReadBlock
+} MWSBIN_CHAIN;
+
+typedef struct
+{
+    MWSBIN_BLOCK_TAG Tag;
+    union
+    {
+        struct
+        {
+            INT64 Target;
+            MWSBIN_STRING Display;
+        } At;
+        struct
+        {
+            INT64 FaceID;
+            MWSBIN_STRING Name;
+        } Face;
+        struct
+        {
+            MWSBIN_STRING Text;
+        } Plain;
+        struct
+        {
+            MWSBIN_STRING Type;      // value of "type"
+            MWSBIN_READER Object; // positioned at the packed block object
+        } Packed;
+    };
+} MWSBIN_BLOCK;
+
+typedef struct
+{
+    MWSBIN_EVENT_TYPE Type;
+    MWSBIN_EVENT_FORM Form;
+    union
+    {
+        struct
+        {
+            INT64 SenderID;
+            MWSBIN_STRING Nick;
+            MWSBIN_STRING Remark;
+            MWSBIN_CHAIN Chain;
+        } FriendMessage;
+        struct
+        {
+            INT64 SenderID;
+            MWSBIN_STRING MemberName;
+            MWSBIN_STRING SpecialTitle;
+            MWSBIN_STRING Permission; // "MEMBER", "ADMINISTRATOR" or "OWNER"
+            INT64 JoinTimestamp;
+            INT64 LastSpeakTimestamp;
+            INT64 MuteTimeRemaining;
+            INT64 GroupID;
+            MWSBIN_STRING GroupName;
+            MWSBIN_STRING GroupPermission;
+            MWSBIN_CHAIN Chain;
+        } GroupMessage;
+        struct
+        {
+            MWSBIN_READER Object; // positioned at the packed data object
+        } Packed;
+    };
+} MWSBIN_EVENT;
+
+/// <summary>
+/// Encode the data object of an event. Measure first with a writer from MwsBinMeasureInit to size the buffer.
+/// </summary>
+/// <returns>TRUE if everything fit into the buffer</returns>
+BOOL MwsBinWriteEvent(_Inout_ MWSBIN_WRITER* pWriter, _In_ yyjson_val* DataField);
+
+/// <summary>
+/// Map a mirai event type name to its code.
+/// </summary>
+/// <returns>MWSBIN_EV_UNKNOWN for names that are not known</returns>
+MWSBIN_EVENT_TYPE MwsBinEventTypeFromName(_In_reads_(cchName) LPCSTR lpName, _In_ SIZE_T cchName);
+
+_Ret_maybenull_
+LPCSTR MwsBinEventTypeName(_In_ MWSBIN_EVENT_TYPE Type);
+
+/// <summary>
+/// Decode an event written by MwsBinWriteEvent. Nothing is copied, strings point into the encoded data.
+/// </summary>
+/// <returns>FALSE if the data is malformed or of another version</returns>
+BOOL MwsBinReadEvent(_Inout_ MWSBIN_READER* pReader, _Out_ MWSBIN_EVENT* pEvent);
+
+/// <summary>
+/// Encode a received message chain alone, in the chain form of the message event bodies.
+/// </summary>
+/// <returns>FALSE if the chain doesn't start with a plain Source block, message events are then written packed</returns>
+BOOL MwsBinWriteChain(_Inout_ MWSBIN_WRITER* pWriter, _In_ yyjson_val* Chain);
+
+/// <summary>
+/// Decode a chain written by MwsBinWriteChain, or inside an event. The reader is moved past its blocks.
+/// </summary>
+/// <returns>FALSE if the data is malformed</returns>
+BOOL MwsBinReadChain(_Inout_ MWSBIN_READER* pReader, _Out_ MWSBIN_CHAIN* pChain);
+
+/// <summary>
+/// Decode the next block of a chain.
+/// </summary>
+/// <returns>FALSE when there are no more blocks or the data is malformed</returns>
+BOOL MwsBinReadBlock(_Inout_ MWSBIN_CHAIN* pChain, _Out_ MWSBIN_BLOCK* pBlock);
+
+EXTERN_C_END
@@ -0,0 +1,381 @@
+#include <Windows.h>
+#include "MiraiWS.h"
+#include "MiraiWSDirectory.h"
+#include "MiraiWSInternal.h"
+
+// Members hash on (group, member) into chained buckets, and are linked into one list from most to least
+// recently used, which is where they are evicted from. Groups are shared by their members and freed with the last one.
+// Sizing, hashing and locking are shared with the history, see MiraiWSInternal.h.
+
+#define DIRECTORY_MIN_BYTES (64 * 1024)
+#define DIRECTORY_GROUP_BUCKETS 64
+
+// a guess at the size of a member, to size the hash table from the cap.
+#define DIRECTORY_AVG_MEMBER 128
+
+typedef struct _DIRECTORY_GROUP DIRECTORY_GROUP;
+typedef struct _DIRECTORY_GROUP
+{
+    DIRECTORY_GROUP* pNext; // in its bucket
+    INT64 ID;
+    LONG Members;           // entries pointing here
+    CHAR Name[MWS_DIRECTORY_MAX_STR];
+} DIRECTORY_GROUP;
+
+typedef struct _DIRECTORY_ENTRY DIRECTORY_ENTRY;
+typedef struct _DIRECTORY_ENTRY
+{
+    DIRECTORY_ENTRY* pNext; // in its bucket
+    DIRECTORY_ENTRY* pNewer;
+    DIRECTORY_ENTRY* pOlder;
+    INT64 MemberID;
+    DIRECTORY_GROUP* pGroup;
+    INT64 JoinTimestamp;
+    INT64 LastSpeakTimestamp;
+    ULONGLONG UpdateTick;
+    MWS_PERMISSION Permission;
+    BYTE cbName;
+    BYTE cbTitle;
+    CHAR Strings[ANYSIZE_ARRAY]; // name then title, not terminated
+} DIRECTORY_ENTRY;
+
+typedef struct _MWS_DIRECTORY
+{
+    const MWS_ALLOCATOR* pAllocator; // of the connection
+    SRWLOCK Lock;
+    DIRECTORY_ENTRY** Buckets;
+    SIZE_T BucketMask;
+    DIRECTORY_GROUP* Groups[DIRECTORY_GROUP_BUCKETS];
+    DIRECTORY_ENTRY* pNewest;
+    DIRECTORY_ENTRY* pOldest;
+    MWS_DIRECTORY_STATS Stats;
+} MWS_DIRECTORY;
+
+static SIZE_T HashMember(_In_ INT64 GroupID, _In_ INT64 MemberID)
+{
+    return HashIDPair((UINT64)GroupID, (UINT64)MemberID);
+}
+
+static SIZE_T EntrySize(_In_ SIZE_T cbStrings)
+{
+    return FIELD_OFFSET(DIRECTORY_ENTRY, Strings[cbStrings]);
+}
+
+/// <summary>
+/// Length of a string cut to at most cbMax bytes without splitting a utf8 character.
+/// </summary>
+static SIZE_T CutUtf8(_In_ MWS_STRING Str, _In_ SIZE_T cbMax)
+{
+    if (Str.Len <= cbMax)
+        return Str.Len;
+    SIZE_T Len = cbMax;
+    while (Len && ((BYTE)Str.Ptr[Len] & 0xC0) == 0x80)
+        Len--;
+    return Len;
+}
+
+static void CopyCut(_Out_writes_(cbDest) LPSTR lpDest, _In_ SIZE_T cbDest, _In_ MWS_STRING Str)
+{
+    SIZE_T Len = CutUtf8(Str, cbDest - 1);
+    memcpy(lpDest, Str.Ptr, Len);
+    lpDest[Len] = '\0';
+}
+
+BOOL EnableMiraiWSDirectory(_Inout_ PMIRAI_WS pMiraiWS, _In_ SIZE_T cbMax)
+{
+    if (pMiraiWS->pDirectory || cbMax < DIRECTORY_MIN_BYTES)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    PMWS_DIRECTORY pDirectory = MwsAlloc(&pMiraiWS->Allocator, HEAP_ZERO_MEMORY, sizeof(MWS_DIRECTORY));
+    if (!pDirectory)
+        return FALSE;
+
+    SIZE_T BucketCnt = BucketCountForCap(cbMax, DIRECTORY_AVG_MEMBER);
+    pDirectory->Buckets = MwsAlloc(&pMiraiWS->Allocator, HEAP_ZERO_MEMORY, BucketCnt * sizeof(DIRECTORY_ENTRY*));
+    if (!pDirectory->Buckets)
+    {
+        MwsFree(&pMiraiWS->Allocator, pDirectory);
+        return FALSE;
+    }
+    pDirectory->BucketMask = BucketCnt - 1;
+    pDirectory->pAllocator = &pMiraiWS->Allocator;
+    InitializeSRWLock(&pDirectory->Lock);
+    pDirectory->Stats.Bytes = sizeof(MWS_DIRECTORY) + BucketCnt * sizeof(DIRECTORY_ENTRY*);
+    pDirectory->Stats.MaxBytes = cbMax;
+
+    pMiraiWS->pDirectory = pDirectory;
+    return TRUE;
+}
+
+static DIRECTORY_GROUP** FindGroup(_In_ PMWS_DIRECTORY pDirectory, _In_ INT64 GroupID)
+{
+    DIRECTORY_GROUP** ppGroup = &pDirectory->Groups[HashMember(GroupID, 0) & (DIRECTORY_GROUP_BUCKETS - 1)];
+    while (*ppGroup && (*ppGroup)->ID != GroupID)
+        ppGroup = &(*ppGroup)->pNext;
+    return ppGroup;
+}
+
+static DIRECTORY_ENTRY** FindEntry(_In_ PMWS_DIRECTORY pDirectory, _In_ INT64 GroupID, _In_ INT64 MemberID)
+{
+    DIRECTORY_ENTRY** ppEntry = &pDirectory->Buckets[HashMember(GroupID, MemberID) & pDirectory->BucketMask];
+    while (*ppEntry && ((*ppEntry)->MemberID != MemberID || (*ppEntry)->pGroup->ID != GroupID))
+        ppEntry = &(*ppEntry)->pNext;
+    return ppEntry;
+}
+
+static void UnlinkLru(_In_ PMWS_DIRECTORY pDirectory, _In_ DIRECTORY_ENTRY* pEntry)
+{
+    if (pEntry->pNewer) pEntry->pNewer->pOlder = pEntry->pOlder;
+    else pDirectory->pNewest = pEntry->pOlder;
+    if (pEntry->pOlder) pEntry->pOlder->pNewer = pEntry->pNewer;
+    else pDirectory->pOldest = pEntry->pNewer;
+}
+
+static void LinkNewest(_In_ PMWS_DIRECTORY pDirectory, _In_ DIRECTORY_ENTRY* pEntry)
+{
+    pEntry->pNewer = NULL;
+    pEntry->pOlder = pDirectory->pNewest;
+    if (pDirectory->pNewest) pDirectory->pNewest->pNewer = pEntry;
+    else pDirectory->pOldest = pEntry;
+    pDirectory->pNewest = pEntry;
+}
+
+static void ReleaseGroup(_In_ PMWS_DIRECTORY pDirectory, _In_ DIRECTORY_GROUP* pGroup)
+{
+    if (--pGroup->Members)
+        return;
+    DIRECTORY_GROUP** ppGroup = FindGroup(pDirectory, pGroup->ID);
+    *ppGroup = pGroup->pNext;
+    MwsFree(pDirectory->pAllocator, pGroup);
+    pDirectory->Stats.Groups--;
+    pDirectory->Stats.Bytes -= sizeof(DIRECTORY_GROUP);
+}
+
+/// <summary>
+/// Take an entry out of its bucket and the use list and free it.
+/// </summary>
+/// <param name="ppEntry">where the entry is linked from in its bucket</param>
+static void DropEntry(_In_ PMWS_DIRECTORY pDirectory, _In_ DIRECTORY_ENTRY** ppEntry)
+{
+    DIRECTORY_ENTRY* pEntry = *ppEntry;
+    *ppEntry = pEntry->pNext;
+    UnlinkLru(pDirectory, pEntry);
+    ReleaseGroup(pDirectory, pEntry->pGroup);
+    pDirectory->Stats.Members--;
+    pDirectory->Stats.Bytes -= EntrySize(pEntry->cbName + pEntry->cbTitle);
+    MwsFree(pDirectory->pAllocator, pEntry);
+}
+
+static void EvictOverCap(_In_ PMWS_DIRECTORY pDirectory)
+{
+    // never the newest, the member just updated stays even if it alone is over the cap.
+    while (pDirectory->Stats.Bytes > pDirectory->Stats.MaxBytes && pDirectory->pOldest != pDirectory->pNewest)
+    {
+        DIRECTORY_ENTRY* pOldest = pDirectory->pOldest;
+        DropEntry(pDirectory, FindEntry(pDirectory, pOldest->pGroup->ID, pOldest->MemberID));
+        pDirectory->Stats.Evictions++;
+    }
+}
+
+/// <summary>
+/// Find a group, adding it if new. The name is only taken when not empty, events that merely point at a group have none.
+/// </summary>
+static DIRECTORY_GROUP* TakeGroup(_In_ PMWS_DIRECTORY pDirectory, _In_ const MWS_GROUPVIEW* pGroupView)
+{
+    DIRECTORY_GROUP** ppGroup = FindGroup(pDirectory, pGroupView->ID);
+    DIRECTORY_GROUP* pGroup = *ppGroup;
+    if (!pGroup)
+    {
+        pGroup = MwsAlloc(pDirectory->pAllocator, HEAP_ZERO_MEMORY, sizeof(DIRECTORY_GROUP));
+        if (!pGroup)
+            return NULL;
+        pGroup->ID = pGroupView->ID;
+        *ppGroup = pGroup;
+        pDirectory->Stats.Groups++;
+        pDirectory->Stats.Bytes += sizeof(DIRECTORY_GROUP);
+    }
+    if (pGroupView->Name.Len)
+        CopyCut(pGroup->Name, sizeof(pGroup->Name), pGroupView->Name);
+    return pGroup;
+}
+
+void UpdateDirectoryMember(_In_ PMWS_DIRECTORY pDirectory, _In_ const MWS_MEMBERVIEW* pMember)
+{
+    if (!pMember->ID || !pMember->Group.ID)
+        return;
+
+    SIZE_T cbName = CutUtf8(pMember->MemberName, MWS_DIRECTORY_MAX_STR - 1);
+    SIZE_T cbTitle = CutUtf8(pMember->SpecialTitle, MWS_DIRECTORY_MAX_STR - 1);
+    AcquireSRWLockExclusive(&pDirectory->Lock);
+    __try
+    {
+        DIRECTORY_ENTRY** ppEntry = FindEntry(pDirectory, pMember->Group.ID, pMember->ID);
+        DIRECTORY_ENTRY* pEntry = *ppEntry;
+        if (pEntry && pEntry->cbName + pEntry->cbTitle != cbName + cbTitle)
+        {
+            // strings don't fit anymore, start over with an entry of the new size.
+            DropEntry(pDirectory, ppEntry);
+            pEntry = NULL;
+        }
+
+        if (pEntry)
+        {
+            UnlinkLru(pDirectory, pEntry);
+            TakeGroup(pDirectory, &pMember->Group);
+        }
+        else
+        {
+            pEntry = MwsAlloc(pDirectory->pAllocator, 0, EntrySize(cbName + cbTitle));
+            if (!pEntry)
+                __leave;
+            pEntry->pGroup = TakeGroup(pDirectory, &pMember->Group);
+            if (!pEntry->pGroup)
+            {
+                MwsFree(pDirectory->pAllocator, pEntry);
+                __leave;
+            }
+            pEntry->pGroup->Members++;
+            pEntry->MemberID = pMember->ID;
+
+            ppEntry = &pDirectory->Buckets[HashMember(pMember->Group.ID, pMember->ID) & pDirectory->BucketMask];
+            pEntry->pNext = *ppEntry;
+            *ppEntry = pEntry;
+            pDirectory->Stats.Members++;
+            pDirectory->Stats.Bytes += EntrySize(cbName + cbTitle);
+        }
+
+        pEntry->cbName = (BYTE)cbName;
+        pEntry->cbTitle = (BYTE)cbTitle;
+        memcpy(pEntry->Strings, pMember->MemberName.Ptr, cbName);
+        memcpy(pEntry->Strings + cbName, pMember->SpecialTitle.Ptr, cbTitle);
+        pEntry->Permission = pMember->PermissionLevel;
+        pEntry->JoinTimestamp = pMember->JoinTimestamp;
+        pEntry->LastSpeakTimestamp = pMember->LastSpeakTimestamp;
+        pEntry->UpdateTick = GetTickCount64();
+        LinkNewest(pDirectory, pEntry);
+        pDirectory->Stats.Updates++;
+
+        EvictOverCap(pDirectory);
+    }
+    __finally
+    {
+        ReleaseSRWLockExclusive(&pDirectory->Lock);
+    }
+}
+
+void RemoveDirectoryMember(_In_ PMWS_DIRECTORY pDirectory, _In_ INT64 GroupID, _In_ INT64 MemberID)
+{
+    AcquireSRWLockExclusive(&pDirectory->Lock);
+    DIRECTORY_ENTRY** ppEntry = FindEntry(pDirectory, GroupID, MemberID);
+    if (*ppEntry)
+        DropEntry(pDirectory, ppEntry);
+    ReleaseSRWLockExclusive(&pDirectory->Lock);
+}
+
+void UpdateDirectoryGroup(_In_ PMWS_DIRECTORY pDirectory, _In_ const MWS_GROUPVIEW* pGroup)
+{
+    AcquireSRWLockExclusive(&pDirectory->Lock);
+    DIRECTORY_GROUP* pKnown = *FindGroup(pDirectory, pGroup->ID);
+    if (pKnown && pGroup->Name.Len)
+        CopyCut(pKnown->Name, sizeof(pKnown->Name), pGroup->Name);
+    ReleaseSRWLockExclusive(&pDirectory->Lock);
+}
+
+void RemoveDirectoryGroup(_In_ PMWS_DIRECTORY pDirectory, _In_ INT64 GroupID)
+{
+    AcquireSRWLockExclusive(&pDirectory->Lock);
+    __try
+    {
+        // the bot left, rare enough to walk everything. The group goes with its last member.
+        DIRECTORY_ENTRY* pEntry = pDirectory->pNewest;
+        while (pEntry && *FindGroup(pDirectory, GroupID))
+        {
+            DIRECTORY_ENTRY* pOlder = pEntry->pOlder;
+            if (pEntry->pGroup->ID == GroupID)
+                DropEntry(pDirectory, FindEntry(pDirectory, GroupID, pEntry->MemberID));
+            pEntry = pOlder;
+        }
+    }
+    __finally
+    {
+        ReleaseSRWLockExclusive(&pDirectory->Lock);
+    }
+}
+
+void FreeDirectory(_In_ _Frees_ptr_ PMWS_DIRECTORY pDirectory)
+{
+    DIRECTORY_ENTRY* pEntry = pDirectory->pNewest;
+    while (pEntry)
+    {
+        DIRECTORY_ENTRY* pOlder = pEntry->pOlder;
+        MwsFree(pDirectory->pAllocator, pEntry);
+        pEntry = pOlder;
+    }
+    for (int i = 0; i < DIRECTORY_GROUP_BUCKETS; i++)
+    {
+        DIRECTORY_GROUP* pGroup = pDirectory->Groups[i];
+        while (pGroup)
+        {
+            DIRECTORY_GROUP* pNext = pGroup->pNext;
+            MwsFree(pDirectory->pAllocator, pGroup);
+            pGroup = pNext;
+        }
+    }
+    MwsFree(pDirectory->pAllocator, pDirectory->Buckets);
+    MwsFree(pDirectory->pAllocator, pDirectory);
+}
+
+BOOL LookupMiraiWSMember(_In_ PMIRAI_WS pMiraiWS, _In_ INT64 GroupID, _In_ INT64 MemberID, _Out_ MWS_DIRECTORY_MEMBER* pMember)
+{
+    PMWS_DIRECTORY pDirectory = pMiraiWS->pDirectory;
+    if (!pDirectory)
+        return FALSE;
+
+    BOOL bFound = FALSE;
+    AcquireSRWLockExclusive(&pDirectory->Lock);
+    __try
+    {
+        DIRECTORY_ENTRY* pEntry = *FindEntry(pDirectory, GroupID, MemberID);
+        if (!pEntry)
+        {
+            pDirectory->Stats.Misses++;
+            __leave;
+        }
+        pDirectory->Stats.Hits++;
+        UnlinkLru(pDirectory, pEntry);
+        LinkNewest(pDirectory, pEntry);
+
+        pMember->GroupID = GroupID;
+        pMember->MemberID = MemberID;
+        MWS_STRING Name = { pEntry->Strings, pEntry->cbName };
+        MWS_STRING Title = { pEntry->Strings + pEntry->cbName, pEntry->cbTitle };
+        CopyCut(pMember->MemberName, sizeof(pMember->MemberName), Name);
+        CopyCut(pMember->SpecialTitle, sizeof(pMember->SpecialTitle), Title);
+        pMember->Permission = pEntry->Permission;
+        memcpy(pMember->GroupName, pEntry->pGroup->Name, sizeof(pMember->GroupName));
+        pMember->JoinTimestamp = pEntry->JoinTimestamp;
+        pMember->LastSpeakTimestamp = pEntry->LastSpeakTimestamp;
+        pMember->UpdateTick = pEntry->UpdateTick;
+        bFound = TRUE;
+    }
+    __finally
+    {
+        ReleaseSRWLockExclusive(&pDirectory->Lock);
+    }
+    return bFound;
+}
+
+BOOL GetMiraiWSDirectoryStats(_In_ PMIRAI_WS pMiraiWS, _Out_ MWS_DIRECTORY_STATS* pStats)
+{
+    PMWS_DIRECTORY pDirectory = pMiraiWS->pDirectory;
+    if (!pDirectory)
+        return FALSE;
+
+    AcquireSRWLockShared(&pDirectory->Lock);
+    *pStats = pDirectory->Stats;
+    ReleaseSRWLockShared(&pDirectory->Lock);
+    return TRUE;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <Windows.h>
+#include "MiraiWS.h"
+
+EXTERN_C_START
+
+// Group members a connection has seen, kept up to date from group messages, member events and memberList
+// responses (see EnableMiraiWSDirectory). Nothing is asked from mirai: a member is known once it spoke,
+// an event was about it, or a memberList of its group was received.
+// Members least recently updated or looked up are evicted when the directory would grow past its cap.
+
+// strings are kept cut to fit these arrays at a character boundary, names on QQ are much shorter.
+#define MWS_DIRECTORY_MAX_STR 128
+
+typedef struct
+{
+    INT64 GroupID;
+    INT64 MemberID;
+    CHAR MemberName[MWS_DIRECTORY_MAX_STR];   // utf8, zero-terminated like the others
+    CHAR SpecialTitle[MWS_DIRECTORY_MAX_STR];
+    MWS_PERMISSION Permission;
+    CHAR GroupName[MWS_DIRECTORY_MAX_STR];
+    INT64 JoinTimestamp;
+    INT64 LastSpeakTimestamp;
+    ULONGLONG UpdateTick;                     // GetTickCount64 when the member was last updated
+} MWS_DIRECTORY_MEMBER;
+
+typedef struct
+{
+    INT64 Members;
+    INT64 Groups;
+    INT64 Bytes;     // held by the directory, its hash table included
+    INT64 MaxBytes;  // as passed to EnableMiraiWSDirectory
+    INT64 Hits;      // lookups that found the member
+    INT64 Misses;
+    INT64 Updates;   // members added or refreshed
+    INT64 Evictions; // members dropped to stay under MaxBytes
+} MWS_DIRECTORY_STATS;
+
+/// <summary>
+/// Look a group member up in the directory of a connection. Any thread.
+/// </summary>
+/// <param name="pMiraiWS">handle with EnableMiraiWSDirectory called</param>
+/// <param name="GroupID">group of the member</param>
+/// <param name="MemberID">QQ of the member</param>
+/// <param name="pMember">receives a copy of what is known about the member</param>
+/// <returns>return TRUE if the member is known, FALSE if not or the directory is not enabled</returns>
+BOOL LookupMiraiWSMember(_In_ PMIRAI_WS pMiraiWS, _In_ INT64 GroupID, _In_ INT64 MemberID, _Out_ MWS_DIRECTORY_MEMBER* pMember);
+
+/// <summary>
+/// Read how full the directory of a connection is and how well it serves lookups.
+/// </summary>
+/// <param name="pMiraiWS">handle with EnableMiraiWSDirectory called</param>
+/// <param name="pStats">receives the numbers</param>
+/// <returns>return TRUE on success, FALSE if the directory is not enabled</returns>
+BOOL GetMiraiWSDirectoryStats(_In_ PMIRAI_WS pMiraiWS, _Out_ MWS_DIRECTORY_STATS* pStats);
+
+EXTERN_C_END
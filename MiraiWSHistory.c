@@ -0,0 +1,264 @@
+#include <Windows.h>
+#include "MiraiWS.h"
+#include "MiraiWSHistory.h"
+#include "MiraiWSInternal.h"
+
+// Records are written one after another into a ring of bytes and never split: one that doesn't fit before the end
+// of the ring starts over at its beginning. Oldest records are overwritten first, and records hash on
+// (kind, target, message id) into chained buckets whose links live in the records themselves.
+// Sizing, hashing and locking are shared with the directory, see MiraiWSInternal.h.
+
+#define HISTORY_MIN_BYTES (64 * 1024)
+
+// a guess at the size of a record, to size the hash table from the cap.
+#define HISTORY_AVG_RECORD 256
+
+typedef struct _HISTORY_RECORD HISTORY_RECORD;
+typedef struct _HISTORY_RECORD
+{
+    HISTORY_RECORD* pNext; // in its bucket
+    DWORD cbRecord;        // the whole record, a multiple of 8 so the next one stays aligned
+    DWORD cbChain;
+    MWS_CONVERSATION Kind;
+    INT64 TargetID;
+    INT64 GroupID;
+    INT64 SenderID;
+    INT64 MessageID;
+    BYTE Chain[ANYSIZE_ARRAY]; // written by MwsBinWriteChain
+} HISTORY_RECORD;
+
+typedef struct _MWS_HISTORY
+{
+    const MWS_ALLOCATOR* pAllocator; // of the connection
+    SRWLOCK Lock;
+    HISTORY_RECORD** Buckets;
+    SIZE_T BucketMask;
+    PBYTE pRing;
+    SIZE_T cbRing;
+    SIZE_T Head;    // oldest record
+    SIZE_T Tail;    // where the next record goes
+    SIZE_T End;     // end of the records before Tail wrapped to the beginning
+    BOOL bWrapped;  // records are in [Head, End) and [0, Tail), otherwise in [Head, Tail)
+    MWS_HISTORY_STATS Stats;
+} MWS_HISTORY;
+
+static SIZE_T HashMessage(_In_ MWS_CONVERSATION Kind, _In_ INT64 TargetID, _In_ INT64 MessageID)
+{
+    return HashIDPair(HashIDPair(Kind, (UINT64)TargetID), (UINT64)MessageID);
+}
+
+static SIZE_T RecordSize(_In_ SIZE_T cbChain)
+{
+    return (FIELD_OFFSET(HISTORY_RECORD, Chain[cbChain]) + 7) & ~(SIZE_T)7;
+}
+
+BOOL EnableMiraiWSHistory(_Inout_ PMIRAI_WS pMiraiWS, _In_ SIZE_T cbMax)
+{
+    if (pMiraiWS->pHistory || cbMax < HISTORY_MIN_BYTES)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    PMWS_HISTORY pHistory = MwsAlloc(&pMiraiWS->Allocator, HEAP_ZERO_MEMORY, sizeof(MWS_HISTORY));
+    if (!pHistory)
+        return FALSE;
+
+    // the ring gets what is left of the cap.
+    SIZE_T BucketCnt = BucketCountForCap(cbMax, HISTORY_AVG_RECORD);
+    pHistory->cbRing = (cbMax - sizeof(MWS_HISTORY) - BucketCnt * sizeof(HISTORY_RECORD*)) & ~(SIZE_T)7;
+    pHistory->Buckets = MwsAlloc(&pMiraiWS->Allocator, HEAP_ZERO_MEMORY, BucketCnt * sizeof(HISTORY_RECORD*));
+    pHistory->pRing = MwsAlloc(&pMiraiWS->Allocator, 0, pHistory->cbRing);
+    if (!pHistory->Buckets || !pHistory->pRing)
+    {
+        if (pHistory->Buckets) MwsFree(&pMiraiWS->Allocator, pHistory->Buckets);
+        if (pHistory->pRing) MwsFree(&pMiraiWS->Allocator, pHistory->pRing);
+        MwsFree(&pMiraiWS->Allocator, pHistory);
+        return FALSE;
+    }
+    pHistory->BucketMask = BucketCnt - 1;
+    pHistory->pAllocator = &pMiraiWS->Allocator;
+    InitializeSRWLock(&pHistory->Lock);
+    pHistory->Stats.MaxBytes = cbMax;
+
+    pMiraiWS->pHistory = pHistory;
+    return TRUE;
+}
+
+static HISTORY_RECORD** FindRecord(_In_ PMWS_HISTORY pHistory, _In_ MWS_CONVERSATION Kind, _In_ INT64 TargetID, _In_ INT64 MessageID)
+{
+    HISTORY_RECORD** ppRecord = &pHistory->Buckets[HashMessage(Kind, TargetID, MessageID) & pHistory->BucketMask];
+    while (*ppRecord && ((*ppRecord)->MessageID != MessageID || (*ppRecord)->TargetID != TargetID || (*ppRecord)->Kind != Kind))
+        ppRecord = &(*ppRecord)->pNext;
+    return ppRecord;
+}
+
+static void EvictOldest(_In_ PMWS_HISTORY pHistory)
+{
+    HISTORY_RECORD* pOldest = (HISTORY_RECORD*)(pHistory->pRing + pHistory->Head);
+
+    // a message may have been stored twice, unlink this very record.
+    HISTORY_RECORD** ppRecord = &pHistory->Buckets[HashMessage(pOldest->Kind, pOldest->TargetID, pOldest->MessageID) & pHistory->BucketMask];
+    while (*ppRecord != pOldest)
+        ppRecord = &(*ppRecord)->pNext;
+    *ppRecord = pOldest->pNext;
+
+    pHistory->Head += pOldest->cbRecord;
+    pHistory->Stats.Bytes -= pOldest->cbRecord;
+    pHistory->Stats.Messages--;
+    pHistory->Stats.Evictions++;
+    if (pHistory->bWrapped && pHistory->Head == pHistory->End)
+    {
+        pHistory->Head = 0;
+        pHistory->bWrapped = FALSE;
+    }
+}
+
+/// <summary>
+/// Make room for a record at Tail, overwriting the oldest records.
+/// </summary>
+/// <param name="cbRecord">at most a quarter of the ring</param>
+static HISTORY_RECORD* ReserveRecord(_In_ PMWS_HISTORY pHistory, _In_ SIZE_T cbRecord)
+{
+    for (;;)
+    {
+        if (!pHistory->Stats.Messages)
+        {
+            pHistory->Head = pHistory->Tail = 0;
+            pHistory->bWrapped = FALSE;
+        }
+
+        if (!pHistory->bWrapped)
+        {
+            if (pHistory->cbRing - pHistory->Tail >= cbRecord)
+                break;
+            // the rest of the ring is too short, leave it unused until the records before it are gone.
+            pHistory->End = pHistory->Tail;
+            pHistory->Tail = 0;
+            pHistory->bWrapped = TRUE;
+        }
+        else if (pHistory->Head - pHistory->Tail >= cbRecord)
+            break;
+
+        EvictOldest(pHistory);
+    }
+    return (HISTORY_RECORD*)(pHistory->pRing + pHistory->Tail);
+}
+
+void StoreHistoryMessage(_In_ PMWS_HISTORY pHistory, _In_ MWS_CONVERSATION Kind, _In_ INT64 TargetID, _In_ INT64 GroupID,
+    _In_ INT64 SenderID, _In_ yyjson_val* Chain)
+{
+    MWSBIN_WRITER Measure;
+    MwsBinMeasureInit(&Measure);
+    BOOL bEncodable = MwsBinWriteChain(&Measure, Chain);
+    SIZE_T cbRecord = RecordSize(Measure.cbWritten);
+
+    AcquireSRWLockExclusive(&pHistory->Lock);
+    __try
+    {
+        // one message must not wipe out the history.
+        if (!bEncodable || cbRecord > pHistory->cbRing / 4)
+        {
+            pHistory->Stats.Skipped++;
+            __leave;
+        }
+
+        HISTORY_RECORD* pRecord = ReserveRecord(pHistory, cbRecord);
+        MWSBIN_WRITER Writer;
+        MwsBinWriterInit(&Writer, pRecord->Chain, Measure.cbWritten);
+        MwsBinWriteChain(&Writer, Chain);
+
+        pRecord->cbRecord = (DWORD)cbRecord;
+        pRecord->cbChain = (DWORD)Measure.cbWritten;
+        pRecord->Kind = Kind;
+        pRecord->TargetID = TargetID;
+        pRecord->GroupID = GroupID;
+        pRecord->SenderID = SenderID;
+        pRecord->MessageID = yyjson_get_sint(yyjson_obj_get(yyjson_arr_get_first(Chain), "id"));
+
+        HISTORY_RECORD** ppBucket = &pHistory->Buckets[HashMessage(Kind, TargetID, pRecord->MessageID) & pHistory->BucketMask];
+        pRecord->pNext = *ppBucket;
+        *ppBucket = pRecord;
+
+        pHistory->Tail += cbRecord;
+        pHistory->Stats.Bytes += cbRecord;
+        pHistory->Stats.Messages++;
+        pHistory->Stats.Stored++;
+    }
+    __finally
+    {
+        ReleaseSRWLockExclusive(&pHistory->Lock);
+    }
+}
+
+void FreeHistory(_In_ _Frees_ptr_ PMWS_HISTORY pHistory)
+{
+    MwsFree(pHistory->pAllocator, pHistory->pRing);
+    MwsFree(pHistory->pAllocator, pHistory->Buckets);
+    MwsFree(pHistory->pAllocator, pHistory);
+}
+
+BOOL LookupMiraiWSMessage(_In_ PMIRAI_WS pMiraiWS, _In_ MWS_CONVERSATION Kind, _In_ INT64 TargetID, _In_ INT64 MessageID,
+    _Out_writes_bytes_opt_(cbBuffer) PVOID pBuffer, _In_ SIZE_T cbBuffer, _Out_opt_ SIZE_T* pcbNeeded, _Out_ MWS_HISTORY_MESSAGE* pMessage)
+{
+    PMWS_HISTORY pHistory = pMiraiWS->pHistory;
+    ZeroMemory(pMessage, sizeof(MWS_HISTORY_MESSAGE));
+    if (pcbNeeded)
+        *pcbNeeded = 0;
+    if (!pHistory)
+        return FALSE;
+
+    BOOL bCopied = FALSE;
+    SIZE_T cbChain = 0;
+    AcquireSRWLockShared(&pHistory->Lock);
+    __try
+    {
+        HISTORY_RECORD* pRecord = *FindRecord(pHistory, Kind, TargetID, MessageID);
+        if (!pRecord)
+        {
+            InterlockedIncrement64(&pHistory->Stats.Misses);
+            SetLastError(ERROR_NOT_FOUND);
+            __leave;
+        }
+        InterlockedIncrement64(&pHistory->Stats.Hits);
+
+        cbChain = pRecord->cbChain;
+        if (pcbNeeded)
+            *pcbNeeded = cbChain;
+        if (!pBuffer || cbBuffer < cbChain)
+        {
+            SetLastError(ERROR_INSUFFICIENT_BUFFER);
+            __leave;
+        }
+
+        memcpy(pBuffer, pRecord->Chain, cbChain);
+        pMessage->Kind = Kind;
+        pMessage->TargetID = TargetID;
+        pMessage->GroupID = pRecord->GroupID;
+        pMessage->SenderID = pRecord->SenderID;
+        bCopied = TRUE;
+    }
+    __finally
+    {
+        ReleaseSRWLockShared(&pHistory->Lock);
+    }
+    if (!bCopied)
+        return FALSE;
+
+    MWSBIN_READER Reader;
+    MwsBinReaderInit(&Reader, pBuffer, cbChain);
+    return MwsBinReadChain(&Reader, &pMessage->Chain);
+}
+
+BOOL GetMiraiWSHistoryStats(_In_ PMIRAI_WS pMiraiWS, _Out_ MWS_HISTORY_STATS* pStats)
+{
+    PMWS_HISTORY pHistory = pMiraiWS->pHistory;
+    if (!pHistory)
+        return FALSE;
+
+    // exclusive, lookups bump Hits and Misses under the shared lock.
+    AcquireSRWLockExclusive(&pHistory->Lock);
+    *pStats = pHistory->Stats;
+    ReleaseSRWLockExclusive(&pHistory->Lock);
+    return TRUE;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <Windows.h>
+#include "MiraiWS.h"
+#include "MiraiWSBin.h"
+
+EXTERN_C_START
+
+// Recent messages a connection received, kept encoded (see MwsBinWriteChain) in a ring of bytes so the content
+// of a recalled or quoted message is at hand without a messageFromId round trip (see EnableMiraiWSHistory).
+// The oldest messages are overwritten once the ring is full.
+
+// message ids of mirai are only unique within a conversation, the conversation is named by its kind and target.
+typedef enum _MWS_CONVERSATION
+{
+    MWS_CONV_FRIEND = 1, // friend and stranger messages, target is the QQ of the other side
+    MWS_CONV_GROUP,      // target is the group
+    MWS_CONV_TEMP        // target is the QQ of the member
+} MWS_CONVERSATION;
+
+typedef struct
+{
+    MWS_CONVERSATION Kind;
+    INT64 TargetID;
+    INT64 GroupID;   // of the group or the temp conversation, 0 for friends
+    INT64 SenderID;  // 0 for messages the bot sent from another client (sync messages)
+    MWSBIN_CHAIN Chain; // ID and Timestamp of its Source, and the other blocks. Read them with MwsBinReadBlock
+} MWS_HISTORY_MESSAGE;
+
+typedef struct
+{
+    INT64 Messages;
+    INT64 Bytes;     // of the ring in use
+    INT64 MaxBytes;  // as passed to EnableMiraiWSHistory
+    INT64 Hits;      // lookups that found the message
+    INT64 Misses;
+    INT64 Stored;    // messages added
+    INT64 Evictions; // messages overwritten
+    INT64 Skipped;   // messages too large for the ring, or without a Source block
+} MWS_HISTORY_STATS;
+
+/// <summary>
+/// Look a recent message up by its conversation and id, like messageFromId does on mirai. Any thread.
+/// </summary>
+/// <param name="pMiraiWS">handle with EnableMiraiWSHistory called</param>
+/// <param name="Kind">kind of the conversation</param>
+/// <param name="TargetID">group, or QQ of the friend or member</param>
+/// <param name="MessageID">id of the Source block of the message, as in recall events and quotes</param>
+/// <param name="pBuffer">receives a copy of the encoded chain, pMessage->Chain points into it</param>
+/// <param name="cbBuffer">size of pBuffer</param>
+/// <param name="pcbNeeded">receives the size the chain needs, when it did not fit the call fails with ERROR_INSUFFICIENT_BUFFER</param>
+/// <param name="pMessage">receives the message</param>
+/// <returns>return TRUE if the message was found, FALSE if not, the buffer is too small or the history is not enabled</returns>
+BOOL LookupMiraiWSMessage(_In_ PMIRAI_WS pMiraiWS, _In_ MWS_CONVERSATION Kind, _In_ INT64 TargetID, _In_ INT64 MessageID,
+    _Out_writes_bytes_opt_(cbBuffer) PVOID pBuffer, _In_ SIZE_T cbBuffer, _Out_opt_ SIZE_T* pcbNeeded, _Out_ MWS_HISTORY_MESSAGE* pMessage);
+
+/// <summary>
+/// Read how full the history of a connection is and how well it serves lookups.
+/// </summary>
+/// <param name="pMiraiWS">handle with EnableMiraiWSHistory called</param>
+/// <param name="pStats">receives the numbers</param>
+/// <returns>return TRUE on success, FALSE if the history is not enabled</returns>
+BOOL GetMiraiWSHistoryStats(_In_ PMIRAI_WS pMiraiWS, _Out_ MWS_HISTORY_STATS* pStats);
+
+EXTERN_C_END
@@ -0,0 +1,288 @@
+#pragma once
+
+// Shared between source files of the library, not meant for library users.
+
+#include <Windows.h>
+#include "MiraiWS.h"
+#include "MiraiWSBin.h"
+#include "MiraiWSHistory.h"
+#include "yyjson.h"
+
+EXTERN_C_START
+
+typedef struct _MWS_EVENT_RING MWS_EVENT_RING, * PMWS_EVENT_RING;
+typedef struct _MWS_JOURNAL MWS_JOURNAL, * PMWS_JOURNAL;
+typedef struct _MWS_METRICS MWS_METRICS, * PMWS_METRICS;
+typedef struct _MWS_DIRECTORY MWS_DIRECTORY, * PMWS_DIRECTORY;
+typedef struct _MWS_HISTORY MWS_HISTORY, * PMWS_HISTORY;
+
+/// <summary>
+/// Clock every latency of the library is measured with, in QueryPerformanceCounter ticks.
+/// </summary>
+FORCEINLINE LONGLONG ReadPerfClock()
+{
+    LARGE_INTEGER Now;
+    QueryPerformanceCounter(&Now);
+    return Now.QuadPart;
+}
+
+// The directory and the history are hash tables of chained buckets within a byte cap. Both are written from
+// the dispatch stage and read from any thread, one lock for all of each: every operation is a few pointer hops,
+// finer locks would cost more than they save.
+
+/// <summary>
+/// Hash of a pair of ids for the buckets of the directory or the history.
+/// </summary>
+FORCEINLINE SIZE_T HashIDPair(_In_ UINT64 Outer, _In_ UINT64 Inner)
+{
+    UINT64 Hash = Outer * 0x9E3779B97F4A7C15ULL ^ Inner;
+    Hash ^= Hash >> 31;
+    Hash *= 0xBF58476D1CE4E5B9ULL;
+    Hash ^= Hash >> 29;
+    return (SIZE_T)Hash;
+}
+
+/// <summary>
+/// A bucket per expected item, rounded down to a power of 2 so the buckets and the items stay within the cap.
+/// </summary>
+/// <param name="cbItem">a guess at the size of an item</param>
+FORCEINLINE SIZE_T BucketCountForCap(_In_ SIZE_T cbMax, _In_ SIZE_T cbItem)
+{
+    SIZE_T BucketCnt = 64;
+    while (BucketCnt * 2 * (cbItem + sizeof(PVOID)) <= cbMax)
+        BucketCnt *= 2;
+    return BucketCnt;
+}
+
+// MiraiWSAlloc.c
+
+// Every allocation of the library goes through MwsAlloc and MwsFree with the allocator of its connection or manager,
+// yyjson documents through MwsJsonAlc of it. Allocations are also counted per thread.
+// Connections on the process heap get small blocks from slabs cached per thread, see MiraiWSAlloc.c.
+
+typedef struct
+{
+    INT64 Allocs;     // reallocations count as one
+    INT64 HeapAllocs; // the ones that reached the allocator, the rest came from a slab
+    INT64 Bytes;      // requested, frees are not subtracted
+} MWS_ALLOC_STATS;
+
+// allocations made by the calling thread since it started, read by benchmarks.
+extern __declspec(thread) MWS_ALLOC_STATS MwsThreadAllocStats;
+
+// the process heap, for connections created without an allocator and for what belongs to no connection.
+extern const MWS_ALLOCATOR MwsHeapAllocator;
+
+/// <summary>
+/// Allocate from an allocator, or from a slab of the calling thread when it is MwsHeapAllocator and the block is small.
+/// </summary>
+/// <param name="dwFlags">0 or HEAP_ZERO_MEMORY</param>
+_Ret_maybenull_
+PVOID MwsAlloc(_In_ const MWS_ALLOCATOR* pAllocator, _In_ DWORD dwFlags, _In_ SIZE_T cbSize);
+
+/// <summary>
+/// Resize a block from MwsAlloc, same allocator. May move it, the old block stays valid on failure.
+/// </summary>
+_Ret_maybenull_
+PVOID MwsRealloc(_In_ const MWS_ALLOCATOR* pAllocator, _In_ PVOID pMem, _In_ SIZE_T cbSize);
+
+/// <summary>
+/// Free a block from MwsAlloc on any thread, same allocator.
+/// </summary>
+void MwsFree(_In_ const MWS_ALLOCATOR* pAllocator, _In_opt_ _Frees_ptr_opt_ PVOID pMem);
+
+/// <summary>
+/// yyjson allocator taking memory from an allocator, which must outlive the documents.
+/// </summary>
+yyjson_alc MwsJsonAlc(_In_ const MWS_ALLOCATOR* pAllocator);
+
+// MiraiWSRing.c
+
+/// <summary>
+/// Publish the data field of an event into the shared memory ring. Only called from the dispatch stage.
+/// </summary>
+/// <returns>FALSE when the event was too large for the ring and dropped, counted in MWS_RING_HEADER.Dropped</returns>
+BOOL PublishEventToRing(_In_ PMWS_EVENT_RING pRing, _In_ yyjson_val* DataField);
+
+void CloseEventRing(_In_ _Frees_ptr_ PMWS_EVENT_RING pRing);
+
+// MiraiWSJournal.c
+
+/// <summary>
+/// Append a received frame to the journal. Only called from the parse stage.
+/// </summary>
+/// <param name="RecvStart">ReadPerfClock when the first fragment of the frame arrived</param>
+BOOL AppendToJournal(_Inout_ PMWS_JOURNAL pJournal, _In_reads_bytes_(cbData) const BYTE* pData, _In_ SIZE_T cbData, _In_ LONGLONG RecvStart);
+
+void CloseJournal(_In_ _Frees_ptr_ PMWS_JOURNAL pJournal);
+
+// MiraiWSMetrics.c
+
+typedef enum _MWS_COUNTER
+{
+    MWS_CTR_FRAMES = 0,
+    MWS_CTR_BYTES,
+    MWS_CTR_BADMSG,
+    MWS_CTR_REQUESTS_SENT,
+    MWS_CTR_REQUESTS_COMPLETED,
+    MWS_CTR_RING_DROPPED,
+    MWS_CTR_EVENTS, // one counter per MWSBIN_EVENT_TYPE from here on
+    MWS_CTR_COUNT = MWS_CTR_EVENTS + MWSBIN_EV_COUNT
+} MWS_COUNTER;
+
+typedef enum _MWS_LATENCY
+{
+    MWS_LAT_PARSE = 0,
+    MWS_LAT_DISPATCH,
+    MWS_LAT_CALLBACK,
+    MWS_LAT_SEND_RTT,
+    MWS_LAT_COUNT
+} MWS_LATENCY;
+
+void MetricsAdd(_In_ PMWS_METRICS pMetrics, _In_ MWS_COUNTER Counter, _In_ INT64 Value);
+
+/// <summary>
+/// Count a latency into its histogram.
+/// </summary>
+/// <param name="Ticks">ReadPerfClock difference</param>
+void MetricsRecord(_In_ PMWS_METRICS pMetrics, _In_ MWS_LATENCY Latency, _In_ LONGLONG Ticks);
+
+/// <summary>
+/// Count a completed request into the histograms of its command. Only called from the dispatch stage.
+/// </summary>
+/// <param name="lpCommand">command name, a string literal</param>
+/// <param name="WrittenTime">0 if the response was unpacked before the request was marked as written</param>
+void MetricsRecordCommand(_In_ PMWS_METRICS pMetrics, _In_z_ LPCSTR lpCommand, _In_ LONGLONG AllocTime, _In_ LONGLONG WrittenTime, _In_ LONGLONG DoneTime);
+
+void FreeMetrics(_In_ _Frees_ptr_ PMWS_METRICS pMetrics);
+
+// MiraiWSDirectory.c
+
+// The directory is only written from the dispatch stage, what is not known is ignored.
+
+/// <summary>
+/// Add a member to the directory, or refresh it, and mark it most recently used.
+/// </summary>
+void UpdateDirectoryMember(_In_ PMWS_DIRECTORY pDirectory, _In_ const MWS_MEMBERVIEW* pMember);
+
+void RemoveDirectoryMember(_In_ PMWS_DIRECTORY pDirectory, _In_ INT64 GroupID, _In_ INT64 MemberID);
+
+/// <summary>
+/// Rename a group members of which are in the directory.
+/// </summary>
+void UpdateDirectoryGroup(_In_ PMWS_DIRECTORY pDirectory, _In_ const MWS_GROUPVIEW* pGroup);
+
+/// <summary>
+/// Forget every member of a group, when the bot left it.
+/// </summary>
+void RemoveDirectoryGroup(_In_ PMWS_DIRECTORY pDirectory, _In_ INT64 GroupID);
+
+void FreeDirectory(_In_ _Frees_ptr_ PMWS_DIRECTORY pDirectory);
+
+// MiraiWSHistory.c
+
+/// <summary>
+/// Keep a received message, from the dispatch stage. Chains without a Source block are skipped.
+/// </summary>
+/// <param name="Chain">the messageChain array of the event</param>
+void StoreHistoryMessage(_In_ PMWS_HISTORY pHistory, _In_ MWS_CONVERSATION Kind, _In_ INT64 TargetID, _In_ INT64 GroupID,
+    _In_ INT64 SenderID, _In_ yyjson_val* Chain);
+
+void FreeHistory(_In_ _Frees_ptr_ PMWS_HISTORY pHistory);
+
+// MiraiWSTrace.c
+
+extern volatile LONG MwsTraceOn;
+
+// the one branch a span costs when tracing is off.
+#define MWS_TRACING() (ReadNoFence(&MwsTraceOn) != FALSE)
+
+typedef enum _MWS_SPAN
+{
+    MWS_SPAN_SOCKET_READ = 0, // receive posted to WinHttp until it completes
+    MWS_SPAN_REASSEMBLY,      // first fragment of a frame until the last one
+    MWS_SPAN_PARSE,           // yyjson_read
+    MWS_SPAN_DISPATCH,        // a whole parsed frame in the dispatch stage
+    MWS_SPAN_EVENT,           // unpacking one event or response
+    MWS_SPAN_CHAIN_DECODE,    // UnpackMessageChain
+    MWS_SPAN_CALLBACK,        // a user callback
+    MWS_SPAN_SERIALIZE,       // building and writing the json of a request
+    MWS_SPAN_SEND,            // WinHttpWebSocketSend
+    MWS_SPAN_COUNT
+} MWS_SPAN;
+
+/// <summary>
+/// Record a span that ends now into the buffer of the calling thread. Only call when MWS_TRACING().
+/// </summary>
+/// <param name="Start">ReadPerfClock when the span started</param>
+/// <param name="SyncID">request the span belongs to, 0 for none</param>
+/// <param name="EventType">event the span belongs to, MWSBIN_EV_UNKNOWN for none</param>
+void TraceSpan(_In_ MWS_SPAN Span, _In_opt_ PMIRAI_WS pMiraiWS, _In_ LONGLONG Start, _In_ INT64 SyncID, _In_ MWSBIN_EVENT_TYPE EventType);
+
+// MiraiWS.c
+
+typedef enum _ASYNC_CALL_TYPE
+{
+    ASYNC_SENDMSG = 1, // Callback is a SEND_MSG_CALLBACK
+    ASYNC_COMMAND      // Callback is a MWS_COMMAND_CALLBACK
+}ASYNC_CALL_TYPE;
+
+// A command of mirai-api-http and what its response decodes to, an entry of the command table.
+typedef struct
+{
+    LPCSTR Command;
+    LPCSTR SubCommand; // NULL for commands that have none
+    MWS_RESULT_KIND Kind;
+} MWS_COMMAND;
+
+/// <summary>
+/// Look a command up in the command table. Commands that are not listed share an entry named "other".
+/// </summary>
+const MWS_COMMAND* FindMiraiWSCommand(_In_z_ LPCSTR lpCommand, _In_opt_z_ LPCSTR lpSubCommand);
+
+typedef struct
+{
+    const MWS_COMMAND* pCommand; // what was sent to mirai
+    LPSTR lpCommandName;    // the name as sent when pCommand is "other", from NameAllocator. Passed on when the slot is freed
+    LPSTR lpSubCommandName; // the same for the subcommand, inside the lpCommandName block. NULL if none
+    MWS_ALLOCATOR NameAllocator; // of the connection that sent the command, set with lpCommandName
+    LONGLONG AllocTime;   // ReadPerfClock when the ID was allocated
+    LONGLONG WrittenTime; // ReadPerfClock when the request was handed to WinHttp, 0 if the response was faster
+} ASYNC_CALL_TIMING;
+
+// Stages of receiving and sending, also driven one at a time by bench/MiraiWSBench.c.
+
+INT64 GetAsyncCallID(_In_ ASYNC_CALL_TYPE Type, _In_ const MWS_COMMAND* pCommand, _In_opt_ LPVOID Callback, _In_opt_ LPVOID Context, _Out_ int* pSlot);
+
+/// <summary>
+/// Free the slot of an async call. With pTiming the caller takes over pTiming->lpCommandName and frees it with
+/// MwsFree on pTiming->NameAllocator.
+/// </summary>
+BOOL RemoveAsyncCallID(_In_ INT64 ID, _Out_opt_ ASYNC_CALL_TYPE* pType, _Out_opt_ LPVOID* pCallback, _Out_opt_ LPVOID* pContext, _Out_opt_ ASYNC_CALL_TIMING* pTiming);
+
+/// <summary>
+/// Hand the json text of a command to WinHttp, once its syncId is allocated and written into it.
+/// The caller removes the syncId when this fails.
+/// </summary>
+/// <param name="TraceStart">ReadPerfClock when serializing started, 0 when not tracing</param>
+BOOL SendCommandFrame(_In_ PMIRAI_WS pMiraiWS, _In_ INT64 AsyncID, _In_ int AsyncSlot, _In_reads_(cbText) LPCSTR lpText, _In_ SIZE_T cbText, _In_ LONGLONG TraceStart);
+
+BOOL EventsUnpacker(_In_ PMIRAI_WS pMiraiWS, _In_ yyjson_val* DataField);
+
+void HandleJsonMessage(_In_ PMIRAI_WS pMiraiWS, _In_opt_ _Frees_ptr_opt_ yyjson_doc* JsonDoc);
+
+yyjson_mut_val* GetMessageChainJson(_In_ const MWS_ALLOCATOR* pAllocator, _In_ yyjson_mut_doc* Doc, _In_ MESSAGE_CHAIN* pMessageChain);
+
+/// <summary>
+/// How many slots of the process wide async call table are taken.
+/// </summary>
+LONG GetAsyncCallsInUse();
+
+/// <summary>
+/// Parse and dispatch a frame on the calling thread, like the pipeline would. For replaying journals.
+/// A frame larger than MIRAI_WS_MAXBUF is reported as MWS_BADMSG.
+/// </summary>
+/// <returns>FALSE with GetLastError set if the frame was not dispatched</returns>
+BOOL DispatchReplayedFrame(_In_ PMIRAI_WS pMiraiWS, _In_reads_bytes_(cbData) const BYTE* pData, _In_ SIZE_T cbData);
+
+EXTERN_C_END
@@ -0,0 +1,366 @@
+#include <Windows.h>
+#include <strsafe.h>
+#include "MiraiWS.h"
+#include "MiraiWSJournal.h"
+#include "MiraiWSInternal.h"
+
+#define JOURNAL_HEADER_SIZE ((sizeof(MWS_JOURNAL_SEGMENT) + MWS_JOURNAL_ALIGN - 1) & ~(MWS_JOURNAL_ALIGN - 1))
+#define JOURNAL_ALIGN_UP(x) (((x) + MWS_JOURNAL_ALIGN - 1) & ~((SIZE_T)MWS_JOURNAL_ALIGN - 1))
+
+typedef struct _MWS_JOURNAL
+{
+    WCHAR szDirectory[MAX_PATH];
+    DWORD cbSegment;
+    UINT32 Sequence; // of the open segment
+
+    HANDLE hFile;
+    HANDLE hMapping;
+    PBYTE pView;
+    SIZE_T cbUsed;
+
+    LONGLONG QpcFrequency;
+    const MWS_ALLOCATOR* pAllocator; // of the connection
+} MWS_JOURNAL;
+
+typedef struct
+{
+    HANDLE hFile;
+    HANDLE hMapping;
+    const BYTE* pView;
+    SIZE_T cbView;
+} JOURNAL_SEGMENT_VIEW;
+
+static INT64 GetTimestamp()
+{
+    FILETIME Now;
+    GetSystemTimeAsFileTime(&Now);
+    return ((INT64)Now.dwHighDateTime << 32) | Now.dwLowDateTime;
+}
+
+static BOOL GetSegmentPath(_In_z_ LPCWSTR lpDirectory, _In_ UINT32 Sequence, _Out_writes_(MAX_PATH) LPWSTR lpPath)
+{
+    return SUCCEEDED(StringCchPrintfW(lpPath, MAX_PATH, L"%s\\%08u.mwsj", lpDirectory, Sequence));
+}
+
+/// <summary>
+/// Find the lowest and highest sequence number of the segments in a directory.
+/// </summary>
+/// <returns>FALSE if there is no segment</returns>
+static BOOL FindSegmentRange(_In_z_ LPCWSTR lpDirectory, _Out_ UINT32* pFirst, _Out_ UINT32* pLast)
+{
+    WCHAR szPattern[MAX_PATH];
+    *pFirst = 0;
+    *pLast = 0;
+    if (FAILED(StringCchPrintfW(szPattern, MAX_PATH, L"%s\\*.mwsj", lpDirectory)))
+        return FALSE;
+
+    WIN32_FIND_DATAW FindData;
+    HANDLE hFind = FindFirstFileW(szPattern, &FindData);
+    if (hFind == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    BOOL bFound = FALSE;
+    do
+    {
+        LPWSTR lpEnd;
+        UINT32 Sequence = wcstoul(FindData.cFileName, &lpEnd, 10);
+        if (lpEnd == FindData.cFileName || _wcsicmp(lpEnd, L".mwsj") != 0 || Sequence == 0)
+            continue;
+        if (!bFound || Sequence < *pFirst) *pFirst = Sequence;
+        if (!bFound || Sequence > *pLast) *pLast = Sequence;
+        bFound = TRUE;
+    } while (FindNextFileW(hFind, &FindData));
+    FindClose(hFind);
+
+    if (!bFound)
+        SetLastError(ERROR_FILE_NOT_FOUND);
+    return bFound;
+}
+
+static BOOL OpenSegment(_Inout_ PMWS_JOURNAL pJournal)
+{
+    WCHAR szPath[MAX_PATH];
+    if (!GetSegmentPath(pJournal->szDirectory, pJournal->Sequence, szPath))
+        return FALSE;
+
+    pJournal->hFile = CreateFileW(szPath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (pJournal->hFile == INVALID_HANDLE_VALUE)
+    {
+        pJournal->hFile = NULL;
+        return FALSE;
+    }
+
+    // the mapping grows the file to the full segment size, CloseSegment trims it.
+    pJournal->hMapping = CreateFileMappingW(pJournal->hFile, NULL, PAGE_READWRITE, 0, pJournal->cbSegment, NULL);
+    if (pJournal->hMapping)
+        pJournal->pView = MapViewOfFile(pJournal->hMapping, FILE_MAP_WRITE, 0, 0, 0);
+    if (!pJournal->pView)
+    {
+        DWORD dwError = GetLastError();
+        if (pJournal->hMapping) CloseHandle(pJournal->hMapping);
+        CloseHandle(pJournal->hFile);
+        DeleteFileW(szPath);
+        pJournal->hMapping = NULL;
+        pJournal->hFile = NULL;
+        SetLastError(dwError);
+        return FALSE;
+    }
+
+    MWS_JOURNAL_SEGMENT* pHeader = (MWS_JOURNAL_SEGMENT*)pJournal->pView;
+    pHeader->Magic = MWS_JOURNAL_MAGIC;
+    pHeader->Version = MWS_JOURNAL_VERSION;
+    pHeader->HeaderSize = JOURNAL_HEADER_SIZE;
+    pHeader->Sequence = pJournal->Sequence;
+    pHeader->CreateTime = GetTimestamp();
+    pJournal->cbUsed = JOURNAL_HEADER_SIZE;
+    return TRUE;
+}
+
+static void CloseSegment(_Inout_ PMWS_JOURNAL pJournal)
+{
+    if (!pJournal->hFile)
+        return;
+
+    UnmapViewOfFile(pJournal->pView);
+    CloseHandle(pJournal->hMapping);
+
+    LARGE_INTEGER Size;
+    Size.QuadPart = pJournal->cbUsed;
+    if (SetFilePointerEx(pJournal->hFile, Size, NULL, FILE_BEGIN))
+        SetEndOfFile(pJournal->hFile);
+    CloseHandle(pJournal->hFile);
+
+    pJournal->pView = NULL;
+    pJournal->hMapping = NULL;
+    pJournal->hFile = NULL;
+}
+
+BOOL EnableMiraiWSJournal(_Inout_ PMIRAI_WS pMiraiWS, _In_z_ LPCWSTR lpDirectory, _In_ DWORD cbSegment)
+{
+    if (pMiraiWS->pJournal || cbSegment < MWS_JOURNAL_MIN_SEGMENT)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    BOOL bSuccess = FALSE;
+    PMWS_JOURNAL pJournal = MwsAlloc(&pMiraiWS->Allocator, HEAP_ZERO_MEMORY, sizeof(MWS_JOURNAL));
+    if (!pJournal)
+        return FALSE;
+    pJournal->pAllocator = &pMiraiWS->Allocator;
+
+    __try
+    {
+        if (FAILED(StringCchCopyW(pJournal->szDirectory, MAX_PATH, lpDirectory)))
+        {
+            SetLastError(ERROR_FILENAME_EXCED_RANGE);
+            __leave;
+        }
+        if (!CreateDirectoryW(lpDirectory, NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+            __leave;
+
+        LARGE_INTEGER Frequency;
+        QueryPerformanceFrequency(&Frequency);
+        pJournal->QpcFrequency = Frequency.QuadPart;
+        pJournal->cbSegment = JOURNAL_ALIGN_UP(cbSegment);
+
+        // go on after segments of earlier runs, never append to them.
+        UINT32 First, Last;
+        pJournal->Sequence = FindSegmentRange(lpDirectory, &First, &Last) ? Last + 1 : 1;
+        if (!OpenSegment(pJournal))
+            __leave;
+
+        pMiraiWS->pJournal = pJournal;
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if (!bSuccess)
+        {
+            DWORD dwError = GetLastError();
+            MwsFree(&pMiraiWS->Allocator, pJournal);
+            SetLastError(dwError);
+        }
+    }
+    return bSuccess;
+}
+
+BOOL AppendToJournal(_Inout_ PMWS_JOURNAL pJournal, _In_reads_bytes_(cbData) const BYTE* pData, _In_ SIZE_T cbData, _In_ LONGLONG RecvStart)
+{
+    SIZE_T cbRecord = JOURNAL_ALIGN_UP(sizeof(MWS_JOURNAL_RECORD) + cbData);
+    if (cbData == 0 || JOURNAL_HEADER_SIZE + cbRecord > pJournal->cbSegment)
+        return FALSE;
+
+    if (pJournal->cbUsed + cbRecord > pJournal->cbSegment)
+    {
+        CloseSegment(pJournal);
+        pJournal->Sequence++;
+        if (!OpenSegment(pJournal))
+            return FALSE;
+    }
+    else if (!pJournal->hFile)
+    {
+        // opening the previous segment failed, try again with the next one.
+        pJournal->Sequence++;
+        if (!OpenSegment(pJournal))
+            return FALSE;
+    }
+
+    INT64 RecvLatency = (ReadPerfClock() - RecvStart) * 10000000 / pJournal->QpcFrequency;
+
+    MWS_JOURNAL_RECORD* pRecord = (MWS_JOURNAL_RECORD*)(pJournal->pView + pJournal->cbUsed);
+    pRecord->Flags = 0;
+    pRecord->Timestamp = GetTimestamp() - RecvLatency;
+    pRecord->RecvLatency = RecvLatency;
+    memcpy(pRecord + 1, pData, cbData);
+
+    // size last, a reader of a segment left behind by a crash stops at the first record without one.
+    WriteRelease((volatile LONG*)&pRecord->Size, (LONG)cbData);
+    pJournal->cbUsed += cbRecord;
+    return TRUE;
+}
+
+void CloseJournal(_In_ _Frees_ptr_ PMWS_JOURNAL pJournal)
+{
+    CloseSegment(pJournal);
+    MwsFree(pJournal->pAllocator, pJournal);
+}
+
+static BOOL OpenSegmentView(_In_z_ LPCWSTR lpDirectory, _In_ UINT32 Sequence, _Out_ JOURNAL_SEGMENT_VIEW* pView)
+{
+    WCHAR szPath[MAX_PATH];
+    ZeroMemory(pView, sizeof(JOURNAL_SEGMENT_VIEW));
+    if (!GetSegmentPath(lpDirectory, Sequence, szPath))
+        return FALSE;
+
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        // the segment may still be written by a running connection.
+        pView->hFile = CreateFileW(szPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (pView->hFile == INVALID_HANDLE_VALUE)
+        {
+            pView->hFile = NULL;
+            __leave;
+        }
+
+        LARGE_INTEGER Size;
+        if (!GetFileSizeEx(pView->hFile, &Size) || Size.QuadPart < (LONGLONG)JOURNAL_HEADER_SIZE || Size.HighPart)
+            __leave;
+        pView->cbView = (SIZE_T)Size.QuadPart;
+
+        pView->hMapping = CreateFileMappingW(pView->hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!pView->hMapping)
+            __leave;
+        pView->pView = MapViewOfFile(pView->hMapping, FILE_MAP_READ, 0, 0, 0);
+        if (!pView->pView)
+            __leave;
+
+        const MWS_JOURNAL_SEGMENT* pHeader = (const MWS_JOURNAL_SEGMENT*)pView->pView;
+        if (pHeader->Magic != MWS_JOURNAL_MAGIC || pHeader->Version != MWS_JOURNAL_VERSION ||
+            pHeader->HeaderSize < sizeof(MWS_JOURNAL_SEGMENT) || pHeader->HeaderSize > pView->cbView)
+            __leave;
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if (!bSuccess)
+        {
+            if (pView->pView) UnmapViewOfFile(pView->pView);
+            if (pView->hMapping) CloseHandle(pView->hMapping);
+            if (pView->hFile) CloseHandle(pView->hFile);
+            ZeroMemory(pView, sizeof(JOURNAL_SEGMENT_VIEW));
+        }
+    }
+    return bSuccess;
+}
+
+static void CloseSegmentView(_In_ JOURNAL_SEGMENT_VIEW* pView)
+{
+    UnmapViewOfFile(pView->pView);
+    CloseHandle(pView->hMapping);
+    CloseHandle(pView->hFile);
+}
+
+/// <summary>
+/// Wait until as much time passed since the replay started as between the first record and this one.
+/// </summary>
+static void WaitForRecordTime(_In_ LONGLONG ReplayStart, _In_ LONGLONG QpcFrequency, _In_ INT64 RecordOffset)
+{
+    for (;;)
+    {
+        INT64 Passed = (ReadPerfClock() - ReplayStart) * 10000000 / QpcFrequency;
+        INT64 Remaining = RecordOffset - Passed;
+        if (Remaining <= 0)
+            return;
+        Sleep((DWORD)min(Remaining / 10000, 1000));
+    }
+}
+
+BOOL ReplayMiraiWSJournal(
+    _Inout_ PMIRAI_WS pMiraiWS,
+    _In_z_ LPCWSTR lpDirectory,
+    _In_ DWORD dwFlags,
+    _Out_opt_ MWS_REPLAY_STATS* pStats)
+{
+    MWS_REPLAY_STATS Stats = { 0 };
+    if (pStats)
+        ZeroMemory(pStats, sizeof(MWS_REPLAY_STATS));
+
+    // frames of a live connection would race with ours in the dispatch stage.
+    if (pMiraiWS->hWebSocketHandle || pMiraiWS->hRequestHandle)
+    {
+        SetLastError(ERROR_INVALID_STATE);
+        return FALSE;
+    }
+
+    UINT32 First, Last;
+    if (!FindSegmentRange(lpDirectory, &First, &Last))
+        return FALSE;
+
+    LARGE_INTEGER Frequency;
+    QueryPerformanceFrequency(&Frequency);
+    LONGLONG ReplayStart = ReadPerfClock();
+    INT64 FirstTimestamp = 0;
+    LONGLONG Elapsed = 0;
+
+    for (UINT32 Sequence = First; Sequence <= Last; Sequence++)
+    {
+        JOURNAL_SEGMENT_VIEW View;
+        if (!OpenSegmentView(lpDirectory, Sequence, &View))
+        {
+            if (GetLastError() != ERROR_FILE_NOT_FOUND)
+                Stats.BadSegments++;
+            continue;
+        }
+
+        SIZE_T Offset = ((const MWS_JOURNAL_SEGMENT*)View.pView)->HeaderSize;
+        while (Offset + sizeof(MWS_JOURNAL_RECORD) <= View.cbView)
+        {
+            const MWS_JOURNAL_RECORD* pRecord = (const MWS_JOURNAL_RECORD*)(View.pView + Offset);
+            UINT32 cbData = (UINT32)ReadAcquire((volatile LONG*)&pRecord->Size);
+            if (cbData == 0 || cbData > MIRAI_WS_MAXBUF || cbData > View.cbView - Offset - sizeof(MWS_JOURNAL_RECORD))
+                break;
+
+            if (!FirstTimestamp)
+                FirstTimestamp = pRecord->Timestamp;
+            if (dwFlags & MWS_REPLAY_REALTIME)
+                WaitForRecordTime(ReplayStart, Frequency.QuadPart, pRecord->Timestamp - FirstTimestamp);
+
+            LONGLONG Start = ReadPerfClock();
+            if (!DispatchReplayedFrame(pMiraiWS, (const BYTE*)(pRecord + 1), cbData))
+                Stats.Dropped++;
+            Elapsed += ReadPerfClock() - Start;
+
+            Stats.Frames++;
+            Stats.Bytes += cbData;
+            Offset += JOURNAL_ALIGN_UP(sizeof(MWS_JOURNAL_RECORD) + cbData);
+        }
+        CloseSegmentView(&View);
+    }
+
+    Stats.Elapsed = Elapsed * 10000000 / Frequency.QuadPart;
+    if (pStats)
+        *pStats = Stats;
+    return TRUE;
+}
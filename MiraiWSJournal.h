@@ -0,0 +1,67 @@
+#pragma once
+
+#include <Windows.h>
+#include "MiraiWS.h"
+
+EXTERN_C_START
+
+// An append-only journal of every frame a connection receives (see EnableMiraiWSJournal),
+// for looking at what mirai sent after the fact and for measuring parse and dispatch offline.
+//
+// The journal is a directory of segment files named by sequence number, "00000001.mwsj", "00000002.mwsj" ...
+// A segment is MWS_JOURNAL_SEGMENT, then records starting at HeaderSize.
+// A record is MWS_JOURNAL_RECORD followed by Size bytes of the raw json frame, padded to MWS_JOURNAL_ALIGN.
+// A segment ends at its file size or at a record with Size 0, whichever comes first:
+// segments are written through a mapping of the full segment size and trimmed when closed.
+
+#define MWS_JOURNAL_MAGIC   0x4A53574D // "MWSJ"
+#define MWS_JOURNAL_VERSION 1
+#define MWS_JOURNAL_ALIGN   8
+
+#define MWS_JOURNAL_MIN_SEGMENT (1 << 20)
+
+typedef struct
+{
+    UINT32 Magic;
+    UINT32 Version;
+    UINT32 HeaderSize; // offset of the first record
+    UINT32 Sequence;   // same as in the file name
+    INT64 CreateTime;  // FILETIME units
+} MWS_JOURNAL_SEGMENT;
+
+typedef struct
+{
+    UINT32 Size;       // frame bytes, written last
+    UINT32 Flags;      // reserved, 0
+    INT64 Timestamp;   // when the first fragment of the frame arrived, in FILETIME units
+    INT64 RecvLatency; // from first fragment to the parse stage picking the frame up, in 100ns units
+} MWS_JOURNAL_RECORD;
+
+// wait between frames as long as when they were recorded, instead of replaying as fast as possible.
+#define MWS_REPLAY_REALTIME 0x1
+
+typedef struct
+{
+    INT64 Frames;
+    INT64 Bytes;
+    INT64 Elapsed;     // time spent in parse and dispatch, in 100ns units. Waiting of MWS_REPLAY_REALTIME is not counted
+    INT64 BadSegments; // segments skipped because they could not be opened or have a bad header
+    INT64 Dropped;     // frames read but not dispatched, for lack of memory
+} MWS_REPLAY_STATS;
+
+/// <summary>
+/// Feed every frame of a journal through json parse and dispatch of a connection, on the calling thread.
+/// Callback of the connection sees the frames like it would see them from mirai.
+/// </summary>
+/// <param name="pMiraiWS">handle created by CreateMiraiWS, must not be connected</param>
+/// <param name="lpDirectory">directory passed to EnableMiraiWSJournal</param>
+/// <param name="dwFlags">0 or MWS_REPLAY_REALTIME</param>
+/// <param name="pStats">optional, receives what was replayed and how long it took</param>
+/// <returns>return TRUE on success, FALSE with GetLastError set if no segment was found</returns>
+BOOL ReplayMiraiWSJournal(
+    _Inout_ PMIRAI_WS pMiraiWS,
+    _In_z_ LPCWSTR lpDirectory,
+    _In_ DWORD dwFlags,
+    _Out_opt_ MWS_REPLAY_STATS* pStats);
+
+EXTERN_C_END
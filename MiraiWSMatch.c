@@ -0,0 +1,262 @@
+#include <Windows.h>
+#include "MiraiWS.h"
+#include "MiraiWSMatch.h"
+#include "MiraiWSInternal.h"
+
+// Aho-Corasick with every failure transition resolved at compile time, so matching takes one table lookup per byte.
+// Bytes that appear in no pattern share class 0 and the others get a class each, which keeps rows of the table short.
+// A state reports the patterns ending in it, then those of its dictionary links: the longest proper suffixes
+// that are states with patterns ending in them.
+
+#define MATCH_NONE MAXUINT
+
+typedef struct
+{
+    UINT ID;
+    UINT cbText;
+    BOOL bPrefix;
+    UINT NextSame; // next pattern ending in the same state, MATCH_NONE at the end
+} MATCHER_PATTERN;
+
+typedef struct _MWS_MATCHER
+{
+    MWS_ALLOCATOR Allocator;
+    UINT StateCnt;
+    UINT ClassCnt;
+    BYTE Classes[256];
+    UINT* Next;      // [state * ClassCnt + class]
+    UINT* Output;    // first pattern ending in the state
+    UINT* MatchLink; // first state to report from: the state itself if a pattern ends in it, else its DictLink. 0 for none
+    UINT* DictLink;
+    MATCHER_PATTERN* Patterns;
+    // the arrays follow in the same allocation
+} MWS_MATCHER;
+
+static BYTE FoldByte(_In_ BYTE Byte, _In_ BOOL bIgnoreCase)
+{
+    return (bIgnoreCase && Byte >= 'A' && Byte <= 'Z') ? Byte - 'A' + 'a' : Byte;
+}
+
+_Ret_maybenull_
+PMWS_MATCHER CreateMiraiWSMatcher(_In_reads_(cPatterns) const MWS_PATTERN* pPatterns, _In_ UINT cPatterns, _In_ DWORD dwFlags)
+{
+    return CreateMiraiWSMatcherEx(pPatterns, cPatterns, dwFlags, NULL);
+}
+
+_Ret_maybenull_
+PMWS_MATCHER CreateMiraiWSMatcherEx(_In_reads_(cPatterns) const MWS_PATTERN* pPatterns, _In_ UINT cPatterns, _In_ DWORD dwFlags, _In_opt_ const MWS_ALLOCATOR* pAllocator)
+{
+    MWS_ALLOCATOR Allocator = pAllocator ? *pAllocator : MwsHeapAllocator;
+    BOOL bIgnoreCase = (dwFlags & MWS_MATCHER_IGNORECASE) != 0;
+    SIZE_T cbTotal = 0;
+    for (UINT i = 0; i < cPatterns; i++)
+    {
+        int cbText = pPatterns[i].lpText ? WideCharToMultiByte(CP_UTF8, 0, pPatterns[i].lpText, -1, NULL, 0, NULL, NULL) - 1 : 0;
+        if (cbText <= 0)
+        {
+            SetLastError(ERROR_INVALID_PARAMETER);
+            return NULL;
+        }
+        cbTotal += cbText;
+    }
+    if (!cPatterns || cbTotal > MWS_MATCHER_MAX_BYTES)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return NULL;
+    }
+
+    PMWS_MATCHER pMatcher = NULL;
+    LPSTR lpUtf8 = NULL;       // every pattern, one after another
+    MATCHER_PATTERN* pBuilt = NULL;
+    UINT* pTrie = NULL;        // Next, Output, Fail and the BFS queue while building, sized for a state per byte
+    __try
+    {
+        lpUtf8 = MwsAlloc(&Allocator, 0, cbTotal);
+        pBuilt = MwsAlloc(&Allocator, 0, cPatterns * sizeof(MATCHER_PATTERN));
+        if (!lpUtf8 || !pBuilt)
+        {
+            SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+            __leave;
+        }
+
+        BOOL bUsed[256] = { 0 };
+        SIZE_T cbDone = 0;
+        for (UINT i = 0; i < cPatterns; i++)
+        {
+            pBuilt[i].ID = pPatterns[i].ID;
+            pBuilt[i].cbText = WideCharToMultiByte(CP_UTF8, 0, pPatterns[i].lpText, (int)wcslen(pPatterns[i].lpText),
+                lpUtf8 + cbDone, (int)(cbTotal - cbDone), NULL, NULL);
+            pBuilt[i].bPrefix = (pPatterns[i].dwFlags & MWS_MATCH_PREFIX) != 0;
+            for (UINT j = 0; j < pBuilt[i].cbText; j++)
+                bUsed[FoldByte(lpUtf8[cbDone + j], bIgnoreCase)] = TRUE;
+            cbDone += pBuilt[i].cbText;
+        }
+
+        // patterns hold no zero byte, so there are at most 255 classes besides 0 and they fit a BYTE.
+        BYTE Classes[256];
+        UINT ClassCnt = 1;
+        for (int b = 0; b < 256; b++)
+            Classes[b] = bUsed[b] ? (BYTE)ClassCnt++ : 0;
+        for (int b = 'A'; bIgnoreCase && b <= 'Z'; b++)
+            Classes[b] = Classes[b - 'A' + 'a'];
+
+        SIZE_T MaxStates = cbTotal + 1;
+        pTrie = MwsAlloc(&Allocator, HEAP_ZERO_MEMORY, (MaxStates * ClassCnt + MaxStates * 3) * sizeof(UINT));
+        if (!pTrie)
+        {
+            SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+            __leave;
+        }
+        UINT* pNext = pTrie;
+        UINT* pOutput = pNext + MaxStates * ClassCnt;
+        UINT* pFail = pOutput + MaxStates;
+        UINT* pQueue = pFail + MaxStates;
+        for (SIZE_T s = 0; s < MaxStates; s++)
+            pOutput[s] = MATCH_NONE;
+
+        // the trie: a missing edge is 0, the root is never a child. Later patterns are linked first so reports keep the order given.
+        UINT StateCnt = 1;
+        cbDone = cbTotal;
+        for (UINT i = cPatterns; i-- > 0;)
+        {
+            cbDone -= pBuilt[i].cbText;
+            UINT State = 0;
+            for (UINT j = 0; j < pBuilt[i].cbText; j++)
+            {
+                UINT* pEdge = &pNext[State * ClassCnt + Classes[(BYTE)lpUtf8[cbDone + j]]];
+                if (!*pEdge)
+                    *pEdge = StateCnt++;
+                State = *pEdge;
+            }
+            pBuilt[i].NextSame = pOutput[State];
+            pOutput[State] = i;
+        }
+
+        SIZE_T cbMatcher = sizeof(MWS_MATCHER) + cPatterns * sizeof(MATCHER_PATTERN) +
+            ((SIZE_T)StateCnt * ClassCnt + (SIZE_T)StateCnt * 3) * sizeof(UINT);
+        pMatcher = MwsAlloc(&Allocator, HEAP_ZERO_MEMORY, cbMatcher);
+        if (!pMatcher)
+        {
+            SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+            __leave;
+        }
+        pMatcher->Allocator = Allocator;
+        pMatcher->StateCnt = StateCnt;
+        pMatcher->ClassCnt = ClassCnt;
+        memcpy(pMatcher->Classes, Classes, sizeof(Classes));
+        pMatcher->Patterns = (MATCHER_PATTERN*)(pMatcher + 1);
+        pMatcher->Next = (UINT*)(pMatcher->Patterns + cPatterns);
+        pMatcher->Output = pMatcher->Next + (SIZE_T)StateCnt * ClassCnt;
+        pMatcher->MatchLink = pMatcher->Output + StateCnt;
+        pMatcher->DictLink = pMatcher->MatchLink + StateCnt;
+        memcpy(pMatcher->Patterns, pBuilt, cPatterns * sizeof(MATCHER_PATTERN));
+        memcpy(pMatcher->Output, pOutput, StateCnt * sizeof(UINT));
+
+        // breadth first, so the failure state of a state, being shallower, is complete when the state is reached.
+        UINT* pDone = pMatcher->Next;
+        memcpy(pDone, pNext, ClassCnt * sizeof(UINT));
+        SIZE_T Head = 0, Tail = 0;
+        for (UINT c = 0; c < ClassCnt; c++)
+        {
+            if (pDone[c])
+                pQueue[Tail++] = pDone[c];
+        }
+        while (Head < Tail)
+        {
+            UINT State = pQueue[Head++];
+            UINT Fail = pFail[State];
+            pMatcher->DictLink[State] = pOutput[Fail] != MATCH_NONE ? Fail : pMatcher->DictLink[Fail];
+            pMatcher->MatchLink[State] = pOutput[State] != MATCH_NONE ? State : pMatcher->DictLink[State];
+
+            const UINT* pEdges = &pNext[(SIZE_T)State * ClassCnt];
+            UINT* pRow = &pDone[(SIZE_T)State * ClassCnt];
+            const UINT* pFailRow = &pDone[(SIZE_T)Fail * ClassCnt];
+            for (UINT c = 0; c < ClassCnt; c++)
+            {
+                if (pEdges[c])
+                {
+                    pRow[c] = pEdges[c];
+                    pFail[pEdges[c]] = pFailRow[c];
+                    pQueue[Tail++] = pEdges[c];
+                }
+                else
+                    pRow[c] = pFailRow[c];
+            }
+        }
+    }
+    __finally
+    {
+        if (lpUtf8) MwsFree(&Allocator, lpUtf8);
+        if (pBuilt) MwsFree(&Allocator, pBuilt);
+        if (pTrie) MwsFree(&Allocator, pTrie);
+    }
+    return pMatcher;
+}
+
+/// <summary>
+/// Run the automaton over one text.
+/// </summary>
+/// <param name="bFirst">the text is the first Plain block, where MWS_MATCH_PREFIX patterns may match</param>
+/// <param name="pFound">matches found so far, new ones are stored from there and counted</param>
+static void MatchText(_In_ PMWS_MATCHER pMatcher, _In_reads_(cbText) LPCSTR lpText, _In_ SIZE_T cbText, _In_ BOOL bFirst, _In_ UINT BlockIndex,
+    _Out_writes_opt_(cMatches) MWS_MATCH* pMatches, _In_ SIZE_T cMatches, _Inout_ SIZE_T* pFound)
+{
+    const UINT* pNext = pMatcher->Next;
+    const BYTE* pClasses = pMatcher->Classes;
+    UINT ClassCnt = pMatcher->ClassCnt;
+    UINT State = 0;
+    for (SIZE_T i = 0; i < cbText; i++)
+    {
+        State = pNext[State * ClassCnt + pClasses[(BYTE)lpText[i]]];
+        for (UINT Report = pMatcher->MatchLink[State]; Report; Report = pMatcher->DictLink[Report])
+        {
+            for (UINT p = pMatcher->Output[Report]; p != MATCH_NONE; p = pMatcher->Patterns[p].NextSame)
+            {
+                const MATCHER_PATTERN* pPattern = &pMatcher->Patterns[p];
+                SIZE_T Offset = i + 1 - pPattern->cbText;
+                if (pPattern->bPrefix && (!bFirst || Offset))
+                    continue;
+                if (*pFound < cMatches)
+                {
+                    pMatches[*pFound].ID = pPattern->ID;
+                    pMatches[*pFound].BlockIndex = BlockIndex;
+                    pMatches[*pFound].Offset = Offset;
+                    pMatches[*pFound].Length = pPattern->cbText;
+                }
+                (*pFound)++;
+            }
+        }
+    }
+}
+
+SIZE_T MatchMiraiWSChain(_In_ PMWS_MATCHER pMatcher, _In_ const MWS_CHAINVIEW* pView, _Out_writes_opt_(cMatches) MWS_MATCH* pMatches, _In_ SIZE_T cMatches)
+{
+    SIZE_T Found = 0;
+    BOOL bFirst = TRUE;
+    size_t i, MaxNode;
+    yyjson_val* Block;
+    yyjson_arr_foreach((yyjson_val*)pView->Node, i, MaxNode, Block) {
+        if (!yyjson_equals_str(yyjson_obj_get(Block, "type"), "Plain"))
+            continue;
+        yyjson_val* TextField = yyjson_obj_get(Block, "text");
+        if (!yyjson_is_str(TextField))
+            continue;
+
+        MatchText(pMatcher, unsafe_yyjson_get_str(TextField), unsafe_yyjson_get_len(TextField), bFirst, (UINT)i, pMatches, cMatches, &Found);
+        bFirst = FALSE;
+    }
+    return Found;
+}
+
+SIZE_T MatchMiraiWSText(_In_ PMWS_MATCHER pMatcher, _In_reads_(cbText) LPCSTR lpText, _In_ SIZE_T cbText, _Out_writes_opt_(cMatches) MWS_MATCH* pMatches, _In_ SIZE_T cMatches)
+{
+    SIZE_T Found = 0;
+    MatchText(pMatcher, lpText, cbText, TRUE, 0, pMatches, cMatches, &Found);
+    return Found;
+}
+
+void DestroyMiraiWSMatcher(_In_ _Frees_ptr_ PMWS_MATCHER pMatcher)
+{
+    MWS_ALLOCATOR Allocator = pMatcher->Allocator;
+    MwsFree(&Allocator, pMatcher);
+}
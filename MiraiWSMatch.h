@@ -0,0 +1,73 @@
+#pragma once
+
+#include <Windows.h>
+#include "MiraiWS.h"
+
+EXTERN_C_START
+
+// Keyword and command matching over the utf8 Plain text of received chains: many patterns are compiled into one
+// automaton that finds all of them in a single pass, without allocating. A matcher is read only once created,
+// any number of threads and connections may use it at the same time.
+
+// the pattern only matches at the start of the first Plain block, for command prefixes like L"/ban".
+#define MWS_MATCH_PREFIX 0x1
+
+// ASCII letters match regardless of case. Flag of the whole matcher.
+#define MWS_MATCHER_IGNORECASE 0x1
+
+// patterns of a matcher may hold this many utf8 bytes in total.
+#define MWS_MATCHER_MAX_BYTES (64 * 1024)
+
+typedef struct
+{
+    LPCWSTR lpText; // not empty
+    UINT ID;        // reported with its matches, several patterns may share one
+    DWORD dwFlags;  // MWS_MATCH_*
+} MWS_PATTERN;
+
+typedef struct
+{
+    UINT ID;          // of the pattern
+    UINT BlockIndex;  // of the Plain block in the chain, Source included. 0 for MatchMiraiWSText
+    SIZE_T Offset;    // utf8 bytes from the start of the block text
+    SIZE_T Length;    // utf8 bytes
+} MWS_MATCH;
+
+typedef struct _MWS_MATCHER MWS_MATCHER, * PMWS_MATCHER;
+
+_Ret_maybenull_
+/// <summary>
+/// Compile patterns into a matcher.
+/// </summary>
+/// <param name="pPatterns">the patterns, copied</param>
+/// <param name="cPatterns">how many</param>
+/// <param name="dwFlags">MWS_MATCHER_*</param>
+/// <returns>matcher handle, or NULL with GetLastError set</returns>
+PMWS_MATCHER CreateMiraiWSMatcher(_In_reads_(cPatterns) const MWS_PATTERN* pPatterns, _In_ UINT cPatterns, _In_ DWORD dwFlags);
+
+_Ret_maybenull_
+/// <summary>
+/// Compile patterns into a matcher that takes its memory from pAllocator, see CreateMiraiWSMatcher.
+/// </summary>
+/// <param name="pAllocator">copied, NULL for the process heap</param>
+PMWS_MATCHER CreateMiraiWSMatcherEx(_In_reads_(cPatterns) const MWS_PATTERN* pPatterns, _In_ UINT cPatterns, _In_ DWORD dwFlags, _In_opt_ const MWS_ALLOCATOR* pAllocator);
+
+/// <summary>
+/// Find every pattern in the Plain blocks of a borrowed chain, overlapping ones included. Only during the callback.
+/// </summary>
+/// <param name="pMatcher">handle returned by CreateMiraiWSMatcher</param>
+/// <param name="pView">the chain to look in, like the View of MWS_GROUPMSGINFO</param>
+/// <param name="pMatches">receives the first cMatches matches, in the order their ends appear in the text</param>
+/// <param name="cMatches">size of pMatches, 0 to only count</param>
+/// <returns>how many matches there are, may be more than cMatches</returns>
+SIZE_T MatchMiraiWSChain(_In_ PMWS_MATCHER pMatcher, _In_ const MWS_CHAINVIEW* pView, _Out_writes_opt_(cMatches) MWS_MATCH* pMatches, _In_ SIZE_T cMatches);
+
+/// <summary>
+/// Find every pattern in a utf8 text, which counts as the first Plain block for MWS_MATCH_PREFIX.
+/// </summary>
+/// <returns>how many matches there are, may be more than cMatches</returns>
+SIZE_T MatchMiraiWSText(_In_ PMWS_MATCHER pMatcher, _In_reads_(cbText) LPCSTR lpText, _In_ SIZE_T cbText, _Out_writes_opt_(cMatches) MWS_MATCH* pMatches, _In_ SIZE_T cMatches);
+
+void DestroyMiraiWSMatcher(_In_ _Frees_ptr_ PMWS_MATCHER pMatcher);
+
+EXTERN_C_END
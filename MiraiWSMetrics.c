@@ -0,0 +1,295 @@
+#include <Windows.h>
+#include "MiraiWS.h"
+#include "MiraiWSMetrics.h"
+#include "MiraiWSInternal.h"
+
+// updates go to the shard of the processor they run on, so threads of different stages and connections
+// rarely write the same cache line. Snapshots add the shards up.
+#define METRICS_SHARDS 8
+
+typedef struct
+{
+    DECLSPEC_CACHEALIGN volatile LONG64 Counters[MWS_CTR_COUNT];
+    volatile LONG64 LatencySums[MWS_LAT_COUNT];
+    volatile LONG64 Latencies[MWS_LAT_COUNT][MWS_HIST_BUCKETS];
+} METRICS_SHARD;
+
+// requests are much rarer than frames, their histograms are not sharded.
+typedef struct
+{
+    LPCSTR Command;
+    volatile LONG64 Sums[3];
+    volatile LONG64 Latencies[3][MWS_HIST_BUCKETS]; // write, response, total
+} COMMAND_LATENCY;
+
+typedef struct _MWS_METRICS
+{
+    LONGLONG QpcFrequency;
+    const MWS_ALLOCATOR* pAllocator; // of the connection
+    METRICS_SHARD Shards[METRICS_SHARDS];
+
+    // filled in order, allocated when a command first completes.
+    COMMAND_LATENCY* volatile Commands[MWS_MAX_TIMED_COMMANDS];
+} MWS_METRICS;
+
+static METRICS_SHARD* CurrentShard(_In_ PMWS_METRICS pMetrics)
+{
+    return &pMetrics->Shards[GetCurrentProcessorNumber() & (METRICS_SHARDS - 1)];
+}
+
+static int BucketOf(_In_ UINT64 Value)
+{
+    if (Value < MWS_HIST_SUB_BUCKETS)
+        return (int)Value;
+
+    DWORD Msb;
+    BitScanReverse64(&Msb, Value);
+    int Bucket = (int)(Msb - MWS_HIST_SUB_BITS + 1) * MWS_HIST_SUB_BUCKETS +
+        (int)((Value >> (Msb - MWS_HIST_SUB_BITS)) & (MWS_HIST_SUB_BUCKETS - 1));
+    return min(Bucket, MWS_HIST_BUCKETS - 1);
+}
+
+INT64 MwsHistogramBucketBase(_In_ int Bucket)
+{
+    if (Bucket < MWS_HIST_SUB_BUCKETS)
+        return Bucket;
+    int Group = Bucket / MWS_HIST_SUB_BUCKETS;
+    int Sub = Bucket % MWS_HIST_SUB_BUCKETS;
+    return (INT64)(MWS_HIST_SUB_BUCKETS + Sub) << (Group - 1);
+}
+
+static INT64 BucketWidth(_In_ int Bucket)
+{
+    return Bucket < MWS_HIST_SUB_BUCKETS ? 1 : (INT64)1 << (Bucket / MWS_HIST_SUB_BUCKETS - 1);
+}
+
+INT64 MwsHistogramPercentile(_In_ const MWS_HISTOGRAM* pHistogram, _In_ double Percentile)
+{
+    if (pHistogram->Count == 0)
+        return 0;
+
+    INT64 Rank = (INT64)(Percentile * pHistogram->Count + 0.5);
+    if (Rank < 1) Rank = 1;
+    if (Rank > pHistogram->Count) Rank = pHistogram->Count;
+
+    INT64 Seen = 0;
+    for (int i = 0; i < MWS_HIST_BUCKETS; i++)
+    {
+        Seen += pHistogram->Buckets[i];
+        if (Seen >= Rank)
+            return MwsHistogramBucketBase(i) + BucketWidth(i) - 1;
+    }
+    return MwsHistogramBucketBase(MWS_HIST_BUCKETS - 1);
+}
+
+BOOL EnableMiraiWSMetrics(_Inout_ PMIRAI_WS pMiraiWS)
+{
+    if (pMiraiWS->pMetrics)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    PMWS_METRICS pMetrics = MwsAlloc(&pMiraiWS->Allocator, HEAP_ZERO_MEMORY, sizeof(MWS_METRICS));
+    if (!pMetrics)
+        return FALSE;
+    pMetrics->pAllocator = &pMiraiWS->Allocator;
+
+    LARGE_INTEGER Frequency;
+    QueryPerformanceFrequency(&Frequency);
+    pMetrics->QpcFrequency = Frequency.QuadPart;
+
+    pMiraiWS->pMetrics = pMetrics;
+    return TRUE;
+}
+
+void MetricsAdd(_In_ PMWS_METRICS pMetrics, _In_ MWS_COUNTER Counter, _In_ INT64 Value)
+{
+    InterlockedExchangeAddNoFence64(&CurrentShard(pMetrics)->Counters[Counter], Value);
+}
+
+static INT64 TicksToNs(_In_ PMWS_METRICS pMetrics, _In_ LONGLONG Ticks)
+{
+    if (Ticks <= 0)
+        return 0;
+    // whole seconds first, Ticks * 1e9 overflows after about 15 minutes at a 10 MHz counter.
+    LONGLONG Frequency = pMetrics->QpcFrequency;
+    return (Ticks / Frequency) * 1000000000 + (Ticks % Frequency) * 1000000000 / Frequency;
+}
+
+void MetricsRecord(_In_ PMWS_METRICS pMetrics, _In_ MWS_LATENCY Latency, _In_ LONGLONG Ticks)
+{
+    INT64 Ns = TicksToNs(pMetrics, Ticks);
+
+    METRICS_SHARD* pShard = CurrentShard(pMetrics);
+    InterlockedIncrementNoFence64(&pShard->Latencies[Latency][BucketOf((UINT64)Ns)]);
+    InterlockedExchangeAddNoFence64(&pShard->LatencySums[Latency], Ns);
+}
+
+static COMMAND_LATENCY* FindCommand(_In_ PMWS_METRICS pMetrics, _In_z_ LPCSTR lpCommand, _In_ BOOL bAdd)
+{
+    for (int i = 0; i < MWS_MAX_TIMED_COMMANDS; i++)
+    {
+        COMMAND_LATENCY* pCommand = ReadPointerAcquire((PVOID volatile*)&pMetrics->Commands[i]);
+        if (!pCommand)
+        {
+            if (!bAdd)
+                return NULL;
+
+            // only the dispatch stage adds, but snapshots may read at the same time.
+            pCommand = MwsAlloc(pMetrics->pAllocator, HEAP_ZERO_MEMORY, sizeof(COMMAND_LATENCY));
+            if (!pCommand)
+                return NULL;
+            pCommand->Command = lpCommand;
+            WritePointerRelease((PVOID volatile*)&pMetrics->Commands[i], pCommand);
+            return pCommand;
+        }
+        if (pCommand->Command == lpCommand || strcmp(pCommand->Command, lpCommand) == 0)
+            return pCommand;
+    }
+    return NULL;
+}
+
+static void RecordCommandLatency(_Inout_ COMMAND_LATENCY* pCommand, _In_ int Which, _In_ INT64 Ns)
+{
+    InterlockedIncrementNoFence64(&pCommand->Latencies[Which][BucketOf((UINT64)Ns)]);
+    InterlockedExchangeAddNoFence64(&pCommand->Sums[Which], Ns);
+}
+
+void MetricsRecordCommand(_In_ PMWS_METRICS pMetrics, _In_z_ LPCSTR lpCommand, _In_ LONGLONG AllocTime, _In_ LONGLONG WrittenTime, _In_ LONGLONG DoneTime)
+{
+    COMMAND_LATENCY* pCommand = FindCommand(pMetrics, lpCommand, TRUE);
+    if (!pCommand)
+        return;
+
+    if (WrittenTime)
+    {
+        RecordCommandLatency(pCommand, 0, TicksToNs(pMetrics, WrittenTime - AllocTime));
+        RecordCommandLatency(pCommand, 1, TicksToNs(pMetrics, DoneTime - WrittenTime));
+    }
+    RecordCommandLatency(pCommand, 2, TicksToNs(pMetrics, DoneTime - AllocTime));
+}
+
+void FreeMetrics(_In_ _Frees_ptr_ PMWS_METRICS pMetrics)
+{
+    for (int i = 0; i < MWS_MAX_TIMED_COMMANDS && pMetrics->Commands[i]; i++)
+        MwsFree(pMetrics->pAllocator, pMetrics->Commands[i]);
+    MwsFree(pMetrics->pAllocator, pMetrics);
+}
+
+static void CopyHistogram(_In_reads_(MWS_HIST_BUCKETS) volatile LONG64* pBuckets, _In_ volatile LONG64* pSum, _Out_ MWS_HISTOGRAM* pHistogram)
+{
+    pHistogram->Sum = ReadNoFence64(pSum);
+    pHistogram->Count = 0;
+    for (int i = 0; i < MWS_HIST_BUCKETS; i++)
+    {
+        pHistogram->Buckets[i] = ReadNoFence64(&pBuckets[i]);
+        pHistogram->Count += pHistogram->Buckets[i];
+    }
+}
+
+UINT GetMiraiWSTimedCommands(_In_ PMIRAI_WS pMiraiWS, _Out_writes_to_(MaxCommands, return) LPCSTR* lpCommands, _In_ UINT MaxCommands)
+{
+    PMWS_METRICS pMetrics = pMiraiWS->pMetrics;
+    UINT Count = 0;
+    if (!pMetrics)
+        return 0;
+
+    for (int i = 0; i < MWS_MAX_TIMED_COMMANDS && Count < MaxCommands; i++)
+    {
+        COMMAND_LATENCY* pCommand = ReadPointerAcquire((PVOID volatile*)&pMetrics->Commands[i]);
+        if (!pCommand)
+            break;
+        lpCommands[Count++] = pCommand->Command;
+    }
+    return Count;
+}
+
+BOOL GetMiraiWSCommandLatency(_In_ PMIRAI_WS pMiraiWS, _In_z_ LPCSTR lpCommand, _Out_ MWS_COMMAND_LATENCY* pLatency)
+{
+    PMWS_METRICS pMetrics = pMiraiWS->pMetrics;
+    ZeroMemory(pLatency, sizeof(MWS_COMMAND_LATENCY));
+
+    COMMAND_LATENCY* pCommand = pMetrics ? FindCommand(pMetrics, lpCommand, FALSE) : NULL;
+    if (!pCommand)
+    {
+        SetLastError(ERROR_NOT_FOUND);
+        return FALSE;
+    }
+
+    CopyHistogram(pCommand->Latencies[0], &pCommand->Sums[0], &pLatency->WriteNs);
+    CopyHistogram(pCommand->Latencies[1], &pCommand->Sums[1], &pLatency->ResponseNs);
+    CopyHistogram(pCommand->Latencies[2], &pCommand->Sums[2], &pLatency->TotalNs);
+    return TRUE;
+}
+
+void MwsHistogramSummarize(_In_ const MWS_HISTOGRAM* pHistogram, _Out_ MWS_HISTOGRAM_SUMMARY* pSummary)
+{
+    ZeroMemory(pSummary, sizeof(MWS_HISTOGRAM_SUMMARY));
+    pSummary->Count = pHistogram->Count;
+    if (pHistogram->Count == 0)
+        return;
+
+    const double Percentiles[] = { 0.5, 0.99, 0.999 };
+    INT64* Results[] = { &pSummary->P50, &pSummary->P99, &pSummary->P999 };
+    int Next = 0;
+    INT64 Seen = 0;
+    for (int i = 0; i < MWS_HIST_BUCKETS; i++)
+    {
+        if (!pHistogram->Buckets[i])
+            continue;
+        Seen += pHistogram->Buckets[i];
+        INT64 Top = MwsHistogramBucketBase(i) + BucketWidth(i) - 1;
+        while (Next < _countof(Percentiles) && Seen >= max((INT64)(Percentiles[Next] * pHistogram->Count + 0.5), 1))
+            *Results[Next++] = Top;
+        pSummary->Max = Top;
+    }
+}
+
+static void SumLatency(_In_ PMWS_METRICS pMetrics, _In_ MWS_LATENCY Latency, _Out_ MWS_HISTOGRAM* pHistogram)
+{
+    ZeroMemory(pHistogram, sizeof(MWS_HISTOGRAM));
+    for (int s = 0; s < METRICS_SHARDS; s++)
+    {
+        METRICS_SHARD* pShard = &pMetrics->Shards[s];
+        pHistogram->Sum += ReadNoFence64(&pShard->LatencySums[Latency]);
+        for (int i = 0; i < MWS_HIST_BUCKETS; i++)
+            pHistogram->Buckets[i] += ReadNoFence64(&pShard->Latencies[Latency][i]);
+    }
+    for (int i = 0; i < MWS_HIST_BUCKETS; i++)
+        pHistogram->Count += pHistogram->Buckets[i];
+}
+
+BOOL GetMiraiWSMetrics(_In_ PMIRAI_WS pMiraiWS, _Out_ MWS_METRICS_SNAPSHOT* pSnapshot)
+{
+    PMWS_METRICS pMetrics = pMiraiWS->pMetrics;
+    ZeroMemory(pSnapshot, sizeof(MWS_METRICS_SNAPSHOT));
+    if (!pMetrics)
+    {
+        SetLastError(ERROR_INVALID_STATE);
+        return FALSE;
+    }
+
+    INT64 Counters[MWS_CTR_COUNT] = { 0 };
+    for (int s = 0; s < METRICS_SHARDS; s++)
+    {
+        for (int i = 0; i < MWS_CTR_COUNT; i++)
+            Counters[i] += ReadNoFence64(&pMetrics->Shards[s].Counters[i]);
+    }
+
+    pSnapshot->FramesReceived = Counters[MWS_CTR_FRAMES];
+    pSnapshot->BytesReceived = Counters[MWS_CTR_BYTES];
+    pSnapshot->BadMessages = Counters[MWS_CTR_BADMSG];
+    pSnapshot->RingDropped = Counters[MWS_CTR_RING_DROPPED];
+    pSnapshot->RequestsSent = Counters[MWS_CTR_REQUESTS_SENT];
+    pSnapshot->RequestsCompleted = Counters[MWS_CTR_REQUESTS_COMPLETED];
+    pSnapshot->PendingRequests = max(pSnapshot->RequestsSent - pSnapshot->RequestsCompleted, 0);
+    pSnapshot->AsyncCallsInUse = GetAsyncCallsInUse();
+    memcpy(pSnapshot->Events, &Counters[MWS_CTR_EVENTS], sizeof(pSnapshot->Events));
+
+    SumLatency(pMetrics, MWS_LAT_PARSE, &pSnapshot->ParseNs);
+    SumLatency(pMetrics, MWS_LAT_DISPATCH, &pSnapshot->DispatchNs);
+    SumLatency(pMetrics, MWS_LAT_CALLBACK, &pSnapshot->CallbackNs);
+    SumLatency(pMetrics, MWS_LAT_SEND_RTT, &pSnapshot->SendRttNs);
+    return TRUE;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <Windows.h>
+#include "MiraiWS.h"
+#include "MiraiWSBin.h"
+
+EXTERN_C_START
+
+// Counters and latency histograms of a connection (see EnableMiraiWSMetrics).
+//
+// Histograms are log-linear: values below MWS_HIST_SUB_BUCKETS get a bucket each,
+// above that every power of 2 is split into MWS_HIST_SUB_BUCKETS buckets of equal width,
+// so a value is never off by more than 1/MWS_HIST_SUB_BUCKETS. All latencies are in nanoseconds.
+
+#define MWS_HIST_SUB_BITS    3
+#define MWS_HIST_SUB_BUCKETS (1 << MWS_HIST_SUB_BITS)
+#define MWS_HIST_BUCKETS     (MWS_HIST_SUB_BUCKETS * 40) // up to about 70 minutes, larger values count in the last bucket
+
+typedef struct
+{
+    INT64 Count;
+    INT64 Sum;
+    INT64 Buckets[MWS_HIST_BUCKETS];
+} MWS_HISTOGRAM;
+
+typedef struct
+{
+    INT64 FramesReceived;
+    INT64 BytesReceived;
+    INT64 BadMessages;       // MWS_BADMSG reported
+    INT64 RingDropped;       // events not published to the event ring, see MWS_RING_HEADER.Dropped
+    INT64 RequestsSent;
+    INT64 RequestsCompleted; // a response arrived for it
+    INT64 PendingRequests;   // of this connection, sent and not completed
+    LONG AsyncCallsInUse;    // of all connections in the process, at most 1024
+
+    INT64 Events[MWSBIN_EV_COUNT]; // indexed by MWSBIN_EVENT_TYPE, types not known to MiraiWS count as MWSBIN_EV_UNKNOWN
+
+    MWS_HISTOGRAM ParseNs;    // yyjson_read of a frame
+    MWS_HISTOGRAM DispatchNs; // unpacking a parsed frame, including user callbacks
+    MWS_HISTOGRAM CallbackNs; // user callbacks called from the dispatch stage
+    MWS_HISTOGRAM SendRttNs;  // request sent to its response dispatched
+} MWS_METRICS_SNAPSHOT;
+
+// requests of up to this many different commands are timed per connection, later ones are not.
+#define MWS_MAX_TIMED_COMMANDS 32
+
+typedef struct
+{
+    MWS_HISTOGRAM WriteNs;    // syncId allocated to the request handed to WinHttp
+    MWS_HISTOGRAM ResponseNs; // request handed to WinHttp to its response unpacked
+    MWS_HISTOGRAM TotalNs;    // syncId allocated to its response unpacked
+} MWS_COMMAND_LATENCY;
+
+typedef struct
+{
+    INT64 Count;
+    INT64 P50;
+    INT64 P99;
+    INT64 P999;
+    INT64 Max; // largest value of the highest non-empty bucket
+} MWS_HISTOGRAM_SUMMARY;
+
+/// <summary>
+/// Copy the metrics of a connection out. The connection keeps running while copying,
+/// so counters of the snapshot may be a few updates apart from each other.
+/// </summary>
+/// <param name="pMiraiWS">handle with EnableMiraiWSMetrics called</param>
+/// <param name="pSnapshot">receives the metrics</param>
+/// <returns>return TRUE on success, FALSE if metrics are not enabled</returns>
+BOOL GetMiraiWSMetrics(_In_ PMIRAI_WS pMiraiWS, _Out_ MWS_METRICS_SNAPSHOT* pSnapshot);
+
+/// <summary>
+/// List the commands GetMiraiWSCommandLatency has latencies for, in the order they were first completed.
+/// </summary>
+/// <param name="pMiraiWS">handle with EnableMiraiWSMetrics called</param>
+/// <param name="lpCommands">receives command names like "sendGroupMessage", valid as long as the connection</param>
+/// <param name="MaxCommands">length of lpCommands</param>
+/// <returns>number of commands stored in lpCommands</returns>
+UINT GetMiraiWSTimedCommands(_In_ PMIRAI_WS pMiraiWS, _Out_writes_to_(MaxCommands, return) LPCSTR* lpCommands, _In_ UINT MaxCommands);
+
+/// <summary>
+/// Copy the request latencies of one command out.
+/// </summary>
+/// <param name="pMiraiWS">handle with EnableMiraiWSMetrics called</param>
+/// <param name="lpCommand">mirai command name, e.g. "sendGroupMessage"</param>
+/// <param name="pLatency">receives the histograms</param>
+/// <returns>return TRUE on success, FALSE if no request of that command completed yet</returns>
+BOOL GetMiraiWSCommandLatency(_In_ PMIRAI_WS pMiraiWS, _In_z_ LPCSTR lpCommand, _Out_ MWS_COMMAND_LATENCY* pLatency);
+
+/// <summary>
+/// Smallest value that falls in a bucket of a histogram.
+/// </summary>
+INT64 MwsHistogramBucketBase(_In_ int Bucket);
+
+/// <summary>
+/// Value below which a share of the recorded values are, e.g. 0.99 for p99.
+/// </summary>
+/// <returns>largest value of the bucket holding the percentile, 0 for an empty histogram</returns>
+INT64 MwsHistogramPercentile(_In_ const MWS_HISTOGRAM* pHistogram, _In_ double Percentile);
+
+/// <summary>
+/// Count, p50, p99, p999 and max of a histogram in one pass.
+/// </summary>
+void MwsHistogramSummarize(_In_ const MWS_HISTOGRAM* pHistogram, _Out_ MWS_HISTOGRAM_SUMMARY* pSummary);
+
+EXTERN_C_END
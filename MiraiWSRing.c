@@ -0,0 +1,277 @@
+#include <Windows.h>
+#include "MiraiWS.h"
+#include "MiraiWSRing.h"
+#include "MiraiWSInternal.h"
+
+#define RING_HEADER_SIZE ((sizeof(MWS_RING_HEADER) + SYSTEM_CACHE_ALIGNMENT_SIZE - 1) & ~(SYSTEM_CACHE_ALIGNMENT_SIZE - 1))
+#define RING_ALIGN_UP(x) (((x) + MWS_RING_ALIGN - 1) & ~((SIZE_T)MWS_RING_ALIGN - 1))
+
+typedef struct _MWS_EVENT_RING
+{
+    HANDLE hMapping;
+    MWS_RING_HEADER* pHeader;
+    PBYTE pRecords;
+    UINT32 Capacity;
+    LONG64 Committed; // publisher's copy of pHeader->Committed
+    const MWS_ALLOCATOR* pAllocator; // of the connection
+} MWS_EVENT_RING;
+
+typedef struct _MWS_RING_READER
+{
+    HANDLE hMapping;
+    const MWS_RING_HEADER* pHeader;
+    const BYTE* pRecords;
+    UINT32 Capacity;
+    LONG64 Cursor;
+    UINT64 Overruns;
+} MWS_RING_READER;
+
+static INT64 GetTimestamp()
+{
+    FILETIME Now;
+    GetSystemTimeAsFileTime(&Now);
+    return ((INT64)Now.dwHighDateTime << 32) | Now.dwLowDateTime;
+}
+
+BOOL EnableMiraiWSEventRing(_Inout_ PMIRAI_WS pMiraiWS, _In_z_ LPCWSTR lpName, _In_ DWORD cbCapacity)
+{
+    // capacity must be a power of 2 and hold at least a few records.
+    if (pMiraiWS->pEventRing || cbCapacity < 4096 || (cbCapacity & (cbCapacity - 1)))
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    BOOL bSuccess = FALSE;
+    PMWS_EVENT_RING pRing = MwsAlloc(&pMiraiWS->Allocator, HEAP_ZERO_MEMORY, sizeof(MWS_EVENT_RING));
+    if (!pRing)
+        return FALSE;
+    pRing->pAllocator = &pMiraiWS->Allocator;
+
+    __try
+    {
+        ULARGE_INTEGER MappingSize;
+        MappingSize.QuadPart = RING_HEADER_SIZE + (ULONGLONG)cbCapacity;
+        pRing->hMapping = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, MappingSize.HighPart, MappingSize.LowPart, lpName);
+        if (!pRing->hMapping)
+            __leave;
+        if (GetLastError() == ERROR_ALREADY_EXISTS)
+        {
+            // someone else publishes under this name.
+            SetLastError(ERROR_ALREADY_EXISTS);
+            __leave;
+        }
+
+        pRing->pHeader = MapViewOfFile(pRing->hMapping, FILE_MAP_WRITE, 0, 0, 0);
+        if (!pRing->pHeader)
+            __leave;
+        pRing->pRecords = (PBYTE)pRing->pHeader + RING_HEADER_SIZE;
+        pRing->Capacity = cbCapacity;
+
+        pRing->pHeader->Capacity = cbCapacity;
+        pRing->pHeader->HeaderSize = RING_HEADER_SIZE;
+        pRing->pHeader->Version = MWS_RING_VERSION;
+        // magic goes last, readers check it before anything else.
+        InterlockedExchange((volatile LONG*)&pRing->pHeader->Magic, MWS_RING_MAGIC);
+
+        pMiraiWS->pEventRing = pRing;
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if (!bSuccess)
+        {
+            DWORD dwError = GetLastError();
+            if (pRing->pHeader) UnmapViewOfFile(pRing->pHeader);
+            if (pRing->hMapping) CloseHandle(pRing->hMapping);
+            MwsFree(&pMiraiWS->Allocator, pRing);
+            SetLastError(dwError);
+        }
+    }
+    return bSuccess;
+}
+
+BOOL PublishEventToRing(_In_ PMWS_EVENT_RING pRing, _In_ yyjson_val* DataField)
+{
+    MWS_RING_HEADER* pHeader = pRing->pHeader;
+    MWSBIN_WRITER Writer;
+    MwsBinMeasureInit(&Writer);
+    MwsBinWriteEvent(&Writer, DataField);
+    SIZE_T cbPayload = Writer.cbWritten;
+    SIZE_T cbRecord = RING_ALIGN_UP(sizeof(MWS_RING_RECORD) + cbPayload);
+    if (cbRecord > MWS_RING_MAX_RECORD(pRing->Capacity))
+    {
+        InterlockedIncrement64(&pHeader->Dropped);
+        return FALSE;
+    }
+
+    LONG64 Pos = pRing->Committed;
+    SIZE_T Offset = (SIZE_T)Pos & (pRing->Capacity - 1);
+    SIZE_T cbPadding = 0;
+    if (Offset + cbRecord > pRing->Capacity)
+        cbPadding = pRing->Capacity - Offset; // record doesn't fit before the end, start over at 0.
+
+    // tell readers which bytes are about to change before changing them.
+    InterlockedExchange64(&pHeader->Reserved, Pos + cbPadding + cbRecord);
+
+    if (cbPadding)
+    {
+        MWS_RING_RECORD* pPadding = (MWS_RING_RECORD*)(pRing->pRecords + Offset);
+        pPadding->Size = (UINT32)(cbPadding - sizeof(MWS_RING_RECORD));
+        pPadding->Kind = MWS_RING_PADDING;
+        pPadding->Flags = 0;
+        pPadding->Timestamp = 0;
+        Offset = 0;
+    }
+
+    MWS_RING_RECORD* pRecord = (MWS_RING_RECORD*)(pRing->pRecords + Offset);
+    pRecord->Size = (UINT32)cbPayload;
+    pRecord->Kind = MWS_RING_EVENT;
+    pRecord->Flags = 0;
+    pRecord->Timestamp = GetTimestamp();
+
+    MwsBinWriterInit(&Writer, pRecord + 1, cbPayload);
+    MwsBinWriteEvent(&Writer, DataField);
+
+    pRing->Committed = Pos + cbPadding + cbRecord;
+    WriteRelease64(&pHeader->Committed, pRing->Committed);
+    InterlockedIncrement64(&pHeader->Published);
+    return TRUE;
+}
+
+void CloseEventRing(_In_ _Frees_ptr_ PMWS_EVENT_RING pRing)
+{
+    UnmapViewOfFile(pRing->pHeader);
+    CloseHandle(pRing->hMapping);
+    MwsFree(pRing->pAllocator, pRing);
+}
+
+_Ret_maybenull_
+PMWS_RING_READER OpenMiraiWSEventRing(_In_z_ LPCWSTR lpName)
+{
+    BOOL bSuccess = FALSE;
+    PMWS_RING_READER pReader = MwsAlloc(&MwsHeapAllocator, HEAP_ZERO_MEMORY, sizeof(MWS_RING_READER));
+    if (!pReader)
+        return NULL;
+
+    __try
+    {
+        pReader->hMapping = OpenFileMappingW(FILE_MAP_READ, FALSE, lpName);
+        if (!pReader->hMapping)
+            __leave;
+
+        pReader->pHeader = MapViewOfFile(pReader->hMapping, FILE_MAP_READ, 0, 0, 0);
+        if (!pReader->pHeader)
+            __leave;
+
+        if (ReadAcquire((volatile LONG*)&pReader->pHeader->Magic) != MWS_RING_MAGIC ||
+            pReader->pHeader->Version != MWS_RING_VERSION)
+        {
+            SetLastError(ERROR_BAD_FORMAT);
+            __leave;
+        }
+
+        pReader->Capacity = pReader->pHeader->Capacity;
+        pReader->pRecords = (const BYTE*)pReader->pHeader + pReader->pHeader->HeaderSize;
+        pReader->Cursor = ReadAcquire64(&pReader->pHeader->Committed);
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if (!bSuccess)
+        {
+            DWORD dwError = GetLastError();
+            if (pReader->pHeader) UnmapViewOfFile(pReader->pHeader);
+            if (pReader->hMapping) CloseHandle(pReader->hMapping);
+            MwsFree(&MwsHeapAllocator, pReader);
+            pReader = NULL;
+            SetLastError(dwError);
+        }
+    }
+    return pReader;
+}
+
+/// <summary>
+/// Check whether the publisher may have touched the record at cursor while we were reading it.
+/// </summary>
+static BOOL IsOverrun(_In_ PMWS_RING_READER pReader)
+{
+    return ReadAcquire64(&pReader->pHeader->Reserved) - pReader->Cursor > pReader->Capacity;
+}
+
+static MWS_RING_STATUS SkipToNewest(_Inout_ PMWS_RING_READER pReader)
+{
+    pReader->Cursor = ReadAcquire64(&pReader->pHeader->Committed);
+    pReader->Overruns++;
+    return MWS_RING_OVERRUN;
+}
+
+MWS_RING_STATUS ReadMiraiWSEventRing(
+    _Inout_ PMWS_RING_READER pReader,
+    _Out_writes_bytes_to_(cbBuffer, pInfo->cbPayload) PVOID pBuffer,
+    _In_ DWORD cbBuffer,
+    _Out_ MWS_RING_RECORD_INFO* pInfo)
+{
+    ZeroMemory(pInfo, sizeof(MWS_RING_RECORD_INFO));
+    for (;;)
+    {
+        LONG64 Committed = ReadAcquire64(&pReader->pHeader->Committed);
+        if (pReader->Cursor == Committed)
+            return MWS_RING_EMPTY;
+        if (Committed - pReader->Cursor > pReader->Capacity)
+            return SkipToNewest(pReader);
+
+        SIZE_T Offset = (SIZE_T)pReader->Cursor & (pReader->Capacity - 1);
+        MWS_RING_RECORD Record = *(const MWS_RING_RECORD*)(pReader->pRecords + Offset);
+        SIZE_T cbRecord = RING_ALIGN_UP(sizeof(MWS_RING_RECORD) + (SIZE_T)Record.Size);
+
+        // the header may be garbage if the publisher lapped us while we copied it.
+        if (Offset + cbRecord > pReader->Capacity)
+            return SkipToNewest(pReader);
+
+        if (Record.Kind == MWS_RING_PADDING)
+        {
+            MemoryBarrier();
+            if (IsOverrun(pReader))
+                return SkipToNewest(pReader);
+            pReader->Cursor += cbRecord;
+            continue;
+        }
+
+        if (Record.Size > cbBuffer)
+        {
+            MemoryBarrier();
+            if (IsOverrun(pReader))
+                return SkipToNewest(pReader);
+            pInfo->Kind = Record.Kind;
+            pInfo->Timestamp = Record.Timestamp;
+            pInfo->cbPayload = Record.Size;
+            return MWS_RING_MORE_DATA;
+        }
+
+        memcpy(pBuffer, pReader->pRecords + Offset + sizeof(MWS_RING_RECORD), Record.Size);
+
+        // only trust what we copied if the publisher didn't reach it meanwhile.
+        MemoryBarrier();
+        if (IsOverrun(pReader))
+            return SkipToNewest(pReader);
+
+        pReader->Cursor += cbRecord;
+        pInfo->Kind = Record.Kind;
+        pInfo->Timestamp = Record.Timestamp;
+        pInfo->cbPayload = Record.Size;
+        return MWS_RING_RECORD_READ;
+    }
+}
+
+UINT64 GetMiraiWSEventRingOverruns(_In_ PMWS_RING_READER pReader)
+{
+    return pReader->Overruns;
+}
+
+void CloseMiraiWSEventRing(_In_ _Frees_ptr_ PMWS_RING_READER pReader)
+{
+    UnmapViewOfFile(pReader->pHeader);
+    CloseHandle(pReader->hMapping);
+    MwsFree(&MwsHeapAllocator, pReader);
+}
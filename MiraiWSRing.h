@@ -0,0 +1,98 @@
+#pragma once
+
+#include <Windows.h>
+#include "MiraiWSBin.h"
+
+EXTERN_C_START
+
+// A named shared memory ring one connection publishes events into (see EnableMiraiWSEventRing),
+// so several processes can consume one mirai connection.
+//
+// The publisher never waits for readers. Every reader keeps its own cursor,
+// a reader that falls more than the ring capacity behind is told so and skips to the newest record.
+//
+// Layout: MWS_RING_HEADER, then records starting at HeaderSize.
+// A record is MWS_RING_RECORD followed by Size bytes of payload, padded to MWS_RING_ALIGN.
+// Records never wrap around the end, the publisher fills the tail with a MWS_RING_PADDING record instead.
+
+#define MWS_RING_MAGIC   0x5253574D // "MWSR"
+#define MWS_RING_VERSION 2
+#define MWS_RING_ALIGN   16
+
+// records larger than a quarter of the ring are dropped rather than published.
+#define MWS_RING_MAX_RECORD(Capacity) ((Capacity) / 4)
+
+typedef enum _MWS_RING_KIND
+{
+    MWS_RING_PADDING = 0, // skip it
+    MWS_RING_EVENT        // payload is the "data" object of an event, decode it with MwsBinReadEvent
+} MWS_RING_KIND;
+
+typedef struct
+{
+    UINT32 Magic;
+    UINT32 Version;
+    UINT32 Capacity;   // bytes of record area, power of 2
+    UINT32 HeaderSize; // offset of record area from start of mapping
+
+    DECLSPEC_CACHEALIGN volatile LONG64 Reserved;  // publisher may be writing below here
+    DECLSPEC_CACHEALIGN volatile LONG64 Committed; // records below here are complete
+    volatile LONG64 Published;                     // records published
+    volatile LONG64 Dropped;                       // records too large to publish
+} MWS_RING_HEADER;
+
+typedef struct
+{
+    UINT32 Size;    // payload bytes
+    UINT16 Kind;    // MWS_RING_KIND
+    UINT16 Flags;   // reserved, 0
+    INT64 Timestamp; // when published, in FILETIME units
+} MWS_RING_RECORD;
+
+typedef enum _MWS_RING_STATUS
+{
+    MWS_RING_RECORD_READ = 0, // a record was copied out
+    MWS_RING_EMPTY,           // reader is up to date with the publisher
+    MWS_RING_OVERRUN,         // publisher overwrote records before they were read, reader moved to the newest record
+    MWS_RING_MORE_DATA        // buffer is too small for the next record, cbPayload tells the size needed
+} MWS_RING_STATUS;
+
+typedef struct
+{
+    MWS_RING_KIND Kind;
+    INT64 Timestamp;
+    DWORD cbPayload;
+} MWS_RING_RECORD_INFO;
+
+typedef struct _MWS_RING_READER MWS_RING_READER, * PMWS_RING_READER;
+
+_Ret_maybenull_
+/// <summary>
+/// Attach to an event ring published by another process. Reading starts from the newest record.
+/// </summary>
+/// <param name="lpName">name passed to EnableMiraiWSEventRing</param>
+/// <returns>reader handle, or NULL with GetLastError set</returns>
+PMWS_RING_READER OpenMiraiWSEventRing(_In_z_ LPCWSTR lpName);
+
+/// <summary>
+/// Copy the next record out of the ring.
+/// </summary>
+/// <param name="pReader">handle returned by OpenMiraiWSEventRing</param>
+/// <param name="pBuffer">receives the payload, decode it with MwsBinReaderInit and MwsBinReadEvent</param>
+/// <param name="cbBuffer">size of pBuffer</param>
+/// <param name="pInfo">receives kind, timestamp and size of the record</param>
+/// <returns>see MWS_RING_STATUS</returns>
+MWS_RING_STATUS ReadMiraiWSEventRing(
+    _Inout_ PMWS_RING_READER pReader,
+    _Out_writes_bytes_to_(cbBuffer, pInfo->cbPayload) PVOID pBuffer,
+    _In_ DWORD cbBuffer,
+    _Out_ MWS_RING_RECORD_INFO* pInfo);
+
+/// <summary>
+/// How many times the reader was overrun since it was opened.
+/// </summary>
+UINT64 GetMiraiWSEventRingOverruns(_In_ PMWS_RING_READER pReader);
+
+void CloseMiraiWSEventRing(_In_ _Frees_ptr_ PMWS_RING_READER pReader);
+
+EXTERN_C_END
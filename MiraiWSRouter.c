@@ -0,0 +1,292 @@
+#include <Windows.h>
+#include "MiraiWS.h"
+#include "MiraiWSRouter.h"
+#include "MiraiWSInternal.h"
+
+// Commands are kept in a byte trie of their utf8 names. The first byte indexes a table of the root, so a message
+// that starts with no command's first byte costs one lookup; deeper nodes keep their children in a sibling list.
+
+#define ROUTE_NONE MAXUINT
+
+typedef struct
+{
+    UINT FirstChild;  // 0 for none, the root is never a child
+    UINT NextSibling;
+    UINT Route;       // first route of the command ending here, ROUTE_NONE if none does
+    BYTE Byte;
+} ROUTER_NODE;
+
+typedef struct
+{
+    INT64 GroupID;
+    MWS_PERMISSION MinPermission;
+    MWS_ROUTE_HANDLER Handler;
+    LPVOID Context;
+    UINT NextSame;    // next route of the same command, ROUTE_NONE at the end
+} ROUTER_ROUTE;
+
+typedef struct _MWS_ROUTER
+{
+    MWS_ALLOCATOR Allocator;
+    UINT RootEdges[256]; // node of each first byte, 0 if no command starts with it
+    UINT NodeCnt;
+    ROUTER_NODE* Nodes;
+    ROUTER_ROUTE* Routes;
+    // the arrays follow in the same allocation
+} MWS_ROUTER;
+
+static BOOL IsSpace(_In_ CHAR c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+_Ret_maybenull_
+PMWS_ROUTER CreateMiraiWSRouter(_In_reads_(cRoutes) const MWS_ROUTE* pRoutes, _In_ UINT cRoutes)
+{
+    return CreateMiraiWSRouterEx(pRoutes, cRoutes, NULL);
+}
+
+_Ret_maybenull_
+PMWS_ROUTER CreateMiraiWSRouterEx(_In_reads_(cRoutes) const MWS_ROUTE* pRoutes, _In_ UINT cRoutes, _In_opt_ const MWS_ALLOCATOR* pAllocator)
+{
+    MWS_ALLOCATOR Allocator = pAllocator ? *pAllocator : MwsHeapAllocator;
+    SIZE_T cbTotal = 0;
+    for (UINT i = 0; i < cRoutes; i++)
+    {
+        int cbCommand = pRoutes[i].lpCommand ? WideCharToMultiByte(CP_UTF8, 0, pRoutes[i].lpCommand, -1, NULL, 0, NULL, NULL) - 1 : 0;
+        if (cbCommand <= 0 || !pRoutes[i].Handler)
+        {
+            SetLastError(ERROR_INVALID_PARAMETER);
+            return NULL;
+        }
+        cbTotal += cbCommand;
+    }
+    if (!cRoutes)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return NULL;
+    }
+
+    // a node per byte at most, the root included.
+    SIZE_T MaxNodes = cbTotal + 1;
+    PMWS_ROUTER pRouter = NULL;
+    LPSTR lpCommand = NULL;
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        pRouter = MwsAlloc(&Allocator, HEAP_ZERO_MEMORY, sizeof(MWS_ROUTER) + cRoutes * sizeof(ROUTER_ROUTE) + MaxNodes * sizeof(ROUTER_NODE));
+        lpCommand = MwsAlloc(&Allocator, 0, cbTotal);
+        if (!pRouter || !lpCommand)
+        {
+            SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+            __leave;
+        }
+        pRouter->Allocator = Allocator;
+        pRouter->Routes = (ROUTER_ROUTE*)(pRouter + 1);
+        pRouter->Nodes = (ROUTER_NODE*)(pRouter->Routes + cRoutes);
+        pRouter->Nodes[0].Route = ROUTE_NONE;
+        pRouter->NodeCnt = 1;
+
+        // later routes are linked first, so the first one given is tried first.
+        for (UINT i = cRoutes; i-- > 0;)
+        {
+            int cbCommand = WideCharToMultiByte(CP_UTF8, 0, pRoutes[i].lpCommand, (int)wcslen(pRoutes[i].lpCommand),
+                lpCommand, (int)cbTotal, NULL, NULL);
+            UINT Node = 0;
+            for (int j = 0; j < cbCommand; j++)
+            {
+                BYTE Byte = (BYTE)lpCommand[j];
+                UINT* pEdge = Node ? &pRouter->Nodes[Node].FirstChild : &pRouter->RootEdges[Byte];
+                while (*pEdge && pRouter->Nodes[*pEdge].Byte != Byte)
+                    pEdge = &pRouter->Nodes[*pEdge].NextSibling;
+                if (!*pEdge)
+                {
+                    UINT New = pRouter->NodeCnt++;
+                    pRouter->Nodes[New].Byte = Byte;
+                    pRouter->Nodes[New].Route = ROUTE_NONE;
+                    *pEdge = New;
+                }
+                Node = *pEdge;
+            }
+
+            ROUTER_ROUTE* pRoute = &pRouter->Routes[i];
+            pRoute->GroupID = pRoutes[i].GroupID;
+            pRoute->MinPermission = pRoutes[i].MinPermission;
+            pRoute->Handler = pRoutes[i].Handler;
+            pRoute->Context = pRoutes[i].Context;
+            pRoute->NextSame = pRouter->Nodes[Node].Route;
+            pRouter->Nodes[Node].Route = i;
+        }
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if (lpCommand) MwsFree(&Allocator, lpCommand);
+        if (!bSuccess && pRouter)
+        {
+            MwsFree(&Allocator, pRouter);
+            pRouter = NULL;
+        }
+    }
+    return pRouter;
+}
+
+/// <summary>
+/// Find the longest command a text starts with, one that is followed by whitespace or the end of the text.
+/// </summary>
+/// <returns>first route of the command, ROUTE_NONE if there is none</returns>
+static UINT MatchCommand(_In_ PMWS_ROUTER pRouter, _In_reads_(cbText) LPCSTR lpText, _In_ SIZE_T cbText, _Out_ SIZE_T* pcbCommand)
+{
+    UINT Found = ROUTE_NONE;
+    *pcbCommand = 0;
+    UINT Node = cbText ? pRouter->RootEdges[(BYTE)lpText[0]] : 0;
+    for (SIZE_T i = 1; Node; i++)
+    {
+        if (pRouter->Nodes[Node].Route != ROUTE_NONE && (i == cbText || IsSpace(lpText[i])))
+        {
+            Found = pRouter->Nodes[Node].Route;
+            *pcbCommand = i;
+        }
+        if (i == cbText)
+            break;
+
+        UINT Child = pRouter->Nodes[Node].FirstChild;
+        while (Child && pRouter->Nodes[Child].Byte != (BYTE)lpText[i])
+            Child = pRouter->Nodes[Child].NextSibling;
+        Node = Child;
+    }
+    return Found;
+}
+
+static void Tokenize(_Inout_ MWS_ROUTE_CONTEXT* pContext)
+{
+    LPCSTR lpCur = pContext->Rest.Ptr;
+    LPCSTR lpEnd = lpCur + pContext->Rest.Len;
+    while (lpCur < lpEnd && pContext->ArgCnt < MWS_ROUTER_MAX_ARGS)
+    {
+        while (lpCur < lpEnd && IsSpace(*lpCur))
+            lpCur++;
+        if (lpCur == lpEnd)
+            break;
+
+        MWS_TOKEN* pArg = &pContext->Args[pContext->ArgCnt++];
+        if (*lpCur == '"')
+        {
+            // up to the closing quote, or the end of the text when there is none.
+            pArg->Ptr = ++lpCur;
+            while (lpCur < lpEnd && *lpCur != '"')
+                lpCur++;
+            pArg->Len = lpCur - pArg->Ptr;
+            if (lpCur < lpEnd)
+                lpCur++;
+        }
+        else
+        {
+            pArg->Ptr = lpCur;
+            while (lpCur < lpEnd && !IsSpace(*lpCur))
+                lpCur++;
+            pArg->Len = lpCur - pArg->Ptr;
+        }
+    }
+}
+
+MWS_ROUTE_RESULT RouteMiraiWSMessage(_In_ PMWS_ROUTER pRouter, _In_ PMIRAI_WS pMiraiWS, _In_ UINT EventType, _In_ PVOID pInformation)
+{
+    MWS_ROUTE_CONTEXT Context = { 0 };
+    Context.EventType = EventType;
+    Context.pInformation = pInformation;
+    switch (EventType)
+    {
+    case MWS_FRIENDMSG:
+    {
+        MWS_FRIENDMSGINFO* pInfo = pInformation;
+        Context.SenderID = pInfo->Sender.ID;
+        Context.pChain = &pInfo->View;
+        break;
+    }
+    case MWS_GROUPMSG:
+    {
+        MWS_GROUPMSGINFO* pInfo = pInformation;
+        Context.SenderID = pInfo->Sender.ID;
+        Context.GroupID = pInfo->Sender.Group.ID;
+        Context.Permission = pInfo->Sender.PermissionLevel;
+        Context.pChain = &pInfo->View;
+        break;
+    }
+    case MWS_TEMPMSG:
+    {
+        MWS_TEMPMSGINFO* pInfo = pInformation;
+        Context.SenderID = pInfo->Sender.ID;
+        Context.GroupID = pInfo->Sender.Group.ID;
+        Context.Permission = pInfo->Sender.PermissionLevel;
+        Context.pChain = &pInfo->MessageChain;
+        break;
+    }
+    case MWS_STRANGERMSG:
+    {
+        MWS_STRANGERMSGINFO* pInfo = pInformation;
+        Context.SenderID = pInfo->Sender.ID;
+        Context.pChain = &pInfo->MessageChain;
+        break;
+    }
+    default:
+        return MWS_ROUTE_NONE;
+    }
+
+    // the first Plain block, commands often come after an At of the bot.
+    yyjson_val* TextField = NULL;
+    size_t i, MaxNode;
+    yyjson_val* Block;
+    yyjson_arr_foreach((yyjson_val*)Context.pChain->Node, i, MaxNode, Block) {
+        if (yyjson_equals_str(yyjson_obj_get(Block, "type"), "Plain"))
+        {
+            TextField = yyjson_obj_get(Block, "text");
+            Context.PlainIndex = (UINT)i;
+            break;
+        }
+    }
+    if (!yyjson_is_str(TextField))
+        return MWS_ROUTE_NONE;
+
+    LPCSTR lpText = unsafe_yyjson_get_str(TextField);
+    LPCSTR lpEnd = lpText + unsafe_yyjson_get_len(TextField);
+    while (lpText < lpEnd && IsSpace(*lpText))
+        lpText++;
+
+    SIZE_T cbCommand;
+    UINT RouteIndex = MatchCommand(pRouter, lpText, lpEnd - lpText, &cbCommand);
+    if (RouteIndex == ROUTE_NONE)
+        return MWS_ROUTE_NONE;
+
+    // in a group or temp chat the sender has a permission, elsewhere only routes asking for none fit.
+    const ROUTER_ROUTE* pRoute = &pRouter->Routes[RouteIndex];
+    while (pRoute && ((pRoute->GroupID && pRoute->GroupID != Context.GroupID) ||
+        (pRoute->MinPermission != MWS_PERMISSION_UNKNOWN && (!Context.GroupID || Context.Permission < pRoute->MinPermission))))
+    {
+        RouteIndex = pRoute->NextSame;
+        pRoute = RouteIndex != ROUTE_NONE ? &pRouter->Routes[RouteIndex] : NULL;
+    }
+    if (!pRoute)
+        return MWS_ROUTE_DENIED;
+
+    Context.RouteIndex = RouteIndex;
+    Context.Command.Ptr = lpText;
+    Context.Command.Len = cbCommand;
+    lpText += cbCommand;
+    while (lpText < lpEnd && IsSpace(*lpText))
+        lpText++;
+    while (lpEnd > lpText && IsSpace(lpEnd[-1]))
+        lpEnd--;
+    Context.Rest.Ptr = lpText;
+    Context.Rest.Len = lpEnd - lpText;
+    Tokenize(&Context);
+
+    pRoute->Handler(pMiraiWS, &Context, pRoute->Context);
+    return MWS_ROUTE_DISPATCHED;
+}
+
+void DestroyMiraiWSRouter(_In_ _Frees_ptr_ PMWS_ROUTER pRouter)
+{
+    MWS_ALLOCATOR Allocator = pRouter->Allocator;
+    MwsFree(&Allocator, pRouter);
+}
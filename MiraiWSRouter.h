@@ -0,0 +1,88 @@
+#pragma once
+
+#include <Windows.h>
+#include "MiraiWS.h"
+
+EXTERN_C_START
+
+// "/command arg1 arg2" style commands on top of the message callback: pass every event to RouteMiraiWSMessage
+// and the handler of the command the message starts with is called, its arguments split into views of the text.
+// Only the first Plain block is looked at, and a message that is no command is let go after its first byte or so.
+// A router is read only once created, any number of threads and connections may use it at the same time.
+
+// arguments split beyond this many are left in Rest only.
+#define MWS_ROUTER_MAX_ARGS 16
+
+// utf8 bytes inside the received json. Unlike MWS_STRING, not zero-terminated.
+typedef struct
+{
+    LPCSTR Ptr;
+    SIZE_T Len;
+} MWS_TOKEN;
+
+typedef struct
+{
+    UINT RouteIndex;      // in the array passed to CreateMiraiWSRouter
+    UINT EventType;       // MWS_FRIENDMSG, MWS_GROUPMSG, MWS_TEMPMSG or MWS_STRANGERMSG
+    PVOID pInformation;   // of the event, as passed to the callback
+    INT64 SenderID;
+    INT64 GroupID;        // 0 for friend and stranger messages
+    MWS_PERMISSION Permission; // of the sender in the group, MWS_PERMISSION_UNKNOWN for friend and stranger messages
+    const MWS_CHAINVIEW* pChain; // the whole message, for At and other blocks
+    UINT PlainIndex;      // of the Plain block the command is in
+    MWS_TOKEN Command;
+    MWS_TOKEN Rest;       // text after the command with surrounding whitespace cut, for commands taking free text
+    MWS_TOKEN Args[MWS_ROUTER_MAX_ARGS]; // split on whitespace, "double quoted" ones may hold it and are given without quotes
+    UINT ArgCnt;
+} MWS_ROUTE_CONTEXT;
+
+typedef VOID(*MWS_ROUTE_HANDLER)(_In_ PMIRAI_WS pMiraiWS, _In_ const MWS_ROUTE_CONTEXT* pContext, _In_opt_ LPVOID Context);
+
+typedef struct
+{
+    LPCWSTR lpCommand;     // like L"/ban", matched at the start of the first Plain block and followed by whitespace or its end
+    INT64 GroupID;         // the only group the command works in, 0 for everywhere
+    MWS_PERMISSION MinPermission; // least permission of the sender, MWS_PERMISSION_UNKNOWN for anyone. Others work in groups only
+    MWS_ROUTE_HANDLER Handler;
+    LPVOID Context;        // passed to Handler
+} MWS_ROUTE;
+
+typedef enum _MWS_ROUTE_RESULT
+{
+    MWS_ROUTE_NONE = 0,   // no command, or not a message event
+    MWS_ROUTE_DISPATCHED, // the handler was called
+    MWS_ROUTE_DENIED      // a command, but out of its group or above the permission of the sender
+} MWS_ROUTE_RESULT;
+
+typedef struct _MWS_ROUTER MWS_ROUTER, * PMWS_ROUTER;
+
+_Ret_maybenull_
+/// <summary>
+/// Build a router. Several routes may share a command, for different groups or permissions: the first one
+/// in the array that fits the message is taken. The longest command a message starts with wins.
+/// </summary>
+/// <param name="pRoutes">the routes, copied</param>
+/// <param name="cRoutes">how many</param>
+/// <returns>router handle, or NULL with GetLastError set</returns>
+PMWS_ROUTER CreateMiraiWSRouter(_In_reads_(cRoutes) const MWS_ROUTE* pRoutes, _In_ UINT cRoutes);
+
+_Ret_maybenull_
+/// <summary>
+/// Build a router that takes its memory from pAllocator, see CreateMiraiWSRouter.
+/// </summary>
+/// <param name="pAllocator">copied, NULL for the process heap</param>
+PMWS_ROUTER CreateMiraiWSRouterEx(_In_reads_(cRoutes) const MWS_ROUTE* pRoutes, _In_ UINT cRoutes, _In_opt_ const MWS_ALLOCATOR* pAllocator);
+
+/// <summary>
+/// Call the handler of the command a message starts with. Call it from the callback with what it was given.
+/// </summary>
+/// <param name="pRouter">handle returned by CreateMiraiWSRouter</param>
+/// <param name="pMiraiWS">as passed to the callback</param>
+/// <param name="EventType">as passed to the callback</param>
+/// <param name="pInformation">as passed to the callback</param>
+/// <returns>see MWS_ROUTE_RESULT</returns>
+MWS_ROUTE_RESULT RouteMiraiWSMessage(_In_ PMWS_ROUTER pRouter, _In_ PMIRAI_WS pMiraiWS, _In_ UINT EventType, _In_ PVOID pInformation);
+
+void DestroyMiraiWSRouter(_In_ _Frees_ptr_ PMWS_ROUTER pRouter);
+
+EXTERN_C_END
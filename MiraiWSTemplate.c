@@ -0,0 +1,444 @@
+#include <Windows.h>
+#include <strsafe.h>
+#include "MiraiWS.h"
+#include "MiraiWSTemplate.h"
+#include "MiraiWSInternal.h"
+
+// A template is one allocation: the allocator it came from, the MWS_TEMPLATE, its parts, then the constant text.
+// Sending writes the envelope, the filled chain and the closing braces into a buffer on the stack, which only frames
+// larger than it leave.
+
+#define TEMPLATE_STACK_FRAME 2048
+
+typedef struct
+{
+    MWS_ALLOCATOR Allocator;
+    MWS_TEMPLATE Template; // handed out
+} TEMPLATE_BLOCK;
+
+typedef struct
+{
+    LPSTR lpBuffer;
+    SIZE_T cbBuffer;
+    SIZE_T cbNeeded;   // terminator not included
+    BOOL bOverflow;
+} TEMPLATE_OUT;
+
+static void TemplateAppend(_Inout_ TEMPLATE_OUT* pOut, _In_reads_(cbText) LPCSTR lpText, _In_ SIZE_T cbText)
+{
+    // one place is kept for the terminator.
+    if (!pOut->bOverflow && pOut->lpBuffer && pOut->cbBuffer > pOut->cbNeeded + cbText)
+        memcpy(pOut->lpBuffer + pOut->cbNeeded, lpText, cbText);
+    else
+        pOut->bOverflow = TRUE;
+    pOut->cbNeeded += cbText;
+}
+
+/// <summary>
+/// Write a wide string as the utf8 inside of a json string, escaping as it goes. A lone surrogate becomes U+FFFD.
+/// </summary>
+static void TemplateAppendEscaped(_Inout_ TEMPLATE_OUT* pOut, _In_z_ LPCWSTR lpText)
+{
+    static const CHAR HexDigits[] = "0123456789abcdef";
+    CHAR Chunk[256];
+    SIZE_T cbChunk = 0;
+    for (LPCWSTR p = lpText; *p; p++)
+    {
+        // the longest a character can take is 6 bytes, \u001f.
+        if (cbChunk > sizeof(Chunk) - 6)
+        {
+            TemplateAppend(pOut, Chunk, cbChunk);
+            cbChunk = 0;
+        }
+
+        UINT Char = *p;
+        if (Char >= 0xD800 && Char <= 0xDBFF && p[1] >= 0xDC00 && p[1] <= 0xDFFF)
+        {
+            Char = 0x10000 + ((Char - 0xD800) << 10) + (p[1] - 0xDC00);
+            p++;
+        }
+        else if (Char >= 0xD800 && Char <= 0xDFFF)
+            Char = 0xFFFD;
+
+        if (Char == '"' || Char == '\\')
+        {
+            Chunk[cbChunk++] = '\\';
+            Chunk[cbChunk++] = (CHAR)Char;
+        }
+        else if (Char < 0x20)
+        {
+            Chunk[cbChunk++] = '\\';
+            switch (Char)
+            {
+            case '\b': Chunk[cbChunk++] = 'b'; break;
+            case '\f': Chunk[cbChunk++] = 'f'; break;
+            case '\n': Chunk[cbChunk++] = 'n'; break;
+            case '\r': Chunk[cbChunk++] = 'r'; break;
+            case '\t': Chunk[cbChunk++] = 't'; break;
+            default:
+                Chunk[cbChunk++] = 'u';
+                Chunk[cbChunk++] = '0';
+                Chunk[cbChunk++] = '0';
+                Chunk[cbChunk++] = HexDigits[Char >> 4];
+                Chunk[cbChunk++] = HexDigits[Char & 0xF];
+            }
+        }
+        else if (Char < 0x80)
+            Chunk[cbChunk++] = (CHAR)Char;
+        else if (Char < 0x800)
+        {
+            Chunk[cbChunk++] = (CHAR)(0xC0 | (Char >> 6));
+            Chunk[cbChunk++] = (CHAR)(0x80 | (Char & 0x3F));
+        }
+        else if (Char < 0x10000)
+        {
+            Chunk[cbChunk++] = (CHAR)(0xE0 | (Char >> 12));
+            Chunk[cbChunk++] = (CHAR)(0x80 | ((Char >> 6) & 0x3F));
+            Chunk[cbChunk++] = (CHAR)(0x80 | (Char & 0x3F));
+        }
+        else
+        {
+            Chunk[cbChunk++] = (CHAR)(0xF0 | (Char >> 18));
+            Chunk[cbChunk++] = (CHAR)(0x80 | ((Char >> 12) & 0x3F));
+            Chunk[cbChunk++] = (CHAR)(0x80 | ((Char >> 6) & 0x3F));
+            Chunk[cbChunk++] = (CHAR)(0x80 | (Char & 0x3F));
+        }
+    }
+    TemplateAppend(pOut, Chunk, cbChunk);
+}
+
+static BOOL TemplateAppendValue(_Inout_ TEMPLATE_OUT* pOut, _In_ MWS_SLOT_KIND Kind, _In_ const MWS_COMMAND_ARG* pValue)
+{
+    switch (pValue->Type)
+    {
+    case MWS_ARG_INT:
+    {
+        CHAR Digits[24];
+        StringCchPrintfA(Digits, _countof(Digits), "%lld", pValue->Int);
+        TemplateAppend(pOut, Digits, strlen(Digits));
+        return TRUE;
+    }
+    case MWS_ARG_BOOL:
+        if (pValue->Bool)
+            TemplateAppend(pOut, "true", 4);
+        else
+            TemplateAppend(pOut, "false", 5);
+        return TRUE;
+    case MWS_ARG_STR:
+        if (!pValue->Str)
+            return FALSE;
+        if (Kind == MWS_SLOT_VALUE)
+            TemplateAppend(pOut, "\"", 1);
+        TemplateAppendEscaped(pOut, pValue->Str);
+        if (Kind == MWS_SLOT_VALUE)
+            TemplateAppend(pOut, "\"", 1);
+        return TRUE;
+    case MWS_ARG_JSON:
+        if (!pValue->Json)
+            return FALSE;
+        TemplateAppend(pOut, pValue->Json, strlen(pValue->Json));
+        return TRUE;
+    }
+    return FALSE;
+}
+
+static BOOL FillTemplate(_In_ const MWS_TEMPLATE* pTemplate, _In_reads_(ValueCnt) const MWS_COMMAND_ARG* pValues, _In_ UINT ValueCnt, _Inout_ TEMPLATE_OUT* pOut)
+{
+    if (ValueCnt < pTemplate->SlotCnt)
+        return FALSE;
+
+    LPCSTR lpText = pTemplate->lpText;
+    for (UINT i = 0; i < pTemplate->PartCnt; i++)
+    {
+        const MWS_TEMPLATE_PART* pPart = &pTemplate->pParts[i];
+        TemplateAppend(pOut, lpText, pPart->cbText);
+        lpText += pPart->cbText;
+        if (pPart->Slot != MWS_TEMPLATE_END && !TemplateAppendValue(pOut, pPart->Kind, &pValues[pPart->Slot]))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+BOOL FormatMiraiWSTemplate(
+    _In_ const MWS_TEMPLATE* pTemplate,
+    _In_reads_(ValueCnt) const MWS_COMMAND_ARG* pValues,
+    _In_ UINT ValueCnt,
+    _Out_writes_opt_(cbBuffer) LPSTR lpBuffer,
+    _In_ SIZE_T cbBuffer,
+    _Out_opt_ SIZE_T* pcbNeeded)
+{
+    TEMPLATE_OUT Out = { lpBuffer, cbBuffer, 0, FALSE };
+    if (!FillTemplate(pTemplate, pValues, ValueCnt, &Out))
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+    if (pcbNeeded)
+        *pcbNeeded = Out.cbNeeded + 1;
+    if (Out.bOverflow)
+    {
+        SetLastError(ERROR_INSUFFICIENT_BUFFER);
+        return FALSE;
+    }
+    lpBuffer[Out.cbNeeded] = '\0';
+    return TRUE;
+}
+
+/// <summary>
+/// Cut the slots out of a chain. Called once to count, with pParts and lpText NULL, then again to fill them.
+/// </summary>
+/// <returns>FALSE if a {{ starts no valid slot</returns>
+static BOOL SplitTemplate(_In_z_ LPCSTR lpChain, _Out_writes_opt_(*pPartCnt) MWS_TEMPLATE_PART* pParts, _Out_opt_ LPSTR lpText,
+    _Out_ UINT* pPartCnt, _Out_ SIZE_T* pcbText, _Out_ UINT* pSlotCnt)
+{
+    UINT PartCnt = 0, SlotCnt = 0;
+    SIZE_T cbText = 0, cbPart = 0;
+    BOOL bInString = FALSE;
+    for (LPCSTR p = lpChain; *p;)
+    {
+        if (p[0] == '{' && p[1] == '{')
+        {
+            UINT Slot = 0;
+            LPCSTR lpDigit = p + 2;
+            while (*lpDigit >= '0' && *lpDigit <= '9' && Slot < MWS_TEMPLATE_MAX_SLOTS)
+                Slot = Slot * 10 + (*lpDigit++ - '0');
+            if (lpDigit == p + 2 || Slot >= MWS_TEMPLATE_MAX_SLOTS || lpDigit[0] != '}' || lpDigit[1] != '}')
+                return FALSE;
+
+            if (pParts)
+            {
+                pParts[PartCnt].cbText = (UINT)cbPart;
+                pParts[PartCnt].Slot = Slot;
+                pParts[PartCnt].Kind = bInString ? MWS_SLOT_STRING : MWS_SLOT_VALUE;
+            }
+            PartCnt++;
+            SlotCnt = max(SlotCnt, Slot + 1);
+            cbPart = 0;
+            p = lpDigit + 2;
+            continue;
+        }
+
+        if (*p == '"')
+            bInString = !bInString;
+        else if (*p == '\\' && bInString && p[1])
+        {
+            if (lpText)
+                lpText[cbText] = *p;
+            cbText++;
+            cbPart++;
+            p++;
+        }
+        if (lpText)
+            lpText[cbText] = *p;
+        cbText++;
+        cbPart++;
+        p++;
+    }
+
+    if (pParts)
+    {
+        pParts[PartCnt].cbText = (UINT)cbPart;
+        pParts[PartCnt].Slot = MWS_TEMPLATE_END;
+        pParts[PartCnt].Kind = MWS_SLOT_VALUE;
+    }
+    *pPartCnt = PartCnt + 1;
+    *pcbText = cbText;
+    *pSlotCnt = SlotCnt;
+    return TRUE;
+}
+
+_Ret_maybenull_
+MWS_TEMPLATE* CreateMiraiWSTemplate(_In_z_ LPCSTR lpChain)
+{
+    return CreateMiraiWSTemplateEx(lpChain, NULL);
+}
+
+_Ret_maybenull_
+MWS_TEMPLATE* CreateMiraiWSTemplateEx(_In_z_ LPCSTR lpChain, _In_opt_ const MWS_ALLOCATOR* pAllocator)
+{
+    MWS_ALLOCATOR Allocator = pAllocator ? *pAllocator : MwsHeapAllocator;
+    UINT PartCnt, SlotCnt;
+    SIZE_T cbText;
+    if (!lpChain || !SplitTemplate(lpChain, NULL, NULL, &PartCnt, &cbText, &SlotCnt) || cbText > MAXUINT)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return NULL;
+    }
+
+    TEMPLATE_BLOCK* pBlock = NULL;
+    MWS_TEMPLATE* pTemplate = NULL;
+    LPSTR lpProbe = NULL;
+    yyjson_doc* ProbeDoc = NULL;
+    BOOL bSuccess = FALSE;
+    __try
+    {
+        pBlock = MwsAlloc(&Allocator, 0, sizeof(TEMPLATE_BLOCK) + PartCnt * sizeof(MWS_TEMPLATE_PART) + cbText + 1);
+        if (!pBlock)
+        {
+            SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+            __leave;
+        }
+        pBlock->Allocator = Allocator;
+        pTemplate = &pBlock->Template;
+        MWS_TEMPLATE_PART* pParts = (MWS_TEMPLATE_PART*)(pBlock + 1);
+        LPSTR lpText = (LPSTR)(pParts + PartCnt);
+        SplitTemplate(lpChain, pParts, lpText, &PartCnt, &cbText, &SlotCnt);
+        lpText[cbText] = '\0';
+        pTemplate->lpText = lpText;
+        pTemplate->pParts = pParts;
+        pTemplate->PartCnt = PartCnt;
+        pTemplate->SlotCnt = SlotCnt;
+
+        // it has to be an array of blocks with every slot holding 0, a number where a value goes and text inside strings.
+        MWS_COMMAND_ARG Zeros[MWS_TEMPLATE_MAX_SLOTS];
+        for (UINT i = 0; i < SlotCnt; i++)
+        {
+            Zeros[i].Key = NULL;
+            Zeros[i].Type = MWS_ARG_INT;
+            Zeros[i].Int = 0;
+        }
+        SIZE_T cbProbe = cbText + PartCnt + 1;
+        lpProbe = MwsAlloc(&Allocator, 0, cbProbe);
+        if (!lpProbe)
+        {
+            SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+            __leave;
+        }
+        FormatMiraiWSTemplate(pTemplate, Zeros, SlotCnt, lpProbe, cbProbe, &cbProbe);
+
+        yyjson_alc Alc = MwsJsonAlc(&Allocator);
+        ProbeDoc = yyjson_read_opts(lpProbe, cbProbe - 1, 0, &Alc, NULL);
+        yyjson_val* Chain = yyjson_doc_get_root(ProbeDoc);
+        if (!yyjson_is_arr(Chain))
+        {
+            SetLastError(ERROR_INVALID_PARAMETER);
+            __leave;
+        }
+        size_t i, MaxNode;
+        yyjson_val* Block;
+        yyjson_arr_foreach(Chain, i, MaxNode, Block) {
+            if (!yyjson_is_obj(Block))
+            {
+                SetLastError(ERROR_INVALID_PARAMETER);
+                __leave;
+            }
+        }
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        if (ProbeDoc) yyjson_doc_free(ProbeDoc);
+        if (lpProbe) MwsFree(&Allocator, lpProbe);
+        if (!bSuccess && pBlock)
+        {
+            MwsFree(&Allocator, pBlock);
+            pTemplate = NULL;
+        }
+    }
+    return pTemplate;
+}
+
+void DestroyMiraiWSTemplate(_In_ _Frees_ptr_ MWS_TEMPLATE* pTemplate)
+{
+    TEMPLATE_BLOCK* pBlock = CONTAINING_RECORD(pTemplate, TEMPLATE_BLOCK, Template);
+    MWS_ALLOCATOR Allocator = pBlock->Allocator;
+    MwsFree(&Allocator, pBlock);
+}
+
+static BOOL SendTemplate(
+    _In_ PMIRAI_WS pMiraiWS,
+    _In_z_ LPCSTR lpCommand,
+    _In_ INT64 Target,
+    _In_ const MWS_TEMPLATE* pTemplate,
+    _In_reads_(ValueCnt) const MWS_COMMAND_ARG* pValues,
+    _In_ UINT ValueCnt,
+    _In_opt_ SEND_MSG_CALLBACK Callback,
+    _In_opt_ LPVOID Context)
+{
+    if (ValueCnt < pTemplate->SlotCnt)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    BOOL bSuccess = FALSE;
+    int AsyncSlot;
+    INT64 AsyncID = GetAsyncCallID(ASYNC_SENDMSG, FindMiraiWSCommand(lpCommand, NULL), Callback, Context, &AsyncSlot);
+    if (!AsyncID)
+        return FALSE;
+
+    CHAR StackFrame[TEMPLATE_STACK_FRAME];
+    LPSTR lpFrame = StackFrame;
+    __try
+    {
+        LONGLONG TraceStart = MWS_TRACING() ? ReadPerfClock() : 0;
+
+        // what CreateWebsockAdapterJson and yyjson would write, and the chain goes last so it is written in place.
+        SIZE_T cbHead;
+        StringCchPrintfA(StackFrame, sizeof(StackFrame),
+            "{\"syncId\":%lld,\"command\":\"%s\",\"subCommand\":null,\"content\":{\"target\":%lld,\"messageChain\":", AsyncID, lpCommand, Target);
+        cbHead = strlen(StackFrame);
+
+        // two places are kept for the closing braces, the first one takes the place of the terminator.
+        SIZE_T cbChain;
+        TEMPLATE_OUT Out = { StackFrame + cbHead, sizeof(StackFrame) - cbHead - 1, 0, FALSE };
+        if (!FillTemplate(pTemplate, pValues, ValueCnt, &Out))
+        {
+            SetLastError(ERROR_INVALID_PARAMETER);
+            __leave;
+        }
+        cbChain = Out.cbNeeded;
+        if (Out.bOverflow)
+        {
+            lpFrame = MwsAlloc(&pMiraiWS->Allocator, 0, cbHead + cbChain + 2);
+            if (!lpFrame)
+            {
+                SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+                __leave;
+            }
+            memcpy(lpFrame, StackFrame, cbHead);
+            TEMPLATE_OUT Retry = { lpFrame + cbHead, cbChain + 1, 0, FALSE };
+            FillTemplate(pTemplate, pValues, ValueCnt, &Retry);
+        }
+        lpFrame[cbHead + cbChain] = '}';
+        lpFrame[cbHead + cbChain + 1] = '}';
+
+        bSuccess = SendCommandFrame(pMiraiWS, AsyncID, AsyncSlot, lpFrame, cbHead + cbChain + 2, TraceStart);
+    }
+    __finally
+    {
+        if (lpFrame && lpFrame != StackFrame)
+        {
+            MwsFree(&pMiraiWS->Allocator, lpFrame);
+        }
+        if (!bSuccess)
+        {
+            RemoveAsyncCallID(AsyncID, NULL, NULL, NULL, NULL);
+        }
+    }
+    return bSuccess;
+}
+
+BOOL SendFriendTemplateAsync(
+    _In_ PMIRAI_WS pMiraiWS,
+    _In_ INT64 Target,
+    _In_ const MWS_TEMPLATE* pTemplate,
+    _In_reads_(ValueCnt) const MWS_COMMAND_ARG* pValues,
+    _In_ UINT ValueCnt,
+    _In_opt_ SEND_MSG_CALLBACK Callback,
+    _In_opt_ LPVOID Context)
+{
+    return SendTemplate(pMiraiWS, "sendFriendMessage", Target, pTemplate, pValues, ValueCnt, Callback, Context);
+}
+
+BOOL SendGroupTemplateAsync(
+    _In_ PMIRAI_WS pMiraiWS,
+    _In_ INT64 Target,
+    _In_ const MWS_TEMPLATE* pTemplate,
+    _In_reads_(ValueCnt) const MWS_COMMAND_ARG* pValues,
+    _In_ UINT ValueCnt,
+    _In_opt_ SEND_MSG_CALLBACK Callback,
+    _In_opt_ LPVOID Context)
+{
+    return SendTemplate(pMiraiWS, "sendGroupMessage", Target, pTemplate, pValues, ValueCnt, Callback, Context);
+}
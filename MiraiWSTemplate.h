@@ -0,0 +1,114 @@
+#pragma once
+
+#include <Windows.h>
+#include "MiraiWS.h"
+
+EXTERN_C_START
+
+// Messages sent over and over with only a few values changing, like "@someone your score is 42": the message chain
+// is written once as json with slots, {{0}} to {{63}}, and every send copies the constant parts as they are and writes
+// the escaped values between them, with no yyjson document and no allocation for frames up to a few KB.
+//
+//   [{"type":"At","target":{{0}}},{"type":"Plain","text":" your score is {{1}}"}]
+//
+// A slot inside a json string is filled with the escaped text of its value, elsewhere with a whole json value.
+// Build a template at run time with CreateMiraiWSTemplate, or at compile time with MiraiWSTemplate.hpp from C++.
+// A template is read only, any number of threads and connections may send it at the same time.
+
+#define MWS_TEMPLATE_MAX_SLOTS 64
+
+// Slot of the last part, which has none.
+#define MWS_TEMPLATE_END MAXUINT
+
+typedef enum _MWS_SLOT_KIND
+{
+    MWS_SLOT_VALUE = 1, // a json value, like the target of an At. Strings are quoted
+    MWS_SLOT_STRING     // inside a json string, like the text of a Plain block. Numbers and booleans are written as text
+} MWS_SLOT_KIND;
+
+typedef struct
+{
+    UINT cbText;        // constant bytes of the part, following those of the previous part in lpText
+    UINT Slot;          // the value written after them, MWS_TEMPLATE_END for the last part
+    MWS_SLOT_KIND Kind;
+} MWS_TEMPLATE_PART;
+
+typedef struct
+{
+    LPCSTR lpText;      // the constant parts one after another, utf8 json with the slots taken out
+    const MWS_TEMPLATE_PART* pParts;
+    UINT PartCnt;       // the last one has no slot
+    UINT SlotCnt;       // values a send needs, the highest slot plus 1
+} MWS_TEMPLATE;
+
+_Ret_maybenull_
+/// <summary>
+/// Split a message chain with slots into its constant parts, and check it is a json array once the slots are filled.
+/// Write a "{{" that is text of a string as "{\u007b", it would be taken as a slot.
+/// </summary>
+/// <param name="lpChain">utf8 json array of message blocks with {{N}} slots</param>
+/// <returns>template, or NULL with GetLastError set</returns>
+MWS_TEMPLATE* CreateMiraiWSTemplate(_In_z_ LPCSTR lpChain);
+
+_Ret_maybenull_
+/// <summary>
+/// Split a message chain with slots into a template that takes its memory from pAllocator, see CreateMiraiWSTemplate.
+/// </summary>
+/// <param name="pAllocator">copied, NULL for the process heap</param>
+MWS_TEMPLATE* CreateMiraiWSTemplateEx(_In_z_ LPCSTR lpChain, _In_opt_ const MWS_ALLOCATOR* pAllocator);
+
+// only for templates from CreateMiraiWSTemplate and CreateMiraiWSTemplateEx.
+void DestroyMiraiWSTemplate(_In_ _Frees_ptr_ MWS_TEMPLATE* pTemplate);
+
+/// <summary>
+/// Fill the slots of a template into the json text of a message chain.
+/// </summary>
+/// <param name="pTemplate">from CreateMiraiWSTemplate or MiraiWSTemplate.hpp</param>
+/// <param name="pValues">value of each slot, their Key is not used. MWS_ARG_JSON is put in as it is, in strings too. MWS_ARG_CHAIN is not taken</param>
+/// <param name="ValueCnt">at least SlotCnt of the template</param>
+/// <param name="lpBuffer">receives the zero-terminated utf8 json</param>
+/// <param name="cbBuffer">size of lpBuffer</param>
+/// <param name="pcbNeeded">optional, receives the size the json needs, terminator included</param>
+/// <returns>TRUE if the json fit, FALSE with ERROR_INSUFFICIENT_BUFFER if not or ERROR_INVALID_PARAMETER for missing values</returns>
+BOOL FormatMiraiWSTemplate(
+    _In_ const MWS_TEMPLATE* pTemplate,
+    _In_reads_(ValueCnt) const MWS_COMMAND_ARG* pValues,
+    _In_ UINT ValueCnt,
+    _Out_writes_opt_(cbBuffer) LPSTR lpBuffer,
+    _In_ SIZE_T cbBuffer,
+    _Out_opt_ SIZE_T* pcbNeeded);
+
+/// <summary>
+/// Send a template to a friend, like SendFriendMsgAsync
+/// </summary>
+/// <param name="pMiraiWS">handle created by CreateMiraiWS</param>
+/// <param name="Target">target QQ id the message will be sent to</param>
+/// <param name="pTemplate">the message to send</param>
+/// <param name="pValues">value of each slot, see FormatMiraiWSTemplate</param>
+/// <param name="ValueCnt">at least SlotCnt of the template</param>
+/// <param name="Callback">An optional callback to notify the sending result</param>
+/// <param name="Context">user defined context to pass to Callback</param>
+/// <returns>TRUE on success, callback will be called, if given, when sending finished.</returns>
+BOOL SendFriendTemplateAsync(
+    _In_ PMIRAI_WS pMiraiWS,
+    _In_ INT64 Target,
+    _In_ const MWS_TEMPLATE* pTemplate,
+    _In_reads_(ValueCnt) const MWS_COMMAND_ARG* pValues,
+    _In_ UINT ValueCnt,
+    _In_opt_ SEND_MSG_CALLBACK Callback,
+    _In_opt_ LPVOID Context);
+
+/// <summary>
+/// Send a template to a group, like SendGroupMsgAsync
+/// </summary>
+/// <param name="Target">target Group id the message will be sent to</param>
+BOOL SendGroupTemplateAsync(
+    _In_ PMIRAI_WS pMiraiWS,
+    _In_ INT64 Target,
+    _In_ const MWS_TEMPLATE* pTemplate,
+    _In_reads_(ValueCnt) const MWS_COMMAND_ARG* pValues,
+    _In_ UINT ValueCnt,
+    _In_opt_ SEND_MSG_CALLBACK Callback,
+    _In_opt_ LPVOID Context);
+
+EXTERN_C_END
@@ -0,0 +1,180 @@
+#pragma once
+
+// MWS_TEMPLATE built by the compiler (C++17): the slots are cut out of the chain at compile time, so a template costs
+// nothing before its first send, and a chain with a bad slot or an unclosed string or bracket does not compile.
+//
+//   static constexpr MiraiWS::Template Score(R"([{"type":"At","target":{{0}}},{"type":"Plain","text":" your score is {{1}}"}])");
+//   MiraiWS::SendGroupTemplate(pMiraiWS, GroupID, Score, nullptr, nullptr, SenderID, Points);
+//
+// The chain is checked for its slots and brackets only, unlike CreateMiraiWSTemplate which parses it.
+
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+#include <Windows.h>
+#include "MiraiWSTemplate.h"
+
+namespace MiraiWS
+{
+    template <size_t N>
+    class Template
+    {
+    public:
+        // a slot takes at least 5 bytes, {{0}}.
+        static constexpr size_t MaxParts = (N - 1) / 5 + 1;
+
+        constexpr explicit Template(const char (&Chain)[N]) : m_Text(), m_Parts(), m_Template()
+        {
+            // every part needs a valid Kind for the result to be a constant, the unused ones too.
+            for (MWS_TEMPLATE_PART& Part : m_Parts)
+                Part = { 0, MWS_TEMPLATE_END, MWS_SLOT_VALUE };
+
+            char Nesting[64] = {};
+            size_t Depth = 0, cbText = 0, cbPart = 0;
+            UINT PartCnt = 0, SlotCnt = 0;
+            bool bInString = false, bStarted = false;
+            for (size_t i = 0; i < N - 1;)
+            {
+                char c = Chain[i];
+                if (c == '{' && Chain[i + 1] == '{')
+                {
+                    size_t j = i + 2;
+                    UINT Slot = 0;
+                    while (Chain[j] >= '0' && Chain[j] <= '9' && Slot < MWS_TEMPLATE_MAX_SLOTS)
+                        Slot = Slot * 10 + (Chain[j++] - '0');
+                    if (j == i + 2 || Slot >= MWS_TEMPLATE_MAX_SLOTS || Chain[j] != '}' || Chain[j + 1] != '}')
+                        throw std::invalid_argument("a slot is {{0}} to {{63}}");
+
+                    m_Parts[PartCnt].cbText = (UINT)cbPart;
+                    m_Parts[PartCnt].Slot = Slot;
+                    m_Parts[PartCnt].Kind = bInString ? MWS_SLOT_STRING : MWS_SLOT_VALUE;
+                    PartCnt++;
+                    SlotCnt = Slot + 1 > SlotCnt ? Slot + 1 : SlotCnt;
+                    cbPart = 0;
+                    i = j + 2;
+                    continue;
+                }
+
+                if (bInString)
+                {
+                    if (c == '"')
+                        bInString = false;
+                    else if (c == '\\' && i + 1 < N - 1)
+                    {
+                        m_Text[cbText++] = c;
+                        cbPart++;
+                        c = Chain[++i];
+                    }
+                }
+                else if (c == '"')
+                    bInString = true;
+                else if (c == '[' || c == '{')
+                {
+                    if (!bStarted && c != '[')
+                        throw std::invalid_argument("a chain is a json array");
+                    if (Depth == sizeof(Nesting))
+                        throw std::invalid_argument("the chain nests too deep");
+                    Nesting[Depth++] = c == '[' ? ']' : '}';
+                    bStarted = true;
+                }
+                else if (c == ']' || c == '}')
+                {
+                    if (!Depth || Nesting[--Depth] != c)
+                        throw std::invalid_argument("a bracket of the chain is not matched");
+                }
+                else if (c != ' ' && c != '\t' && c != '\r' && c != '\n' && !Depth)
+                    throw std::invalid_argument("a chain is a json array");
+
+                m_Text[cbText++] = c;
+                cbPart++;
+                i++;
+            }
+            if (bInString || Depth || !bStarted)
+                throw std::invalid_argument("the chain is not closed");
+
+            m_Parts[PartCnt].cbText = (UINT)cbPart;
+            m_Parts[PartCnt].Slot = MWS_TEMPLATE_END;
+            m_Parts[PartCnt].Kind = MWS_SLOT_VALUE;
+            m_Template.lpText = m_Text;
+            m_Template.pParts = m_Parts;
+            m_Template.PartCnt = PartCnt + 1;
+            m_Template.SlotCnt = SlotCnt;
+        }
+
+        // the template points into itself.
+        Template(const Template&) = delete;
+        Template& operator=(const Template&) = delete;
+
+        constexpr operator const MWS_TEMPLATE*() const noexcept { return &m_Template; }
+        constexpr UINT SlotCount() const noexcept { return m_Template.SlotCnt; }
+
+    private:
+        char m_Text[N];
+        MWS_TEMPLATE_PART m_Parts[MaxParts];
+        MWS_TEMPLATE m_Template;
+    };
+
+    // the value of a slot, MWS_COMMAND_ARG without a Key.
+
+    template <class T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>, int> = 0>
+    inline MWS_COMMAND_ARG SlotValue(T Value) noexcept
+    {
+        MWS_COMMAND_ARG Arg = {};
+        Arg.Type = MWS_ARG_INT;
+        Arg.Int = (INT64)Value;
+        return Arg;
+    }
+
+    inline MWS_COMMAND_ARG SlotValue(bool Value) noexcept
+    {
+        MWS_COMMAND_ARG Arg = {};
+        Arg.Type = MWS_ARG_BOOL;
+        Arg.Bool = Value;
+        return Arg;
+    }
+
+    inline MWS_COMMAND_ARG SlotValue(LPCWSTR Value) noexcept
+    {
+        MWS_COMMAND_ARG Arg = {};
+        Arg.Type = MWS_ARG_STR;
+        Arg.Str = Value;
+        return Arg;
+    }
+
+    inline MWS_COMMAND_ARG SlotValue(const MWS_COMMAND_ARG& Value) noexcept
+    {
+        return Value;
+    }
+
+    // anything else given as a pointer would turn into bool and be sent as true. Strings are LPCWSTR,
+    // utf8 text goes in quoted with SlotJson.
+    MWS_COMMAND_ARG SlotValue(const char*) = delete;
+    MWS_COMMAND_ARG SlotValue(std::nullptr_t) = delete;
+    template <class T>
+    MWS_COMMAND_ARG SlotValue(const T*) = delete;
+
+    // utf8 json put in as it is.
+    inline MWS_COMMAND_ARG SlotJson(LPCSTR Value) noexcept
+    {
+        MWS_COMMAND_ARG Arg = {};
+        Arg.Type = MWS_ARG_JSON;
+        Arg.Json = Value;
+        return Arg;
+    }
+
+    template <class... T>
+    inline BOOL SendFriendTemplate(PMIRAI_WS pMiraiWS, INT64 Target, const MWS_TEMPLATE* pTemplate,
+        SEND_MSG_CALLBACK Callback, LPVOID Context, const T&... Values)
+    {
+        MWS_COMMAND_ARG Args[sizeof...(T) + 1] = { SlotValue(Values)... };
+        return SendFriendTemplateAsync(pMiraiWS, Target, pTemplate, Args, (UINT)sizeof...(T), Callback, Context);
+    }
+
+    template <class... T>
+    inline BOOL SendGroupTemplate(PMIRAI_WS pMiraiWS, INT64 Target, const MWS_TEMPLATE* pTemplate,
+        SEND_MSG_CALLBACK Callback, LPVOID Context, const T&... Values)
+    {
+        MWS_COMMAND_ARG Args[sizeof...(T) + 1] = { SlotValue(Values)... };
+        return SendGroupTemplateAsync(pMiraiWS, Target, pTemplate, Args, (UINT)sizeof...(T), Callback, Context);
+    }
+}
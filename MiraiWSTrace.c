@@ -0,0 +1,240 @@
+#include <Windows.h>
+#include <strsafe.h>
+#include "MiraiWS.h"
+#include "MiraiWSTrace.h"
+#include "MiraiWSInternal.h"
+
+typedef struct
+{
+    LONGLONG Start;
+    LONGLONG End;
+    PMIRAI_WS pMiraiWS;
+    INT64 SyncID;
+    UINT16 Span;      // MWS_SPAN
+    UINT16 EventType; // MWSBIN_EVENT_TYPE
+} TRACE_SPAN;
+
+// Written by its thread only. Buffers are never freed: threadpool threads come back,
+// and a thread may still be finishing a span while StopMiraiWSTrace reads its buffer.
+typedef struct _TRACE_BUFFER TRACE_BUFFER;
+typedef struct _TRACE_BUFFER
+{
+    TRACE_BUFFER* pNext; // every buffer ever made
+    DWORD ThreadID;
+    DWORD Capacity;
+    volatile LONG Generation; // of the trace the spans belong to
+    volatile LONG Count;
+    volatile LONG64 Dropped;
+    TRACE_SPAN Spans[ANYSIZE_ARRAY];
+} TRACE_BUFFER;
+
+typedef struct
+{
+    HANDLE hFile;
+    SIZE_T cbUsed;
+    BOOL bError;
+    CHAR Buffer[1 << 16];
+} TRACE_WRITER;
+
+volatile LONG MwsTraceOn = FALSE;
+static volatile LONG TraceGeneration = 0;
+static DWORD TraceCapacity;
+static LONGLONG TraceBase;
+static TRACE_BUFFER* volatile TraceBuffers = NULL;
+static __declspec(thread) TRACE_BUFFER* ThreadBuffer = NULL;
+
+static const LPCSTR SpanNames[MWS_SPAN_COUNT] = {
+    "socket read",
+    "frame reassembly",
+    "json parse",
+    "dispatch",
+    "event",
+    "chain decode",
+    "user callback",
+    "serialize",
+    "send"
+};
+
+_Ret_maybenull_
+static TRACE_BUFFER* GetThreadBuffer()
+{
+    LONG Generation = ReadAcquire(&TraceGeneration);
+    TRACE_BUFFER* pBuffer = ThreadBuffer;
+    if (pBuffer && pBuffer->Generation == Generation)
+        return pBuffer;
+
+    // first span of this thread in a new trace, the previous one was written out already.
+    if (pBuffer && pBuffer->Capacity >= TraceCapacity)
+    {
+        pBuffer->Count = 0;
+        pBuffer->Dropped = 0;
+        WriteRelease(&pBuffer->Generation, Generation);
+        return pBuffer;
+    }
+
+    // too small or none yet. An old buffer stays listed, with a generation nobody reads.
+    pBuffer = MwsAlloc(&MwsHeapAllocator, HEAP_ZERO_MEMORY, FIELD_OFFSET(TRACE_BUFFER, Spans) + (SIZE_T)TraceCapacity * sizeof(TRACE_SPAN));
+    if (!pBuffer)
+        return NULL;
+    pBuffer->ThreadID = GetCurrentThreadId();
+    pBuffer->Capacity = TraceCapacity;
+    pBuffer->Generation = Generation;
+
+    TRACE_BUFFER* pHead;
+    do
+    {
+        pHead = ReadPointerAcquire((PVOID volatile*)&TraceBuffers);
+        pBuffer->pNext = pHead;
+    } while (InterlockedCompareExchangePointer((PVOID volatile*)&TraceBuffers, pBuffer, pHead) != pHead);
+
+    ThreadBuffer = pBuffer;
+    return pBuffer;
+}
+
+void TraceSpan(_In_ MWS_SPAN Span, _In_opt_ PMIRAI_WS pMiraiWS, _In_ LONGLONG Start, _In_ INT64 SyncID, _In_ MWSBIN_EVENT_TYPE EventType)
+{
+    LONGLONG End = ReadPerfClock();
+    TRACE_BUFFER* pBuffer = GetThreadBuffer();
+    if (!pBuffer)
+        return;
+
+    LONG Index = pBuffer->Count;
+    if ((DWORD)Index >= pBuffer->Capacity)
+    {
+        WriteNoFence64(&pBuffer->Dropped, pBuffer->Dropped + 1);
+        return;
+    }
+
+    TRACE_SPAN* pSpan = &pBuffer->Spans[Index];
+    pSpan->Start = Start;
+    pSpan->End = End;
+    pSpan->pMiraiWS = pMiraiWS;
+    pSpan->SyncID = SyncID;
+    pSpan->Span = (UINT16)Span;
+    pSpan->EventType = (UINT16)EventType;
+
+    // StopMiraiWSTrace only reads spans below Count.
+    WriteRelease(&pBuffer->Count, Index + 1);
+}
+
+BOOL StartMiraiWSTrace(_In_ DWORD MaxSpansPerThread)
+{
+    if (ReadAcquire(&MwsTraceOn))
+    {
+        SetLastError(ERROR_INVALID_STATE);
+        return FALSE;
+    }
+    if (MaxSpansPerThread == 0)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    TraceCapacity = MaxSpansPerThread;
+    TraceBase = ReadPerfClock();
+    InterlockedIncrement(&TraceGeneration);
+    InterlockedExchange(&MwsTraceOn, TRUE);
+    return TRUE;
+}
+
+static void FlushTrace(_Inout_ TRACE_WRITER* pWriter)
+{
+    DWORD dwWritten;
+    if (!pWriter->bError && pWriter->cbUsed &&
+        !WriteFile(pWriter->hFile, pWriter->Buffer, (DWORD)pWriter->cbUsed, &dwWritten, NULL))
+        pWriter->bError = TRUE;
+    pWriter->cbUsed = 0;
+}
+
+static void WriteTrace(_Inout_ TRACE_WRITER* pWriter, _In_z_ LPCSTR lpText)
+{
+    SIZE_T cbText = strlen(lpText);
+    if (pWriter->cbUsed + cbText > sizeof(pWriter->Buffer))
+        FlushTrace(pWriter);
+    memcpy(pWriter->Buffer + pWriter->cbUsed, lpText, cbText);
+    pWriter->cbUsed += cbText;
+}
+
+static void WriteSpan(_Inout_ TRACE_WRITER* pWriter, _In_ const TRACE_SPAN* pSpan, _In_ DWORD ThreadID, _In_ LONGLONG Frequency, _In_ BOOL bFirst)
+{
+    CHAR Line[512];
+    CHAR Args[192] = "";
+    double Ts = (double)(pSpan->Start - TraceBase) * 1e6 / Frequency;
+    double Dur = (double)(pSpan->End - pSpan->Start) * 1e6 / Frequency;
+    LPCSTR lpEventName = MwsBinEventTypeName((MWSBIN_EVENT_TYPE)pSpan->EventType);
+
+    if (pSpan->pMiraiWS)
+        StringCchPrintfA(Args, _countof(Args), "\"conn\":\"%p\"", pSpan->pMiraiWS);
+    if (pSpan->SyncID)
+        StringCchPrintfA(Args + strlen(Args), _countof(Args) - strlen(Args), "%s\"syncId\":%lld", Args[0] ? "," : "", pSpan->SyncID);
+    if (lpEventName)
+        StringCchPrintfA(Args + strlen(Args), _countof(Args) - strlen(Args), "%s\"event\":\"%s\"", Args[0] ? "," : "", lpEventName);
+
+    StringCchPrintfA(Line, _countof(Line),
+        "%s\n{\"name\":\"%s\",\"cat\":\"miraiws\",\"ph\":\"X\",\"pid\":%lu,\"tid\":%lu,\"ts\":%.3f,\"dur\":%.3f,\"args\":{%s}}",
+        bFirst ? "" : ",", SpanNames[pSpan->Span], GetCurrentProcessId(), ThreadID, Ts, Dur, Args);
+    WriteTrace(pWriter, Line);
+}
+
+BOOL StopMiraiWSTrace(_In_z_ LPCWSTR lpFileName, _Out_opt_ INT64* pDroppedSpans)
+{
+    if (pDroppedSpans)
+        *pDroppedSpans = 0;
+    if (!InterlockedExchange(&MwsTraceOn, FALSE))
+    {
+        SetLastError(ERROR_INVALID_STATE);
+        return FALSE;
+    }
+
+    BOOL bSuccess = FALSE;
+    TRACE_WRITER* pWriter = MwsAlloc(&MwsHeapAllocator, 0, sizeof(TRACE_WRITER));
+    if (!pWriter)
+        return FALSE;
+    pWriter->cbUsed = 0;
+    pWriter->bError = FALSE;
+    pWriter->hFile = CreateFileW(lpFileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    __try
+    {
+        if (pWriter->hFile == INVALID_HANDLE_VALUE)
+            __leave;
+
+        LARGE_INTEGER Frequency;
+        QueryPerformanceFrequency(&Frequency);
+        LONG Generation = ReadAcquire(&TraceGeneration);
+        INT64 Dropped = 0;
+        BOOL bFirst = TRUE;
+
+        WriteTrace(pWriter, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+        for (TRACE_BUFFER* pBuffer = ReadPointerAcquire((PVOID volatile*)&TraceBuffers); pBuffer; pBuffer = pBuffer->pNext)
+        {
+            if (ReadAcquire(&pBuffer->Generation) != Generation)
+                continue;
+
+            LONG Count = ReadAcquire(&pBuffer->Count);
+            for (LONG i = 0; i < Count; i++)
+            {
+                WriteSpan(pWriter, &pBuffer->Spans[i], pBuffer->ThreadID, Frequency.QuadPart, bFirst);
+                bFirst = FALSE;
+            }
+            Dropped += ReadNoFence64(&pBuffer->Dropped);
+        }
+        WriteTrace(pWriter, "\n]}\n");
+        FlushTrace(pWriter);
+        if (pWriter->bError)
+            __leave;
+
+        if (pDroppedSpans)
+            *pDroppedSpans = Dropped;
+        bSuccess = TRUE;
+    }
+    __finally
+    {
+        DWORD dwError = GetLastError();
+        if (pWriter->hFile != INVALID_HANDLE_VALUE)
+            CloseHandle(pWriter->hFile);
+        MwsFree(&MwsHeapAllocator, pWriter);
+        SetLastError(dwError);
+    }
+    return bSuccess;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <Windows.h>
+
+EXTERN_C_START
+
+// Opt-in tracing of the hot path of every connection in the process.
+//
+// While tracing, each thread records spans (socket read, frame reassembly, json parse, event dispatch,
+// chain decode, user callback, serialize, send) into a buffer of its own, no locks are taken.
+// StopMiraiWSTrace writes them as a Chrome trace json file, open it in chrome://tracing or ui.perfetto.dev.
+// Spans carry the connection, syncId and event type they belong to, where one applies.
+//
+// When tracing is off every span costs a check of one global flag.
+
+/// <summary>
+/// Start recording spans. Start and stop must not be called from several threads at once.
+/// </summary>
+/// <param name="MaxSpansPerThread">spans kept per thread, later ones are dropped and counted</param>
+/// <returns>return TRUE on success, FALSE with ERROR_INVALID_STATE if already tracing</returns>
+BOOL StartMiraiWSTrace(_In_ DWORD MaxSpansPerThread);
+
+/// <summary>
+/// Stop recording and write what was recorded to a file.
+/// </summary>
+/// <param name="lpFileName">file to write the Chrome trace json to, replaced if it exists</param>
+/// <param name="pDroppedSpans">optional, receives the number of spans that did not fit into thread buffers</param>
+/// <returns>return TRUE on success</returns>
+BOOL StopMiraiWSTrace(_In_z_ LPCWSTR lpFileName, _Out_opt_ INT64* pDroppedSpans);
+
+EXTERN_C_END
@@ -0,0 +1,341 @@
+// Benchmarks of the stages a frame and a request go through, driven one at a time without a connection:
+// json parse and HandleJsonMessage on a corpus of frames, EventsUnpacker for every event type,
+// GetMessageChainJson with yyjson_mut_write for typical chains, and syncId allocation from several threads.
+//
+// Every result is one line of json on stdout, to be diffed between runs:
+//   {"bench":"handle/GroupMessage","ops":200000,"ns_per_op":812.4,"allocs_per_op":9.00,"heap_allocs_per_op":0.01,"bytes_per_op":402.0}
+// allocations are the ones made through MwsAlloc and MwsJsonAlc (see MiraiWSInternal.h),
+// heap allocations the part of them not served from a slab.
+
+#include <Windows.h>
+#include <stdio.h>
+#include "../MiraiWS.h"
+#include "../MiraiWSInternal.h"
+#include "../yyjson.h"
+
+#define ITERATIONS 200000
+#define EVENT_ITERATIONS 20000
+#define ASYNC_ITERATIONS 100000 // per thread
+#define BATCH 256               // documents parsed ahead of HandleJsonMessage, which frees them
+
+typedef struct
+{
+    LPCSTR lpName;
+    LPCSTR lpJson;
+} BENCH_FRAME;
+
+#define GROUP_SENDER \
+    "\"sender\":{\"id\":123456789,\"memberName\":\"someone\",\"specialTitle\":\"\",\"permission\":\"MEMBER\"," \
+    "\"joinTimestamp\":1600000000,\"lastSpeakTimestamp\":1650000000,\"muteTimeRemaining\":0," \
+    "\"group\":{\"id\":987654321,\"name\":\"test group\",\"permission\":\"ADMINISTRATOR\"}}"
+
+#define GROUP_MEMBER(Field, ID, Name, Permission) \
+    "\"" Field "\":{\"id\":" ID ",\"memberName\":\"" Name "\",\"permission\":\"" Permission "\"," \
+    "\"group\":{\"id\":987654321,\"name\":\"test group\",\"permission\":\"ADMINISTRATOR\"}}"
+
+// one object that passes for a friend, a member, a group or a client, so every event type decodes.
+#define ANY_CONTACT(Field, ID) \
+    "\"" Field "\":{\"id\":" ID ",\"nickname\":\"someone\",\"remark\":\"\",\"memberName\":\"someone\"," \
+    "\"permission\":\"MEMBER\",\"platform\":\"MOBILE\",\"kind\":\"Group\"," \
+    "\"group\":{\"id\":987654321,\"name\":\"test group\",\"permission\":\"ADMINISTRATOR\"}}"
+
+static const BENCH_FRAME Corpus[] = {
+    { "GroupMessage",
+      "{\"syncId\":\"-1\",\"data\":{\"type\":\"GroupMessage\"," GROUP_SENDER ","
+      "\"messageChain\":[{\"type\":\"Source\",\"id\":41234,\"time\":1650000000},"
+      "{\"type\":\"At\",\"target\":10001,\"display\":\"@bot\"},"
+      "{\"type\":\"Plain\",\"text\":\" hello, how is the weather today?\"},"
+      "{\"type\":\"Face\",\"faceId\":14,\"name\":\"smile\"}]}}" },
+
+    { "GroupMessage.Image",
+      "{\"syncId\":\"-1\",\"data\":{\"type\":\"GroupMessage\"," GROUP_SENDER ","
+      "\"messageChain\":[{\"type\":\"Source\",\"id\":41236,\"time\":1650000002},"
+      "{\"type\":\"Plain\",\"text\":\"look at this\"},"
+      "{\"type\":\"Image\",\"imageId\":\"{01E9451B-70ED-EAE3-B37C-101F1EEBF5B5}.jpg\","
+      "\"url\":\"http://gchat.qpic.cn/gchatpic_new/0/0-0-01E9451B70EDEAE3B37C101F1EEBF5B5/0\","
+      "\"path\":null,\"base64\":null,\"width\":1080,\"height\":1920,\"size\":123456,"
+      "\"imageType\":\"JPG\",\"isEmoji\":false}]}}" },
+
+    { "GroupMessage.Quote",
+      "{\"syncId\":\"-1\",\"data\":{\"type\":\"GroupMessage\"," GROUP_SENDER ","
+      "\"messageChain\":[{\"type\":\"Source\",\"id\":41237,\"time\":1650000003},"
+      "{\"type\":\"Quote\",\"id\":41234,\"groupId\":987654321,\"senderId\":123456789,\"targetId\":987654321,"
+      "\"origin\":[{\"type\":\"At\",\"target\":10001,\"display\":\"@bot\"},"
+      "{\"type\":\"Plain\",\"text\":\" hello, how is the weather today?\"},"
+      "{\"type\":\"Face\",\"faceId\":14,\"name\":\"smile\"}]},"
+      "{\"type\":\"Plain\",\"text\":\"sunny\"}]}}" },
+
+    { "FriendMessage",
+      "{\"syncId\":\"-1\",\"data\":{\"type\":\"FriendMessage\","
+      "\"sender\":{\"id\":123456789,\"nickname\":\"someone\",\"remark\":\"friend\"},"
+      "\"messageChain\":[{\"type\":\"Source\",\"id\":41235,\"time\":1650000001},"
+      "{\"type\":\"Plain\",\"text\":\"ping\"}]}}" },
+
+    { "MemberMuteEvent",
+      "{\"syncId\":\"-1\",\"data\":{\"type\":\"MemberMuteEvent\",\"durationSeconds\":600,"
+      GROUP_MEMBER("member", "123456789", "someone", "MEMBER") ","
+      GROUP_MEMBER("operator", "10002", "admin", "OWNER") "}}" },
+
+    { "NudgeEvent",
+      "{\"syncId\":\"-1\",\"data\":{\"type\":\"NudgeEvent\",\"fromId\":123456789,"
+      "\"subject\":{\"id\":987654321,\"kind\":\"Group\"},\"action\":\"poke\",\"suffix\":\"\",\"target\":10001}}" },
+
+    { "MemberJoinRequestEvent",
+      "{\"syncId\":\"-1\",\"data\":{\"type\":\"MemberJoinRequestEvent\",\"eventId\":12345678,"
+      "\"fromId\":123456789,\"groupId\":987654321,\"groupName\":\"test group\",\"nick\":\"someone\","
+      "\"message\":\"let me in\",\"invitorId\":null}}" }
+};
+
+static LARGE_INTEGER Frequency;
+static volatile LONG64 CallbackSink;
+
+static VOID BenchCallback(_In_ PMIRAI_WS pMiraiWS, _In_ UINT EventType, _In_ PVOID pInformation)
+{
+    InterlockedIncrement64(&CallbackSink);
+}
+
+static void Report(_In_z_ LPCSTR lpBench, _In_ INT64 Ops, _In_ LONGLONG Ticks, _In_ const MWS_ALLOC_STATS* pAllocs)
+{
+    printf("{\"bench\":\"%s\",\"ops\":%lld,\"ns_per_op\":%.1f,\"allocs_per_op\":%.2f,\"heap_allocs_per_op\":%.2f,\"bytes_per_op\":%.1f}\n",
+        lpBench, Ops,
+        (double)Ticks * 1e9 / Frequency.QuadPart / Ops,
+        (double)pAllocs->Allocs / Ops,
+        (double)pAllocs->HeapAllocs / Ops,
+        (double)pAllocs->Bytes / Ops);
+    fflush(stdout);
+}
+
+static void AddAllocsSince(_Inout_ MWS_ALLOC_STATS* pTotal, _In_ const MWS_ALLOC_STATS* pBefore)
+{
+    pTotal->Allocs += MwsThreadAllocStats.Allocs - pBefore->Allocs;
+    pTotal->HeapAllocs += MwsThreadAllocStats.HeapAllocs - pBefore->HeapAllocs;
+    pTotal->Bytes += MwsThreadAllocStats.Bytes - pBefore->Bytes;
+}
+
+static yyjson_doc* ParseFrame(_In_ PMIRAI_WS pMiraiWS, _In_z_ LPCSTR lpJson, _In_ SIZE_T cchJson)
+{
+    yyjson_alc Alc = MwsJsonAlc(&pMiraiWS->Allocator);
+    return yyjson_read_opts((char*)lpJson, cchJson, 0, &Alc, NULL);
+}
+
+// documents are parsed in batches ahead of HandleJsonMessage, so each is timed on its own.
+static void BenchHandleJsonMessage(_In_ PMIRAI_WS pMiraiWS)
+{
+    static yyjson_doc* Docs[BATCH];
+    CHAR Name[128];
+
+    for (int i = 0; i < _countof(Corpus); i++)
+    {
+        SIZE_T cchJson = strlen(Corpus[i].lpJson);
+        LONGLONG ParseTicks = 0, HandleTicks = 0;
+        MWS_ALLOC_STATS ParseAllocs = { 0 }, HandleAllocs = { 0 };
+
+        for (int Done = 0; Done < ITERATIONS; Done += BATCH)
+        {
+            MWS_ALLOC_STATS Before = MwsThreadAllocStats;
+            LONGLONG Start = ReadPerfClock();
+            for (int n = 0; n < BATCH; n++)
+                Docs[n] = ParseFrame(pMiraiWS, Corpus[i].lpJson, cchJson);
+            LONGLONG End = ReadPerfClock();
+            ParseTicks += End - Start;
+            AddAllocsSince(&ParseAllocs, &Before);
+
+            Before = MwsThreadAllocStats;
+            Start = ReadPerfClock();
+            for (int n = 0; n < BATCH; n++)
+                HandleJsonMessage(pMiraiWS, Docs[n]);
+            End = ReadPerfClock();
+            HandleTicks += End - Start;
+            AddAllocsSince(&HandleAllocs, &Before);
+        }
+
+        INT64 Ops = (ITERATIONS + BATCH - 1) / BATCH * BATCH;
+        sprintf_s(Name, _countof(Name), "parse/%s", Corpus[i].lpName);
+        Report(Name, Ops, ParseTicks, &ParseAllocs);
+        sprintf_s(Name, _countof(Name), "handle/%s", Corpus[i].lpName);
+        Report(Name, Ops, HandleTicks, &HandleAllocs);
+    }
+}
+
+static void BenchEventsUnpacker(_In_ PMIRAI_WS pMiraiWS)
+{
+    CHAR Json[2048];
+    CHAR Name[128];
+
+    for (int Type = MWSBIN_EV_UNKNOWN + 1; Type < MWSBIN_EV_COUNT; Type++)
+    {
+        LPCSTR lpType = MwsBinEventTypeName((MWSBIN_EVENT_TYPE)Type);
+
+        // messages get a sender, a subject and a chain, other events every field one of them requires.
+        if (strstr(lpType, "Message"))
+            sprintf_s(Json, _countof(Json),
+                "{\"type\":\"%s\"," ANY_CONTACT("sender", "123456789") "," ANY_CONTACT("subject", "10003") ","
+                "\"messageChain\":[{\"type\":\"Source\",\"id\":41234,\"time\":1650000000},"
+                "{\"type\":\"Plain\",\"text\":\"hello\"}]}", lpType);
+        else
+            sprintf_s(Json, _countof(Json),
+                "{\"type\":\"%s\",\"qq\":10001,\"durationSeconds\":600,\"eventId\":7,\"messageId\":41234,"
+                "\"origin\":\"MEMBER\",\"current\":\"ADMINISTRATOR\","
+                GROUP_MEMBER("member", "123456789", "someone", "MEMBER") ","
+                GROUP_MEMBER("operator", "10002", "admin", "OWNER") ","
+                ANY_CONTACT("friend", "10003") "," ANY_CONTACT("client", "1") "," ANY_CONTACT("subject", "987654321") ","
+                "\"group\":{\"id\":987654321,\"name\":\"test group\",\"permission\":\"ADMINISTRATOR\"}}", lpType);
+
+        yyjson_doc* Doc = yyjson_read(Json, strlen(Json), 0);
+        if (!Doc)
+            continue;
+        yyjson_val* DataField = yyjson_doc_get_root(Doc);
+
+        MWS_ALLOC_STATS Allocs = { 0 };
+        MWS_ALLOC_STATS Before = MwsThreadAllocStats;
+        LONGLONG Start = ReadPerfClock();
+        for (int n = 0; n < EVENT_ITERATIONS; n++)
+            EventsUnpacker(pMiraiWS, DataField);
+        LONGLONG End = ReadPerfClock();
+        AddAllocsSince(&Allocs, &Before);
+
+        sprintf_s(Name, _countof(Name), "events_unpacker/%s", lpType);
+        Report(Name, EVENT_ITERATIONS, End - Start, &Allocs);
+        yyjson_doc_free(Doc);
+    }
+}
+
+static void BenchSerializeChain()
+{
+    MESSAGE_BLOCK Plain[] = {
+        { .Type = MB_PLAIN, .Plain = { L"hello, how is the weather today?" } }
+    };
+    MESSAGE_BLOCK Mixed[] = {
+        { .Type = MB_AT, .At = { 123456789, NULL } },
+        { .Type = MB_PLAIN, .Plain = { L" the build is green again, thanks for the fix" } },
+        { .Type = MB_FACE, .Face = { 14 } }
+    };
+    MESSAGE_BLOCK Image[] = {
+        { .Type = MB_PLAIN, .Plain = { L"look at this" } },
+        { .Type = MB_IMAGE, .Image = { FALSE, L"{01E9451B-70ED-EAE3-B37C-101F1EEBF5B5}.jpg", NULL, NULL, FALSE } }
+    };
+    struct
+    {
+        LPCSTR lpName;
+        MESSAGE_CHAIN Chain;
+    } Chains[] = {
+        { "Plain", { 0, 0, Plain, _countof(Plain) } },
+        { "At+Plain+Face", { 0, 0, Mixed, _countof(Mixed) } },
+        { "Plain+Image", { 0, 0, Image, _countof(Image) } }
+    };
+    CHAR Name[128];
+    yyjson_alc Alc = MwsJsonAlc(&MwsHeapAllocator);
+
+    for (int i = 0; i < _countof(Chains); i++)
+    {
+        volatile SIZE_T Sink = 0;
+        MWS_ALLOC_STATS Allocs = { 0 };
+        MWS_ALLOC_STATS Before = MwsThreadAllocStats;
+        LONGLONG Start = ReadPerfClock();
+        for (int n = 0; n < ITERATIONS; n++)
+        {
+            yyjson_mut_doc* Doc = yyjson_mut_doc_new(&Alc);
+            yyjson_mut_doc_set_root(Doc, GetMessageChainJson(&MwsHeapAllocator, Doc, &Chains[i].Chain));
+
+            size_t JsonLen;
+            LPSTR lpJsonText = yyjson_mut_write_opts(Doc, 0, &Alc, &JsonLen, NULL);
+            Sink += JsonLen;
+            MwsFree(&MwsHeapAllocator, lpJsonText);
+            yyjson_mut_doc_free(Doc);
+        }
+        LONGLONG End = ReadPerfClock();
+        AddAllocsSince(&Allocs, &Before);
+
+        sprintf_s(Name, _countof(Name), "serialize_chain/%s", Chains[i].lpName);
+        Report(Name, ITERATIONS, End - Start, &Allocs);
+    }
+}
+
+typedef struct
+{
+    HANDLE hStart;
+    MWS_ALLOC_STATS Allocs;
+    INT64 Failed;
+} ASYNC_BENCH_THREAD;
+
+static DWORD WINAPI AsyncCallThread(_In_ LPVOID lpParameter)
+{
+    ASYNC_BENCH_THREAD* pThread = lpParameter;
+    WaitForSingleObject(pThread->hStart, INFINITE);
+
+    const MWS_COMMAND* pCommand = FindMiraiWSCommand("sendGroupMessage", NULL);
+    MWS_ALLOC_STATS Before = MwsThreadAllocStats;
+    for (int n = 0; n < ASYNC_ITERATIONS; n++)
+    {
+        int Slot;
+        INT64 ID = GetAsyncCallID(ASYNC_SENDMSG, pCommand, NULL, pThread, &Slot);
+        if (!ID || !RemoveAsyncCallID(ID, NULL, NULL, NULL, NULL))
+            pThread->Failed++;
+    }
+    AddAllocsSince(&pThread->Allocs, &Before);
+    return 0;
+}
+
+// ns_per_op is wall time over all threads, one op is a GetAsyncCallID and its RemoveAsyncCallID.
+static void BenchAsyncCallID(_In_ int ThreadCnt)
+{
+    static ASYNC_BENCH_THREAD Threads[MAXIMUM_WAIT_OBJECTS];
+    HANDLE hThreads[MAXIMUM_WAIT_OBJECTS];
+    HANDLE hStart = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (!hStart)
+        return;
+
+    int Created = 0;
+    for (; Created < ThreadCnt; Created++)
+    {
+        ZeroMemory(&Threads[Created], sizeof(ASYNC_BENCH_THREAD));
+        Threads[Created].hStart = hStart;
+        hThreads[Created] = CreateThread(NULL, 0, AsyncCallThread, &Threads[Created], 0, NULL);
+        if (!hThreads[Created])
+            break;
+    }
+
+    LONGLONG Start = ReadPerfClock();
+    SetEvent(hStart);
+    WaitForMultipleObjects(Created, hThreads, TRUE, INFINITE);
+    LONGLONG End = ReadPerfClock();
+
+    MWS_ALLOC_STATS Allocs = { 0 };
+    INT64 Failed = 0;
+    for (int i = 0; i < Created; i++)
+    {
+        Allocs.Allocs += Threads[i].Allocs.Allocs;
+        Allocs.Bytes += Threads[i].Allocs.Bytes;
+        Failed += Threads[i].Failed;
+        CloseHandle(hThreads[i]);
+    }
+    CloseHandle(hStart);
+    if (!Created)
+        return;
+
+    CHAR Name[128];
+    sprintf_s(Name, _countof(Name), "async_call_id/threads:%d", Created);
+    Report(Name, (INT64)Created * ASYNC_ITERATIONS, End - Start, &Allocs);
+    if (Failed)
+        fprintf(stderr, "%s: %lld calls failed\n", Name, Failed);
+}
+
+int main()
+{
+    QueryPerformanceFrequency(&Frequency);
+
+    PMIRAI_WS pMiraiWS = CreateMiraiWS(L"localhost", 8080, FALSE, BenchCallback);
+    if (!pMiraiWS)
+    {
+        fprintf(stderr, "CreateMiraiWS failed: %lu\n", GetLastError());
+        return 1;
+    }
+
+    BenchHandleJsonMessage(pMiraiWS);
+    BenchEventsUnpacker(pMiraiWS);
+    BenchSerializeChain();
+    BenchAsyncCallID(1);
+    BenchAsyncCallID(8);
+    BenchAsyncCallID(64);
+    return 0;
+}
@@ -0,0 +1,135 @@
+// Compare the binary event encoding (MiraiWSBin.h) with the json mirai sends:
+// encoded size, and the time to decode an event and walk its message chain.
+
+#include <Windows.h>
+#include <stdio.h>
+#include "../MiraiWSBin.h"
+#include "../yyjson.h"
+
+#define ITERATIONS 200000
+
+static const char* Samples[] = {
+    "{\"type\":\"GroupMessage\",\"sender\":{\"id\":123456789,\"memberName\":\"someone\",\"specialTitle\":\"\","
+    "\"permission\":\"MEMBER\",\"joinTimestamp\":1600000000,\"lastSpeakTimestamp\":1650000000,\"muteTimeRemaining\":0,"
+    "\"group\":{\"id\":987654321,\"name\":\"test group\",\"permission\":\"ADMINISTRATOR\"}},"
+    "\"messageChain\":[{\"type\":\"Source\",\"id\":41234,\"time\":1650000000},"
+    "{\"type\":\"At\",\"target\":10001,\"display\":\"@bot\"},"
+    "{\"type\":\"Plain\",\"text\":\" hello, how is the weather today?\"},"
+    "{\"type\":\"Face\",\"faceId\":14,\"name\":\"smile\"}]}",
+
+    "{\"type\":\"FriendMessage\",\"sender\":{\"id\":123456789,\"nickname\":\"someone\",\"remark\":\"friend\"},"
+    "\"messageChain\":[{\"type\":\"Source\",\"id\":41235,\"time\":1650000001},"
+    "{\"type\":\"Plain\",\"text\":\"ping\"}]}",
+
+    "{\"type\":\"MemberMuteEvent\",\"durationSeconds\":600,\"member\":{\"id\":123456789,\"memberName\":\"someone\","
+    "\"permission\":\"MEMBER\",\"group\":{\"id\":987654321,\"name\":\"test group\",\"permission\":\"ADMINISTRATOR\"}},"
+    "\"operator\":{\"id\":10002,\"memberName\":\"admin\",\"permission\":\"OWNER\","
+    "\"group\":{\"id\":987654321,\"name\":\"test group\",\"permission\":\"ADMINISTRATOR\"}}}"
+};
+
+static double Seconds(LARGE_INTEGER Start, LARGE_INTEGER End)
+{
+    LARGE_INTEGER Freq;
+    QueryPerformanceFrequency(&Freq);
+    return (double)(End.QuadPart - Start.QuadPart) / Freq.QuadPart;
+}
+
+// what a consumer of the json does: parse, find the type, walk the chain.
+static SIZE_T WalkJson(const char* Json, size_t Len)
+{
+    SIZE_T Touched = 0;
+    yyjson_doc* Doc = yyjson_read(Json, Len, 0);
+    yyjson_val* Root = yyjson_doc_get_root(Doc);
+    yyjson_val* TypeField = yyjson_obj_get(Root, "type");
+    Touched += yyjson_get_len(TypeField);
+
+    yyjson_val* ChainField = yyjson_obj_get(Root, "messageChain");
+    size_t Index, Max;
+    yyjson_val* Block;
+    yyjson_arr_foreach(ChainField, Index, Max, Block)
+    {
+        yyjson_val* BlockType = yyjson_obj_get(Block, "type");
+        if (yyjson_equals_str(BlockType, "Plain"))
+            Touched += yyjson_get_len(yyjson_obj_get(Block, "text"));
+        else
+            Touched++;
+    }
+    yyjson_doc_free(Doc);
+    return Touched;
+}
+
+static SIZE_T WalkBin(const BYTE* pData, SIZE_T cbData)
+{
+    SIZE_T Touched = 0;
+    MWSBIN_READER Reader;
+    MWSBIN_EVENT Event;
+    MwsBinReaderInit(&Reader, pData, cbData);
+    if (!MwsBinReadEvent(&Reader, &Event))
+        return 0;
+    LPCSTR lpTypeName = MwsBinEventTypeName(Event.Type);
+    Touched += lpTypeName ? strlen(lpTypeName) : 0;
+
+    MWSBIN_CHAIN* pChain = NULL;
+    if (Event.Form == MWSBIN_FORM_FRIEND_MESSAGE)
+        pChain = &Event.FriendMessage.Chain;
+    else if (Event.Form == MWSBIN_FORM_GROUP_MESSAGE)
+        pChain = &Event.GroupMessage.Chain;
+    if (!pChain)
+        return Touched;
+
+    MWSBIN_BLOCK Block;
+    while (MwsBinReadBlock(pChain, &Block))
+    {
+        if (Block.Tag == MWSBIN_BLOCK_PLAIN)
+            Touched += Block.Plain.Text.Len;
+        else
+            Touched++;
+    }
+    return Touched;
+}
+
+int main()
+{
+    printf("%-20s %10s %10s %14s %14s\n", "event", "json B", "bin B", "json ns/evt", "bin ns/evt");
+    for (int i = 0; i < _countof(Samples); i++)
+    {
+        size_t cchJson = strlen(Samples[i]);
+        yyjson_doc* Doc = yyjson_read(Samples[i], cchJson, 0);
+        if (!Doc)
+            return 1;
+
+        MWSBIN_WRITER Writer;
+        MwsBinMeasureInit(&Writer);
+        MwsBinWriteEvent(&Writer, yyjson_doc_get_root(Doc));
+        SIZE_T cbBin = Writer.cbWritten;
+        PBYTE pBin = HeapAlloc(GetProcessHeap(), 0, cbBin);
+        if (!pBin)
+            return 1;
+        MwsBinWriterInit(&Writer, pBin, cbBin);
+        MwsBinWriteEvent(&Writer, yyjson_doc_get_root(Doc));
+
+        LARGE_INTEGER Start, End;
+        volatile SIZE_T Sink = 0;
+
+        QueryPerformanceCounter(&Start);
+        for (int n = 0; n < ITERATIONS; n++)
+            Sink += WalkJson(Samples[i], cchJson);
+        QueryPerformanceCounter(&End);
+        double JsonSec = Seconds(Start, End);
+
+        QueryPerformanceCounter(&Start);
+        for (int n = 0; n < ITERATIONS; n++)
+            Sink += WalkBin(pBin, cbBin);
+        QueryPerformanceCounter(&End);
+        double BinSec = Seconds(Start, End);
+
+        yyjson_val* TypeField = yyjson_obj_get(yyjson_doc_get_root(Doc), "type");
+        printf("%-20s %10zu %10zu %14.1f %14.1f\n",
+            yyjson_get_str(TypeField), cchJson, cbBin,
+            JsonSec * 1e9 / ITERATIONS, BinSec * 1e9 / ITERATIONS);
+
+        HeapFree(GetProcessHeap(), 0, pBin);
+        yyjson_doc_free(Doc);
+    }
+    return 0;
+}
@@ -0,0 +1,312 @@
+// Codec check: varints at their edges, json values packed and read back member by member, message events in the
+// schema and the packed form, and data that is cut short or malformed. A leak check cannot tell a wrong byte from
+// a right one, so every value read back is compared with what was written.
+// Exits with 0 on success, prints the failed checks otherwise.
+
+#include <Windows.h>
+#include <stdio.h>
+#include <string.h>
+#include "../MiraiWSBin.h"
+
+static int Failures;
+
+#define CHECK(Cond) \
+    do { if (!(Cond)) { fprintf(stderr, "%s(%d): check failed: %s\n", __FILE__, __LINE__, #Cond); Failures++; } } while (0)
+
+static BOOL SameStr(_In_ MWSBIN_STRING Str, _In_z_ LPCSTR lpExpected)
+{
+    return Str.Len == strlen(lpExpected) && memcmp(Str.Ptr, lpExpected, Str.Len) == 0;
+}
+
+static void TestVarInts()
+{
+    static const UINT64 Unsigned[] = { 0, 1, 127, 128, 300, 16383, 16384, MAXUINT32, (UINT64)MAXINT64, MAXUINT64 };
+    static const INT64 Signed[] = { 0, -1, 1, -64, 63, 64, -65, MAXINT32, MININT32, MAXINT64, MININT64 };
+    BYTE Buffer[MWSBIN_MAX_VARINT * 2];
+    MWSBIN_WRITER Writer;
+    MWSBIN_READER Reader;
+
+    for (int i = 0; i < _countof(Unsigned); i++)
+    {
+        MwsBinWriterInit(&Writer, Buffer, sizeof(Buffer));
+        MwsBinWriteVarUInt(&Writer, Unsigned[i]);
+        CHECK(!Writer.bOverflow && Writer.cbWritten == MwsBinVarUIntSize(Unsigned[i]));
+        MwsBinReaderInit(&Reader, Buffer, Writer.cbWritten);
+        CHECK(MwsBinReadVarUInt(&Reader) == Unsigned[i] && !Reader.bError && Reader.pCur == Reader.pEnd);
+    }
+    CHECK(MwsBinVarUIntSize(127) == 1 && MwsBinVarUIntSize(128) == 2 && MwsBinVarUIntSize(MAXUINT64) == MWSBIN_MAX_VARINT);
+
+    // LEB128, low bits first.
+    MwsBinWriterInit(&Writer, Buffer, sizeof(Buffer));
+    MwsBinWriteVarUInt(&Writer, 300);
+    CHECK(Writer.cbWritten == 2 && Buffer[0] == 0xAC && Buffer[1] == 0x02);
+
+    for (int i = 0; i < _countof(Signed); i++)
+    {
+        MwsBinWriterInit(&Writer, Buffer, sizeof(Buffer));
+        MwsBinWriteVarSInt(&Writer, Signed[i]);
+        MwsBinReaderInit(&Reader, Buffer, Writer.cbWritten);
+        CHECK(MwsBinReadVarSInt(&Reader) == Signed[i] && !Reader.bError && Reader.pCur == Reader.pEnd);
+    }
+
+    // zigzag keeps small negative numbers short.
+    MwsBinWriterInit(&Writer, Buffer, sizeof(Buffer));
+    MwsBinWriteVarSInt(&Writer, -1);
+    MwsBinWriteVarSInt(&Writer, 1);
+    MwsBinWriteVarSInt(&Writer, -64);
+    CHECK(Writer.cbWritten == 3 && Buffer[0] == 0x01 && Buffer[1] == 0x02 && Buffer[2] == 0x7F);
+
+    // cut short, and longer than any UINT64.
+    static const BYTE Truncated[] = { 0x80, 0x80 };
+    MwsBinReaderInit(&Reader, Truncated, sizeof(Truncated));
+    MwsBinReadVarUInt(&Reader);
+    CHECK(Reader.bError);
+
+    BYTE Overlong[MWSBIN_MAX_VARINT + 1];
+    memset(Overlong, 0x80, sizeof(Overlong));
+    Overlong[MWSBIN_MAX_VARINT] = 0x01;
+    MwsBinReaderInit(&Reader, Overlong, sizeof(Overlong));
+    MwsBinReadVarUInt(&Reader);
+    CHECK(Reader.bError);
+
+    // nothing is written once a write did not fit.
+    MwsBinWriterInit(&Writer, Buffer, 1);
+    MwsBinWriteVarUInt(&Writer, 300);
+    MwsBinWriteVarUInt(&Writer, 0);
+    CHECK(Writer.bOverflow && Writer.cbWritten <= 1);
+}
+
+/// <summary>
+/// Read one packed value and compare it with the json it was written from.
+/// </summary>
+static BOOL SameValue(_Inout_ MWSBIN_READER* pReader, _In_ yyjson_val* Value)
+{
+    MWSBIN_TAG Tag = MwsBinPeekTag(pReader);
+    switch (yyjson_get_type(Value))
+    {
+    case YYJSON_TYPE_NULL:
+        return MwsBinReadByte(pReader) == MWSBIN_NULL;
+    case YYJSON_TYPE_BOOL:
+    {
+        BOOL Bool;
+        return MwsBinReadBool(pReader, &Bool) && Bool == (BOOL)yyjson_get_bool(Value);
+    }
+    case YYJSON_TYPE_NUM:
+        if (yyjson_is_real(Value))
+        {
+            double Real;
+            BYTE Bytes[sizeof(Real)];
+            if (MwsBinReadByte(pReader) != MWSBIN_REAL)
+                return FALSE;
+            for (int i = 0; i < sizeof(Bytes); i++)
+                Bytes[i] = MwsBinReadByte(pReader);
+            memcpy(&Real, Bytes, sizeof(Real));
+            return !pReader->bError && Real == yyjson_get_real(Value);
+        }
+        else
+        {
+            // only integers above INT64_MAX take MWSBIN_UINT.
+            INT64 Int;
+            if (Tag != (yyjson_is_sint(Value) || yyjson_get_uint(Value) <= (UINT64)MAXINT64 ? MWSBIN_SINT : MWSBIN_UINT) ||
+                !MwsBinReadInt(pReader, &Int))
+                return FALSE;
+            return yyjson_is_sint(Value) ? Int == yyjson_get_sint(Value) : (UINT64)Int == yyjson_get_uint(Value);
+        }
+    case YYJSON_TYPE_STR:
+    {
+        LPCSTR lpStr;
+        SIZE_T cbStr;
+        return MwsBinReadString(pReader, &lpStr, &cbStr) && cbStr == yyjson_get_len(Value) &&
+            memcmp(lpStr, yyjson_get_str(Value), cbStr) == 0;
+    }
+    case YYJSON_TYPE_ARR:
+    {
+        SIZE_T Count;
+        if (!MwsBinReadContainer(pReader, MWSBIN_ARR, &Count) || Count != yyjson_arr_size(Value))
+            return FALSE;
+        size_t Index, Max;
+        yyjson_val* Element;
+        yyjson_arr_foreach(Value, Index, Max, Element) {
+            if (!SameValue(pReader, Element))
+                return FALSE;
+        }
+        return TRUE;
+    }
+    case YYJSON_TYPE_OBJ:
+    {
+        SIZE_T Count;
+        if (!MwsBinReadContainer(pReader, MWSBIN_OBJ, &Count) || Count != yyjson_obj_size(Value))
+            return FALSE;
+        while (Count--)
+        {
+            LPCSTR lpKey;
+            SIZE_T cbKey;
+            yyjson_val* Member;
+            if (!MwsBinReadStr(pReader, &lpKey, &cbKey) || !(Member = yyjson_obj_getn(Value, lpKey, cbKey)) ||
+                !SameValue(pReader, Member))
+                return FALSE;
+        }
+        return TRUE;
+    }
+    default:
+        return FALSE;
+    }
+}
+
+static void TestValues()
+{
+    static const char Json[] =
+        "{\"null\":null,\"yes\":true,\"no\":false,\"zero\":0,\"neg\":-9223372036854775808,"
+        "\"max\":9223372036854775807,\"big\":18446744073709551615,\"real\":-1.5e-300,"
+        "\"str\":\"a\\\"b\\\\c\\u0000d\\u4e2d\\ud83d\\ude00\",\"empty\":\"\",\"arr\":[1,[],{},[[\"x\"]]],"
+        "\"obj\":{\"inner\":{\"id\":123456789}}}";
+    yyjson_doc* Doc = yyjson_read(Json, sizeof(Json) - 1, 0);
+    yyjson_val* Root = yyjson_doc_get_root(Doc);
+    CHECK(Root != NULL);
+    if (!Root)
+        return;
+
+    BYTE Buffer[512];
+    SIZE_T cbMeasured = MwsBinMeasureValue(Root);
+    MWSBIN_WRITER Writer;
+    MwsBinWriterInit(&Writer, Buffer, sizeof(Buffer));
+    CHECK(MwsBinWriteValue(&Writer, Root) && !Writer.bOverflow);
+    CHECK(Writer.cbWritten == cbMeasured);
+
+    MWSBIN_READER Reader;
+    MwsBinReaderInit(&Reader, Buffer, Writer.cbWritten);
+    CHECK(SameValue(&Reader, Root) && !Reader.bError && Reader.pCur == Reader.pEnd);
+
+    // members are found by name at any depth, a missing one leaves the reader where it was.
+    INT64 ID;
+    MwsBinReaderInit(&Reader, Buffer, Writer.cbWritten);
+    CHECK(MwsBinFindMember(&Reader, "obj") && MwsBinFindMember(&Reader, "inner") && MwsBinFindMember(&Reader, "id") &&
+        MwsBinReadInt(&Reader, &ID) && ID == 123456789);
+    MwsBinReaderInit(&Reader, Buffer, Writer.cbWritten);
+    CHECK(!MwsBinFindMember(&Reader, "nothing") && Reader.pCur == Buffer);
+    CHECK(MwsBinSkipValue(&Reader) && Reader.pCur == Reader.pEnd);
+
+    // every cut of the value must fail to read instead of reading past the end.
+    BOOL bAllFailed = TRUE;
+    for (SIZE_T cbCut = 0; cbCut < Writer.cbWritten; cbCut++)
+    {
+        MwsBinReaderInit(&Reader, Buffer, cbCut);
+        if (MwsBinSkipValue(&Reader))
+            bAllFailed = FALSE;
+    }
+    CHECK(bAllFailed);
+
+    // too small a buffer overflows instead of writing a part.
+    MwsBinWriterInit(&Writer, Buffer, cbMeasured - 1);
+    CHECK(!MwsBinWriteValue(&Writer, Root) || Writer.bOverflow);
+
+    yyjson_doc_free(Doc);
+}
+
+#define GROUP_SENDER \
+    "\"sender\":{\"id\":123456789,\"memberName\":\"someone\",\"specialTitle\":\"title\",\"permission\":\"ADMINISTRATOR\"," \
+    "\"joinTimestamp\":1600000000,\"lastSpeakTimestamp\":1650000000,\"muteTimeRemaining\":30," \
+    "\"group\":{\"id\":987654321,\"name\":\"test group\",\"permission\":\"OWNER\"}}"
+
+/// <summary>
+/// Encode the data object of an event into a buffer.
+/// </summary>
+/// <returns>bytes written, 0 on failure</returns>
+static SIZE_T WriteEvent(_In_z_ LPCSTR lpJson, _Out_writes_bytes_(cbBuffer) PBYTE pBuffer, _In_ SIZE_T cbBuffer)
+{
+    yyjson_doc* Doc = yyjson_read(lpJson, strlen(lpJson), 0);
+    MWSBIN_WRITER Measure, Writer;
+    MwsBinMeasureInit(&Measure);
+    MwsBinWriterInit(&Writer, pBuffer, cbBuffer);
+    BOOL bSuccess = Doc && MwsBinWriteEvent(&Measure, yyjson_doc_get_root(Doc)) &&
+        MwsBinWriteEvent(&Writer, yyjson_doc_get_root(Doc)) && Writer.cbWritten == Measure.cbWritten;
+    yyjson_doc_free(Doc);
+    return bSuccess ? Writer.cbWritten : 0;
+}
+
+static void TestEvents()
+{
+    BYTE Buffer[512];
+    MWSBIN_READER Reader;
+    MWSBIN_EVENT Event;
+    MWSBIN_BLOCK Block;
+
+    SIZE_T cbEvent = WriteEvent("{\"type\":\"GroupMessage\"," GROUP_SENDER ","
+        "\"messageChain\":[{\"type\":\"Source\",\"id\":41234,\"time\":1650000000},"
+        "{\"type\":\"At\",\"target\":10001,\"display\":\"@bot\"},"
+        "{\"type\":\"Plain\",\"text\":\" /roll 1 100\"},"
+        "{\"type\":\"Face\",\"faceId\":14,\"name\":\"smile\"},"
+        "{\"type\":\"AtAll\"},"
+        "{\"type\":\"Image\",\"imageId\":\"{01E9451B-70ED-EAE3-B37C-101F1EEBF5B5}.jpg\",\"isEmoji\":false}]}",
+        Buffer, sizeof(Buffer));
+    CHECK(cbEvent != 0);
+    MwsBinReaderInit(&Reader, Buffer, cbEvent);
+    CHECK(MwsBinReadEvent(&Reader, &Event));
+    CHECK(Event.Type == MWSBIN_EV_GROUP_MESSAGE && Event.Form == MWSBIN_FORM_GROUP_MESSAGE);
+    if (Event.Form == MWSBIN_FORM_GROUP_MESSAGE)
+    {
+        CHECK(Event.GroupMessage.SenderID == 123456789);
+        CHECK(SameStr(Event.GroupMessage.MemberName, "someone") && SameStr(Event.GroupMessage.SpecialTitle, "title"));
+        CHECK(SameStr(Event.GroupMessage.Permission, "ADMINISTRATOR") && SameStr(Event.GroupMessage.GroupPermission, "OWNER"));
+        CHECK(Event.GroupMessage.JoinTimestamp == 1600000000 && Event.GroupMessage.LastSpeakTimestamp == 1650000000 &&
+            Event.GroupMessage.MuteTimeRemaining == 30);
+        CHECK(Event.GroupMessage.GroupID == 987654321 && SameStr(Event.GroupMessage.GroupName, "test group"));
+
+        MWSBIN_CHAIN* pChain = &Event.GroupMessage.Chain;
+        CHECK(pChain->ID == 41234 && pChain->Timestamp == 1650000000 && pChain->BlockCnt == 5);
+        CHECK(MwsBinReadBlock(pChain, &Block) && Block.Tag == MWSBIN_BLOCK_AT && Block.At.Target == 10001 &&
+            SameStr(Block.At.Display, "@bot"));
+        CHECK(MwsBinReadBlock(pChain, &Block) && Block.Tag == MWSBIN_BLOCK_PLAIN && SameStr(Block.Plain.Text, " /roll 1 100"));
+        CHECK(MwsBinReadBlock(pChain, &Block) && Block.Tag == MWSBIN_BLOCK_FACE && Block.Face.FaceID == 14 &&
+            SameStr(Block.Face.Name, "smile"));
+        CHECK(MwsBinReadBlock(pChain, &Block) && Block.Tag == MWSBIN_BLOCK_ATALL);
+
+        BOOL bEmoji = TRUE;
+        CHECK(MwsBinReadBlock(pChain, &Block) && Block.Tag == MWSBIN_BLOCK_PACKED && SameStr(Block.Packed.Type, "Image") &&
+            MwsBinFindMember(&Block.Packed.Object, "isEmoji") && MwsBinReadBool(&Block.Packed.Object, &bEmoji) && !bEmoji);
+        CHECK(!MwsBinReadBlock(pChain, &Block));
+    }
+
+    // a field the schema doesn't know sends the whole event packed, and it is still there.
+    cbEvent = WriteEvent("{\"type\":\"FriendMessage\",\"sender\":{\"id\":1,\"nickname\":\"n\",\"remark\":\"r\",\"extra\":7},"
+        "\"messageChain\":[{\"type\":\"Source\",\"id\":1,\"time\":2}]}", Buffer, sizeof(Buffer));
+    CHECK(cbEvent != 0);
+    MwsBinReaderInit(&Reader, Buffer, cbEvent);
+    INT64 Extra = 0;
+    CHECK(MwsBinReadEvent(&Reader, &Event) && Event.Type == MWSBIN_EV_FRIEND_MESSAGE && Event.Form == MWSBIN_FORM_PACKED &&
+        MwsBinFindMember(&Event.Packed.Object, "sender") && MwsBinFindMember(&Event.Packed.Object, "extra") &&
+        MwsBinReadInt(&Event.Packed.Object, &Extra) && Extra == 7);
+
+    // events without a schema are packed under their own type.
+    cbEvent = WriteEvent("{\"type\":\"MemberMuteEvent\",\"durationSeconds\":600,"
+        "\"member\":{\"id\":123456789,\"memberName\":\"someone\",\"permission\":\"MEMBER\"}}", Buffer, sizeof(Buffer));
+    CHECK(cbEvent != 0);
+    MwsBinReaderInit(&Reader, Buffer, cbEvent);
+    INT64 Duration = 0;
+    CHECK(MwsBinReadEvent(&Reader, &Event) && Event.Type == MWSBIN_EV_MEMBER_MUTE && Event.Form == MWSBIN_FORM_PACKED &&
+        MwsBinFindMember(&Event.Packed.Object, "durationSeconds") && MwsBinReadInt(&Event.Packed.Object, &Duration) &&
+        Duration == 600);
+    CHECK(MwsBinEventTypeFromName("MemberMuteEvent", 15) == MWSBIN_EV_MEMBER_MUTE &&
+        strcmp(MwsBinEventTypeName(MWSBIN_EV_MEMBER_MUTE), "MemberMuteEvent") == 0);
+    CHECK(MwsBinEventTypeFromName("NoSuchEvent", 11) == MWSBIN_EV_UNKNOWN);
+
+    // another version is refused.
+    Buffer[0] = MWSBIN_EVENT_VERSION + 1;
+    MwsBinReaderInit(&Reader, Buffer, cbEvent);
+    CHECK(!MwsBinReadEvent(&Reader, &Event));
+}
+
+int main()
+{
+    TestVarInts();
+    TestValues();
+    TestEvents();
+
+    if (Failures)
+    {
+        fprintf(stderr, "%d checks failed\n", Failures);
+        return 1;
+    }
+    printf("codec checks passed\n");
+    return 0;
+}
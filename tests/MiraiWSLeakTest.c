@@ -0,0 +1,191 @@
+// Leak check: a connection with the directory, the history and metrics enabled is fed a corpus of frames without
+// a socket, while the callback unpacks the chains and runs them through a matcher, a router and a template.
+// Commands are sent too, and fail for the lack of a socket after taking their async call slot.
+// Everything takes its memory from one counting allocator, which must have no live block left once the connection
+// is closed and the objects are destroyed. Exits with 0 on success, prints what is left otherwise.
+
+#include <Windows.h>
+#include <stdio.h>
+#include "../MiraiWS.h"
+#include "../MiraiWSAlloc.h"
+#include "../MiraiWSInternal.h"
+#include "../MiraiWSMatch.h"
+#include "../MiraiWSRouter.h"
+#include "../MiraiWSTemplate.h"
+
+#define ROUNDS 1000
+#define CLOSE_TIMEOUT 10000 // ms
+
+#define GROUP_SENDER \
+    "\"sender\":{\"id\":123456789,\"memberName\":\"someone\",\"specialTitle\":\"\",\"permission\":\"MEMBER\"," \
+    "\"joinTimestamp\":1600000000,\"lastSpeakTimestamp\":1650000000,\"muteTimeRemaining\":0," \
+    "\"group\":{\"id\":987654321,\"name\":\"test group\",\"permission\":\"ADMINISTRATOR\"}}"
+
+static const LPCSTR Corpus[] = {
+    "{\"syncId\":\"-1\",\"data\":{\"type\":\"GroupMessage\"," GROUP_SENDER ","
+    "\"messageChain\":[{\"type\":\"Source\",\"id\":41234,\"time\":1650000000},"
+    "{\"type\":\"At\",\"target\":10001,\"display\":\"@bot\"},"
+    "{\"type\":\"Plain\",\"text\":\" hello, how is the weather today?\"},"
+    "{\"type\":\"Face\",\"faceId\":14,\"name\":\"smile\"}]}}",
+
+    "{\"syncId\":\"-1\",\"data\":{\"type\":\"GroupMessage\"," GROUP_SENDER ","
+    "\"messageChain\":[{\"type\":\"Source\",\"id\":41236,\"time\":1650000002},"
+    "{\"type\":\"Plain\",\"text\":\"/roll 1 100\"},"
+    "{\"type\":\"Image\",\"imageId\":\"{01E9451B-70ED-EAE3-B37C-101F1EEBF5B5}.jpg\",\"url\":\"http://example.com/0\","
+    "\"imageType\":\"JPG\",\"isEmoji\":false}]}}",
+
+    "{\"syncId\":\"-1\",\"data\":{\"type\":\"FriendMessage\","
+    "\"sender\":{\"id\":123456789,\"nickname\":\"someone\",\"remark\":\"friend\"},"
+    "\"messageChain\":[{\"type\":\"Source\",\"id\":41235,\"time\":1650000001},"
+    "{\"type\":\"Plain\",\"text\":\"/ping weather\"}]}}",
+
+    "{\"syncId\":\"-1\",\"data\":{\"type\":\"MemberMuteEvent\",\"durationSeconds\":600,"
+    "\"member\":{\"id\":123456789,\"memberName\":\"someone\",\"permission\":\"MEMBER\","
+    "\"group\":{\"id\":987654321,\"name\":\"test group\",\"permission\":\"ADMINISTRATOR\"}},"
+    "\"operator\":{\"id\":10002,\"memberName\":\"admin\",\"permission\":\"OWNER\","
+    "\"group\":{\"id\":987654321,\"name\":\"test group\",\"permission\":\"ADMINISTRATOR\"}}}}",
+
+    "{\"syncId\":\"-1\",\"data\":{\"type\":\"BotLeaveEventActive\","
+    "\"group\":{\"id\":987654321,\"name\":\"test group\",\"permission\":\"ADMINISTRATOR\"}}}",
+
+    "not json at all"
+};
+
+typedef struct
+{
+    PMWS_MATCHER pMatcher;
+    PMWS_ROUTER pRouter;
+    MWS_TEMPLATE* pTemplate;
+    HANDLE hClosed;
+    LONG64 Matches;
+    LONG64 Routed;
+    LONG64 Failures;
+} LEAK_TEST;
+
+static VOID RouteHandler(_In_ PMIRAI_WS pMiraiWS, _In_ const MWS_ROUTE_CONTEXT* pContext, _In_opt_ LPVOID Context)
+{
+    LEAK_TEST* pTest = pMiraiWS->Context;
+    pTest->Routed++;
+
+    // the reply is only formatted, there is no socket to send it on.
+    CHAR Json[256];
+    MWS_COMMAND_ARG Values[] = { MWS_INT_ARG(NULL, pContext->SenderID), MWS_INT_ARG(NULL, pContext->ArgCnt) };
+    if (!FormatMiraiWSTemplate(pTest->pTemplate, Values, _countof(Values), Json, sizeof(Json), NULL))
+        pTest->Failures++;
+}
+
+static VOID TestCallback(_In_ PMIRAI_WS pMiraiWS, _In_ UINT EventType, _In_ PVOID pInformation)
+{
+    LEAK_TEST* pTest = pMiraiWS->Context;
+    const MWS_CHAINVIEW* pView = NULL;
+    switch (EventType)
+    {
+    case MWS_FRIENDMSG:
+        pView = &((MWS_FRIENDMSGINFO*)pInformation)->View;
+        break;
+    case MWS_GROUPMSG:
+        pView = &((MWS_GROUPMSGINFO*)pInformation)->View;
+        break;
+    case MWS_CLOSED:
+        SetEvent(pTest->hClosed);
+        return;
+    }
+    if (!pView)
+        return;
+
+    MESSAGE_CHAIN Chain;
+    if (UnpackMiraiWSChain(pMiraiWS, pView, &Chain))
+        ReleaseMiraiWSChain(pMiraiWS, &Chain);
+    else
+        pTest->Failures++;
+
+    MWS_MATCH Matches[8];
+    pTest->Matches += MatchMiraiWSChain(pTest->pMatcher, pView, Matches, _countof(Matches));
+    RouteMiraiWSMessage(pTest->pRouter, pMiraiWS, EventType, pInformation);
+}
+
+int main()
+{
+    static MWS_COUNTING_ALLOCATOR Counting;
+    InitMiraiWSCountingAllocator(&Counting, NULL);
+
+    LEAK_TEST Test = { 0 };
+    Test.hClosed = CreateEventW(NULL, TRUE, FALSE, NULL);
+
+    static const MWS_PATTERN Patterns[] = {
+        { L"weather", 1, 0 },
+        { L"/roll", 2, MWS_MATCH_PREFIX },
+        { L"hello", 3, 0 }
+    };
+    static const MWS_ROUTE Routes[] = {
+        { L"/ping", 0, MWS_PERMISSION_UNKNOWN, RouteHandler, NULL },
+        { L"/roll", 987654321, MWS_PERMISSION_MEMBER, RouteHandler, NULL }
+    };
+    Test.pMatcher = CreateMiraiWSMatcherEx(Patterns, _countof(Patterns), MWS_MATCHER_IGNORECASE, &Counting.Allocator);
+    Test.pRouter = CreateMiraiWSRouterEx(Routes, _countof(Routes), &Counting.Allocator);
+    Test.pTemplate = CreateMiraiWSTemplateEx(
+        "[{\"type\":\"At\",\"target\":{{0}}},{\"type\":\"Plain\",\"text\":\" got {{1}} args\"}]", &Counting.Allocator);
+    if (!Test.hClosed || !Test.pMatcher || !Test.pRouter || !Test.pTemplate)
+    {
+        fprintf(stderr, "setup failed: %lu\n", GetLastError());
+        return 1;
+    }
+
+    // what the matcher, the router and the template hold, the connection must give back everything else.
+    LONG64 ObjectBlocks = Counting.LiveBlocks;
+    PMIRAI_WS pMiraiWS = CreateMiraiWSEx(L"localhost", 8080, FALSE, TestCallback, &Counting.Allocator);
+    if (!pMiraiWS)
+    {
+        fprintf(stderr, "CreateMiraiWSEx failed: %lu\n", GetLastError());
+        return 1;
+    }
+    pMiraiWS->Context = &Test;
+    if (!EnableMiraiWSMetrics(pMiraiWS) ||
+        !EnableMiraiWSDirectory(pMiraiWS, 64 * 1024) ||
+        !EnableMiraiWSHistory(pMiraiWS, 64 * 1024))
+    {
+        fprintf(stderr, "enabling caches failed: %lu\n", GetLastError());
+        return 1;
+    }
+
+    for (int Round = 0; Round < ROUNDS; Round++)
+    {
+        for (int i = 0; i < _countof(Corpus); i++)
+            DispatchReplayedFrame(pMiraiWS, (const BYTE*)Corpus[i], strlen(Corpus[i]));
+
+        // a command not in the command table keeps its names in the async call slot until the send fails.
+        if (SendMiraiWSCommandAsync(pMiraiWS, "someUnlistedCommand", "get", NULL, 0, NULL, NULL))
+            Test.Failures++;
+    }
+
+    // never connected, MWS_CLOSED still comes and the connection is freed right after it.
+    DestroyMiraiWSAsync(pMiraiWS);
+    if (WaitForSingleObject(Test.hClosed, CLOSE_TIMEOUT) != WAIT_OBJECT_0)
+    {
+        fprintf(stderr, "MWS_CLOSED never came\n");
+        return 1;
+    }
+    for (int Waited = 0; ReadNoFence64(&Counting.LiveBlocks) > ObjectBlocks && Waited < CLOSE_TIMEOUT; Waited += 10)
+        Sleep(10);
+
+    DestroyMiraiWSTemplate(Test.pTemplate);
+    DestroyMiraiWSRouter(Test.pRouter);
+    DestroyMiraiWSMatcher(Test.pMatcher);
+    CloseHandle(Test.hClosed);
+
+    printf("{\"allocs\":%lld,\"frees\":%lld,\"peak_bytes\":%lld,\"live_blocks\":%lld,\"live_bytes\":%lld,"
+        "\"matches\":%lld,\"routed\":%lld,\"failures\":%lld}\n",
+        Counting.Allocs, Counting.Frees, Counting.PeakBytes, Counting.LiveBlocks, Counting.LiveBytes,
+        Test.Matches, Test.Routed, Test.Failures);
+    if (Counting.LiveBlocks != 0 || Counting.LiveBytes != 0)
+    {
+        fprintf(stderr, "%lld blocks (%lld bytes) leaked\n", Counting.LiveBlocks, Counting.LiveBytes);
+        return 1;
+    }
+    if (Test.Failures || !Test.Matches || !Test.Routed)
+    {
+        fprintf(stderr, "the corpus did not go through as expected\n");
+        return 1;
+    }
+    return 0;
+}
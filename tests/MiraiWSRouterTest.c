@@ -0,0 +1,200 @@
+// Router check: messages built by hand go through a router and the command, the arguments and the rest the handler
+// is given are compared with what they should be. Covers the longest command winning, commands that are only the
+// start of a word, quoted and unclosed arguments, the argument cap, and routes kept to a group or a permission.
+// Exits with 0 on success, prints the failed checks otherwise.
+
+#include <Windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../MiraiWS.h"
+#include "../MiraiWSRouter.h"
+#include "../yyjson.h"
+
+#define TEST_GROUP 987654321
+#define OTHER_GROUP 111111111
+#define TEST_SENDER 123456789
+
+static int Failures;
+
+#define CHECK(Cond) \
+    do { if (!(Cond)) { fprintf(stderr, "%s(%d): check failed: %s\n", __FILE__, __LINE__, #Cond); Failures++; } } while (0)
+
+// what the last handler call was given, its tokens point into Doc.
+static struct
+{
+    int Calls;
+    LPCSTR lpRoute;
+    MWS_ROUTE_CONTEXT Context;
+} Last;
+
+static yyjson_doc* Doc;
+
+static VOID RecordRoute(_In_ PMIRAI_WS pMiraiWS, _In_ const MWS_ROUTE_CONTEXT* pContext, _In_opt_ LPVOID Context)
+{
+    Last.Calls++;
+    Last.lpRoute = Context;
+    Last.Context = *pContext;
+}
+
+static BOOL RoutedTo(_In_z_ LPCSTR lpRoute)
+{
+    return Last.lpRoute && strcmp(Last.lpRoute, lpRoute) == 0;
+}
+
+static BOOL SameToken(_In_ MWS_TOKEN Token, _In_z_ LPCSTR lpExpected)
+{
+    return Token.Len == strlen(lpExpected) && memcmp(Token.Ptr, lpExpected, Token.Len) == 0;
+}
+
+/// <summary>
+/// Route a message of a Source, an At and a Plain block with the text, from a friend when GroupID is 0.
+/// </summary>
+static MWS_ROUTE_RESULT RouteText(_In_ PMWS_ROUTER pRouter, _In_z_ LPCSTR lpText, _In_ INT64 GroupID, _In_ MWS_PERMISSION Permission)
+{
+    if (Doc)
+        yyjson_doc_free(Doc);
+
+    yyjson_mut_doc* MutDoc = yyjson_mut_doc_new(NULL);
+    yyjson_mut_val* Chain = yyjson_mut_arr(MutDoc);
+    yyjson_mut_val* Source = yyjson_mut_arr_add_obj(MutDoc, Chain);
+    yyjson_mut_obj_add_str(MutDoc, Source, "type", "Source");
+    yyjson_mut_obj_add_int(MutDoc, Source, "id", 41234);
+    yyjson_mut_obj_add_int(MutDoc, Source, "time", 1650000000);
+    yyjson_mut_val* At = yyjson_mut_arr_add_obj(MutDoc, Chain);
+    yyjson_mut_obj_add_str(MutDoc, At, "type", "At");
+    yyjson_mut_obj_add_int(MutDoc, At, "target", 10001);
+    yyjson_mut_val* Plain = yyjson_mut_arr_add_obj(MutDoc, Chain);
+    yyjson_mut_obj_add_str(MutDoc, Plain, "type", "Plain");
+    yyjson_mut_obj_add_str(MutDoc, Plain, "text", lpText);
+    yyjson_mut_doc_set_root(MutDoc, Chain);
+
+    // received chains are read only documents.
+    size_t cbJson;
+    char* lpJson = yyjson_mut_write(MutDoc, 0, &cbJson);
+    Doc = yyjson_read(lpJson, cbJson, 0);
+    free(lpJson);
+    yyjson_mut_doc_free(MutDoc);
+
+    MWS_CHAINVIEW View = { 41234, 1650000000, 3, yyjson_doc_get_root(Doc) };
+    if (!GroupID)
+    {
+        MWS_FRIENDMSGINFO Info = { 0 };
+        Info.Sender.ID = TEST_SENDER;
+        Info.View = View;
+        return RouteMiraiWSMessage(pRouter, NULL, MWS_FRIENDMSG, &Info);
+    }
+    MWS_GROUPMSGINFO Info = { 0 };
+    Info.Sender.ID = TEST_SENDER;
+    Info.Sender.PermissionLevel = Permission;
+    Info.Sender.Group.ID = GroupID;
+    Info.View = View;
+    return RouteMiraiWSMessage(pRouter, NULL, MWS_GROUPMSG, &Info);
+}
+
+static void TestCommands(_In_ PMWS_ROUTER pRouter)
+{
+    // the longest command wins, and the context describes the message.
+    CHECK(RouteText(pRouter, "/roll 1 100", TEST_GROUP, MWS_PERMISSION_MEMBER) == MWS_ROUTE_DISPATCHED);
+    CHECK(RoutedTo("roll") && SameToken(Last.Context.Command, "/roll"));
+    CHECK(Last.Context.RouteIndex == 1 && Last.Context.EventType == MWS_GROUPMSG && Last.Context.PlainIndex == 2);
+    CHECK(Last.Context.SenderID == TEST_SENDER && Last.Context.GroupID == TEST_GROUP && Last.Context.Permission == MWS_PERMISSION_MEMBER);
+    CHECK(Last.Context.ArgCnt == 2 && SameToken(Last.Context.Args[0], "1") && SameToken(Last.Context.Args[1], "100"));
+    CHECK(SameToken(Last.Context.Rest, "1 100"));
+
+    CHECK(RouteText(pRouter, "  /r\tx  ", 0, MWS_PERMISSION_UNKNOWN) == MWS_ROUTE_DISPATCHED);
+    CHECK(RoutedTo("r") && SameToken(Last.Context.Command, "/r") && SameToken(Last.Context.Rest, "x"));
+    CHECK(Last.Context.EventType == MWS_FRIENDMSG && Last.Context.GroupID == 0 && Last.Context.Permission == MWS_PERMISSION_UNKNOWN);
+
+    CHECK(RouteText(pRouter, "/roll", 0, MWS_PERMISSION_UNKNOWN) == MWS_ROUTE_DISPATCHED);
+    CHECK(RoutedTo("roll") && Last.Context.ArgCnt == 0 && Last.Context.Rest.Len == 0);
+
+    // a command is a whole word, and is at the start of the text.
+    int Calls = Last.Calls;
+    CHECK(RouteText(pRouter, "/rollx 1", 0, MWS_PERMISSION_UNKNOWN) == MWS_ROUTE_NONE);
+    CHECK(RouteText(pRouter, "/ro", 0, MWS_PERMISSION_UNKNOWN) == MWS_ROUTE_NONE);
+    CHECK(RouteText(pRouter, "please /roll", 0, MWS_PERMISSION_UNKNOWN) == MWS_ROUTE_NONE);
+    CHECK(RouteText(pRouter, "", 0, MWS_PERMISSION_UNKNOWN) == MWS_ROUTE_NONE);
+    CHECK(RouteText(pRouter, " \r\n", 0, MWS_PERMISSION_UNKNOWN) == MWS_ROUTE_NONE);
+    CHECK(Last.Calls == Calls);
+
+    // not a message event.
+    CHECK(RouteMiraiWSMessage(pRouter, NULL, MWS_BOTONLINE, NULL) == MWS_ROUTE_NONE);
+}
+
+static void TestArgs(_In_ PMWS_ROUTER pRouter)
+{
+    CHECK(RouteText(pRouter, "/echo a\tb\r\nc", 0, MWS_PERMISSION_UNKNOWN) == MWS_ROUTE_DISPATCHED);
+    CHECK(Last.Context.ArgCnt == 3 && SameToken(Last.Context.Args[0], "a") && SameToken(Last.Context.Args[1], "b") &&
+        SameToken(Last.Context.Args[2], "c"));
+
+    // quotes hold whitespace and are taken off, an unclosed one runs to the end.
+    CHECK(RouteText(pRouter, "/echo \"hello world\" x \"\" \"unclosed tail  ", 0, MWS_PERMISSION_UNKNOWN) == MWS_ROUTE_DISPATCHED);
+    CHECK(Last.Context.ArgCnt == 4);
+    CHECK(SameToken(Last.Context.Args[0], "hello world") && SameToken(Last.Context.Args[1], "x"));
+    CHECK(SameToken(Last.Context.Args[2], "") && SameToken(Last.Context.Args[3], "unclosed tail"));
+    CHECK(SameToken(Last.Context.Rest, "\"hello world\" x \"\" \"unclosed tail"));
+
+    // arguments past the cap are left in Rest.
+    static const CHAR Text[] = "/echo a0 a1 a2 a3 a4 a5 a6 a7 a8 a9 a10 a11 a12 a13 a14 a15 a16 a17 a18 a19";
+    CHECK(RouteText(pRouter, Text, 0, MWS_PERMISSION_UNKNOWN) == MWS_ROUTE_DISPATCHED);
+    CHECK(Last.Context.ArgCnt == MWS_ROUTER_MAX_ARGS && SameToken(Last.Context.Args[0], "a0") &&
+        SameToken(Last.Context.Args[MWS_ROUTER_MAX_ARGS - 1], "a15"));
+    CHECK(SameToken(Last.Context.Rest, Text + strlen("/echo ")));
+}
+
+static void TestPermissions(_In_ PMWS_ROUTER pRouter)
+{
+    // the first route that fits is taken, routes for a group or a permission fit nowhere else.
+    int Calls = Last.Calls;
+    CHECK(RouteText(pRouter, "/ban 42", TEST_GROUP, MWS_PERMISSION_MEMBER) == MWS_ROUTE_DENIED);
+    CHECK(RouteText(pRouter, "/ban 42", OTHER_GROUP, MWS_PERMISSION_ADMINISTRATOR) == MWS_ROUTE_DENIED);
+    CHECK(RouteText(pRouter, "/ban 42", 0, MWS_PERMISSION_UNKNOWN) == MWS_ROUTE_DENIED);
+    CHECK(Last.Calls == Calls);
+
+    CHECK(RouteText(pRouter, "/ban 42", TEST_GROUP, MWS_PERMISSION_ADMINISTRATOR) == MWS_ROUTE_DISPATCHED);
+    CHECK(RoutedTo("ban in group") && Last.Context.RouteIndex == 3);
+    CHECK(RouteText(pRouter, "/ban 42", TEST_GROUP, MWS_PERMISSION_OWNER) == MWS_ROUTE_DISPATCHED);
+    CHECK(RoutedTo("ban in group"));
+    CHECK(RouteText(pRouter, "/ban 42", OTHER_GROUP, MWS_PERMISSION_OWNER) == MWS_ROUTE_DISPATCHED);
+    CHECK(RoutedTo("ban by owner") && Last.Context.RouteIndex == 4);
+    CHECK(Last.Calls == Calls + 3);
+}
+
+int main()
+{
+    static const MWS_ROUTE Routes[] = {
+        { L"/r", 0, MWS_PERMISSION_UNKNOWN, RecordRoute, "r" },
+        { L"/roll", 0, MWS_PERMISSION_UNKNOWN, RecordRoute, "roll" },
+        { L"/echo", 0, MWS_PERMISSION_UNKNOWN, RecordRoute, "echo" },
+        { L"/ban", TEST_GROUP, MWS_PERMISSION_ADMINISTRATOR, RecordRoute, "ban in group" },
+        { L"/ban", 0, MWS_PERMISSION_OWNER, RecordRoute, "ban by owner" },
+    };
+
+    // routes without a command or a handler are refused.
+    MWS_ROUTE Empty = { L"", 0, MWS_PERMISSION_UNKNOWN, RecordRoute, NULL };
+    MWS_ROUTE NoHandler = { L"/x", 0, MWS_PERMISSION_UNKNOWN, NULL, NULL };
+    CHECK(!CreateMiraiWSRouter(&Empty, 1) && GetLastError() == ERROR_INVALID_PARAMETER);
+    CHECK(!CreateMiraiWSRouter(&NoHandler, 1) && GetLastError() == ERROR_INVALID_PARAMETER);
+    CHECK(!CreateMiraiWSRouter(Routes, 0) && GetLastError() == ERROR_INVALID_PARAMETER);
+
+    PMWS_ROUTER pRouter = CreateMiraiWSRouter(Routes, _countof(Routes));
+    CHECK(pRouter != NULL);
+    if (pRouter)
+    {
+        TestCommands(pRouter);
+        TestArgs(pRouter);
+        TestPermissions(pRouter);
+        DestroyMiraiWSRouter(pRouter);
+    }
+    if (Doc)
+        yyjson_doc_free(Doc);
+
+    if (Failures)
+    {
+        fprintf(stderr, "%d checks failed\n", Failures);
+        return 1;
+    }
+    printf("router checks passed\n");
+    return 0;
+}
@@ -0,0 +1,166 @@
+// Template check: slots in and out of strings filled with every kind of value, text escaped the way a json string
+// wants it, utf16 turned into utf8, missing values and small buffers refused, and chains with bad slots refused
+// when the template is created. The json written is compared byte for byte.
+// Exits with 0 on success, prints the failed checks otherwise.
+
+#include <Windows.h>
+#include <stdio.h>
+#include <string.h>
+#include "../MiraiWS.h"
+#include "../MiraiWSTemplate.h"
+
+static int Failures;
+
+#define CHECK(Cond) \
+    do { if (!(Cond)) { fprintf(stderr, "%s(%d): check failed: %s\n", __FILE__, __LINE__, #Cond); Failures++; } } while (0)
+
+/// <summary>
+/// Fill a template and compare the json with what it should be.
+/// </summary>
+static BOOL Formats(_In_z_ LPCSTR lpChain, _In_reads_(ValueCnt) const MWS_COMMAND_ARG* pValues, _In_ UINT ValueCnt, _In_z_ LPCSTR lpExpected)
+{
+    CHAR Buffer[512] = "";
+    SIZE_T cbNeeded = 0;
+    MWS_TEMPLATE* pTemplate = CreateMiraiWSTemplate(lpChain);
+    if (!pTemplate)
+    {
+        fprintf(stderr, "template not created: %s\n", lpChain);
+        return FALSE;
+    }
+    BOOL bSame = FormatMiraiWSTemplate(pTemplate, pValues, ValueCnt, Buffer, sizeof(Buffer), &cbNeeded) &&
+        cbNeeded == strlen(lpExpected) + 1 && strcmp(Buffer, lpExpected) == 0;
+    if (!bSame)
+        fprintf(stderr, "expected %s\n     got %s\n", lpExpected, Buffer);
+    DestroyMiraiWSTemplate(pTemplate);
+    return bSame;
+}
+
+static void TestValues()
+{
+    // a value slot takes a whole json value, a string slot the text inside the quotes.
+    MWS_COMMAND_ARG Score[] = { MWS_INT_ARG(NULL, 10001), MWS_INT_ARG(NULL, -42) };
+    CHECK(Formats("[{\"type\":\"At\",\"target\":{{0}}},{\"type\":\"Plain\",\"text\":\" your score is {{1}}\"}]", Score, 2,
+        "[{\"type\":\"At\",\"target\":10001},{\"type\":\"Plain\",\"text\":\" your score is -42\"}]"));
+
+    MWS_COMMAND_ARG Name[] = { MWS_STR_ARG(NULL, L"someone") };
+    CHECK(Formats("[{\"type\":\"Plain\",\"text\":{{0}}}]", Name, 1, "[{\"type\":\"Plain\",\"text\":\"someone\"}]"));
+    CHECK(Formats("[{\"type\":\"Plain\",\"text\":\"hi {{0}}!\"}]", Name, 1, "[{\"type\":\"Plain\",\"text\":\"hi someone!\"}]"));
+
+    MWS_COMMAND_ARG Flags[] = { MWS_BOOL_ARG(NULL, TRUE), MWS_BOOL_ARG(NULL, FALSE) };
+    CHECK(Formats("[{\"type\":\"Image\",\"isEmoji\":{{1}},\"text\":\"{{0}}/{{1}}\"}]", Flags, 2,
+        "[{\"type\":\"Image\",\"isEmoji\":false,\"text\":\"true/false\"}]"));
+
+    // json is put in as it is, and a slot holds a value, never a whole block.
+    MWS_COMMAND_ARG Json[] = { MWS_JSON_ARG(NULL, "{\"id\":[1,null]}") };
+    CHECK(Formats("[{\"type\":\"Forward\",\"extra\":{{0}}}]", Json, 1, "[{\"type\":\"Forward\",\"extra\":{\"id\":[1,null]}}]"));
+
+    // a slot may be used more than once, and escaped quotes don't end the string it is in.
+    MWS_COMMAND_ARG Twice[] = { MWS_STR_ARG(NULL, L"ab") };
+    CHECK(Formats("[{\"type\":\"Plain\",\"text\":\"say \\\"{{0}}\\\" {{0}}\"}]", Twice, 1,
+        "[{\"type\":\"Plain\",\"text\":\"say \\\"ab\\\" ab\"}]"));
+
+    // a "{{" that is text.
+    CHECK(Formats("[{\"type\":\"Plain\",\"text\":\"{\\u007b0}}\"}]", NULL, 0, "[{\"type\":\"Plain\",\"text\":\"{\\u007b0}}\"}]"));
+}
+
+static void TestEscaping()
+{
+    MWS_COMMAND_ARG Special[] = { MWS_STR_ARG(NULL, L"q\"b\\n\n t\t r\r b\b f\f c\x01\x1F/") };
+    CHECK(Formats("[{\"type\":\"Plain\",\"text\":\"{{0}}\"}]", Special, 1,
+        "[{\"type\":\"Plain\",\"text\":\"q\\\"b\\\\n\\n t\\t r\\r b\\b f\\f c\\u0001\\u001f/\"}]"));
+    CHECK(Formats("[{\"type\":\"Plain\",\"text\":{{0}}}]", Special, 1,
+        "[{\"type\":\"Plain\",\"text\":\"q\\\"b\\\\n\\n t\\t r\\r b\\b f\\f c\\u0001\\u001f/\"}]"));
+
+    // 2, 3 and 4 byte utf8, a lone surrogate becomes U+FFFD.
+    MWS_COMMAND_ARG Wide[] = { MWS_STR_ARG(NULL, L"\x00E9\x4E2D\xD83D\xDE00\xD800x\xDC00") };
+    CHECK(Formats("[{\"type\":\"Plain\",\"text\":\"{{0}}\"}]", Wide, 1,
+        "[{\"type\":\"Plain\",\"text\":\"\xC3\xA9\xE4\xB8\xAD\xF0\x9F\x98\x80\xEF\xBF\xBDx\xEF\xBF\xBD\"}]"));
+
+    // longer than the chunk the escaping works in.
+    static const CHAR Head[] = "[{\"type\":\"Plain\",\"text\":\"";
+    WCHAR Long[1000];
+    CHAR Expected[1100];
+    SIZE_T cbExpected = sizeof(Head) - 1;
+    memcpy(Expected, Head, cbExpected);
+    for (int i = 0; i < _countof(Long) - 1; i++)
+    {
+        Long[i] = i % 100 == 99 ? L'"' : L'a' + i % 26;
+        if (Long[i] == L'"')
+            Expected[cbExpected++] = '\\';
+        Expected[cbExpected++] = (CHAR)Long[i];
+    }
+    Long[_countof(Long) - 1] = L'\0';
+    memcpy(Expected + cbExpected, "\"}]", 4);
+
+    MWS_TEMPLATE* pTemplate = CreateMiraiWSTemplate("[{\"type\":\"Plain\",\"text\":\"{{0}}\"}]");
+    CHECK(pTemplate != NULL);
+    if (pTemplate)
+    {
+        MWS_COMMAND_ARG LongArg[] = { MWS_STR_ARG(NULL, Long) };
+        CHAR Buffer[1100];
+        CHECK(FormatMiraiWSTemplate(pTemplate, LongArg, 1, Buffer, sizeof(Buffer), NULL) && strcmp(Buffer, Expected) == 0);
+        DestroyMiraiWSTemplate(pTemplate);
+    }
+}
+
+static void TestErrors()
+{
+    MWS_TEMPLATE* pTemplate = CreateMiraiWSTemplate("[{\"type\":\"At\",\"target\":{{0}}},{\"type\":\"Plain\",\"text\":\"{{2}}\"}]");
+    CHECK(pTemplate && pTemplate->SlotCnt == 3);
+    if (!pTemplate)
+        return;
+
+    CHAR Buffer[128];
+    SIZE_T cbNeeded = 0;
+    MWS_COMMAND_ARG Values[] = { MWS_INT_ARG(NULL, 1), MWS_INT_ARG(NULL, 2), MWS_STR_ARG(NULL, L"text") };
+    LPCSTR lpExpected = "[{\"type\":\"At\",\"target\":1},{\"type\":\"Plain\",\"text\":\"text\"}]";
+
+    // too few values, or a string that is NULL.
+    CHECK(!FormatMiraiWSTemplate(pTemplate, Values, 2, Buffer, sizeof(Buffer), &cbNeeded) && GetLastError() == ERROR_INVALID_PARAMETER);
+    MWS_COMMAND_ARG NullStr[] = { MWS_INT_ARG(NULL, 1), MWS_INT_ARG(NULL, 2), MWS_STR_ARG(NULL, NULL) };
+    CHECK(!FormatMiraiWSTemplate(pTemplate, NullStr, 3, Buffer, sizeof(Buffer), &cbNeeded) && GetLastError() == ERROR_INVALID_PARAMETER);
+
+    // the size needed is given when it doesn't fit, and it fits exactly.
+    CHECK(!FormatMiraiWSTemplate(pTemplate, Values, 3, NULL, 0, &cbNeeded) && GetLastError() == ERROR_INSUFFICIENT_BUFFER);
+    CHECK(cbNeeded == strlen(lpExpected) + 1);
+    CHECK(!FormatMiraiWSTemplate(pTemplate, Values, 3, Buffer, cbNeeded - 1, NULL) && GetLastError() == ERROR_INSUFFICIENT_BUFFER);
+    CHECK(FormatMiraiWSTemplate(pTemplate, Values, 3, Buffer, cbNeeded, NULL) && strcmp(Buffer, lpExpected) == 0);
+    DestroyMiraiWSTemplate(pTemplate);
+
+    // slots that are not, and chains that are no array of blocks.
+    static const LPCSTR Bad[] = {
+        "[{\"type\":\"At\",\"target\":{{x}}}]",
+        "[{\"type\":\"At\",\"target\":{{0}}]",
+        "[{\"type\":\"At\",\"target\":{{}}}]",
+        "[{\"type\":\"At\",\"target\":{{64}}}]",
+        "{\"type\":\"At\",\"target\":{{0}}}",
+        "[{{0}}]",
+        "[{\"type\":\"Plain\",\"text\":\"unclosed}]",
+    };
+    for (int i = 0; i < _countof(Bad); i++)
+    {
+        SetLastError(ERROR_SUCCESS);
+        pTemplate = CreateMiraiWSTemplate(Bad[i]);
+        CHECK(!pTemplate && GetLastError() == ERROR_INVALID_PARAMETER);
+        if (pTemplate)
+        {
+            fprintf(stderr, "taken: %s\n", Bad[i]);
+            DestroyMiraiWSTemplate(pTemplate);
+        }
+    }
+}
+
+int main()
+{
+    TestValues();
+    TestEscaping();
+    TestErrors();
+
+    if (Failures)
+    {
+        fprintf(stderr, "%d checks failed\n", Failures);
+        return 1;
+    }
+    printf("template checks passed\n");
+    return 0;
+}
@@ -0,0 +1,287 @@
+// Load generator for soak testing MiraiWS, against MiraiMockServer or a test mirai.
+//
+// Opens N connections on one manager, keeps M sendGroupMessage requests in flight on each of them
+// (a new one is sent as soon as one is answered), and takes whatever events the server pushes;
+// the event rate is set on MiraiMockServer's command line.
+//
+// Every report interval it prints one json line of what happened in that interval:
+// request and event throughput, send round trip percentiles, syncId slots in use against requests in flight,
+// and working set growth since the first report. When stopped (duration over or Ctrl+C) it lets requests
+// in flight finish and prints a summary of the whole run, where leaked_sync_ids counts async call slots
+// still taken that no unanswered request holds.
+//
+// usage: MiraiLoadGen server port connections concurrency [seconds, 0 = until Ctrl+C] [report interval seconds] [threads]
+
+#include <Windows.h>
+#include <Psapi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../MiraiWS.h"
+#include "../MiraiWSMetrics.h"
+
+#pragma comment(lib, "psapi.lib")
+
+#define TARGET_GROUP 987654321
+#define MAX_ASYNC_PENDING 1024 // size of the async call table of MiraiWS.c, shared by every connection
+#define TOPUP_PERIOD 100       // ms between checks for connections below their concurrency
+
+typedef struct
+{
+    PMIRAI_WS pMiraiWS;
+    volatile LONG bReady;    // authenticated and not disconnected
+    volatile LONG InFlight;  // requests sent and not answered
+    volatile LONG64 Errors;  // sends that failed or were answered with a nonzero code
+} LOAD_CONNECTION;
+
+typedef struct
+{
+    INT64 Requests;
+    INT64 Events;
+    INT64 Errors;
+    MWS_HISTOGRAM RttNs;
+} LOAD_TOTALS;
+
+static LOAD_CONNECTION* Conns;
+static int ConnCnt;
+static LONG Concurrency;
+static volatile LONG bStopping;
+static volatile LONG64 Disconnects;
+
+static MESSAGE_BLOCK LoadBlocks[] = { { .Type = MB_PLAIN, .Plain = { L"load test message" } } };
+static MESSAGE_CHAIN LoadChain = { 0, 0, LoadBlocks, _countof(LoadBlocks) };
+
+static void SendGroupMsgCallback(_In_ PMIRAI_WS pMiraiWS, _In_ INT64 RetCode, _In_z_ LPCWSTR lpMessage, _In_ INT64 MessageCode, _In_ LPVOID Context);
+
+static void SendOne(_Inout_ LOAD_CONNECTION* pConn)
+{
+    InterlockedIncrement(&pConn->InFlight);
+    if (!SendGroupMsgAsync(pConn->pMiraiWS, TARGET_GROUP, &LoadChain, SendGroupMsgCallback, pConn))
+    {
+        InterlockedDecrement(&pConn->InFlight);
+        InterlockedIncrement64(&pConn->Errors);
+    }
+}
+
+static void SendGroupMsgCallback(_In_ PMIRAI_WS pMiraiWS, _In_ INT64 RetCode, _In_z_ LPCWSTR lpMessage, _In_ INT64 MessageCode, _In_ LPVOID Context)
+{
+    LOAD_CONNECTION* pConn = Context;
+    InterlockedDecrement(&pConn->InFlight);
+    if (RetCode != 0)
+        InterlockedIncrement64(&pConn->Errors);
+
+    if (!ReadAcquire(&bStopping) && ReadAcquire(&pConn->bReady))
+        SendOne(pConn);
+}
+
+static LOAD_CONNECTION* FindConnection(_In_ PMIRAI_WS pMiraiWS)
+{
+    for (int i = 0; i < ConnCnt; i++)
+        if (Conns[i].pMiraiWS == pMiraiWS)
+            return &Conns[i];
+    return NULL;
+}
+
+static VOID LoadCallback(_In_ PMIRAI_WS pMiraiWS, _In_ UINT EventType, _In_ PVOID pInformation)
+{
+    LOAD_CONNECTION* pConn = FindConnection(pMiraiWS);
+    if (!pConn)
+        return;
+
+    switch (EventType)
+    {
+    case MWS_CONNECT:
+        if (!((MWS_CONNECTINFO*)pInformation)->bSuccess)
+        {
+            fprintf(stderr, "connection %d failed: %lu\n", (int)(pConn - Conns), ((MWS_CONNECTINFO*)pInformation)->dwError);
+            InterlockedIncrement64(&Disconnects);
+        }
+        break;
+    case MWS_AUTH:
+        // requests are started by the top-up loop of main.
+        if (((MWS_AUTHINFO*)pInformation)->ResponseCode == 0)
+            InterlockedExchange(&pConn->bReady, TRUE);
+        break;
+    case MWS_NWERROR:
+        InterlockedExchange(&pConn->bReady, FALSE);
+        InterlockedIncrement64(&Disconnects);
+        break;
+    default:
+        break;
+    }
+}
+
+static BOOL WINAPI CtrlHandler(_In_ DWORD dwCtrlType)
+{
+    InterlockedExchange(&bStopping, TRUE);
+    return TRUE;
+}
+
+static void AddHistogram(_Inout_ MWS_HISTOGRAM* pTotal, _In_ const MWS_HISTOGRAM* pAdd, _In_ int Sign)
+{
+    pTotal->Count += Sign * pAdd->Count;
+    pTotal->Sum += Sign * pAdd->Sum;
+    for (int i = 0; i < MWS_HIST_BUCKETS; i++)
+        pTotal->Buckets[i] += Sign * pAdd->Buckets[i];
+}
+
+// AsyncCallsInUse is process wide, it comes with every snapshot.
+static void CollectTotals(_Out_ LOAD_TOTALS* pTotals, _Out_ LONG* pSlotsInUse, _Out_ LONG* pInFlight, _Out_ int* pReady)
+{
+    static MWS_METRICS_SNAPSHOT Snapshot;
+    ZeroMemory(pTotals, sizeof(LOAD_TOTALS));
+    *pSlotsInUse = 0;
+    *pInFlight = 0;
+    *pReady = 0;
+
+    for (int i = 0; i < ConnCnt; i++)
+    {
+        *pInFlight += ReadNoFence(&Conns[i].InFlight);
+        *pReady += ReadNoFence(&Conns[i].bReady) ? 1 : 0;
+        pTotals->Errors += ReadNoFence64(&Conns[i].Errors);
+        if (!GetMiraiWSMetrics(Conns[i].pMiraiWS, &Snapshot))
+            continue;
+
+        pTotals->Requests += Snapshot.RequestsCompleted;
+        for (int Type = 0; Type < MWSBIN_EV_COUNT; Type++)
+            pTotals->Events += Snapshot.Events[Type];
+        AddHistogram(&pTotals->RttNs, &Snapshot.SendRttNs, 1);
+        *pSlotsInUse = Snapshot.AsyncCallsInUse;
+    }
+}
+
+static void GetMemory(_Out_ double* pWorkingSetMB, _Out_ double* pPrivateMB)
+{
+    PROCESS_MEMORY_COUNTERS_EX Counters = { 0 };
+    Counters.cb = sizeof(Counters);
+    GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*)&Counters, sizeof(Counters));
+    *pWorkingSetMB = Counters.WorkingSetSize / 1048576.0;
+    *pPrivateMB = Counters.PrivateUsage / 1048576.0;
+}
+
+static void PrintStats(_In_ BOOL bSummary, _In_ double Seconds, _In_ int Ready, _In_ const LOAD_TOTALS* pDelta,
+    _In_ LONG InFlight, _In_ LONG SlotsInUse, _In_ double WorkingSetMB, _In_ double WorkingSetGrowthMB, _In_ double PrivateMB)
+{
+    MWS_HISTOGRAM_SUMMARY Rtt;
+    MwsHistogramSummarize(&pDelta->RttNs, &Rtt);
+
+    printf("{\"%s\":%.1f,\"connected\":%d,\"requests_per_sec\":%.1f,\"events_per_sec\":%.1f,\"errors\":%lld,"
+        "\"rtt_p50_us\":%.1f,\"rtt_p99_us\":%.1f,\"rtt_p999_us\":%.1f,\"rtt_max_us\":%.1f,",
+        bSummary ? "summary_s" : "elapsed_s", Seconds, Ready,
+        pDelta->Requests / Seconds, pDelta->Events / Seconds, pDelta->Errors,
+        Rtt.P50 / 1e3, Rtt.P99 / 1e3, Rtt.P999 / 1e3, Rtt.Max / 1e3);
+    if (bSummary)
+        printf("\"disconnects\":%lld,\"unanswered\":%ld,\"leaked_sync_ids\":%ld,", ReadNoFence64(&Disconnects), InFlight, SlotsInUse - InFlight);
+    else
+        printf("\"in_flight\":%ld,\"sync_id_slots\":%ld,", InFlight, SlotsInUse);
+    printf("\"rss_mb\":%.1f,\"rss_growth_mb\":%.1f,\"private_mb\":%.1f}\n", WorkingSetMB, WorkingSetGrowthMB, PrivateMB);
+    fflush(stdout);
+}
+
+int wmain(int argc, wchar_t* argv[])
+{
+    if (argc < 5)
+    {
+        fprintf(stderr, "usage: MiraiLoadGen server port connections concurrency [seconds] [report interval seconds] [threads]\n");
+        return 1;
+    }
+    LPCWSTR lpServer = argv[1];
+    INTERNET_PORT Port = (INTERNET_PORT)_wtoi(argv[2]);
+    ConnCnt = _wtoi(argv[3]);
+    Concurrency = _wtoi(argv[4]);
+    DWORD Duration = argc > 5 ? _wtoi(argv[5]) : 0;
+    DWORD Interval = argc > 6 ? _wtoi(argv[6]) : 10;
+    DWORD Threads = argc > 7 ? _wtoi(argv[7]) : 4;
+    if (ConnCnt <= 0 || Concurrency <= 0 || Interval == 0)
+        return 1;
+    if ((INT64)ConnCnt * Concurrency > MAX_ASYNC_PENDING)
+        fprintf(stderr, "warning: %d requests in flight do not fit the %d async call slots, sends will fail\n",
+            ConnCnt * Concurrency, MAX_ASYNC_PENDING);
+
+    PMIRAI_WS_MANAGER pManager = CreateMiraiWSManager(Threads, 256);
+    Conns = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(LOAD_CONNECTION) * ConnCnt);
+    LOAD_TOTALS* pTotals = HeapAlloc(GetProcessHeap(), 0, sizeof(LOAD_TOTALS) * 3); // start, previous report, now
+    if (!pManager || !Conns || !pTotals)
+        return 1;
+
+    for (int i = 0; i < ConnCnt; i++)
+    {
+        Conns[i].pMiraiWS = AttachMiraiWS(pManager, lpServer, Port, FALSE, LoadCallback);
+        if (!Conns[i].pMiraiWS || !EnableMiraiWSMetrics(Conns[i].pMiraiWS))
+            return 1;
+    }
+    for (int i = 0; i < ConnCnt; i++)
+    {
+        WCHAR QQ[16];
+        swprintf_s(QQ, _countof(QQ), L"%d", 10000 + i);
+        if (!ConnectMiraiWS(Conns[i].pMiraiWS, L"loadtest", QQ))
+            fprintf(stderr, "ConnectMiraiWS %d failed: %lu\n", i, GetLastError());
+    }
+    SetConsoleCtrlHandler(CtrlHandler, TRUE);
+
+    LOAD_TOTALS *pStart = &pTotals[0], *pLast = &pTotals[1], *pNow = &pTotals[2];
+    LONG SlotsInUse, InFlight;
+    int Ready;
+    CollectTotals(pStart, &SlotsInUse, &InFlight, &Ready);
+    *pLast = *pStart;
+
+    ULONGLONG StartTick = GetTickCount64();
+    ULONGLONG LastReport = StartTick;
+    double BaseWorkingSetMB = -1;
+
+    while (!ReadAcquire(&bStopping))
+    {
+        Sleep(TOPUP_PERIOD);
+        for (int i = 0; i < ConnCnt; i++)
+        {
+            while (ReadAcquire(&Conns[i].bReady) && !ReadAcquire(&bStopping) && ReadNoFence(&Conns[i].InFlight) < Concurrency)
+                SendOne(&Conns[i]);
+        }
+
+        ULONGLONG Now = GetTickCount64();
+        if (Duration && Now - StartTick >= Duration * 1000ULL)
+            InterlockedExchange(&bStopping, TRUE);
+        if (Now - LastReport < Interval * 1000ULL)
+            continue;
+
+        CollectTotals(pNow, &SlotsInUse, &InFlight, &Ready);
+        LOAD_TOTALS Delta = *pNow;
+        Delta.Requests -= pLast->Requests;
+        Delta.Events -= pLast->Events;
+        Delta.Errors -= pLast->Errors;
+        AddHistogram(&Delta.RttNs, &pLast->RttNs, -1);
+
+        // growth is measured from the first report, once connections and pools are warmed up.
+        double WorkingSetMB, PrivateMB;
+        GetMemory(&WorkingSetMB, &PrivateMB);
+        if (BaseWorkingSetMB < 0)
+            BaseWorkingSetMB = WorkingSetMB;
+
+        PrintStats(FALSE, (Now - StartTick) / 1000.0, Ready, &Delta, InFlight, SlotsInUse,
+            WorkingSetMB, WorkingSetMB - BaseWorkingSetMB, PrivateMB);
+        *pLast = *pNow;
+        LastReport = Now;
+    }
+
+    // stop sending and give requests in flight time to be answered.
+    ULONGLONG StopTick = GetTickCount64();
+    do
+    {
+        Sleep(TOPUP_PERIOD);
+        CollectTotals(pNow, &SlotsInUse, &InFlight, &Ready);
+    } while (InFlight && GetTickCount64() - StopTick < 10000);
+
+    LOAD_TOTALS Delta = *pNow;
+    Delta.Requests -= pStart->Requests;
+    Delta.Events -= pStart->Events;
+    Delta.Errors -= pStart->Errors;
+    AddHistogram(&Delta.RttNs, &pStart->RttNs, -1);
+
+    double WorkingSetMB, PrivateMB;
+    GetMemory(&WorkingSetMB, &PrivateMB);
+    PrintStats(TRUE, (StopTick - StartTick) / 1000.0, Ready, &Delta, InFlight, SlotsInUse,
+        WorkingSetMB, BaseWorkingSetMB < 0 ? 0 : WorkingSetMB - BaseWorkingSetMB, PrivateMB);
+
+    for (int i = 0; i < ConnCnt; i++)
+        DestroyMiraiWSAsync(Conns[i].pMiraiWS);
+    return 0;
+}
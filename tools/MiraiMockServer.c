@@ -0,0 +1,398 @@
+// A stand-in for mirai-api-http's websocket adapter, for load testing MiraiWS without a QQ account.
+//
+// Accepts any verifyKey and qq on /all, answers every sendGroupMessage and sendFriendMessage with success,
+// and pushes GroupMessage events to each connection at a fixed rate.
+// Only speaks the part of the websocket protocol MiraiWS uses: unfragmented text frames, ping, close.
+//
+// usage: MiraiMockServer [port] [events per second per connection]
+
+#include <winsock2.h>
+#include <Windows.h>
+#include <bcrypt.h>
+#include <wincrypt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../yyjson.h"
+
+#pragma comment(lib, "ws2_32.lib")
+#pragma comment(lib, "bcrypt.lib")
+#pragma comment(lib, "crypt32.lib")
+
+#define DEFAULT_PORT 8080
+#define MAX_FRAME (1 << 16)
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+#define WS_OP_CONTINUATION 0x0
+#define WS_OP_TEXT         0x1
+#define WS_OP_CLOSE        0x8
+#define WS_OP_PING         0x9
+#define WS_OP_PONG         0xA
+
+typedef struct
+{
+    SOCKET Socket;
+    double EventRate;
+    INT64 MessageID;
+
+    SIZE_T cbRecv;
+    BYTE Recv[MAX_FRAME * 2];
+    BYTE Send[MAX_FRAME + 16];
+} MOCK_CONNECTION;
+
+static volatile LONG Connections;
+static volatile LONG64 RequestsAnswered;
+static volatile LONG64 EventsSent;
+
+static BOOL SendAll(_In_ SOCKET Socket, _In_reads_bytes_(cbData) const BYTE* pData, _In_ SIZE_T cbData)
+{
+    while (cbData)
+    {
+        int cbSent = send(Socket, (const char*)pData, (int)min(cbData, 0x10000), 0);
+        if (cbSent == SOCKET_ERROR)
+            return FALSE;
+        pData += cbSent;
+        cbData -= cbSent;
+    }
+    return TRUE;
+}
+
+// server frames are never masked, header and payload go out in one send.
+static BOOL SendFrame(_Inout_ MOCK_CONNECTION* pConn, _In_ BYTE Opcode, _In_reads_bytes_(cbPayload) const void* pPayload, _In_ SIZE_T cbPayload)
+{
+    if (cbPayload > MAX_FRAME)
+        return FALSE;
+
+    SIZE_T cbHeader;
+    pConn->Send[0] = 0x80 | Opcode;
+    if (cbPayload < 126)
+    {
+        pConn->Send[1] = (BYTE)cbPayload;
+        cbHeader = 2;
+    }
+    else if (cbPayload <= 0xFFFF)
+    {
+        pConn->Send[1] = 126;
+        pConn->Send[2] = (BYTE)(cbPayload >> 8);
+        pConn->Send[3] = (BYTE)cbPayload;
+        cbHeader = 4;
+    }
+    else
+    {
+        pConn->Send[1] = 127;
+        for (int i = 0; i < 8; i++)
+            pConn->Send[2 + i] = (BYTE)((UINT64)cbPayload >> (56 - 8 * i));
+        cbHeader = 10;
+    }
+    memcpy(pConn->Send + cbHeader, pPayload, cbPayload);
+    return SendAll(pConn->Socket, pConn->Send, cbHeader + cbPayload);
+}
+
+static BOOL SendText(_Inout_ MOCK_CONNECTION* pConn, _In_z_ LPCSTR lpText)
+{
+    return SendFrame(pConn, WS_OP_TEXT, lpText, strlen(lpText));
+}
+
+static BOOL AcceptHandshake(_Inout_ MOCK_CONNECTION* pConn)
+{
+    CHAR Request[8192];
+    SIZE_T cbRequest = 0;
+    for (;;)
+    {
+        int cbRead = recv(pConn->Socket, Request + cbRequest, (int)(sizeof(Request) - 1 - cbRequest), 0);
+        if (cbRead <= 0)
+            return FALSE;
+        cbRequest += cbRead;
+        Request[cbRequest] = '\0';
+        if (strstr(Request, "\r\n\r\n"))
+            break;
+        if (cbRequest == sizeof(Request) - 1)
+            return FALSE;
+    }
+
+    // header names are case insensitive.
+    LPCSTR lpKey = NULL;
+    for (LPSTR lpLine = Request; lpLine && *lpLine; )
+    {
+        LPSTR lpNext = strstr(lpLine, "\r\n");
+        if (lpNext)
+            *lpNext = '\0';
+        if (_strnicmp(lpLine, "Sec-WebSocket-Key:", 18) == 0)
+        {
+            lpKey = lpLine + 18;
+            while (*lpKey == ' ')
+                lpKey++;
+        }
+        lpLine = lpNext ? lpNext + 2 : NULL;
+    }
+    if (!lpKey)
+        return FALSE;
+
+    CHAR KeyGuid[128];
+    BYTE Hash[20];
+    CHAR Accept[64];
+    DWORD cchAccept = _countof(Accept);
+    int cchKeyGuid = sprintf_s(KeyGuid, _countof(KeyGuid), "%s%s", lpKey, WS_GUID);
+    if (cchKeyGuid < 0 ||
+        !BCRYPT_SUCCESS(BCryptHash(BCRYPT_SHA1_ALG_HANDLE, NULL, 0, (PUCHAR)KeyGuid, cchKeyGuid, Hash, sizeof(Hash))) ||
+        !CryptBinaryToStringA(Hash, sizeof(Hash), CRYPT_STRING_BASE64 | CRYPT_STRING_NOCRLF, Accept, &cchAccept))
+        return FALSE;
+
+    CHAR Response[256];
+    int cchResponse = sprintf_s(Response, _countof(Response),
+        "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n", Accept);
+    if (!SendAll(pConn->Socket, (const BYTE*)Response, cchResponse))
+        return FALSE;
+
+    // mirai sends the session as the first message.
+    return SendText(pConn, "{\"syncId\":\"\",\"data\":{\"code\":0,\"session\":\"MockSession\"}}");
+}
+
+static BOOL AnswerRequest(_Inout_ MOCK_CONNECTION* pConn, _In_reads_bytes_(cbText) BYTE* pText, _In_ SIZE_T cbText)
+{
+    yyjson_doc* Doc = yyjson_read((const char*)pText, cbText, 0);
+    if (!Doc)
+        return TRUE;
+
+    yyjson_val* Root = yyjson_doc_get_root(Doc);
+    yyjson_val* SyncIDField = yyjson_obj_get(Root, "syncId");
+    LPCSTR lpCommand = yyjson_get_str(yyjson_obj_get(Root, "command"));
+    INT64 SyncID = yyjson_is_int(SyncIDField) ? yyjson_get_sint(SyncIDField) : atoll(yyjson_get_str(SyncIDField) ? yyjson_get_str(SyncIDField) : "0");
+
+    CHAR Response[256];
+    if (lpCommand && (strcmp(lpCommand, "sendGroupMessage") == 0 || strcmp(lpCommand, "sendFriendMessage") == 0))
+        sprintf_s(Response, _countof(Response),
+            "{\"syncId\":\"%lld\",\"data\":{\"code\":0,\"msg\":\"success\",\"messageId\":%lld}}", SyncID, ++pConn->MessageID);
+    else
+        sprintf_s(Response, _countof(Response),
+            "{\"syncId\":\"%lld\",\"data\":{\"code\":3,\"msg\":\"unknown command\"}}", SyncID);
+    yyjson_doc_free(Doc);
+
+    InterlockedIncrement64(&RequestsAnswered);
+    return SendText(pConn, Response);
+}
+
+/// <summary>
+/// Handle every complete frame in the receive buffer, keep the rest for the next recv.
+/// </summary>
+/// <returns>FALSE when the connection should be closed</returns>
+static BOOL HandleFrames(_Inout_ MOCK_CONNECTION* pConn)
+{
+    SIZE_T Offset = 0;
+    BOOL bOpen = TRUE;
+    while (bOpen)
+    {
+        BYTE* pFrame = pConn->Recv + Offset;
+        SIZE_T cbAvail = pConn->cbRecv - Offset;
+        if (cbAvail < 2)
+            break;
+
+        BYTE Opcode = pFrame[0] & 0x0F;
+        BOOL bMasked = (pFrame[1] & 0x80) != 0;
+        UINT64 cbPayload = pFrame[1] & 0x7F;
+        SIZE_T cbHeader = 2;
+        if (cbPayload == 126)
+        {
+            if (cbAvail < 4)
+                break;
+            cbPayload = ((UINT64)pFrame[2] << 8) | pFrame[3];
+            cbHeader = 4;
+        }
+        else if (cbPayload == 127)
+        {
+            if (cbAvail < 10)
+                break;
+            cbPayload = 0;
+            for (int i = 0; i < 8; i++)
+                cbPayload = (cbPayload << 8) | pFrame[2 + i];
+            cbHeader = 10;
+        }
+        if (cbPayload > MAX_FRAME)
+            return FALSE;
+
+        BYTE* pMask = pFrame + cbHeader;
+        if (bMasked)
+            cbHeader += 4;
+        if (cbAvail < cbHeader + cbPayload)
+            break;
+
+        BYTE* pPayload = pFrame + cbHeader;
+        if (bMasked)
+        {
+            for (SIZE_T i = 0; i < cbPayload; i++)
+                pPayload[i] ^= pMask[i & 3];
+        }
+
+        switch (Opcode)
+        {
+        case WS_OP_TEXT:
+        case WS_OP_CONTINUATION: // MiraiWS sends whole messages, a fragment is answered on its own
+            bOpen = AnswerRequest(pConn, pPayload, (SIZE_T)cbPayload);
+            break;
+        case WS_OP_PING:
+            bOpen = SendFrame(pConn, WS_OP_PONG, pPayload, (SIZE_T)cbPayload);
+            break;
+        case WS_OP_CLOSE:
+            SendFrame(pConn, WS_OP_CLOSE, pPayload, (SIZE_T)min(cbPayload, 2));
+            bOpen = FALSE;
+            break;
+        default:
+            break;
+        }
+        Offset += cbHeader + (SIZE_T)cbPayload;
+    }
+
+    memmove(pConn->Recv, pConn->Recv + Offset, pConn->cbRecv - Offset);
+    pConn->cbRecv -= Offset;
+    return bOpen;
+}
+
+static BOOL SendEvent(_Inout_ MOCK_CONNECTION* pConn, _In_ INT64 Sequence)
+{
+    CHAR Event[1024];
+    INT64 Now = (INT64)time(NULL);
+    sprintf_s(Event, _countof(Event),
+        "{\"syncId\":\"-1\",\"data\":{\"type\":\"GroupMessage\","
+        "\"sender\":{\"id\":%lld,\"memberName\":\"member %lld\",\"specialTitle\":\"\",\"permission\":\"MEMBER\","
+        "\"joinTimestamp\":1600000000,\"lastSpeakTimestamp\":%lld,\"muteTimeRemaining\":0,"
+        "\"group\":{\"id\":987654321,\"name\":\"load test\",\"permission\":\"ADMINISTRATOR\"}},"
+        "\"messageChain\":[{\"type\":\"Source\",\"id\":%lld,\"time\":%lld},"
+        "{\"type\":\"At\",\"target\":10001,\"display\":\"@bot\"},"
+        "{\"type\":\"Plain\",\"text\":\" load test message %lld\"}]}}",
+        100000 + Sequence % 500, Sequence % 500, Now, Sequence, Now, Sequence);
+
+    InterlockedIncrement64(&EventsSent);
+    return SendText(pConn, Event);
+}
+
+static DWORD WINAPI ConnectionThread(_In_ LPVOID lpParameter)
+{
+    MOCK_CONNECTION* pConn = lpParameter;
+    InterlockedIncrement(&Connections);
+
+    if (AcceptHandshake(pConn))
+    {
+        LARGE_INTEGER Frequency, Now;
+        QueryPerformanceFrequency(&Frequency);
+        QueryPerformanceCounter(&Now);
+        LONGLONG Period = pConn->EventRate > 0 ? (LONGLONG)(Frequency.QuadPart / pConn->EventRate) : 0;
+        LONGLONG NextEvent = Now.QuadPart;
+        INT64 Sequence = 0;
+
+        for (;;)
+        {
+            // wait for a request or the next event, whichever comes first.
+            LONGLONG Wait = Period ? max(NextEvent - Now.QuadPart, 0) : Frequency.QuadPart;
+            struct timeval Timeout = { (long)(Wait / Frequency.QuadPart), (long)(Wait % Frequency.QuadPart * 1000000 / Frequency.QuadPart) };
+            fd_set ReadSet;
+            FD_ZERO(&ReadSet);
+            FD_SET(pConn->Socket, &ReadSet);
+            int Ready = select(0, &ReadSet, NULL, NULL, &Timeout);
+            if (Ready == SOCKET_ERROR)
+                break;
+            if (Ready)
+            {
+                int cbRead = recv(pConn->Socket, (char*)pConn->Recv + pConn->cbRecv, (int)(sizeof(pConn->Recv) - pConn->cbRecv), 0);
+                if (cbRead <= 0)
+                    break;
+                pConn->cbRecv += cbRead;
+                if (!HandleFrames(pConn))
+                    break;
+            }
+
+            // select sleeps in timer ticks, so events due meanwhile go out together to keep the rate.
+            QueryPerformanceCounter(&Now);
+            if (Period && Now.QuadPart - NextEvent > Frequency.QuadPart)
+                NextEvent = Now.QuadPart; // client too slow for a second, don't burst to catch up
+
+            BOOL bOpen = TRUE;
+            while (Period && bOpen && Now.QuadPart >= NextEvent)
+            {
+                bOpen = SendEvent(pConn, ++Sequence);
+                NextEvent += Period;
+            }
+            if (!bOpen)
+                break;
+        }
+    }
+
+    shutdown(pConn->Socket, SD_BOTH);
+    closesocket(pConn->Socket);
+    HeapFree(GetProcessHeap(), 0, pConn);
+    InterlockedDecrement(&Connections);
+    return 0;
+}
+
+static DWORD WINAPI StatusThread(_In_ LPVOID lpParameter)
+{
+    INT64 LastRequests = 0, LastEvents = 0;
+    for (;;)
+    {
+        Sleep(10000);
+        INT64 Requests = ReadNoFence64(&RequestsAnswered);
+        INT64 Events = ReadNoFence64(&EventsSent);
+        printf("{\"connections\":%ld,\"requests_per_sec\":%.1f,\"events_per_sec\":%.1f}\n",
+            ReadNoFence(&Connections), (Requests - LastRequests) / 10.0, (Events - LastEvents) / 10.0);
+        fflush(stdout);
+        LastRequests = Requests;
+        LastEvents = Events;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    USHORT Port = argc > 1 ? (USHORT)atoi(argv[1]) : DEFAULT_PORT;
+    double EventRate = argc > 2 ? atof(argv[2]) : 10.0;
+
+    WSADATA WsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &WsaData) != 0)
+        return 1;
+
+    SOCKET Listen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    SOCKADDR_IN Addr = { 0 };
+    Addr.sin_family = AF_INET;
+    Addr.sin_port = htons(Port);
+    Addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (Listen == INVALID_SOCKET ||
+        bind(Listen, (SOCKADDR*)&Addr, sizeof(Addr)) == SOCKET_ERROR ||
+        listen(Listen, SOMAXCONN) == SOCKET_ERROR)
+    {
+        fprintf(stderr, "cannot listen on port %u: %d\n", Port, WSAGetLastError());
+        return 1;
+    }
+    fprintf(stderr, "mock mirai listening on port %u, %.1f events/s per connection\n", Port, EventRate);
+
+    HANDLE hStatus = CreateThread(NULL, 0, StatusThread, NULL, 0, NULL);
+    if (hStatus)
+        CloseHandle(hStatus);
+
+    for (;;)
+    {
+        SOCKET Socket = accept(Listen, NULL, NULL);
+        if (Socket == INVALID_SOCKET)
+            continue;
+
+        BOOL bNoDelay = TRUE;
+        setsockopt(Socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&bNoDelay, sizeof(bNoDelay));
+
+        MOCK_CONNECTION* pConn = HeapAlloc(GetProcessHeap(), 0, sizeof(MOCK_CONNECTION));
+        if (!pConn)
+        {
+            closesocket(Socket);
+            continue;
+        }
+        pConn->Socket = Socket;
+        pConn->EventRate = EventRate;
+        pConn->MessageID = 0;
+        pConn->cbRecv = 0;
+
+        HANDLE hThread = CreateThread(NULL, 0, ConnectionThread, pConn, 0, NULL);
+        if (!hThread)
+        {
+            closesocket(Socket);
+            HeapFree(GetProcessHeap(), 0, pConn);
+            continue;
+        }
+        CloseHandle(hThread);
+    }
+}